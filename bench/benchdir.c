@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * benchdir.c
+ * Benchmarks creating, looking up and unlinking files in a large directory.
+ */
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+static void file_name(char* name, size_t size, size_t i)
+{
+	snprintf(name, size, "file-%zu", i);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* directory = 2 <= argc ? argv[1] : ".";
+	size_t count = 3 <= argc ? strtoul(argv[2], NULL, 10) : 100000;
+	if ( !count )
+		errx(1, "invalid file count");
+	size_t step = count < 10 ? 1 : count / 10;
+
+	char* template;
+	if ( asprintf(&template, "%s/benchdir.XXXXXX", directory) < 0 )
+		err(1, "malloc");
+	if ( !mkdtemp(template) )
+		err(1, "mkdtemp: %s", template);
+	int dirfd = open(template, O_RDONLY | O_DIRECTORY);
+	if ( dirfd < 0 )
+		err(1, "%s", template);
+
+	// Report the cost of creating files as the directory grows, which stays
+	// flat if the directory is indexed and grows linearly otherwise.
+	char name[sizeof(size_t) * 3 + 8];
+	for ( size_t i = 0; i < count; i += step )
+	{
+		size_t end = count - i < step ? count : i + step;
+		uintmax_t start, finish;
+		if ( uptime(&start) )
+			err(1, "uptime");
+		for ( size_t n = i; n < end; n++ )
+		{
+			file_name(name, sizeof(name), n);
+			int fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+			if ( fd < 0 )
+				err(1, "%s/%s", template, name);
+			close(fd);
+		}
+		if ( uptime(&finish) )
+			err(1, "uptime");
+		printf("%8zu files: %8ju us per create\n", end,
+		       (finish - start) / (end - i));
+		fflush(stdout);
+	}
+
+	// Look up the files in a scattered order so every lookup misses the
+	// blocks used by the previous one.
+	uintmax_t start, finish;
+	if ( uptime(&start) )
+		err(1, "uptime");
+	for ( size_t i = 0; i < count; i++ )
+	{
+		size_t n = (i * 7919) % count;
+		file_name(name, sizeof(name), n);
+		struct stat st;
+		if ( fstatat(dirfd, name, &st, 0) < 0 )
+			err(1, "stat: %s/%s", template, name);
+	}
+	if ( uptime(&finish) )
+		err(1, "uptime");
+	printf("%8zu files: %8ju us per lookup\n", count, (finish - start) / count);
+	fflush(stdout);
+
+	if ( uptime(&start) )
+		err(1, "uptime");
+	for ( size_t i = 0; i < count; i++ )
+	{
+		file_name(name, sizeof(name), i);
+		if ( unlinkat(dirfd, name, 0) < 0 )
+			err(1, "unlink: %s/%s", template, name);
+	}
+	if ( uptime(&finish) )
+		err(1, "uptime");
+	printf("%8zu files: %8ju us per unlink\n", count, (finish - start) / count);
+	fflush(stdout);
+
+	close(dirfd);
+	if ( rmdir(template) < 0 )
+		err(1, "rmdir: %s", template);
+	free(template);
+
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * benchevents.c
+ * Benchmarks waiting for a few busy sockets among many idle sockets.
+ */
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <err.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+static size_t idle_count;
+static size_t busy_count;
+static int* sockets;
+static int* peers;
+
+static void make_busy(void)
+{
+	for ( size_t i = 0; i < busy_count; i++ )
+		if ( write(peers[i], "x", 1) != 1 )
+			err(1, "write");
+}
+
+static void consume(int fd)
+{
+	char c;
+	if ( read(fd, &c, 1) != 1 )
+		err(1, "read");
+}
+
+static void round_poll(struct pollfd* pfds, size_t count)
+{
+	make_busy();
+	size_t done = 0;
+	while ( done < busy_count )
+	{
+		int num_events = poll(pfds, count, -1);
+		if ( num_events < 0 )
+			err(1, "poll");
+		for ( size_t i = 0; i < count; i++ )
+		{
+			if ( !(pfds[i].revents & POLLIN) )
+				continue;
+			consume(pfds[i].fd);
+			done++;
+		}
+	}
+}
+
+static void round_epoll(int epfd)
+{
+	make_busy();
+	size_t done = 0;
+	while ( done < busy_count )
+	{
+		struct epoll_event events[16];
+		int num_events = epoll_wait(epfd, events, 16, -1);
+		if ( num_events < 0 )
+			err(1, "epoll_wait");
+		for ( int i = 0; i < num_events; i++ )
+		{
+			consume(events[i].data.fd);
+			done++;
+		}
+	}
+}
+
+static int create_epoll(size_t count, uint32_t flags)
+{
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if ( epfd < 0 )
+		err(1, "epoll_create1");
+	for ( size_t i = 0; i < count; i++ )
+	{
+		struct epoll_event event;
+		event.events = EPOLLIN | flags;
+		event.data.fd = sockets[i];
+		if ( epoll_ctl(epfd, EPOLL_CTL_ADD, sockets[i], &event) < 0 )
+			err(1, "epoll_ctl");
+	}
+	return epfd;
+}
+
+static void report(const char* name, uintmax_t start, size_t iterations)
+{
+	uintmax_t end;
+	if ( uptime(&end) )
+		err(1, "uptime");
+	uintmax_t nsecs = (end - start) * 1000 / iterations;
+	printf("%-8s: %10ju ns per round\n", name, nsecs);
+	fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t iterations = 2 <= argc ? strtoul(argv[1], NULL, 10) : 1000;
+	idle_count = 3 <= argc ? strtoul(argv[2], NULL, 10) : 10000;
+	busy_count = 4 <= argc ? strtoul(argv[3], NULL, 10) : 10;
+	if ( !iterations || !busy_count )
+		errx(1, "invalid iteration or busy socket count");
+
+	// Every socket pair uses two file descriptors.
+	size_t count = busy_count + idle_count;
+	struct rlimit limit;
+	if ( getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+	     limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < 2 * count + 16 )
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	if ( !(sockets = calloc(count, sizeof(int))) ||
+	     !(peers = calloc(count, sizeof(int))) )
+		err(1, "malloc");
+	struct pollfd* pfds = calloc(count, sizeof(struct pollfd));
+	if ( !pfds )
+		err(1, "malloc");
+	// The busy sockets come last so poll has to scan past the idle sockets.
+	for ( size_t i = 0; i < count; i++ )
+	{
+		int fds[2];
+		if ( socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0 )
+			err(1, "socketpair");
+		sockets[i] = fds[0];
+		peers[i] = fds[1];
+		pfds[count - 1 - i].fd = fds[0];
+		pfds[count - 1 - i].events = POLLIN;
+	}
+	printf("%zu idle and %zu busy sockets\n", idle_count, busy_count);
+
+	uintmax_t start;
+	if ( uptime(&start) )
+		err(1, "uptime");
+	for ( size_t n = 0; n < iterations; n++ )
+		round_poll(pfds, count);
+	report("poll", start, iterations);
+
+	int epfd = create_epoll(count, 0);
+	if ( uptime(&start) )
+		err(1, "uptime");
+	for ( size_t n = 0; n < iterations; n++ )
+		round_epoll(epfd);
+	report("epoll", start, iterations);
+	close(epfd);
+
+	epfd = create_epoll(count, EPOLLET);
+	if ( uptime(&start) )
+		err(1, "uptime");
+	for ( size_t n = 0; n < iterations; n++ )
+		round_epoll(epfd);
+	report("epoll-et", start, iterations);
+	close(epfd);
+
+	return 0;
+}
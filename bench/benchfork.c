@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * benchfork.c
+ * Benchmarks the speed of fork and exec as the resident set grows.
+ */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* program = 2 <= argc ? argv[1] : "true";
+	size_t iterations = 3 <= argc ? strtoul(argv[2], NULL, 10) : 100;
+	if ( !iterations )
+		errx(1, "invalid iteration count");
+
+	const size_t sizes_mib[] = { 0, 16, 64, 256 };
+	for ( size_t i = 0; i < sizeof(sizes_mib) / sizeof(sizes_mib[0]); i++ )
+	{
+		// Grow the resident set by touching every page of a private mapping.
+		size_t size = sizes_mib[i] * 1024 * 1024;
+		void* memory = NULL;
+		if ( size )
+		{
+			memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if ( memory == MAP_FAILED )
+				err(1, "mmap: %zu MiB", sizes_mib[i]);
+			memset(memory, 1, size);
+		}
+
+		uintmax_t fork_usecs = 0;
+		uintmax_t start;
+		if ( uptime(&start) )
+			err(1, "uptime");
+		for ( size_t n = 0; n < iterations; n++ )
+		{
+			uintmax_t before, after;
+			if ( uptime(&before) )
+				err(1, "uptime");
+			pid_t child = fork();
+			if ( child < 0 )
+				err(1, "fork");
+			if ( !child )
+			{
+				execlp(program, program, (const char*) NULL);
+				_exit(127);
+			}
+			if ( uptime(&after) )
+				err(1, "uptime");
+			fork_usecs += after - before;
+			int status;
+			if ( waitpid(child, &status, 0) < 0 )
+				err(1, "waitpid");
+			if ( !WIFEXITED(status) || WEXITSTATUS(status) == 127 )
+				errx(1, "%s: did not run successfully", program);
+		}
+		uintmax_t end;
+		if ( uptime(&end) )
+			err(1, "uptime");
+
+		printf("%4zu MiB resident: %8ju us per fork, %8ju us per fork+exec\n",
+		       sizes_mib[i], fork_usecs / iterations,
+		       (end - start) / iterations);
+		fflush(stdout);
+
+		if ( memory )
+			munmap(memory, size);
+	}
+
+	return 0;
+}
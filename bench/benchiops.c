@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Benchmarks random block reads per second at a given queue depth.
+ */
+
+// Each thread keeps one read outstanding, so the number of threads is the
+// queue depth offered to the device. Compare a depth of one against a depth of
+// 32 to see whether the driver overlaps the commands:
+//
+//   benchiops /dev/ahci0 1 && benchiops /dev/ahci0 32
+
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static int fd;
+static const char* path;
+static size_t block_size;
+static uintmax_t block_count;
+static uintmax_t deadline;
+static uintmax_t reads;
+static pthread_mutex_t reads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+static uintmax_t random_block(void)
+{
+	if ( block_count <= UINT32_MAX )
+		return arc4random_uniform(block_count);
+	return ((uintmax_t) arc4random() << 32 | arc4random()) % block_count;
+}
+
+static void* worker(void* ctx)
+{
+	(void) ctx;
+	unsigned char* buffer = malloc(block_size);
+	if ( !buffer )
+		err(1, "malloc");
+	uintmax_t done = 0;
+	uintmax_t now = 0;
+	while ( true )
+	{
+		// Only check the time once in a while to keep the overhead down.
+		if ( !(done % 16) && (uptime(&now) || deadline <= now) )
+			break;
+		off_t offset = (off_t) (random_block() * block_size);
+		ssize_t amount = pread(fd, buffer, block_size, offset);
+		if ( amount < 0 )
+			err(1, "pread: %s", path);
+		if ( (size_t) amount != block_size )
+			errx(1, "pread: %s: short read", path);
+		done++;
+	}
+	pthread_mutex_lock(&reads_lock);
+	reads += done;
+	pthread_mutex_unlock(&reads_lock);
+	free(buffer);
+	return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+	if ( argc < 2 )
+		errx(1, "usage: %s DEVICE [QUEUE-DEPTH=1] [SECONDS=10] "
+		        "[BLOCK-SIZE=4096]", argv[0]);
+	path = argv[1];
+	size_t depth = 3 <= argc ? strtoul(argv[2], NULL, 10) : 1;
+	unsigned long seconds = 4 <= argc ? strtoul(argv[3], NULL, 10) : 10;
+	block_size = 5 <= argc ? strtoul(argv[4], NULL, 10) : 4096;
+	if ( !depth )
+		errx(1, "invalid queue depth");
+	if ( !block_size )
+		errx(1, "invalid block size");
+
+	fd = open(path, O_RDONLY);
+	if ( fd < 0 )
+		err(1, "%s", path);
+	off_t size = lseek(fd, 0, SEEK_END);
+	if ( size < 0 )
+		err(1, "lseek: %s", path);
+	block_count = (uintmax_t) size / block_size;
+	if ( !block_count )
+		errx(1, "%s: smaller than the block size", path);
+
+	pthread_t* threads = calloc(depth, sizeof(pthread_t));
+	if ( !threads )
+		err(1, "malloc");
+	uintmax_t start, finish;
+	if ( uptime(&start) )
+		err(1, "uptime");
+	deadline = start + seconds * 1000000ULL;
+	for ( size_t i = 0; i < depth; i++ )
+	{
+		int errnum = pthread_create(&threads[i], NULL, worker, NULL);
+		if ( errnum )
+			errc(1, errnum, "pthread_create");
+	}
+	for ( size_t i = 0; i < depth; i++ )
+		pthread_join(threads[i], NULL);
+	if ( uptime(&finish) )
+		err(1, "uptime");
+	close(fd);
+
+	uintmax_t usecs = finish - start ? finish - start : 1;
+	printf("queue depth %zu, %zu byte reads: %ju reads in %ju.%03ju s: "
+	       "%ju IOPS\n", depth, block_size, reads, usecs / 1000000,
+	       usecs / 1000 % 1000, reads * 1000000 / usecs);
+	fflush(stdout);
+
+	free(threads);
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * benchlatency.c
+ * Benchmarks pipe wakeup latency next to CPU hogs as a proxy for input latency.
+ */
+
+// The display server's input latency can't be measured directly, as its input
+// comes from the keyboard and mouse drivers, and programs can't inject input
+// events or observe when the display server handles them. Instead the latency
+// is measured on the path that matters for scheduling: a process blocked
+// reading a pipe, like the display server blocked on its input devices, is
+// woken by a write from a process that was itself woken by a timer interrupt,
+// while nice 19 processes keep every processor busy. The pipe adds a small
+// constant overhead compared to the input devices, which is visible in the
+// measurement without the hogs.
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+// The interactive process models the display server waiting for input events,
+// which arrive as timestamps on a pipe, and it reports how long it took to be
+// scheduled after each event was sent.
+static void interactive(int fd, const char* label)
+{
+	uintmax_t sent;
+	uintmax_t count = 0, total = 0, worst = 0;
+	ssize_t amount;
+	while ( 0 < (amount = read(fd, &sent, sizeof(sent))) )
+	{
+		if ( amount != sizeof(sent) )
+			errx(1, "short read");
+		uintmax_t received;
+		if ( uptime(&received) )
+			err(1, "uptime");
+		uintmax_t latency = received - sent;
+		count++;
+		total += latency;
+		if ( worst < latency )
+			worst = latency;
+	}
+	if ( amount < 0 )
+		err(1, "read");
+	if ( !count )
+		errx(1, "no events were received");
+	printf("%-24s %8ju us average, %8ju us worst\n", label, total / count,
+	       worst);
+	fflush(stdout);
+}
+
+static void measure(const char* label, size_t events)
+{
+	int fds[2];
+	if ( pipe(fds) < 0 )
+		err(1, "pipe");
+	pid_t child = fork();
+	if ( child < 0 )
+		err(1, "fork");
+	if ( !child )
+	{
+		close(fds[1]);
+		interactive(fds[0], label);
+		_exit(0);
+	}
+	close(fds[0]);
+	for ( size_t i = 0; i < events; i++ )
+	{
+		// Send events at irregular intervals like a human typing.
+		struct timespec delay = { .tv_sec = 0,
+		                          .tv_nsec = (1 + i % 7) * 3000000L };
+		nanosleep(&delay, NULL);
+		uintmax_t now;
+		if ( uptime(&now) )
+			err(1, "uptime");
+		if ( write(fds[1], &now, sizeof(now)) != sizeof(now) )
+			err(1, "write");
+	}
+	close(fds[1]);
+	int status;
+	if ( waitpid(child, &status, 0) < 0 )
+		err(1, "waitpid");
+	if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+		errx(1, "the interactive process failed");
+}
+
+int main(int argc, char* argv[])
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( cpus < 1 )
+		cpus = 1;
+	size_t hogs = 2 <= argc ? strtoul(argv[1], NULL, 10) : (size_t) cpus;
+	size_t events = 3 <= argc ? strtoul(argv[2], NULL, 10) : 500;
+	if ( !events )
+		errx(1, "invalid event count");
+
+	measure("no load:", events);
+
+	pid_t* hog_pids = calloc(hogs, sizeof(pid_t));
+	if ( hogs && !hog_pids )
+		err(1, "malloc");
+	for ( size_t i = 0; i < hogs; i++ )
+	{
+		if ( (hog_pids[i] = fork()) < 0 )
+			err(1, "fork");
+		if ( !hog_pids[i] )
+		{
+			if ( setpriority(PRIO_PROCESS, 0, 19) < 0 )
+				err(1, "setpriority");
+			while ( true )
+				asm volatile ("" ::: "memory");
+		}
+	}
+
+	char label[64];
+	snprintf(label, sizeof(label), "%zu nice 19 hogs:", hogs);
+	measure(label, events);
+
+	for ( size_t i = 0; i < hogs; i++ )
+	{
+		kill(hog_pids[i], SIGKILL);
+		waitpid(hog_pids[i], NULL, 0);
+	}
+	free(hog_pids);
+
+	return 0;
+}
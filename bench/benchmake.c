@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * benchmake.c
+ * Benchmarks a parallel build to measure the multiprocessor speedup.
+ */
+
+#include <sys/wait.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+static void generate(const char* dir, size_t sources, size_t functions)
+{
+	char* path;
+	if ( asprintf(&path, "%s/Makefile", dir) < 0 )
+		err(1, "malloc");
+	FILE* fp = fopen(path, "w");
+	if ( !fp )
+		err(1, "%s", path);
+	fprintf(fp, "OBJS=");
+	for ( size_t i = 0; i < sources; i++ )
+		fprintf(fp, " source%zu.o", i);
+	fprintf(fp, "\n\nall: $(OBJS)\n\n");
+	fprintf(fp, "%%.o: %%.c\n\t$(CC) -O2 -c $< -o $@\n\n");
+	fprintf(fp, "clean:\n\trm -f $(OBJS)\n");
+	if ( ferror(fp) || fclose(fp) == EOF )
+		err(1, "%s", path);
+	free(path);
+
+	for ( size_t i = 0; i < sources; i++ )
+	{
+		if ( asprintf(&path, "%s/source%zu.c", dir, i) < 0 )
+			err(1, "malloc");
+		if ( !(fp = fopen(path, "w")) )
+			err(1, "%s", path);
+		for ( size_t n = 0; n < functions; n++ )
+		{
+			fprintf(fp, "unsigned long f%zu_%zu(unsigned long x)\n{\n", i, n);
+			fprintf(fp, "\tfor ( unsigned long i = 0; i < %zu; i++ )\n", n + 1);
+			fprintf(fp, "\t\tx = x * %zu + (x >> %zu) + i;\n", 2 * n + 3,
+			        n % 13 + 1);
+			fprintf(fp, "\treturn x;\n}\n\n");
+		}
+		if ( ferror(fp) || fclose(fp) == EOF )
+			err(1, "%s", path);
+		free(path);
+	}
+}
+
+static void run_make(const char* dir, const char* target, long jobs)
+{
+	char jobs_arg[sizeof(long) * 3 + 3];
+	snprintf(jobs_arg, sizeof(jobs_arg), "-j%ld", jobs);
+	pid_t child = fork();
+	if ( child < 0 )
+		err(1, "fork");
+	if ( !child )
+	{
+		execlp("make", "make", "-s", "-C", dir, jobs_arg, target,
+		       (const char*) NULL);
+		warn("make");
+		_exit(127);
+	}
+	int status;
+	if ( waitpid(child, &status, 0) < 0 )
+		err(1, "waitpid");
+	if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+		errx(1, "make %s %s: did not run successfully", jobs_arg, target);
+}
+
+static uintmax_t time_build(const char* dir, long jobs)
+{
+	run_make(dir, "clean", 1);
+	uintmax_t start, end;
+	if ( uptime(&start) )
+		err(1, "uptime");
+	run_make(dir, "all", jobs);
+	if ( uptime(&end) )
+		err(1, "uptime");
+	return end - start;
+}
+
+int main(int argc, char* argv[])
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( cpus < 1 )
+		cpus = 1;
+	long jobs = 2 <= argc ? strtol(argv[1], NULL, 10) : cpus;
+	size_t sources = 3 <= argc ? strtoul(argv[2], NULL, 10) : 4 * (size_t) jobs;
+	size_t functions = 4 <= argc ? strtoul(argv[3], NULL, 10) : 200;
+	if ( jobs < 1 || !sources || !functions )
+		errx(1, "usage: %s [jobs] [sources] [functions]", argv[0]);
+
+	const char* tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	char* dir;
+	if ( asprintf(&dir, "%s/benchmake.XXXXXX", tmpdir) < 0 )
+		err(1, "malloc");
+	if ( !mkdtemp(dir) )
+		err(1, "mkdtemp: %s", dir);
+	generate(dir, sources, functions);
+
+	printf("%ld processors, %zu sources of %zu functions\n", cpus, sources,
+	       functions);
+	fflush(stdout);
+	uintmax_t serial = time_build(dir, 1);
+	printf("make -j1: %8ju ms\n", serial / 1000);
+	fflush(stdout);
+	uintmax_t parallel = time_build(dir, jobs);
+	printf("make -j%ld: %8ju ms\n", jobs, parallel / 1000);
+	if ( parallel )
+		printf("speedup: %ju.%02jux\n", serial / parallel,
+		       serial * 100 / parallel % 100);
+
+	run_make(dir, "clean", 1);
+	for ( size_t i = 0; i < sources; i++ )
+	{
+		char* path;
+		if ( asprintf(&path, "%s/source%zu.c", dir, i) < 0 )
+			err(1, "malloc");
+		unlink(path);
+		free(path);
+	}
+	char* makefile;
+	if ( asprintf(&makefile, "%s/Makefile", dir) < 0 )
+		err(1, "malloc");
+	unlink(makefile);
+	free(makefile);
+	if ( rmdir(dir) < 0 )
+		warn("rmdir: %s", dir);
+	free(dir);
+
+	return 0;
+}
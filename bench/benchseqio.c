@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * benchseqio.c
+ * Benchmarks sequential file write and read throughput.
+ */
+
+// The write and read phases are separate invocations so the filesystem can be
+// remounted in between and the read measures a cold cache. This also works on
+// other systems, such as against the FUSE build of extfs on Linux:
+//
+//   extfs disk.img /mnt && benchseqio write /mnt/file 512 && fusermount -u /mnt
+//   extfs disk.img /mnt && benchseqio read /mnt/file && fusermount -u /mnt
+
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+static void report(const char* what, uintmax_t bytes, uintmax_t usecs)
+{
+	if ( !usecs )
+		usecs = 1;
+	uintmax_t rate = (bytes * 100 / usecs) * 1000000 / (1024 * 1024);
+	printf("%s %ju MiB in %ju.%03ju s: %ju.%02ju MiB/s\n", what,
+	       bytes / (1024 * 1024), usecs / 1000000, usecs / 1000 % 1000,
+	       rate / 100, rate % 100);
+	fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+	if ( argc < 3 )
+		errx(1, "usage: %s write FILE [MIB=256] [BUFFER-KIB=64] | "
+		        "read FILE [BUFFER-KIB=64]", argv[0]);
+	const char* mode = argv[1];
+	const char* path = argv[2];
+	bool writing = !strcmp(mode, "write");
+	if ( !writing && strcmp(mode, "read") != 0 )
+		errx(1, "unknown mode: %s", mode);
+	int next = 3;
+	uintmax_t size = 256;
+	if ( writing && next < argc )
+		size = strtoumax(argv[next++], NULL, 10);
+	size_t buffer_size = 64;
+	if ( next < argc )
+		buffer_size = strtoul(argv[next++], NULL, 10);
+	size <<= 20;
+	buffer_size <<= 10;
+	if ( !buffer_size )
+		errx(1, "invalid buffer size");
+	unsigned char* buffer = malloc(buffer_size);
+	if ( !buffer )
+		err(1, "malloc");
+	for ( size_t i = 0; i < buffer_size; i++ )
+		buffer[i] = (unsigned char) (i * 7 + i / 4093);
+
+	int fd = writing ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) :
+	                   open(path, O_RDONLY);
+	if ( fd < 0 )
+		err(1, "%s", path);
+
+	uintmax_t start, finish;
+	uintmax_t done = 0;
+	if ( uptime(&start) )
+		err(1, "uptime");
+	if ( writing )
+	{
+		while ( done < size )
+		{
+			size_t amount = size - done < buffer_size ? size - done :
+			                                            buffer_size;
+			ssize_t written = write(fd, buffer, amount);
+			if ( written <= 0 )
+				err(1, "write: %s", path);
+			done += written;
+		}
+		// Include writing back the data in the measurement.
+		if ( fsync(fd) < 0 )
+			err(1, "fsync: %s", path);
+	}
+	else
+	{
+		ssize_t amount;
+		while ( 0 < (amount = read(fd, buffer, buffer_size)) )
+			done += amount;
+		if ( amount < 0 )
+			err(1, "read: %s", path);
+	}
+	if ( uptime(&finish) )
+		err(1, "uptime");
+	close(fd);
+
+	report(writing ? "write" : "read", done, finish - start);
+
+	free(buffer);
+
+	return 0;
+}
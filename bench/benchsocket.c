@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * benchsocket.c
+ * Benchmarks the speed of creating and closing sockets.
+ */
+
+#include <sys/socket.h>
+
+#include <err.h>
+#include <memusage.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+static void create(int domain, int type)
+{
+	if ( domain == AF_UNIX )
+	{
+		int fds[2];
+		if ( socketpair(domain, type, 0, fds) < 0 )
+			err(1, "socketpair");
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	}
+	int fd = socket(domain, type, 0);
+	if ( fd < 0 )
+		err(1, "socket");
+	close(fd);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t iterations = 2 <= argc ? strtoul(argv[1], NULL, 10) : 10000;
+	if ( !iterations )
+		errx(1, "invalid iteration count");
+
+	const struct
+	{
+		const char* name;
+		int domain;
+		int type;
+	} kinds[] =
+	{
+		{ "tcp", AF_INET, SOCK_STREAM },
+		{ "udp", AF_INET, SOCK_DGRAM },
+		{ "unix pair", AF_UNIX, SOCK_STREAM },
+	};
+	for ( size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++ )
+	{
+		uintmax_t start;
+		if ( uptime(&start) )
+			err(1, "uptime");
+		for ( size_t n = 0; n < iterations; n++ )
+			create(kinds[i].domain, kinds[i].type);
+		uintmax_t end;
+		if ( uptime(&end) )
+			err(1, "uptime");
+		uintmax_t nsecs = (end - start) * 1000 / iterations;
+		printf("%-9s: %8ju ns per socket\n", kinds[i].name, nsecs);
+		fflush(stdout);
+	}
+
+	// Report how much of the kernel object caches is in use.
+	size_t statistics[] = { MEMUSAGE_SLAB, MEMUSAGE_SLAB_USED };
+	size_t values[2];
+	if ( memusage(statistics, values, 2) < 0 )
+		err(1, "memusage");
+	printf("slab: %zu KiB, %zu KiB used\n", values[0] / 1024, values[1] / 1024);
+
+	return 0;
+}
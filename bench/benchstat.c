@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * benchstat.c
+ * Benchmarks the per-operation overhead of stat on a filesystem.
+ */
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* directory = 2 <= argc ? argv[1] : ".";
+	size_t count = 3 <= argc ? strtoul(argv[2], NULL, 10) : 100000;
+	if ( !count )
+		errx(1, "invalid file count");
+
+	char* template;
+	if ( asprintf(&template, "%s/benchstat.XXXXXX", directory) < 0 )
+		err(1, "malloc");
+	if ( !mkdtemp(template) )
+		err(1, "mkdtemp: %s", template);
+	int dirfd = open(template, O_RDONLY | O_DIRECTORY);
+	if ( dirfd < 0 )
+		err(1, "%s", template);
+
+	uintmax_t start, end;
+	if ( uptime(&start) )
+		err(1, "uptime");
+	for ( size_t i = 0; i < count; i++ )
+	{
+		char name[sizeof(size_t) * 3 + 1];
+		snprintf(name, sizeof(name), "%zu", i);
+		int fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if ( fd < 0 )
+			err(1, "%s/%s", template, name);
+		close(fd);
+	}
+	if ( uptime(&end) )
+		err(1, "uptime");
+	printf("%zu files: %8ju us per create\n", count, (end - start) / count);
+	fflush(stdout);
+
+	// The first pass warms up the caches, so later passes measure the cost of
+	// getting the request to the filesystem and the answer back.
+	for ( int pass = 0; pass < 3; pass++ )
+	{
+		if ( uptime(&start) )
+			err(1, "uptime");
+		for ( size_t i = 0; i < count; i++ )
+		{
+			char name[sizeof(size_t) * 3 + 1];
+			snprintf(name, sizeof(name), "%zu", i);
+			struct stat st;
+			if ( fstatat(dirfd, name, &st, 0) < 0 )
+				err(1, "stat: %s/%s", template, name);
+		}
+		if ( uptime(&end) )
+			err(1, "uptime");
+		printf("%zu files: %8ju ns per stat (pass %i)\n", count,
+		       (end - start) * 1000 / count, pass + 1);
+		fflush(stdout);
+	}
+
+	// Searching for files that don't exist, like shells searching PATH and
+	// compilers probing include directories.
+	for ( int pass = 0; pass < 2; pass++ )
+	{
+		if ( uptime(&start) )
+			err(1, "uptime");
+		for ( size_t i = 0; i < count; i++ )
+		{
+			char name[sizeof(size_t) * 3 + 2];
+			snprintf(name, sizeof(name), "x%zu", i);
+			struct stat st;
+			if ( fstatat(dirfd, name, &st, 0) == 0 )
+				errx(1, "stat: %s/%s: File exists", template, name);
+		}
+		if ( uptime(&end) )
+			err(1, "uptime");
+		printf("%zu files: %8ju ns per missing stat (pass %i)\n", count,
+		       (end - start) * 1000 / count, pass + 1);
+		fflush(stdout);
+	}
+
+	for ( size_t i = 0; i < count; i++ )
+	{
+		char name[sizeof(size_t) * 3 + 1];
+		snprintf(name, sizeof(name), "%zu", i);
+		if ( unlinkat(dirfd, name, 0) < 0 )
+			err(1, "unlink: %s/%s", template, name);
+	}
+	close(dirfd);
+	if ( rmdir(template) < 0 )
+		err(1, "rmdir: %s", template);
+	free(template);
+
+	return 0;
+}
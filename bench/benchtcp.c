@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * benchtcp.c
+ * Benchmarks bulk TCP transfer throughput against nc(1) on another machine.
+ */
+
+// The other end of the connection is nc(1), so this can measure a link to a
+// host outside of the system, such as the host of a virtual machine. For
+// instance with qemu -netdev user,id=net0,hostfwd=tcp::5001-:5001 the host can
+// receive and send with:
+//
+//   host$ nc -l 5000 > /dev/null
+//   guest$ benchtcp send 10.0.2.2 5000 256
+//
+//   guest$ benchtcp receive 0.0.0.0 5001
+//   host$ head -c 256M /dev/zero | nc localhost 5001
+//
+// The sendfile mode transmits a file with sendfile(2) instead, which compares
+// the copying of write(2) with the transmission of the file pages in place:
+//
+//   guest$ benchtcp sendfile 10.0.2.2 5000 /path/to/large/file
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int uptime(uintmax_t* usecs)
+{
+	struct timespec uptime;
+	if ( clock_gettime(CLOCK_BOOTTIME, &uptime) < 0 )
+		return -1;
+	*usecs = uptime.tv_sec * 1000000ULL + uptime.tv_nsec / 1000ULL;
+	return 0;
+}
+
+static void report(const char* what, uintmax_t bytes, uintmax_t usecs)
+{
+	if ( !usecs )
+		usecs = 1;
+	uintmax_t rate = (bytes * 100 / usecs) * 1000000 / (1024 * 1024);
+	printf("%s %ju MiB in %ju.%03ju s: %ju.%02ju MiB/s\n", what,
+	       bytes / (1024 * 1024), usecs / 1000000, usecs / 1000 % 1000,
+	       rate / 100, rate % 100);
+	fflush(stdout);
+}
+
+static void report_socket(int fd)
+{
+	int rcvbuf = 0;
+	int sndbuf = 0;
+	int maxseg = 0;
+	socklen_t size = sizeof(rcvbuf);
+	getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &size);
+	size = sizeof(sndbuf);
+	getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &size);
+	size = sizeof(maxseg);
+	getsockopt(fd, IPPROTO_TCP, TCP_MAXSEG, &maxseg, &size);
+	printf("rcvbuf %d KiB, sndbuf %d KiB, maxseg %d\n", rcvbuf / 1024,
+	       sndbuf / 1024, maxseg);
+#if defined(__sortix__)
+	struct tcp_info info;
+	size = sizeof(info);
+	if ( getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &size) < 0 )
+		return;
+	printf("rtt %" PRIu32 " us, rto %" PRIu32 " ms, cwnd %" PRIu32 " KiB, "
+	       "%" PRIu64 " retransmitted (%" PRIu64 " fast, %" PRIu64
+	       " timeouts)\n", info.tcpi_rtt, info.tcpi_rto / 1000,
+	       info.tcpi_snd_cwnd / 1024, info.tcpi_total_retrans,
+	       info.tcpi_fast_retrans, info.tcpi_timeouts);
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+	if ( argc < 4 )
+		errx(1, "usage: %s send HOST PORT [MIB=256] | receive HOST PORT | "
+		     "sendfile HOST PORT FILE", argv[0]);
+	const char* mode = argv[1];
+	const char* host = argv[2];
+	const char* port = argv[3];
+	bool sending_file = !strcmp(mode, "sendfile");
+	bool sending = sending_file || !strcmp(mode, "send");
+	if ( !sending && strcmp(mode, "receive") != 0 )
+		errx(1, "unknown mode: %s", mode);
+	uintmax_t size = 256;
+	if ( !sending_file && sending && 5 <= argc )
+		size = strtoumax(argv[4], NULL, 10);
+	size <<= 20;
+	int file_fd = -1;
+	if ( sending_file )
+	{
+		if ( argc < 5 )
+			errx(1, "sendfile mode requires a file");
+		if ( (file_fd = open(argv[4], O_RDONLY)) < 0 )
+			err(1, "%s", argv[4]);
+		struct stat st;
+		if ( fstat(file_fd, &st) < 0 )
+			err(1, "stat: %s", argv[4]);
+		size = st.st_size;
+	}
+	size_t buffer_size = 64 * 1024;
+	unsigned char* buffer = malloc(buffer_size);
+	if ( !buffer )
+		err(1, "malloc");
+	for ( size_t i = 0; i < buffer_size; i++ )
+		buffer[i] = (unsigned char) (i * 7 + i / 4093);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = sending ? 0 : AI_PASSIVE;
+	struct addrinfo* res;
+	int status = getaddrinfo(host, port, &hints, &res);
+	if ( status )
+		errx(1, "%s: %s", host, gai_strerror(status));
+	int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if ( fd < 0 )
+		err(1, "socket");
+	if ( sending )
+	{
+		if ( connect(fd, res->ai_addr, res->ai_addrlen) < 0 )
+			err(1, "connect: %s", host);
+	}
+	else
+	{
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if ( bind(fd, res->ai_addr, res->ai_addrlen) < 0 )
+			err(1, "bind: %s", host);
+		if ( listen(fd, 1) < 0 )
+			err(1, "listen");
+		int conn = accept(fd, NULL, NULL);
+		if ( conn < 0 )
+			err(1, "accept");
+		close(fd);
+		fd = conn;
+	}
+	freeaddrinfo(res);
+
+	uintmax_t start, finish;
+	uintmax_t done = 0;
+	if ( uptime(&start) )
+		err(1, "uptime");
+	if ( sending )
+	{
+		while ( done < size )
+		{
+			size_t amount = size - done < buffer_size ? size - done :
+			                                            buffer_size;
+			ssize_t written;
+			if ( sending_file )
+				written = sendfile(fd, file_fd, NULL, amount);
+			else
+				written = write(fd, buffer, amount);
+			if ( written <= 0 )
+				err(1, sending_file ? "sendfile" : "write");
+			done += written;
+		}
+		// Include the delivery of the data in the measurement by waiting for
+		// nc to close the connection after the end of the data.
+		if ( shutdown(fd, SHUT_WR) < 0 )
+			err(1, "shutdown");
+		while ( 0 < read(fd, buffer, buffer_size) )
+			continue;
+	}
+	else
+	{
+		ssize_t amount;
+		while ( 0 < (amount = read(fd, buffer, buffer_size)) )
+			done += amount;
+		if ( amount < 0 )
+			err(1, "read");
+	}
+	if ( uptime(&finish) )
+		err(1, "uptime");
+
+	report(mode, done, finish - start);
+	report_socket(fd);
+	close(fd);
+
+	free(buffer);
+
+	return 0;
+}
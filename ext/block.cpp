@@ -53,6 +53,7 @@ void Block::Construct(Device* device, uint32_t block_id)
 	this->block_id = block_id;
 	this->dirty = false;
 	this->is_in_transit = false;
+	this->is_loading = false;
 }
 
 Block::~Block()
@@ -69,12 +70,12 @@ void Block::Destruct()
 
 void Block::Refer()
 {
-	reference_count++;
+	__atomic_add_fetch(&reference_count, 1, __ATOMIC_SEQ_CST);
 }
 
 void Block::Unref()
 {
-	if ( !--reference_count )
+	if ( !__atomic_sub_fetch(&reference_count, 1, __ATOMIC_SEQ_CST) )
 	{
 #if 0
 		device->block_count--;
@@ -88,20 +89,32 @@ void Block::Sync()
 	if ( device->has_sync_thread )
 	{
 		pthread_mutex_lock(&device->sync_thread_lock);
+		if ( dirty )
+		{
+			device->sync_thread_flush = true;
+			pthread_cond_signal(&device->sync_thread_cond);
+		}
 		while ( dirty || is_in_transit )
 			pthread_cond_wait(&transit_done_cond, &device->sync_thread_lock);
 		pthread_mutex_unlock(&device->sync_thread_lock);
 		return;
 	}
 
+	pthread_mutex_lock(&device->sync_thread_lock);
+	while ( is_in_transit )
+		pthread_cond_wait(&transit_done_cond, &device->sync_thread_lock);
 	if ( !dirty )
+	{
+		pthread_mutex_unlock(&device->sync_thread_lock);
 		return;
+	}
 	dirty = false;
 	(prev_dirty ? prev_dirty->next_dirty : device->dirty_block) = next_dirty;
 	if ( next_dirty )
 		next_dirty->prev_dirty = prev_dirty;
 	prev_dirty = NULL;
 	next_dirty = NULL;
+	pthread_mutex_unlock(&device->sync_thread_lock);
 	if ( !device->write )
 		return;
 	off_t file_offset = (off_t) device->block_size * (off_t) block_id;
@@ -118,6 +131,8 @@ void Block::FinishWrite()
 {
 	pthread_mutex_unlock(&modify_lock);
 	pthread_mutex_lock(&device->sync_thread_lock);
+	while ( is_in_transit )
+		pthread_cond_wait(&transit_done_cond, &device->sync_thread_lock);
 	if ( !dirty )
 	{
 		dirty = true;
@@ -134,8 +149,20 @@ void Block::FinishWrite()
 
 void Block::Use()
 {
+	pthread_rwlock_wrlock(&device->hash_lock);
 	Unlink();
 	Prelink();
+	pthread_rwlock_unlock(&device->hash_lock);
+}
+
+void Block::WaitLoaded()
+{
+	// The block is published in the hash before its contents have been read,
+	// and the loading thread holds the modify lock until the read is done.
+	if ( !__atomic_load_n(&is_loading, __ATOMIC_SEQ_CST) )
+		return;
+	pthread_mutex_lock(&modify_lock);
+	pthread_mutex_unlock(&modify_lock);
 }
 
 void Block::Unlink()
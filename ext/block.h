@@ -45,6 +45,7 @@ public:
 	uint32_t block_id;
 	bool dirty;
 	bool is_in_transit;
+	bool is_loading;
 	uint8_t* block_data;
 
 public:
@@ -54,6 +55,7 @@ public:
 	void BeginWrite();
 	void FinishWrite();
 	void Use();
+	void WaitLoaded();
 	void Unlink();
 	void Prelink();
 
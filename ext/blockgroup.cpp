@@ -21,8 +21,10 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "ext-constants.h"
 #include "ext-structs.h"
@@ -35,6 +37,7 @@
 
 BlockGroup::BlockGroup(Filesystem* filesystem, uint32_t group_id)
 {
+	this->allocation_lock = PTHREAD_MUTEX_INITIALIZER;
 	this->data_block = NULL;
 	this->data = NULL;
 	this->filesystem = filesystem;
@@ -44,7 +47,7 @@ BlockGroup::BlockGroup(Filesystem* filesystem, uint32_t group_id)
 	this->group_id = group_id;
 	this->block_alloc_chunk = 0;
 	this->inode_alloc_chunk = 0;
-	this->block_bitmap_chunk_i = 0;
+	this->block_alloc_hint = 0;
 	this->inode_bitmap_chunk_i = 0;
 	this->first_block_id = filesystem->sb->s_first_data_block +
 	                       filesystem->sb->s_blocks_per_group * group_id;
@@ -74,63 +77,150 @@ BlockGroup::~BlockGroup()
 	filesystem->block_groups[group_id] = NULL;
 }
 
-uint32_t BlockGroup::AllocateBlock()
+// Returns the first bit in [begin, end) with the given value, or end if none.
+// The bitmap is scanned a 64-bit word at a time, which relies on the bitmap
+// being little-endian like the bit order of the on-disk format.
+static uint32_t FindBit(const uint8_t* bitmap, uint32_t begin, uint32_t end,
+                        bool value)
 {
+	uint32_t i = begin;
+	while ( i < end )
+	{
+		uint64_t word;
+		memcpy(&word, bitmap + (i / 64) * 8, sizeof(word));
+		if ( !value )
+			word = ~word;
+		word &= ~0ULL << (i % 64);
+		if ( word )
+		{
+			uint32_t found = (i & ~63U) + __builtin_ctzll(word);
+			return found < end ? found : end;
+		}
+		i = (i & ~63U) + 64;
+	}
+	return end;
+}
+
+static void SetBits(uint8_t* bitmap, uint32_t begin, uint32_t count,
+                    bool value)
+{
+	uint32_t i = begin;
+	uint32_t end = begin + count;
+	for ( ; i < end && i % 8; i++ )
+		value ? setbit(bitmap, i) : clearbit(bitmap, i);
+	uint32_t bytes = (end - i) / 8;
+	memset(bitmap + i / 8, value ? 0xFF : 0x00, bytes);
+	i += bytes * 8;
+	for ( ; i < end; i++ )
+		value ? setbit(bitmap, i) : clearbit(bitmap, i);
+}
+
+Block* BlockGroup::GetBlockBitmap(uint32_t chunk)
+{
+	// allocation_lock is held.
+	if ( block_bitmap_chunk && block_alloc_chunk == chunk )
+		return block_bitmap_chunk;
+	if ( block_bitmap_chunk )
+		block_bitmap_chunk->Unref();
+	block_alloc_chunk = chunk;
+	uint32_t block_id = data->bg_block_bitmap + chunk;
+	return block_bitmap_chunk = filesystem->device->GetBlock(block_id);
+}
+
+uint32_t BlockGroup::AllocateBlocks(uint32_t goal, uint32_t wanted,
+                                    uint32_t* count)
+{
+	assert(wanted);
 	if ( !filesystem->device->write )
 		return errno = EROFS, 0;
+	pthread_mutex_lock(&allocation_lock);
 	if ( !data->bg_free_blocks_count )
-		return errno = ENOSPC, 0;
-	size_t num_chunk_bits = filesystem->block_size * 8UL;
-	uint32_t begun_chunk = block_alloc_chunk;
-	for ( uint32_t i = 0; i < num_block_bitmap_chunks; i++ )
+		return pthread_mutex_unlock(&allocation_lock), errno = ENOSPC, 0;
+	uint32_t num_chunk_bits = filesystem->block_size * 8UL;
+	uint32_t start = block_alloc_hint;
+	if ( first_block_id <= goal && goal - first_block_id < num_blocks )
+		start = goal - first_block_id;
+	if ( num_blocks <= start )
+		start = 0;
+	// Search from the goal towards the end of the group and then wrap around,
+	// stopping at the first free run that's long enough. A run starting right
+	// at the goal is taken regardless of its length since it continues the
+	// file contiguously, otherwise the longest run seen is used.
+	uint32_t found_begin = 0;
+	uint32_t found_length = 0;
+	for ( int pass = 0; pass < 2 && found_length < wanted; pass++ )
 	{
-		block_alloc_chunk = (begun_chunk + i) % num_block_bitmap_chunks;
-		bool last = block_alloc_chunk + 1 == num_block_bitmap_chunks;
-		if ( !block_bitmap_chunk )
-		{
-			uint32_t block_id = data->bg_block_bitmap + block_alloc_chunk;
-			block_bitmap_chunk = filesystem->device->GetBlock(block_id);
-			if ( !block_bitmap_chunk )
-				return 0;
-			block_bitmap_chunk_i = 0;
-		}
-		uint32_t chunk_offset = block_alloc_chunk * num_chunk_bits;
-		uint8_t* chunk_bits = block_bitmap_chunk->block_data;
-		size_t num_bits = last ? num_blocks - chunk_offset : num_chunk_bits;
-		// TODO: This can be made faster by caching if previous bits were set.
-		for ( ; block_bitmap_chunk_i < num_bits; block_bitmap_chunk_i++ )
+		uint32_t begin = pass == 0 ? start : 0;
+		uint32_t end = pass == 0 ? num_blocks : start;
+		uint32_t i = begin;
+		while ( i < end && found_length < wanted )
 		{
-			if ( !checkbit(chunk_bits, block_bitmap_chunk_i) )
+			uint32_t chunk = i / num_chunk_bits;
+			uint32_t chunk_offset = chunk * num_chunk_bits;
+			uint32_t chunk_end = chunk_offset + num_chunk_bits;
+			if ( end < chunk_end )
+				chunk_end = end;
+			Block* bitmap = GetBlockBitmap(chunk);
+			if ( !bitmap )
+				return pthread_mutex_unlock(&allocation_lock), 0;
+			uint8_t* bits = bitmap->block_data;
+			uint32_t run_begin = chunk_offset +
+				FindBit(bits, i - chunk_offset, chunk_end - chunk_offset, false);
+			if ( run_begin == chunk_end )
 			{
-				block_bitmap_chunk->BeginWrite();
-				setbit(chunk_bits, block_bitmap_chunk_i);
-				block_bitmap_chunk->FinishWrite();
-				BeginWrite();
-				data->bg_free_blocks_count--;
-				FinishWrite();
-				filesystem->BeginWrite();
-				filesystem->sb->s_free_blocks_count--;
-				filesystem->FinishWrite();
-				uint32_t group_block_id = chunk_offset + block_bitmap_chunk_i++;
-				uint32_t block_id = first_block_id + group_block_id;
-				return block_id;
+				i = chunk_end;
+				continue;
 			}
+			uint32_t run_limit = chunk_end - run_begin < wanted ?
+			                     chunk_end : run_begin + wanted;
+			uint32_t run_end = chunk_offset +
+				FindBit(bits, run_begin - chunk_offset, run_limit - chunk_offset,
+				        true);
+			if ( found_length < run_end - run_begin )
+			{
+				found_begin = run_begin;
+				found_length = run_end - run_begin;
+			}
+			if ( run_begin == start )
+				break;
+			i = run_end;
 		}
-		block_bitmap_chunk->Unref();
-		block_bitmap_chunk = NULL;
+		if ( found_length && found_begin == start )
+			break;
 	}
+	if ( !found_length )
+	{
+		BeginWrite();
+		data->bg_free_blocks_count = 0;
+		FinishWrite();
+		pthread_mutex_unlock(&allocation_lock);
+		return errno = ENOSPC, 0;
+	}
+	Block* bitmap = GetBlockBitmap(found_begin / num_chunk_bits);
+	assert(bitmap);
+	bitmap->BeginWrite();
+	SetBits(bitmap->block_data, found_begin % num_chunk_bits, found_length,
+	        true);
+	bitmap->FinishWrite();
 	BeginWrite();
-	data->bg_free_blocks_count = 0;
+	data->bg_free_blocks_count -= found_length;
 	FinishWrite();
-	return errno = ENOSPC, 0;
+	filesystem->BeginWrite();
+	filesystem->sb->s_free_blocks_count -= found_length;
+	filesystem->FinishWrite();
+	block_alloc_hint = found_begin + found_length;
+	pthread_mutex_unlock(&allocation_lock);
+	*count = found_length;
+	return first_block_id + found_begin;
 }
 
 uint32_t BlockGroup::AllocateInode()
 {
 	if ( !filesystem->device->write )
 		return errno = EROFS, 0;
+	pthread_mutex_lock(&allocation_lock);
 	if ( !data->bg_free_inodes_count )
-		return errno = ENOSPC, 0;
+		return pthread_mutex_unlock(&allocation_lock), errno = ENOSPC, 0;
 	size_t num_chunk_bits = filesystem->block_size * 8UL;
 	uint32_t begun_chunk = inode_alloc_chunk;
 	for ( uint32_t i = 0; i < num_inode_bitmap_chunks; i++ )
@@ -142,7 +232,7 @@ uint32_t BlockGroup::AllocateInode()
 			uint32_t block_id = data->bg_inode_bitmap + inode_alloc_chunk;
 			inode_bitmap_chunk = filesystem->device->GetBlock(block_id);
 			if ( !inode_bitmap_chunk )
-				return 0;
+				return pthread_mutex_unlock(&allocation_lock), 0;
 			inode_bitmap_chunk_i = 0;
 		}
 		uint32_t chunk_offset = inode_alloc_chunk * num_chunk_bits;
@@ -164,6 +254,7 @@ uint32_t BlockGroup::AllocateInode()
 				filesystem->FinishWrite();
 				uint32_t group_inode_id = chunk_offset + inode_bitmap_chunk_i++;
 				uint32_t inode_id = first_inode_id + group_inode_id;
+				pthread_mutex_unlock(&allocation_lock);
 				return inode_id;
 			}
 		}
@@ -173,38 +264,41 @@ uint32_t BlockGroup::AllocateInode()
 	BeginWrite();
 	data->bg_free_inodes_count = 0;
 	FinishWrite();
+	pthread_mutex_unlock(&allocation_lock);
 	return errno = ENOSPC, 0;
 }
 
-void BlockGroup::FreeBlock(uint32_t block_id)
+void BlockGroup::FreeBlocks(uint32_t block_id, uint32_t count)
 {
 	assert(filesystem->device->write);
-	block_id -= first_block_id;
-	size_t num_chunk_bits = filesystem->block_size * 8UL;
-	uint32_t chunk_id = block_id / num_chunk_bits;
-	uint32_t chunk_bit = block_id % num_chunk_bits;
-	if ( !block_bitmap_chunk || chunk_id != block_alloc_chunk )
+	assert(first_block_id <= block_id);
+	assert(block_id - first_block_id + count <= num_blocks);
+	uint32_t group_block_id = block_id - first_block_id;
+	uint32_t num_chunk_bits = filesystem->block_size * 8UL;
+	pthread_mutex_lock(&allocation_lock);
+	uint32_t done = 0;
+	while ( done < count )
 	{
-		if ( block_bitmap_chunk )
-			block_bitmap_chunk->Unref();
-		block_alloc_chunk = chunk_id;
-		uint32_t block_id = data->bg_block_bitmap + block_alloc_chunk;
-		block_bitmap_chunk = filesystem->device->GetBlock(block_id);
-		block_bitmap_chunk_i = 0;
+		uint32_t chunk = (group_block_id + done) / num_chunk_bits;
+		uint32_t chunk_bit = (group_block_id + done) % num_chunk_bits;
+		uint32_t amount = num_chunk_bits - chunk_bit;
+		if ( count - done < amount )
+			amount = count - done;
+		Block* bitmap = GetBlockBitmap(chunk);
+		if ( !bitmap )
+			break;
+		bitmap->BeginWrite();
+		SetBits(bitmap->block_data, chunk_bit, amount, false);
+		bitmap->FinishWrite();
+		done += amount;
 	}
-
-	block_bitmap_chunk->BeginWrite();
-	uint8_t* chunk_bits = block_bitmap_chunk->block_data;
-	clearbit(chunk_bits, chunk_bit);
-	block_bitmap_chunk->FinishWrite();
-	if ( chunk_bit < inode_bitmap_chunk_i )
-		block_bitmap_chunk_i = chunk_bit;
 	BeginWrite();
-	data->bg_free_blocks_count++;
+	data->bg_free_blocks_count += done;
 	FinishWrite();
 	filesystem->BeginWrite();
-	filesystem->sb->s_free_blocks_count++;
+	filesystem->sb->s_free_blocks_count += done;
 	filesystem->FinishWrite();
+	pthread_mutex_unlock(&allocation_lock);
 }
 
 void BlockGroup::FreeInode(uint32_t inode_id)
@@ -214,6 +308,7 @@ void BlockGroup::FreeInode(uint32_t inode_id)
 	size_t num_chunk_bits = filesystem->block_size * 8UL;
 	uint32_t chunk_id = inode_id / num_chunk_bits;
 	uint32_t chunk_bit = inode_id % num_chunk_bits;
+	pthread_mutex_lock(&allocation_lock);
 	if ( !inode_bitmap_chunk || chunk_id != inode_alloc_chunk )
 	{
 		if ( inode_bitmap_chunk )
@@ -236,6 +331,7 @@ void BlockGroup::FreeInode(uint32_t inode_id)
 	filesystem->BeginWrite();
 	filesystem->sb->s_free_inodes_count++;
 	filesystem->FinishWrite();
+	pthread_mutex_unlock(&allocation_lock);
 }
 
 void BlockGroup::Refer()
@@ -250,6 +346,7 @@ void BlockGroup::Unref()
 
 void BlockGroup::Sync()
 {
+	pthread_mutex_lock(&allocation_lock);
 	if ( block_bitmap_chunk )
 		block_bitmap_chunk->Sync();
 	if ( inode_bitmap_chunk )
@@ -257,6 +354,7 @@ void BlockGroup::Sync()
 	if ( dirty )
 		data_block->Sync();
 	dirty = false;
+	pthread_mutex_unlock(&allocation_lock);
 }
 
 void BlockGroup::BeginWrite()
@@ -30,6 +30,7 @@ public:
 	~BlockGroup();
 
 public:
+	pthread_mutex_t allocation_lock;
 	Block* data_block;
 	struct ext_blockgrpdesc* data;
 	Filesystem* filesystem;
@@ -39,7 +40,7 @@ public:
 	uint32_t group_id;
 	uint32_t block_alloc_chunk;
 	uint32_t inode_alloc_chunk;
-	uint32_t block_bitmap_chunk_i;
+	uint32_t block_alloc_hint;
 	uint32_t inode_bitmap_chunk_i;
 	uint32_t first_block_id;
 	uint32_t first_inode_id;
@@ -50,9 +51,9 @@ public:
 	bool dirty;
 
 public:
-	uint32_t AllocateBlock();
+	uint32_t AllocateBlocks(uint32_t goal, uint32_t wanted, uint32_t* count);
 	uint32_t AllocateInode();
-	void FreeBlock(uint32_t block_id);
+	void FreeBlocks(uint32_t block_id, uint32_t count);
 	void FreeInode(uint32_t inode_id);
 	void Refer();
 	void Unref();
@@ -62,6 +63,7 @@ public:
 	void Use();
 	void Unlink();
 	void Prelink();
+	Block* GetBlockBitmap(uint32_t chunk);
 
 };
 
@@ -19,18 +19,73 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "block.h"
 #include "device.h"
 #include "ioleast.h"
 
+static const size_t EVICTION_SCAN_MAX = 128;
+static const long SYNC_THREAD_DELAY_MS = 50;
+
+static Block* FindCachedBlock(Device* device, uint32_t block_id)
+{
+	size_t bin = block_id % DEVICE_HASH_LENGTH;
+	for ( Block* iter = device->hash_blocks[bin]; iter; iter = iter->next_hashed )
+		if ( iter->block_id == block_id )
+			return iter;
+	return NULL;
+}
+
+static bool IsSyncable(Block* block, bool unreferenced)
+{
+	return block && block->dirty && !block->is_in_transit &&
+	       (!unreferenced || !block->reference_count);
+}
+
+static void ReadBlocks(int fd, Block** blocks, size_t count, size_t block_size,
+                       off_t offset)
+{
+	struct iovec iov[DEVICE_RUN_MAX];
+	size_t total = count * block_size;
+	size_t done = 0;
+	while ( done < total )
+	{
+		size_t first = done / block_size;
+		size_t skip = done % block_size;
+		int iovcnt = 0;
+		for ( size_t i = first; i < count; i++ )
+		{
+			size_t from = i == first ? skip : 0;
+			iov[iovcnt].iov_base = blocks[i]->block_data + from;
+			iov[iovcnt].iov_len = block_size - from;
+			iovcnt++;
+		}
+		ssize_t amount = preadv(fd, iov, iovcnt, offset + (off_t) done);
+		if ( amount < 0 && errno == EINTR )
+			continue;
+		if ( amount <= 0 )
+		{
+			for ( size_t i = first; i < count; i++ )
+			{
+				size_t from = i == first ? skip : 0;
+				memset(blocks[i]->block_data + from, 0, block_size - from);
+			}
+			break;
+		}
+		done += (size_t) amount;
+	}
+}
+
 void* Device__SyncThread(void* ctx)
 {
 	((Device*) ctx)->SyncThread();
@@ -43,6 +98,7 @@ Device::Device(int fd, const char* path, uint32_t block_size, bool write)
 	this->sync_thread_cond = PTHREAD_COND_INITIALIZER;
 	this->sync_thread_idle_cond = PTHREAD_COND_INITIALIZER;
 	this->sync_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+	this->hash_lock = PTHREAD_RWLOCK_INITIALIZER;
 	this->mru_block = NULL;
 	this->lru_block = NULL;
 	this->dirty_block = NULL;
@@ -57,7 +113,8 @@ Device::Device(int fd, const char* path, uint32_t block_size, bool write)
 	this->write = write;
 	this->has_sync_thread = false;
 	this->sync_thread_should_exit = false;
-	this->sync_in_transit = false;
+	this->sync_thread_flush = false;
+	this->sync_in_transit = 0;
 	this->block_count = 0;
 #ifdef __sortix__
 	// TODO: This isn't scaleable if there's multiple filesystems mounted.
@@ -96,14 +153,60 @@ void Device::SpawnSyncThread()
 
 Block* Device::AllocateBlock()
 {
+	// hash_lock is held for writing.
 	if ( block_limit <= block_count )
 	{
-		for ( Block* block = lru_block; block; block = block->prev_block )
+		// Prefer evicting a clean block so the cache isn't locked while the
+		// victim is written back, but only look at the least recently used
+		// blocks so a cache full of dirty blocks doesn't make this linear.
+		Block* victim = NULL;
+		size_t candidates = 0;
+		for ( Block* block = lru_block;
+		      block && candidates < EVICTION_SCAN_MAX;
+		      block = block->prev_block )
 		{
 			if ( block->reference_count )
 				continue;
-			block->Destruct(); // Syncs.
-			return block;
+			candidates++;
+			if ( !block->dirty && !block->is_in_transit )
+			{
+				victim = block;
+				break;
+			}
+			if ( !victim )
+				victim = block;
+		}
+		if ( victim && write )
+		{
+			// Write back the victim along with its dirty neighbours, which
+			// makes them clean candidates for the following evictions. Only
+			// unreferenced blocks are included as nobody can be modifying
+			// them while the hash lock is held.
+			pthread_mutex_lock(&sync_thread_lock);
+			Block* run[DEVICE_RUN_MAX];
+			size_t count = 0;
+			uint8_t* buffer = NULL;
+			if ( IsSyncable(victim, true) )
+			{
+				ClaimDirty(victim);
+				buffer = new uint8_t[block_size * DEVICE_RUN_MAX];
+				if ( buffer )
+					count = CollectDirtyRun(victim, run, DEVICE_RUN_MAX, true);
+				else
+				{
+					victim->Refer();
+					run[count++] = victim;
+				}
+			}
+			pthread_mutex_unlock(&sync_thread_lock);
+			if ( count )
+				WriteRun(run, count, buffer);
+			delete[] buffer;
+		}
+		if ( victim )
+		{
+			victim->Destruct(); // Syncs.
+			return victim;
 		}
 	}
 	uint8_t* data = new uint8_t[block_size];
@@ -121,39 +224,127 @@ Block* Device::GetBlock(uint32_t block_id)
 {
 	if ( Block* block = GetCachedBlock(block_id) )
 		return block;
+	pthread_rwlock_wrlock(&hash_lock);
+	if ( Block* block = GetCachedBlockLocked(block_id) )
+	{
+		pthread_rwlock_unlock(&hash_lock);
+		block->WaitLoaded();
+		return block;
+	}
 	Block* block = AllocateBlock();
 	if ( !block )
-		return NULL;
+		return pthread_rwlock_unlock(&hash_lock), (Block*) NULL;
 	block->Construct(this, block_id);
+	// Publish the block before reading it so other lookups aren't blocked by
+	// the disk, they wait for the modify lock until the contents are loaded.
+	pthread_mutex_lock(&block->modify_lock);
+	block->is_loading = true;
+	block->Prelink();
+	pthread_rwlock_unlock(&hash_lock);
 	off_t file_offset = (off_t) block_size * (off_t) block_id;
 	preadall(fd, block->block_data, block_size, file_offset);
-	block->Prelink();
+	__atomic_store_n(&block->is_loading, false, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&block->modify_lock);
 	return block;
 }
 
 Block* Device::GetBlockZeroed(uint32_t block_id)
 {
 	assert(write);
-	if ( Block* block = GetCachedBlock(block_id) )
+	pthread_rwlock_wrlock(&hash_lock);
+	Block* block = GetCachedBlockLocked(block_id);
+	if ( block )
 	{
+		pthread_rwlock_unlock(&hash_lock);
+		block->WaitLoaded();
 		block->BeginWrite();
 		memset(block->block_data, 0, block_size);
 		block->FinishWrite();
 		return block;
 	}
-	Block* block = AllocateBlock();
+	block = AllocateBlock();
 	if ( !block )
-		return NULL;
+		return pthread_rwlock_unlock(&hash_lock), (Block*) NULL;
 	block->Construct(this, block_id);
 	memset(block->block_data, 0, block_size);
 	block->Prelink();
+	pthread_rwlock_unlock(&hash_lock);
 	block->BeginWrite();
 	block->FinishWrite();
 	return block;
 }
 
+void Device::Prefetch(uint32_t block_id, uint32_t count)
+{
+	// Load the uncached blocks in the range with a single read per contiguous
+	// run, and leave them in the cache for the following GetBlock calls.
+	if ( block_limit / 4 < count )
+		count = block_limit / 4;
+	uint64_t device_blocks = (uint64_t) device_size / block_size;
+	if ( device_size && device_blocks <= block_id )
+		return;
+	if ( device_size && device_blocks - block_id < count )
+		count = device_blocks - block_id;
+	Block* run[DEVICE_RUN_MAX];
+	uint32_t end = block_id + count;
+	while ( block_id < end )
+	{
+		size_t run_length = 0;
+		uint32_t run_start = block_id;
+		pthread_rwlock_wrlock(&hash_lock);
+		while ( block_id < end && run_length < DEVICE_RUN_MAX )
+		{
+			if ( FindCachedBlock(this, block_id) )
+			{
+				if ( !run_length )
+				{
+					block_id++;
+					run_start = block_id;
+					continue;
+				}
+				break;
+			}
+			Block* block = AllocateBlock();
+			if ( !block )
+			{
+				end = block_id;
+				break;
+			}
+			block->Construct(this, block_id);
+			pthread_mutex_lock(&block->modify_lock);
+			block->is_loading = true;
+			block->Prelink();
+			run[run_length++] = block;
+			block_id++;
+		}
+		pthread_rwlock_unlock(&hash_lock);
+		if ( !run_length )
+			continue;
+		off_t file_offset = (off_t) block_size * (off_t) run_start;
+		ReadBlocks(fd, run, run_length, block_size, file_offset);
+		for ( size_t i = 0; i < run_length; i++ )
+		{
+			Block* block = run[i];
+			__atomic_store_n(&block->is_loading, false, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&block->modify_lock);
+			block->Unref();
+		}
+	}
+}
+
 Block* Device::GetCachedBlock(uint32_t block_id)
 {
+	pthread_rwlock_rdlock(&hash_lock);
+	Block* block = GetCachedBlockLocked(block_id);
+	pthread_rwlock_unlock(&hash_lock);
+	if ( block )
+		block->WaitLoaded();
+	return block;
+}
+
+Block* Device::GetCachedBlockLocked(uint32_t block_id)
+{
+	// hash_lock is held.
 	size_t bin = block_id % DEVICE_HASH_LENGTH;
 	for ( Block* iter = hash_blocks[bin]; iter; iter = iter->next_hashed )
 		if ( iter->block_id == block_id )
@@ -161,60 +352,187 @@ Block* Device::GetCachedBlock(uint32_t block_id)
 	return NULL;
 }
 
+void Device::ClaimDirty(Block* block)
+{
+	// sync_thread_lock is held.
+	(block->prev_dirty ? block->prev_dirty->next_dirty : dirty_block) =
+		block->next_dirty;
+	if ( block->next_dirty )
+		block->next_dirty->prev_dirty = block->prev_dirty;
+	block->prev_dirty = NULL;
+	block->next_dirty = NULL;
+	block->dirty = false;
+	block->is_in_transit = true;
+	sync_in_transit++;
+}
+
+size_t Device::CollectDirtyRun(Block* block, Block** run, size_t max,
+                               bool unreferenced)
+{
+	// hash_lock and sync_thread_lock are held and the block has been claimed.
+	// Gather the dirty neighbours so the run is written back at once.
+	uint32_t first = block->block_id;
+	while ( 0 < first && block->block_id - first < max / 2 &&
+	        IsSyncable(FindCachedBlock(this, first - 1), unreferenced) )
+		first--;
+	size_t count = 0;
+	for ( uint32_t block_id = first; count < max; block_id++ )
+	{
+		Block* member = block;
+		if ( block_id != block->block_id )
+		{
+			member = FindCachedBlock(this, block_id);
+			if ( !IsSyncable(member, unreferenced) )
+				break;
+			ClaimDirty(member);
+		}
+		member->Refer();
+		run[count++] = member;
+		if ( block_id == UINT32_MAX )
+			break;
+	}
+	return count;
+}
+
+void Device::WriteRun(Block** run, size_t count, uint8_t* buffer)
+{
+	// The blocks are snapshotted so they can be modified during the write,
+	// which also makes the run a single contiguous write. A single block can
+	// be written directly if the caller knows it can't be modified.
+	if ( buffer )
+	{
+		for ( size_t i = 0; i < count; i++ )
+		{
+			pthread_mutex_lock(&run[i]->modify_lock);
+			memcpy(buffer + i * block_size, run[i]->block_data, block_size);
+			pthread_mutex_unlock(&run[i]->modify_lock);
+		}
+	}
+	else
+	{
+		assert(count == 1);
+		buffer = run[0]->block_data;
+	}
+	off_t offset = (off_t) block_size * (off_t) run[0]->block_id;
+	pwriteall(fd, buffer, block_size * count, offset);
+	for ( size_t i = 0; i < count; i++ )
+		run[i]->Unref();
+	pthread_mutex_lock(&sync_thread_lock);
+	for ( size_t i = 0; i < count; i++ )
+	{
+		run[i]->is_in_transit = false;
+		pthread_cond_broadcast(&run[i]->transit_done_cond);
+	}
+	sync_in_transit -= count;
+	if ( !dirty_block && !sync_in_transit )
+		pthread_cond_broadcast(&sync_thread_idle_cond);
+	pthread_mutex_unlock(&sync_thread_lock);
+}
+
 void Device::Sync()
 {
 	if ( has_sync_thread )
 	{
 		pthread_mutex_lock(&sync_thread_lock);
+		if ( dirty_block )
+		{
+			sync_thread_flush = true;
+			pthread_cond_signal(&sync_thread_cond);
+		}
 		while ( dirty_block || sync_in_transit )
-			pthread_cond_wait(&sync_thread_cond, &sync_thread_lock);
+			pthread_cond_wait(&sync_thread_idle_cond, &sync_thread_lock);
 		pthread_mutex_unlock(&sync_thread_lock);
 		fsync(fd);
 		return;
 	}
 
-	while ( dirty_block )
-		dirty_block->Sync();
+	uint8_t* buffer = write ? new uint8_t[block_size * DEVICE_RUN_MAX] : NULL;
+	if ( !buffer )
+	{
+		while ( dirty_block )
+			dirty_block->Sync();
+		fsync(fd);
+		return;
+	}
+	Block* run[DEVICE_RUN_MAX];
+	while ( true )
+	{
+		pthread_rwlock_rdlock(&hash_lock);
+		pthread_mutex_lock(&sync_thread_lock);
+		Block* block = dirty_block;
+		size_t count = 0;
+		if ( block )
+		{
+			ClaimDirty(block);
+			count = CollectDirtyRun(block, run, DEVICE_RUN_MAX);
+		}
+		pthread_mutex_unlock(&sync_thread_lock);
+		pthread_rwlock_unlock(&hash_lock);
+		if ( !count )
+			break;
+		WriteRun(run, count, buffer);
+	}
+	delete[] buffer;
 	fsync(fd);
 }
 
 void Device::SyncThread()
 {
+	uint8_t* buffer = new uint8_t[block_size * DEVICE_RUN_MAX];
 	uint8_t transit_block_data[block_size];
+	size_t max = buffer ? DEVICE_RUN_MAX : 1;
+	if ( !buffer )
+		buffer = transit_block_data;
+	Block* run[DEVICE_RUN_MAX];
 	pthread_mutex_lock(&sync_thread_lock);
 	while ( true )
 	{
 		while ( !(dirty_block || sync_thread_should_exit) )
 			pthread_cond_wait(&sync_thread_cond, &sync_thread_lock);
+
+		// Let writes accumulate for a moment so adjacent blocks are written
+		// back together, unless someone is waiting for the blocks.
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += SYNC_THREAD_DELAY_MS * 1000000L;
+		if ( 1000000000L <= deadline.tv_nsec )
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while ( !sync_thread_flush && !sync_thread_should_exit &&
+		        pthread_cond_timedwait(&sync_thread_cond, &sync_thread_lock,
+		                               &deadline) != ETIMEDOUT )
+			continue;
 		if ( sync_thread_should_exit )
 			break;
 
-		Block* block = dirty_block;
-
-		if ( block->next_dirty )
-			block->next_dirty->prev_dirty = NULL;
-		dirty_block = block->next_dirty;
-		block->next_dirty = NULL;
-
-		block->dirty = false;
-		block->is_in_transit = true;
-		sync_in_transit = true;
-
-		pthread_mutex_unlock(&sync_thread_lock);
+		while ( dirty_block )
+		{
+			// Eviction writes back dirty victims itself, so the hash lock can
+			// be waited for here without the evicting thread waiting for us.
+			pthread_mutex_unlock(&sync_thread_lock);
+			pthread_rwlock_rdlock(&hash_lock);
+			pthread_mutex_lock(&sync_thread_lock);
+			size_t count = 0;
+			if ( Block* block = dirty_block )
+			{
+				ClaimDirty(block);
+				count = CollectDirtyRun(block, run, max);
+			}
+			pthread_rwlock_unlock(&hash_lock);
+			if ( !count )
+				break;
 
-		pthread_mutex_lock(&block->modify_lock);
-		memcpy(transit_block_data, block->block_data, block_size);
-		pthread_mutex_unlock(&block->modify_lock);
+			pthread_mutex_unlock(&sync_thread_lock);
 
-		off_t offset = (off_t) block_size * (off_t) block->block_id;
-		pwriteall(fd, transit_block_data, block_size, offset);
+			WriteRun(run, count, buffer);
 
-		pthread_mutex_lock(&sync_thread_lock);
-		block->is_in_transit = false;
-		sync_in_transit = false;
-		pthread_cond_signal(&block->transit_done_cond);
-		if ( !dirty_block )
-			pthread_cond_signal(&sync_thread_idle_cond);
+			pthread_mutex_lock(&sync_thread_lock);
+		}
+		sync_thread_flush = false;
 	}
 	pthread_mutex_unlock(&sync_thread_lock);
+	if ( buffer != transit_block_data )
+		delete[] buffer;
 }
@@ -23,6 +23,7 @@
 class Block;
 
 static const size_t DEVICE_HASH_LENGTH = 1 << 16;
+static const size_t DEVICE_RUN_MAX = 256;
 
 class Device
 {
@@ -35,6 +36,7 @@ public:
 	pthread_cond_t sync_thread_cond;
 	pthread_cond_t sync_thread_idle_cond;
 	pthread_mutex_t sync_thread_lock;
+	pthread_rwlock_t hash_lock;
 	Block* mru_block;
 	Block* lru_block;
 	Block* dirty_block;
@@ -46,7 +48,8 @@ public:
 	bool write;
 	bool has_sync_thread;
 	bool sync_thread_should_exit;
-	bool sync_in_transit;
+	bool sync_thread_flush;
+	size_t sync_in_transit;
 	size_t block_count;
 	size_t block_limit;
 
@@ -56,6 +59,12 @@ public:
 	Block* GetBlock(uint32_t block_id);
 	Block* GetBlockZeroed(uint32_t block_id);
 	Block* GetCachedBlock(uint32_t block_id);
+	Block* GetCachedBlockLocked(uint32_t block_id);
+	void Prefetch(uint32_t block_id, uint32_t count);
+	void ClaimDirty(Block* block);
+	size_t CollectDirtyRun(Block* block, Block** run, size_t max,
+	                       bool unreferenced = false);
+	void WriteRun(Block** run, size_t count, uint8_t* buffer);
 	void Sync();
 	void SyncThread();
 
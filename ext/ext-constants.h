@@ -48,9 +48,13 @@ static const uint32_t EXT2_FEATURE_INCOMPAT_FILETYPE = 1U << 1U;
 static const uint32_t EXT2_FEATURE_INCOMPAT_RECOVER = 1U << 2U;
 static const uint32_t EXT2_FEATURE_INCOMPAT_JOURNAL_DEV = 1U << 3U;
 static const uint32_t EXT2_FEATURE_INCOMPAT_META_BG = 1U << 4U;
+static const uint32_t EXT4_FEATURE_INCOMPAT_EXTENTS = 1U << 6U;
 static const uint32_t EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER = 1U << 0U;
 static const uint32_t EXT2_FEATURE_RO_COMPAT_LARGE_FILE = 1U << 1U;
 static const uint32_t EXT2_FEATURE_RO_COMPAT_BTREE_DIR = 1U << 2U;
+static const uint32_t EXT2_FLAGS_SIGNED_HASH = 1U << 0U;
+static const uint32_t EXT2_FLAGS_UNSIGNED_HASH = 1U << 1U;
+static const uint32_t EXT2_FLAGS_TEST_FILESYS = 1U << 2U;
 static const uint32_t EXT2_LZV1_ALG = 1U << 0U;
 static const uint32_t EXT2_LZRW3A_ALG = 1U << 1U;
 static const uint32_t EXT2_GZIP_ALG = 1U << 2U;
@@ -99,8 +103,16 @@ static const uint32_t EXT2_BTREE_FL = 0x00001000U;
 static const uint32_t EXT2_INDEX_FL = 0x00001000U;
 static const uint32_t EXT2_IMAGIC_FL = 0x00002000U;
 static const uint32_t EXT3_JOURNAL_DATA_FL = 0x00004000U;
+static const uint32_t EXT4_EXTENTS_FL = 0x00080000U;
 static const uint32_t EXT2_RESERVED_FL = 0x80000000U;
 static const uint32_t EXT2_ROOT_INO = 2;
+static const uint16_t EXT4_EXT_MAGIC = 0xF30A;
+static const uint8_t EXT2_HASH_LEGACY = 0;
+static const uint8_t EXT2_HASH_HALF_MD4 = 1;
+static const uint8_t EXT2_HASH_TEA = 2;
+static const uint8_t EXT2_HASH_LEGACY_UNSIGNED = 3;
+static const uint8_t EXT2_HASH_HALF_MD4_UNSIGNED = 4;
+static const uint8_t EXT2_HASH_TEA_UNSIGNED = 5;
 static const uint8_t EXT2_FT_UNKNOWN = 0;
 static const uint8_t EXT2_FT_REG_FILE = 1;
 static const uint8_t EXT2_FT_DIR = 2;
@@ -74,7 +74,15 @@ struct ext_superblock
 // Other options
 	uint32_t s_default_mount_options;
 	uint32_t s_first_meta_bg;
-	uint8_t  alignment2[760];
+	uint32_t s_mkfs_time;
+	uint32_t s_jnl_blocks[17];
+	uint32_t s_blocks_count_hi;
+	uint32_t s_r_blocks_count_hi;
+	uint32_t s_free_blocks_count_hi;
+	uint16_t s_min_extra_isize;
+	uint16_t s_want_extra_isize;
+	uint32_t s_flags;
+	uint8_t  alignment2[668];
 };
 
 struct ext_blockgrpdesc
@@ -116,6 +124,31 @@ struct ext_inode
 	uint32_t i_osd2_alignment0;
 };
 
+struct ext_extent_header
+{
+	uint16_t eh_magic;
+	uint16_t eh_entries;
+	uint16_t eh_max;
+	uint16_t eh_depth;
+	uint32_t eh_generation;
+};
+
+struct ext_extent
+{
+	uint32_t ee_block;
+	uint16_t ee_len;
+	uint16_t ee_start_hi;
+	uint32_t ee_start_lo;
+};
+
+struct ext_extent_idx
+{
+	uint32_t ei_block;
+	uint32_t ei_leaf_lo;
+	uint16_t ei_leaf_hi;
+	uint16_t ei_unused;
+};
+
 struct ext_dirent
 {
 	uint32_t inode;
@@ -125,4 +158,25 @@ struct ext_dirent
 	char name[0];
 };
 
+struct ext_dx_root_info
+{
+	uint32_t reserved_zero;
+	uint8_t hash_version;
+	uint8_t info_length;
+	uint8_t indirect_levels;
+	uint8_t unused_flags;
+};
+
+struct ext_dx_countlimit
+{
+	uint16_t limit;
+	uint16_t count;
+};
+
+struct ext_dx_entry
+{
+	uint32_t hash;
+	uint32_t block;
+};
+
 #endif
@@ -0,0 +1,710 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * extent.cpp
+ * Extent mapped files.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ext-constants.h"
+#include "ext-structs.h"
+
+#include "block.h"
+#include "device.h"
+#include "filesystem.h"
+#include "inode.h"
+#include "util.h"
+
+// Extent mapped files keep a tree in the inode's block array instead of the
+// classic indirect block tables. The root of the tree is stored in i_block and
+// has room for four entries, while the deeper nodes are whole blocks. Interior
+// nodes map the first logical block of each child to its physical block, and
+// the leaves map runs of logical blocks onto contiguous physical blocks. The
+// key of an interior entry is always the first key of its child. Extents
+// longer than EXTENT_INIT_MAX_LEN are uninitialized, their blocks are allocated
+// but read as zeroes until written. Extent and index entries have the same
+// size and both begin with their key.
+
+static const uint32_t EXTENT_INIT_MAX_LEN = 32768;
+static const uint32_t EXTENT_UNINIT_MAX_LEN = 32767;
+static const uint16_t EXTENT_MAX_DEPTH = 5;
+
+struct extent_path
+{
+	Block* block;
+	struct ext_extent_header* header;
+	uint16_t index;
+};
+
+static struct ext_extent* Extents(struct ext_extent_header* header)
+{
+	return (struct ext_extent*) (header + 1);
+}
+
+static struct ext_extent_idx* Indexes(struct ext_extent_header* header)
+{
+	return (struct ext_extent_idx*) (header + 1);
+}
+
+static uint32_t Key(struct ext_extent_header* header, size_t i)
+{
+	return header->eh_depth ? Indexes(header)[i].ei_block :
+	                          Extents(header)[i].ee_block;
+}
+
+static uint32_t ExtentLength(const struct ext_extent* extent)
+{
+	if ( EXTENT_INIT_MAX_LEN < extent->ee_len )
+		return extent->ee_len - EXTENT_INIT_MAX_LEN;
+	return extent->ee_len;
+}
+
+static bool IsUninitialized(const struct ext_extent* extent)
+{
+	return EXTENT_INIT_MAX_LEN < extent->ee_len;
+}
+
+static void SetExtent(struct ext_extent* extent, uint32_t logical,
+                      uint32_t physical, uint32_t length, bool uninitialized)
+{
+	extent->ee_block = logical;
+	extent->ee_len = uninitialized ? EXTENT_INIT_MAX_LEN + length : length;
+	extent->ee_start_hi = 0;
+	extent->ee_start_lo = physical;
+}
+
+static void SetIndex(struct ext_extent_idx* index, uint32_t logical,
+                     uint32_t block_id)
+{
+	index->ei_block = logical;
+	index->ei_leaf_lo = block_id;
+	index->ei_leaf_hi = 0;
+	index->ei_unused = 0;
+}
+
+static uint16_t NodeCapacity(size_t size)
+{
+	return (size - sizeof(struct ext_extent_header)) / sizeof(struct ext_extent);
+}
+
+static bool IsValidNode(struct ext_extent_header* header, uint16_t capacity,
+                        uint16_t depth)
+{
+	return header->eh_magic == EXT4_EXT_MAGIC &&
+	       header->eh_max && header->eh_max <= capacity &&
+	       header->eh_entries <= header->eh_max &&
+	       header->eh_depth == depth;
+}
+
+static bool IsValidBlock(Filesystem* fs, uint16_t hi, uint32_t block_id,
+                         uint32_t count)
+{
+	return !hi && block_id && block_id < fs->num_blocks &&
+	       count <= fs->num_blocks - block_id;
+}
+
+// Returns the last entry whose key is at most logical, or the first entry.
+static uint16_t Search(struct ext_extent_header* header, uint32_t logical)
+{
+	uint16_t begin = 0;
+	uint16_t end = header->eh_entries;
+	while ( begin + 1 < end )
+	{
+		uint16_t middle = begin + (end - begin) / 2;
+		if ( Key(header, middle) <= logical )
+			begin = middle;
+		else
+			end = middle;
+	}
+	return begin;
+}
+
+static void BeginNodeWrite(Inode* inode, struct extent_path* node)
+{
+	if ( node->block )
+		node->block->BeginWrite();
+	else
+		inode->BeginWrite();
+}
+
+static void FinishNodeWrite(Inode* inode, struct extent_path* node)
+{
+	if ( node->block )
+		node->block->FinishWrite();
+	else
+		inode->FinishWrite();
+}
+
+static void ReleasePath(struct extent_path* path, uint16_t depth)
+{
+	for ( uint16_t level = 1; level <= depth; level++ )
+		path[level].block->Unref();
+}
+
+static void AdjustBlocks(Inode* inode, int64_t count)
+{
+	inode->BeginWrite();
+	inode->data->i_blocks += count * (inode->filesystem->block_size / 512);
+	inode->FinishWrite();
+}
+
+static bool FindPath(Inode* inode, uint32_t logical, struct extent_path* path,
+                     uint16_t* depth_ptr)
+{
+	Filesystem* fs = inode->filesystem;
+	struct ext_extent_header* header =
+		(struct ext_extent_header*) inode->data->i_block;
+	uint16_t depth = header->eh_depth;
+	if ( EXTENT_MAX_DEPTH < depth ||
+	     !IsValidNode(header, NodeCapacity(sizeof(inode->data->i_block)), depth) )
+		return errno = EIO, false;
+	path[0].block = NULL;
+	path[0].header = header;
+	for ( uint16_t level = 0; true; level++ )
+	{
+		path[level].index = Search(header, logical);
+		if ( level == depth )
+			break;
+		struct ext_extent_idx* index = &Indexes(header)[path[level].index];
+		if ( !header->eh_entries ||
+		     !IsValidBlock(fs, index->ei_leaf_hi, index->ei_leaf_lo, 1) )
+			return ReleasePath(path, level), errno = EIO, false;
+		Block* block = fs->device->GetBlock(index->ei_leaf_lo);
+		if ( !block )
+			return ReleasePath(path, level), false;
+		header = (struct ext_extent_header*) block->block_data;
+		path[level + 1].block = block;
+		path[level + 1].header = header;
+		if ( !IsValidNode(header, NodeCapacity(fs->block_size),
+		                  depth - level - 1) )
+			return ReleasePath(path, level + 1), errno = EIO, false;
+	}
+	*depth_ptr = depth;
+	return true;
+}
+
+// Propagates a change to the first key of the node at the level up the path.
+static void UpdateKeys(Inode* inode, struct extent_path* path, uint16_t level)
+{
+	for ( ; level; level-- )
+	{
+		struct extent_path* parent = &path[level - 1];
+		struct ext_extent_idx* index = &Indexes(parent->header)[parent->index];
+		uint32_t key = Key(path[level].header, 0);
+		if ( index->ei_block == key )
+			return;
+		BeginNodeWrite(inode, parent);
+		index->ei_block = key;
+		FinishNodeWrite(inode, parent);
+		if ( parent->index )
+			return;
+	}
+}
+
+static Block* AllocateNode(Inode* inode, uint32_t* block_id_ptr)
+{
+	uint32_t block_id = inode->AllocateBlock(0);
+	if ( !block_id )
+		return NULL;
+	Block* block = inode->filesystem->device->GetBlockZeroed(block_id);
+	if ( !block )
+		return inode->filesystem->FreeBlock(block_id), (Block*) NULL;
+	AdjustBlocks(inode, 1);
+	*block_id_ptr = block_id;
+	return block;
+}
+
+// Moves the entries of the full root into a new block and makes it the only
+// child of the root.
+static bool GrowRoot(Inode* inode)
+{
+	Filesystem* fs = inode->filesystem;
+	struct ext_extent_header* root =
+		(struct ext_extent_header*) inode->data->i_block;
+	if ( EXTENT_MAX_DEPTH <= root->eh_depth )
+		return errno = EFBIG, false;
+	uint32_t block_id;
+	Block* block = AllocateNode(inode, &block_id);
+	if ( !block )
+		return false;
+	struct ext_extent_header* child =
+		(struct ext_extent_header*) block->block_data;
+	block->BeginWrite();
+	memcpy(child, root, sizeof(*root) + root->eh_entries * sizeof(struct ext_extent));
+	child->eh_max = NodeCapacity(fs->block_size);
+	block->FinishWrite();
+	block->Unref();
+	inode->BeginWrite();
+	SetIndex(&Indexes(root)[0], Key(root, 0), block_id);
+	root->eh_entries = 1;
+	root->eh_depth++;
+	inode->FinishWrite();
+	return true;
+}
+
+// Splits the full node at the level into a new sibling, whose parent has room
+// for another entry.
+static bool SplitNode(Inode* inode, struct extent_path* path, uint16_t level)
+{
+	Filesystem* fs = inode->filesystem;
+	struct extent_path* node = &path[level];
+	struct extent_path* parent = &path[level - 1];
+	struct ext_extent_header* header = node->header;
+	uint16_t count = header->eh_entries;
+	// Move only the last entry when appending, so sequentially written files
+	// leave full nodes behind.
+	uint16_t split = node->index + 1 == count ? count - 1 : count / 2;
+	uint32_t block_id;
+	Block* block = AllocateNode(inode, &block_id);
+	if ( !block )
+		return false;
+	struct ext_extent_header* sibling =
+		(struct ext_extent_header*) block->block_data;
+	block->BeginWrite();
+	sibling->eh_magic = EXT4_EXT_MAGIC;
+	sibling->eh_entries = count - split;
+	sibling->eh_max = NodeCapacity(fs->block_size);
+	sibling->eh_depth = header->eh_depth;
+	sibling->eh_generation = 0;
+	memcpy(Extents(sibling), Extents(header) + split,
+	       (count - split) * sizeof(struct ext_extent));
+	uint32_t key = Key(sibling, 0);
+	block->FinishWrite();
+	block->Unref();
+	BeginNodeWrite(inode, node);
+	header->eh_entries = split;
+	FinishNodeWrite(inode, node);
+	struct ext_extent_header* parent_header = parent->header;
+	struct ext_extent_idx* indexes = Indexes(parent_header);
+	uint16_t at = parent->index + 1;
+	BeginNodeWrite(inode, parent);
+	memmove(indexes + at + 1, indexes + at,
+	        (parent_header->eh_entries - at) * sizeof(struct ext_extent_idx));
+	SetIndex(&indexes[at], key, block_id);
+	parent_header->eh_entries++;
+	FinishNodeWrite(inode, parent);
+	return true;
+}
+
+// Makes progress towards room in the full leaf by splitting the deepest node
+// whose parent has room, or by growing the tree if every node is full.
+static bool MakeRoom(Inode* inode, struct extent_path* path, uint16_t depth)
+{
+	uint16_t level = depth;
+	while ( level &&
+	        path[level].header->eh_entries == path[level].header->eh_max )
+		level--;
+	if ( path[level].header->eh_entries == path[level].header->eh_max )
+		return GrowRoot(inode);
+	return SplitNode(inode, path, level + 1);
+}
+
+// Initializes a single block of an uninitialized extent by splitting it into
+// up to three extents.
+static bool InitializeBlock(Inode* inode, struct extent_path* path,
+                            uint16_t depth, uint32_t logical)
+{
+	inode->extent_cache_length = 0;
+	struct extent_path* leaf = &path[depth];
+	struct ext_extent* extents = Extents(leaf->header);
+	struct ext_extent* extent = &extents[leaf->index];
+	uint32_t start = extent->ee_block;
+	uint32_t physical = extent->ee_start_lo;
+	uint32_t before = logical - start;
+	uint32_t after = ExtentLength(extent) - before - 1;
+	if ( before )
+	{
+		BeginNodeWrite(inode, leaf);
+		SetExtent(extent, start, physical, before, true);
+		FinishNodeWrite(inode, leaf);
+		if ( !inode->InsertExtent(logical, physical + before, 1, false) )
+			return false;
+		return !after ||
+		       inode->InsertExtent(logical + 1, physical + before + 1, after,
+		                           true);
+	}
+	// Grow the previous extent if possible, so writing a preallocated file
+	// sequentially doesn't leave an extent per block.
+	struct ext_extent* prev = leaf->index ? extent - 1 : NULL;
+	uint32_t prev_length = prev ? ExtentLength(prev) : 0;
+	if ( prev && !IsUninitialized(prev) &&
+	     prev->ee_block + prev_length == logical &&
+	     prev->ee_start_lo + prev_length == physical &&
+	     prev_length < EXTENT_INIT_MAX_LEN )
+	{
+		BeginNodeWrite(inode, leaf);
+		SetExtent(prev, prev->ee_block, prev->ee_start_lo, prev_length + 1,
+		          false);
+		if ( after )
+			SetExtent(extent, logical + 1, physical + 1, after, true);
+		else
+		{
+			size_t following = leaf->header->eh_entries - leaf->index - 1;
+			memmove(extent, extent + 1, following * sizeof(struct ext_extent));
+			leaf->header->eh_entries--;
+		}
+		FinishNodeWrite(inode, leaf);
+		return true;
+	}
+	BeginNodeWrite(inode, leaf);
+	SetExtent(extent, logical, physical, 1, false);
+	FinishNodeWrite(inode, leaf);
+	return !after || inode->InsertExtent(logical + 1, physical + 1, after, true);
+}
+
+// Removes the mappings at and after the logical block from the subtree and
+// returns whether the node became empty.
+static bool RemoveExtents(Inode* inode, struct extent_path* node, uint32_t from)
+{
+	Filesystem* fs = inode->filesystem;
+	struct ext_extent_header* header = node->header;
+	uint16_t count = header->eh_entries;
+	uint16_t keep = count;
+	if ( !header->eh_depth )
+	{
+		while ( keep )
+		{
+			struct ext_extent* extent = &Extents(header)[keep - 1];
+			uint32_t length = ExtentLength(extent);
+			uint32_t physical = extent->ee_start_lo;
+			if ( (uint64_t) extent->ee_block + length <= from )
+				break;
+			bool valid = IsValidBlock(fs, extent->ee_start_hi, physical, length);
+			if ( from <= extent->ee_block )
+			{
+				if ( valid )
+				{
+					fs->FreeBlocks(physical, length);
+					AdjustBlocks(inode, -(int64_t) length);
+				}
+				keep--;
+				continue;
+			}
+			uint32_t remain = from - extent->ee_block;
+			if ( valid )
+			{
+				fs->FreeBlocks(physical + remain, length - remain);
+				AdjustBlocks(inode, -(int64_t) (length - remain));
+			}
+			BeginNodeWrite(inode, node);
+			SetExtent(extent, extent->ee_block, physical, remain,
+			          IsUninitialized(extent));
+			FinishNodeWrite(inode, node);
+			break;
+		}
+	}
+	else
+	{
+		while ( keep )
+		{
+			struct ext_extent_idx* index = &Indexes(header)[keep - 1];
+			uint32_t child_id = index->ei_leaf_lo;
+			if ( !IsValidBlock(fs, index->ei_leaf_hi, child_id, 1) )
+				break;
+			Block* block = fs->device->GetBlock(child_id);
+			if ( !block )
+				break;
+			struct extent_path child;
+			child.block = block;
+			child.header = (struct ext_extent_header*) block->block_data;
+			child.index = 0;
+			bool empty = IsValidNode(child.header, NodeCapacity(fs->block_size),
+			                         header->eh_depth - 1) &&
+			             RemoveExtents(inode, &child, from);
+			block->Unref();
+			if ( !empty )
+				break;
+			fs->FreeBlock(child_id);
+			AdjustBlocks(inode, -1);
+			keep--;
+			// The earlier children only map blocks before this child's key.
+			if ( index->ei_block < from )
+				break;
+		}
+	}
+	if ( keep != count )
+	{
+		BeginNodeWrite(inode, node);
+		header->eh_entries = keep;
+		FinishNodeWrite(inode, node);
+	}
+	return !keep;
+}
+
+// Pulls the only child of the root into the root while it fits.
+static void CollapseRoot(Inode* inode)
+{
+	Filesystem* fs = inode->filesystem;
+	struct ext_extent_header* root =
+		(struct ext_extent_header*) inode->data->i_block;
+	while ( root->eh_depth && root->eh_entries == 1 )
+	{
+		struct ext_extent_idx* index = &Indexes(root)[0];
+		uint32_t child_id = index->ei_leaf_lo;
+		if ( !IsValidBlock(fs, index->ei_leaf_hi, child_id, 1) )
+			return;
+		Block* block = fs->device->GetBlock(child_id);
+		if ( !block )
+			return;
+		struct ext_extent_header* child =
+			(struct ext_extent_header*) block->block_data;
+		if ( !IsValidNode(child, NodeCapacity(fs->block_size),
+		                  root->eh_depth - 1) ||
+		     root->eh_max < child->eh_entries )
+		{
+			block->Unref();
+			return;
+		}
+		inode->BeginWrite();
+		memcpy(Extents(root), Extents(child),
+		       child->eh_entries * sizeof(struct ext_extent));
+		root->eh_entries = child->eh_entries;
+		root->eh_depth = child->eh_depth;
+		inode->FinishWrite();
+		block->Unref();
+		fs->FreeBlock(child_id);
+		AdjustBlocks(inode, -1);
+	}
+}
+
+bool Inode::HasExtents()
+{
+	return data->i_flags & EXT4_EXTENTS_FL;
+}
+
+void Inode::InitializeExtents()
+{
+	if ( !(filesystem->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_EXTENTS) )
+		return;
+	BeginWrite();
+	memset(data->i_block, 0, sizeof(data->i_block));
+	struct ext_extent_header* root = (struct ext_extent_header*) data->i_block;
+	root->eh_magic = EXT4_EXT_MAGIC;
+	root->eh_entries = 0;
+	root->eh_max = NodeCapacity(sizeof(data->i_block));
+	root->eh_depth = 0;
+	root->eh_generation = 0;
+	data->i_flags |= EXT4_EXTENTS_FL;
+	FinishWrite();
+}
+
+Block* Inode::GetExtentBlock(uint64_t offset, bool allocate)
+{
+	if ( UINT32_MAX < offset )
+		return errno = EFBIG, (Block*) NULL;
+	uint32_t logical = (uint32_t) offset;
+	pthread_mutex_lock(&data_lock);
+	if ( extent_cache_length && extent_cache_logical <= logical &&
+	     logical - extent_cache_logical < extent_cache_length )
+	{
+		uint32_t block_id =
+			extent_cache_physical + (logical - extent_cache_logical);
+		pthread_mutex_unlock(&data_lock);
+		return filesystem->device->GetBlock(block_id);
+	}
+	struct extent_path path[EXTENT_MAX_DEPTH + 1];
+	uint16_t depth;
+	if ( !FindPath(this, logical, path, &depth) )
+		return pthread_mutex_unlock(&data_lock), (Block*) NULL;
+	struct extent_path* leaf = &path[depth];
+	uint32_t goal = 0;
+	if ( leaf->header->eh_entries )
+	{
+		struct ext_extent* extent = &Extents(leaf->header)[leaf->index];
+		uint32_t start = extent->ee_block;
+		uint32_t length = ExtentLength(extent);
+		uint32_t physical = extent->ee_start_lo;
+		bool valid = IsValidBlock(filesystem, extent->ee_start_hi, physical,
+		                          length);
+		if ( start <= logical && logical - start < length )
+		{
+			if ( !valid )
+			{
+				ReleasePath(path, depth);
+				pthread_mutex_unlock(&data_lock);
+				return errno = EIO, (Block*) NULL;
+			}
+			uint32_t block_id = physical + (logical - start);
+			if ( !IsUninitialized(extent) )
+			{
+				extent_cache_logical = start;
+				extent_cache_physical = physical;
+				extent_cache_length = length;
+				ReleasePath(path, depth);
+				pthread_mutex_unlock(&data_lock);
+				return filesystem->device->GetBlock(block_id);
+			}
+			if ( !allocate || !filesystem->device->write )
+			{
+				ReleasePath(path, depth);
+				pthread_mutex_unlock(&data_lock);
+				return errno = ENOENT, (Block*) NULL;
+			}
+			bool success = InitializeBlock(this, path, depth, logical);
+			ReleasePath(path, depth);
+			Block* block = success ?
+			               filesystem->device->GetBlockZeroed(block_id) : NULL;
+			pthread_mutex_unlock(&data_lock);
+			return block;
+		}
+		// Try to continue the preceding extent contiguously.
+		if ( valid && start <= logical &&
+		     logical - start < filesystem->num_blocks - physical )
+			goal = physical + (logical - start);
+	}
+	ReleasePath(path, depth);
+	if ( !allocate || !filesystem->device->write )
+		return pthread_mutex_unlock(&data_lock), errno = ENOENT, (Block*) NULL;
+	uint32_t block_id = AllocateBlock(goal);
+	if ( !block_id )
+		return pthread_mutex_unlock(&data_lock), (Block*) NULL;
+	if ( !InsertExtent(logical, block_id, 1, false) )
+	{
+		int errnum = errno;
+		filesystem->FreeBlock(block_id);
+		pthread_mutex_unlock(&data_lock);
+		return errno = errnum, (Block*) NULL;
+	}
+	AdjustBlocks(this, 1);
+	Block* block = filesystem->device->GetBlockZeroed(block_id);
+	pthread_mutex_unlock(&data_lock);
+	return block;
+}
+
+uint32_t Inode::MapExtent(uint64_t offset, uint32_t* length)
+{
+	if ( UINT32_MAX < offset )
+		return 0;
+	uint32_t logical = (uint32_t) offset;
+	pthread_mutex_lock(&data_lock);
+	uint32_t start = extent_cache_logical;
+	uint32_t extent_length = extent_cache_length;
+	uint32_t physical = extent_cache_physical;
+	if ( !(extent_length && start <= logical &&
+	       logical - start < extent_length) )
+	{
+		struct extent_path path[EXTENT_MAX_DEPTH + 1];
+		uint16_t depth;
+		if ( !FindPath(this, logical, path, &depth) )
+			return pthread_mutex_unlock(&data_lock), 0;
+		struct extent_path* leaf = &path[depth];
+		extent_length = 0;
+		if ( leaf->header->eh_entries )
+		{
+			struct ext_extent* extent = &Extents(leaf->header)[leaf->index];
+			start = extent->ee_block;
+			physical = extent->ee_start_lo;
+			// Uninitialized extents read as zeroes and aren't worth loading.
+			if ( !IsUninitialized(extent) &&
+			     IsValidBlock(filesystem, extent->ee_start_hi, physical,
+			                  ExtentLength(extent)) )
+				extent_length = ExtentLength(extent);
+		}
+		ReleasePath(path, depth);
+		if ( !(extent_length && start <= logical &&
+		       logical - start < extent_length) )
+			return pthread_mutex_unlock(&data_lock), 0;
+	}
+	pthread_mutex_unlock(&data_lock);
+	*length = extent_length - (logical - start);
+	return physical + (logical - start);
+}
+
+bool Inode::InsertExtent(uint32_t logical, uint32_t physical, uint32_t length,
+                         bool uninitialized)
+{
+	// data_lock is held.
+	extent_cache_length = 0;
+	uint32_t max_length =
+		uninitialized ? EXTENT_UNINIT_MAX_LEN : EXTENT_INIT_MAX_LEN;
+	while ( true )
+	{
+		struct extent_path path[EXTENT_MAX_DEPTH + 1];
+		uint16_t depth;
+		if ( !FindPath(this, logical, path, &depth) )
+			return false;
+		struct extent_path* leaf = &path[depth];
+		struct ext_extent_header* header = leaf->header;
+		struct ext_extent* extents = Extents(header);
+		uint16_t at = leaf->index;
+		if ( header->eh_entries && extents[at].ee_block <= logical )
+			at++;
+		if ( at )
+		{
+			struct ext_extent* prev = &extents[at - 1];
+			uint32_t prev_length = ExtentLength(prev);
+			if ( IsUninitialized(prev) == uninitialized &&
+			     prev->ee_block + prev_length == logical &&
+			     prev->ee_start_lo + prev_length == physical &&
+			     prev_length + length <= max_length )
+			{
+				BeginNodeWrite(this, leaf);
+				SetExtent(prev, prev->ee_block, prev->ee_start_lo,
+				          prev_length + length, uninitialized);
+				FinishNodeWrite(this, leaf);
+				ReleasePath(path, depth);
+				return true;
+			}
+		}
+		if ( header->eh_entries < header->eh_max )
+		{
+			BeginNodeWrite(this, leaf);
+			memmove(extents + at + 1, extents + at,
+			        (header->eh_entries - at) * sizeof(struct ext_extent));
+			SetExtent(&extents[at], logical, physical, length, uninitialized);
+			header->eh_entries++;
+			FinishNodeWrite(this, leaf);
+			if ( !at )
+				UpdateKeys(this, path, depth);
+			ReleasePath(path, depth);
+			return true;
+		}
+		bool success = MakeRoom(this, path, depth);
+		ReleasePath(path, depth);
+		if ( !success )
+			return false;
+	}
+}
+
+void Inode::TruncateExtents(uint64_t new_num_blocks)
+{
+	// data_lock is held.
+	extent_cache_length = 0;
+	if ( UINT32_MAX < new_num_blocks )
+		return;
+	struct ext_extent_header* root = (struct ext_extent_header*) data->i_block;
+	if ( EXTENT_MAX_DEPTH < root->eh_depth ||
+	     !IsValidNode(root, NodeCapacity(sizeof(data->i_block)), root->eh_depth) )
+		return;
+	struct extent_path node;
+	node.block = NULL;
+	node.header = root;
+	node.index = 0;
+	if ( RemoveExtents(this, &node, (uint32_t) new_num_blocks) &&
+	     root->eh_depth )
+	{
+		BeginWrite();
+		root->eh_depth = 0;
+		FinishWrite();
+	}
+	CollapseRoot(this);
+}
@@ -50,14 +50,16 @@
 #include "ioleast.h"
 
 // These must be kept up to date with libmount/ext2.c.
-static const uint32_t EXT2_FEATURE_COMPAT_SUPPORTED = 0;
+static const uint32_t EXT2_FEATURE_COMPAT_SUPPORTED = \
+                      EXT2_FEATURE_COMPAT_DIR_INDEX;
 static const uint32_t EXT2_FEATURE_INCOMPAT_SUPPORTED = \
-                      EXT2_FEATURE_INCOMPAT_FILETYPE;
+                      EXT2_FEATURE_INCOMPAT_FILETYPE | \
+                      EXT4_FEATURE_INCOMPAT_EXTENTS;
 static const uint32_t EXT2_FEATURE_RO_COMPAT_SUPPORTED = \
                       EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
 
-uid_t request_uid;
-uid_t request_gid;
+__thread uid_t request_uid;
+__thread uid_t request_gid;
 
 mode_t HostModeFromExtMode(uint32_t extmode)
 {
@@ -258,7 +260,7 @@ int main(int argc, char* argv[])
 		     device_path);
 
 	// Verify that no incompatible features are in use.
-	if ( sb.s_feature_compat & ~EXT2_FEATURE_INCOMPAT_SUPPORTED )
+	if ( sb.s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPPORTED )
 		errx(1, "%s: Uses unsupported and incompatible features", device_path);
 
 	// Verify that no incompatible features are in use if opening for write.
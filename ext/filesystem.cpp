@@ -21,6 +21,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -40,6 +41,9 @@ Filesystem::Filesystem(Device* device, const char* mount_path)
 {
 	uint64_t sb_offset = 1024;
 	uint32_t sb_block_id = sb_offset / device->block_size;
+	this->tree_lock = PTHREAD_RWLOCK_INITIALIZER;
+	this->inode_cache_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+	this->block_groups_lock = PTHREAD_MUTEX_INITIALIZER;
 	this->sb_block = device->GetBlock(sb_block_id);
 	assert(sb_block); // TODO: This can fail.
 	this->sb = (struct ext_superblock*)
@@ -90,6 +94,7 @@ Filesystem::~Filesystem()
 	for ( size_t i = 0; i < num_groups; i++ )
 		delete block_groups[i];
 	delete[] block_groups;
+	block_groups = NULL;
 	if ( device->write )
 	{
 		BeginWrite();
@@ -113,13 +118,24 @@ void Filesystem::FinishWrite()
 
 void Filesystem::Sync()
 {
-	while ( dirty_inode )
-		dirty_inode->Sync();
+	while ( true )
+	{
+		pthread_mutex_lock(&inode_cache_lock);
+		Inode* inode = dirty_inode;
+		if ( inode )
+			inode->Refer();
+		pthread_mutex_unlock(&inode_cache_lock);
+		if ( !inode )
+			break;
+		inode->Sync();
+		inode->Unref();
+	}
 	// TODO: This can be made faster by maintaining a linked list of dirty block
 	//       groups.
 	for ( size_t i = 0; i < num_groups; i++ )
 		if ( block_groups && block_groups[i] )
 			block_groups[i]->Sync();
+	pthread_mutex_lock(&sb_block->modify_lock);
 	if ( dirty )
 	{
 		// The correct real-time might not have been known when the filesystem
@@ -134,17 +150,25 @@ void Filesystem::Sync()
 
 		sb->s_wtime = now_realtime.tv_sec;
 		sb->s_mtime = mtime_realtime;
-		sb_block->Sync();
 		dirty = false;
+		pthread_mutex_unlock(&sb_block->modify_lock);
+		sb_block->Sync();
 	}
+	else
+		pthread_mutex_unlock(&sb_block->modify_lock);
 	device->Sync();
 }
 
 BlockGroup* Filesystem::GetBlockGroup(uint32_t group_id)
 {
 	assert(group_id < num_groups);
-	if ( block_groups[group_id] )
-		return block_groups[group_id]->Refer(), block_groups[group_id];
+	pthread_mutex_lock(&block_groups_lock);
+	if ( BlockGroup* group = block_groups[group_id] )
+	{
+		group->Refer();
+		pthread_mutex_unlock(&block_groups_lock);
+		return group;
+	}
 
 	size_t group_size = sizeof(ext_blockgrpdesc);
 	uint32_t first_block_id = sb->s_first_data_block + 1 /* superblock */;
@@ -153,14 +177,19 @@ BlockGroup* Filesystem::GetBlockGroup(uint32_t group_id)
 
 	Block* block = device->GetBlock(block_id);
 	if ( !block )
-		return (BlockGroup*) NULL;
+		return pthread_mutex_unlock(&block_groups_lock), (BlockGroup*) NULL;
 	BlockGroup* group = new BlockGroup(this, group_id);
 	if ( !group ) // TODO: Use operator new nothrow!
+	{
+		pthread_mutex_unlock(&block_groups_lock);
 		return block->Unref(), (BlockGroup*) NULL;
+	}
 	group->data_block = block;
 	uint8_t* buf = group->data_block->block_data + offset;
 	group->data = (struct ext_blockgrpdesc*) buf;
-	return block_groups[group_id] = group;
+	block_groups[group_id] = group;
+	pthread_mutex_unlock(&block_groups_lock);
+	return group;
 }
 
 Inode* Filesystem::GetInode(uint32_t inode_id)
@@ -170,10 +199,8 @@ Inode* Filesystem::GetInode(uint32_t inode_id)
 	if ( !inode_id )
 		return errno = EBADF, (Inode*) NULL;
 
-	size_t bin = inode_id % INODE_HASH_LENGTH;
-	for ( Inode* iter = hash_inodes[bin]; iter; iter = iter->next_hashed )
-		if ( iter->inode_id == inode_id )
-			return iter->Refer(), iter;
+	if ( Inode* inode = GetCachedInode(inode_id) )
+		return inode;
 
 	uint32_t group_id = (inode_id-1) / sb->s_inodes_per_group;
 	uint32_t tabel_index = (inode_id-1) % sb->s_inodes_per_group;
@@ -189,31 +216,70 @@ Inode* Filesystem::GetInode(uint32_t inode_id)
 	Block* block = device->GetBlock(block_id);
 	if ( !block )
 		return (Inode*) NULL;
+	// Another thread may have loaded the inode while the block was read.
+	pthread_mutex_lock(&inode_cache_lock);
+	if ( Inode* inode = GetCachedInode(inode_id) )
+	{
+		pthread_mutex_unlock(&inode_cache_lock);
+		return block->Unref(), inode;
+	}
 	Inode* inode = new Inode(this, inode_id);
 	if ( !inode )
+	{
+		pthread_mutex_unlock(&inode_cache_lock);
 		return block->Unref(), (Inode*) NULL;
+	}
 	inode->data_block = block;
 	uint8_t* buf = inode->data_block->block_data + offset;
 	inode->data = (struct ext_inode*) buf;
 	inode->Prelink();
+	pthread_mutex_unlock(&inode_cache_lock);
 
 	return inode;
 }
 
-uint32_t Filesystem::AllocateBlock(BlockGroup* preferred)
+Inode* Filesystem::GetCachedInode(uint32_t inode_id)
+{
+	pthread_mutex_lock(&inode_cache_lock);
+	size_t bin = inode_id % INODE_HASH_LENGTH;
+	for ( Inode* iter = hash_inodes[bin]; iter; iter = iter->next_hashed )
+	{
+		if ( iter->inode_id == inode_id )
+		{
+			iter->Refer();
+			pthread_mutex_unlock(&inode_cache_lock);
+			return iter;
+		}
+	}
+	pthread_mutex_unlock(&inode_cache_lock);
+	return NULL;
+}
+
+uint32_t Filesystem::AllocateBlocks(uint32_t goal, uint32_t wanted,
+                                    uint32_t* count)
 {
 	if ( !device->write )
 		return errno = EROFS, 0;
 	if ( !sb->s_free_blocks_count )
 		return errno = ENOSPC, 0;
-	if ( preferred )
-		if ( uint32_t block_id = preferred->AllocateBlock() )
-			return block_id;
+	uint32_t goal_group_id = 0;
+	if ( sb->s_first_data_block <= goal && goal < num_blocks )
+		goal_group_id = (goal - sb->s_first_data_block) / sb->s_blocks_per_group;
 	// TODO: This can be made faster by maintaining a linked list of block
 	//       groups that definitely have free blocks.
-	for ( uint32_t group_id = 0; group_id < num_groups; group_id++ )
-		if ( uint32_t block_id = GetBlockGroup(group_id)->AllocateBlock() )
+	for ( uint32_t i = 0; i < num_groups; i++ )
+	{
+		uint32_t group_id = (goal_group_id + i) % num_groups;
+		BlockGroup* group = GetBlockGroup(group_id);
+		if ( !group )
+			return 0;
+		uint32_t block_id = group->AllocateBlocks(goal, wanted, count);
+		group->Unref();
+		if ( block_id )
 			return block_id;
+		if ( errno != ENOSPC )
+			return 0;
+	}
 	// TODO: This case should only be fit in the event of corruption. We should
 	//       rebuild all these values upon filesystem mount instead so we know
 	//       this can't happen. That also allows us to make the linked list
@@ -249,17 +315,29 @@ uint32_t Filesystem::AllocateInode(BlockGroup* preferred)
 }
 
 void Filesystem::FreeBlock(uint32_t block_id)
+{
+	FreeBlocks(block_id, 1);
+}
+
+void Filesystem::FreeBlocks(uint32_t block_id, uint32_t count)
 {
 	assert(device->write);
 	assert(block_id);
-	assert(block_id < num_blocks);
-	uint32_t group_id = (block_id - sb->s_first_data_block) / sb->s_blocks_per_group;
-	assert(group_id < num_groups);
-	BlockGroup* group = GetBlockGroup(group_id);
-	if ( !group )
-		return;
-	group->FreeBlock(block_id);
-	group->Unref();
+	assert(block_id < num_blocks && count <= num_blocks - block_id);
+	while ( count )
+	{
+		uint32_t group_id = (block_id - sb->s_first_data_block) / sb->s_blocks_per_group;
+		assert(group_id < num_groups);
+		BlockGroup* group = GetBlockGroup(group_id);
+		if ( !group )
+			return;
+		uint32_t group_left = group->first_block_id + group->num_blocks - block_id;
+		uint32_t amount = count < group_left ? count : group_left;
+		group->FreeBlocks(block_id, amount);
+		group->Unref();
+		block_id += amount;
+		count -= amount;
+	}
 }
 
 void Filesystem::FreeInode(uint32_t inode_id)
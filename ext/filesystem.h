@@ -33,6 +33,9 @@ public:
 	~Filesystem();
 
 public:
+	pthread_rwlock_t tree_lock;
+	pthread_mutex_t inode_cache_lock;
+	pthread_mutex_t block_groups_lock;
 	Block* sb_block;
 	struct ext_superblock* sb;
 	Device* device;
@@ -54,9 +57,11 @@ public:
 public:
 	BlockGroup* GetBlockGroup(uint32_t group_id);
 	Inode* GetInode(uint32_t inode_id);
-	uint32_t AllocateBlock(BlockGroup* preferred = NULL);
+	Inode* GetCachedInode(uint32_t inode_id);
+	uint32_t AllocateBlocks(uint32_t goal, uint32_t wanted, uint32_t* count);
 	uint32_t AllocateInode(BlockGroup* preferred = NULL);
 	void FreeBlock(uint32_t block_id);
+	void FreeBlocks(uint32_t block_id, uint32_t count);
 	void FreeInode(uint32_t inode_id);
 	void BeginWrite();
 	void FinishWrite();
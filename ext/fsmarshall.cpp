@@ -29,6 +29,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <ioleast.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -54,6 +55,10 @@
 #include "fuse.h"
 #include "inode.h"
 
+// The request being answered by this thread, echoed in the response so the
+// kernel can match it up when requests are multiplexed over a session.
+static __thread size_t request_id;
+
 bool RespondData(int chl, const void* ptr, size_t count)
 {
 	return writeall(chl, ptr, count) == count;
@@ -62,14 +67,34 @@ bool RespondData(int chl, const void* ptr, size_t count)
 bool RespondHeader(int chl, size_t type, size_t size)
 {
 	struct fsm_msg_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
 	hdr.msgtype = type;
 	hdr.msgsize = size;
+	hdr.request_id = request_id;
 	return RespondData(chl, &hdr, sizeof(hdr));
 }
 
-bool RespondMessage(int chl, size_t type, const void* ptr, size_t count)
+// The size includes the extra data sent after the response body, so the whole
+// response can be forwarded without understanding it.
+bool RespondMessage(int chl, size_t type, const void* ptr, size_t count,
+                    size_t extra = 0)
 {
-	return RespondHeader(chl, type, count) &&
+	// Send small responses with a single write.
+	struct
+	{
+		struct fsm_msg_header hdr;
+		uint8_t body[256];
+	} response;
+	if ( count <= sizeof(response.body) )
+	{
+		memset(&response.hdr, 0, sizeof(response.hdr));
+		response.hdr.msgtype = type;
+		response.hdr.msgsize = count + extra;
+		response.hdr.request_id = request_id;
+		memcpy(response.body, ptr, count);
+		return RespondData(chl, &response, sizeof(response.hdr) + count);
+	}
+	return RespondHeader(chl, type, count + extra) &&
 	       RespondData(chl, ptr, count);
 }
 
@@ -112,7 +137,7 @@ bool RespondRead(int chl, const uint8_t* buf, size_t count)
 {
 	struct fsm_resp_read body;
 	body.count = count;
-	return RespondMessage(chl, FSM_RESP_READ, &body, sizeof(body)) &&
+	return RespondMessage(chl, FSM_RESP_READ, &body, sizeof(body), count) &&
 	       RespondData(chl, buf, count);
 }
 
@@ -120,7 +145,8 @@ bool RespondReadlink(int chl, const uint8_t* buf, size_t count)
 {
 	struct fsm_resp_readlink body;
 	body.targetlen = count;
-	return RespondMessage(chl, FSM_RESP_READLINK, &body, sizeof(body)) &&
+	return RespondMessage(chl, FSM_RESP_READLINK, &body, sizeof(body),
+	                      count) &&
 	       RespondData(chl, buf, count);
 }
 
@@ -152,7 +178,8 @@ bool RespondReadDir(int chl, struct dirent* dirent)
 	body.ino = dirent->d_ino;
 	body.type = dirent->d_type;
 	body.namelen = dirent->d_namlen;
-	return RespondMessage(chl, FSM_RESP_READDIRENTS, &body, sizeof(body)) &&
+	return RespondMessage(chl, FSM_RESP_READDIRENTS, &body, sizeof(body),
+	                      dirent->d_namlen) &&
 	       RespondData(chl, dirent->d_name, dirent->d_namlen);
 }
 
@@ -160,7 +187,8 @@ bool RespondTCGetBlob(int chl, const void* data, size_t data_size)
 {
 	struct fsm_resp_tcgetblob body;
 	body.count = data_size;
-	return RespondMessage(chl, FSM_RESP_TCGETBLOB, &body, sizeof(body)) &&
+	return RespondMessage(chl, FSM_RESP_TCGETBLOB, &body, sizeof(body),
+	                      data_size) &&
 	       RespondData(chl, data, data_size);
 }
 
@@ -651,8 +679,28 @@ void HandleTCGetBlob(int chl, struct fsm_req_tcgetblob* msg, Filesystem* fs)
 	free(name);
 }
 
+static bool IsTreeModification(size_t msgtype, const void* body)
+{
+	switch ( msgtype )
+	{
+	case FSM_REQ_OPEN:
+		return ((const struct fsm_req_open*) body)->flags & O_CREAT;
+	case FSM_REQ_CHMOD:
+	case FSM_REQ_TRUNCATE:
+	case FSM_REQ_MKDIR:
+	case FSM_REQ_RMDIR:
+	case FSM_REQ_UNLINK:
+	case FSM_REQ_LINK:
+	case FSM_REQ_SYMLINK:
+	case FSM_REQ_RENAME:
+		return true;
+	}
+	return false;
+}
+
 void HandleIncomingMessage(int chl, struct fsm_msg_header* hdr, Filesystem* fs)
 {
+	request_id = hdr->request_id;
 	request_uid = hdr->uid;
 	request_gid = hdr->gid;
 	if ( (uint16_t) request_uid != request_uid ||
@@ -707,7 +755,17 @@ void HandleIncomingMessage(int chl, struct fsm_msg_header* hdr, Filesystem* fs)
 		}
 	}
 	if ( readall(chl, body, hdr->msgsize) == hdr->msgsize )
+	{
+		// Requests that change directories or the inode layout are serialized,
+		// all others run concurrently under the finer inode and block locks.
+		bool exclusive = IsTreeModification(hdr->msgtype, body);
+		if ( exclusive )
+			pthread_rwlock_wrlock(&fs->tree_lock);
+		else
+			pthread_rwlock_rdlock(&fs->tree_lock);
 		handlers[hdr->msgtype](chl, body, fs);
+		pthread_rwlock_unlock(&fs->tree_lock);
+	}
 	else
 		RespondError(chl, errno);
 	if ( sizeof(body_buffer) < hdr->msgsize )
@@ -720,6 +778,180 @@ void TerminationHandler(int)
 	should_terminate = true;
 }
 
+static const size_t CHANNEL_QUEUE_LENGTH = 256;
+static const size_t WORKER_STACK_SIZE = 256 * 1024;
+
+static pthread_mutex_t channel_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t channel_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t channel_queue_space_cond = PTHREAD_COND_INITIALIZER;
+static int channel_queue[CHANNEL_QUEUE_LENGTH];
+static size_t channel_queue_offset = 0;
+static size_t channel_queue_used = 0;
+static bool workers_should_exit = false;
+
+static void HandleChannel(int channel, Filesystem* fs)
+{
+	struct fsm_msg_header hdr;
+	size_t amount;
+	if ( (amount = readall(channel, &hdr, sizeof(hdr))) != sizeof(hdr) )
+	{
+		//warn("incomplete header: got %zi of %zu bytes", amount, sizeof(hdr));
+		errno = 0;
+		close(channel);
+		return;
+	}
+	HandleIncomingMessage(channel, &hdr, fs);
+	close(channel);
+}
+
+static void* Worker(void* ctx)
+{
+	Filesystem* fs = (Filesystem*) ctx;
+	pthread_mutex_lock(&channel_queue_lock);
+	while ( true )
+	{
+		while ( !channel_queue_used && !workers_should_exit )
+			pthread_cond_wait(&channel_queue_cond, &channel_queue_lock);
+		if ( !channel_queue_used )
+			break;
+		int channel = channel_queue[channel_queue_offset];
+		channel_queue_offset = (channel_queue_offset + 1) % CHANNEL_QUEUE_LENGTH;
+		channel_queue_used--;
+		pthread_cond_signal(&channel_queue_space_cond);
+		pthread_mutex_unlock(&channel_queue_lock);
+		HandleChannel(channel, fs);
+		pthread_mutex_lock(&channel_queue_lock);
+	}
+	pthread_mutex_unlock(&channel_queue_lock);
+	return NULL;
+}
+
+// Read the header of the next request on a session, which only ever returns
+// bytes from one request at a time.
+static bool ReadSessionHeader(int session, struct fsm_msg_header* hdr)
+{
+	uint8_t* buf = (uint8_t*) hdr;
+	size_t done = 0;
+	while ( done < sizeof(*hdr) )
+	{
+		ssize_t amount = read(session, buf + done, sizeof(*hdr) - done);
+		if ( amount < 0 && errno == EINTR && !should_terminate )
+			continue;
+		if ( amount <= 0 )
+			return false;
+		done += amount;
+	}
+	return true;
+}
+
+struct session_worker
+{
+	pthread_t thread;
+	int session;
+	Filesystem* fs;
+};
+
+static void* SessionWorker(void* ctx)
+{
+	struct session_worker* worker = (struct session_worker*) ctx;
+	struct fsm_msg_header hdr;
+	while ( ReadSessionHeader(worker->session, &hdr) )
+		HandleIncomingMessage(worker->session, &hdr, worker->fs);
+	return NULL;
+}
+
+static void QueueChannel(int channel)
+{
+	pthread_mutex_lock(&channel_queue_lock);
+	while ( channel_queue_used == CHANNEL_QUEUE_LENGTH )
+		pthread_cond_wait(&channel_queue_space_cond, &channel_queue_lock);
+	size_t index = (channel_queue_offset + channel_queue_used++) %
+	               CHANNEL_QUEUE_LENGTH;
+	channel_queue[index] = channel;
+	pthread_cond_signal(&channel_queue_cond);
+	pthread_mutex_unlock(&channel_queue_lock);
+}
+
+static int fsmarshall_shutdown(int serverfd, Filesystem* fs, Device* dev);
+
+static int fsmarshall_multiplexed(int serverfd, Filesystem* fs, Device* dev)
+{
+	// Each worker answers the requests on its own session. The main thread is
+	// a worker as well and the only one handling the termination signals, so
+	// the other workers are stopped by shutting down their sessions.
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t num_workers = 2 * (size_t) (cpus < 1 ? 1 : cpus);
+	if ( 64 < num_workers )
+		num_workers = 64;
+	int main_session = accept4(serverfd, NULL, NULL, SOCK_CLOEXEC);
+	if ( main_session < 0 )
+		err(1, "accept4");
+	struct session_worker* workers = new struct session_worker[num_workers - 1];
+	sigset_t termination_signals, old_signals;
+	sigemptyset(&termination_signals);
+	sigaddset(&termination_signals, SIGINT);
+	sigaddset(&termination_signals, SIGTERM);
+	sigaddset(&termination_signals, SIGQUIT);
+	pthread_sigmask(SIG_BLOCK, &termination_signals, &old_signals);
+	pthread_attr_t worker_attr;
+	pthread_attr_init(&worker_attr);
+	pthread_attr_setstacksize(&worker_attr, WORKER_STACK_SIZE);
+	size_t workers_spawned = 0;
+	while ( workers_spawned < num_workers - 1 )
+	{
+		struct session_worker* worker = &workers[workers_spawned];
+		worker->fs = fs;
+		worker->session = accept4(serverfd, NULL, NULL, SOCK_CLOEXEC);
+		if ( worker->session < 0 )
+			break;
+		if ( pthread_create(&worker->thread, &worker_attr, SessionWorker,
+		                    worker) )
+		{
+			close(worker->session);
+			break;
+		}
+		workers_spawned++;
+	}
+	pthread_attr_destroy(&worker_attr);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	// Answer requests and sync the filesystem every few seconds.
+	struct timespec last_sync_at;
+	clock_gettime(CLOCK_MONOTONIC, &last_sync_at);
+	struct fsm_msg_header hdr;
+	while ( !should_terminate && ReadSessionHeader(main_session, &hdr) )
+	{
+		HandleIncomingMessage(main_session, &hdr, fs);
+
+		if ( dev->write && !dev->has_sync_thread )
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			if ( 5 <= timespec_sub(now, last_sync_at).tv_sec )
+			{
+				pthread_rwlock_rdlock(&fs->tree_lock);
+				fs->Sync();
+				pthread_rwlock_unlock(&fs->tree_lock);
+				last_sync_at = now;
+			}
+		}
+	}
+
+	// Let the workers finish their current requests and stop.
+	for ( size_t i = 0; i < workers_spawned; i++ )
+		shutdown(workers[i].session, SHUT_RD);
+	for ( size_t i = 0; i < workers_spawned; i++ )
+	{
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].session);
+	}
+	delete[] workers;
+	close(main_session);
+
+	return fsmarshall_shutdown(serverfd, fs, dev);
+}
+
 static void ready(void)
 {
 	const char* readyfd_env = getenv("READYFD");
@@ -748,8 +980,18 @@ int fsmarshall_main(const char* argv0,
 	StatInode(root_inode, &root_inode_st);
 	root_inode->Unref();
 
-	// Create a filesystem server connected to the kernel that we'll listen on.
-	int serverfd = fsm_mountat(AT_FDCWD, mount_path, &root_inode_st, 0);
+	// Create a filesystem server connected to the kernel that we'll listen on,
+	// preferably with requests multiplexed over persistent sessions rather than
+	// a new channel per request. The files only change through the mount, so
+	// the kernel may cache their contents.
+	bool multiplexed = true;
+	int serverfd = fsm_mountat(AT_FDCWD, mount_path, &root_inode_st,
+	                           FSM_MOUNT_MULTIPLEX | FSM_MOUNT_CACHE);
+	if ( serverfd < 0 && errno == EINVAL )
+	{
+		multiplexed = false;
+		serverfd = fsm_mountat(AT_FDCWD, mount_path, &root_inode_st, 0);
+	}
 	if ( serverfd < 0 )
 		err(1, "%s", mount_path);
 
@@ -773,6 +1015,26 @@ int fsmarshall_main(const char* argv0,
 
 	dev->SpawnSyncThread();
 
+	if ( multiplexed )
+		return fsmarshall_multiplexed(serverfd, fs, dev);
+
+	// Serve channels from a pool of worker threads, so a request waiting for
+	// the disk doesn't hold up the requests that can be answered from cache.
+	// There are more workers than processors as most of them block on I/O.
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t num_workers = 2 * (size_t) (cpus < 1 ? 1 : cpus);
+	if ( 64 < num_workers )
+		num_workers = 64;
+	pthread_t* workers = new pthread_t[num_workers];
+	pthread_attr_t worker_attr;
+	pthread_attr_init(&worker_attr);
+	pthread_attr_setstacksize(&worker_attr, WORKER_STACK_SIZE);
+	size_t workers_spawned = 0;
+	while ( workers_spawned < num_workers &&
+	        !pthread_create(&workers[workers_spawned], &worker_attr, Worker, fs) )
+		workers_spawned++;
+	pthread_attr_destroy(&worker_attr);
+
 	// Listen for filesystem messages and sync the filesystem every few seconds.
 	struct timespec last_sync_at;
 	clock_gettime(CLOCK_MONOTONIC, &last_sync_at);
@@ -780,17 +1042,14 @@ int fsmarshall_main(const char* argv0,
 	while ( 0 <= (channel = accept(serverfd, NULL, NULL)) )
 	{
 		if ( should_terminate )
-			break;
-		struct fsm_msg_header hdr;
-		size_t amount;
-		if ( (amount = readall(channel, &hdr, sizeof(hdr))) != sizeof(hdr) )
 		{
-			//warn("incomplete header: got %zi of %zu bytes", amount, sizeof(hdr));
-			errno = 0;
-			continue;
+			close(channel);
+			break;
 		}
-		HandleIncomingMessage(channel, &hdr, fs);
-		close(channel);
+		if ( workers_spawned )
+			QueueChannel(channel);
+		else
+			HandleChannel(channel, fs);
 
 		if ( dev->write && !dev->has_sync_thread )
 		{
@@ -799,12 +1058,28 @@ int fsmarshall_main(const char* argv0,
 
 			if ( 5 <= timespec_sub(now, last_sync_at).tv_sec )
 			{
+				pthread_rwlock_rdlock(&fs->tree_lock);
 				fs->Sync();
+				pthread_rwlock_unlock(&fs->tree_lock);
 				last_sync_at = now;
 			}
 		}
 	}
 
+	// Finish the queued requests and stop the workers.
+	pthread_mutex_lock(&channel_queue_lock);
+	workers_should_exit = true;
+	pthread_cond_broadcast(&channel_queue_cond);
+	pthread_mutex_unlock(&channel_queue_lock);
+	for ( size_t i = 0; i < workers_spawned; i++ )
+		pthread_join(workers[i], NULL);
+	delete[] workers;
+
+	return fsmarshall_shutdown(serverfd, fs, dev);
+}
+
+static int fsmarshall_shutdown(int serverfd, Filesystem* fs, Device* dev)
+{
 	// Garbage collect all open inode references.
 	while ( fs->mru_inode )
 	{
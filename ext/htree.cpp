@@ -0,0 +1,818 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * htree.cpp
+ * Hashed directory indexes.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ext-constants.h"
+#include "ext-structs.h"
+
+#include "block.h"
+#include "device.h"
+#include "filesystem.h"
+#include "htree.h"
+#include "inode.h"
+#include "util.h"
+
+// Indexed directories are compatible with the linear format. The first block
+// holds the "." and ".." entries, where ".." spans the rest of the block and
+// hides the root of the index, and the interior index nodes look like blocks
+// with a single unused entry. The index maps ranges of name hashes to the leaf
+// blocks that contain the names with those hashes. A leaf whose starting hash
+// has the low bit set continues the range of hash collisions in the previous
+// leaf.
+
+static const uint8_t HTREE_MAX_LEVELS = 2;
+static const uint32_t HTREE_BLOCK_MASK = 0x0FFFFFFF;
+static const uint32_t HTREE_ROOT_INFO_OFFSET = 24;
+static const uint32_t HTREE_ROOT_ENTRIES_OFFSET = 32;
+static const uint32_t HTREE_NODE_ENTRIES_OFFSET = 8;
+static const uint32_t HTREE_EOF = 0x7FFFFFFF;
+static const size_t HTREE_MAX_SPLITS = 16;
+
+struct htree_frame
+{
+	Block* block;
+	struct ext_dx_entry* entries;
+	struct ext_dx_entry* at;
+};
+
+struct htree_map_entry
+{
+	uint32_t hash;
+	uint32_t offset;
+	uint32_t size;
+};
+
+static uint32_t RotateLeft(uint32_t value, int amount)
+{
+	return value << amount | value >> (32 - amount);
+}
+
+static void TEATransform(uint32_t buf[4], const uint32_t in[4])
+{
+	uint32_t sum = 0;
+	uint32_t b0 = buf[0];
+	uint32_t b1 = buf[1];
+	for ( int n = 0; n < 16; n++ )
+	{
+		sum += 0x9E3779B9;
+		b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+		b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+	}
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + (x), a = RotateLeft(a, s))
+
+static void HalfMD4Transform(uint32_t buf[4], const uint32_t in[8])
+{
+	const uint32_t K2 = 0x5A827999;
+	const uint32_t K3 = 0x6ED9EBA1;
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	ROUND(F, a, b, c, d, in[0], 3);
+	ROUND(F, d, a, b, c, in[1], 7);
+	ROUND(F, c, d, a, b, in[2], 11);
+	ROUND(F, b, c, d, a, in[3], 19);
+	ROUND(F, a, b, c, d, in[4], 3);
+	ROUND(F, d, a, b, c, in[5], 7);
+	ROUND(F, c, d, a, b, in[6], 11);
+	ROUND(F, b, c, d, a, in[7], 19);
+
+	ROUND(G, a, b, c, d, in[1] + K2, 3);
+	ROUND(G, d, a, b, c, in[3] + K2, 5);
+	ROUND(G, c, d, a, b, in[5] + K2, 9);
+	ROUND(G, b, c, d, a, in[7] + K2, 13);
+	ROUND(G, a, b, c, d, in[0] + K2, 3);
+	ROUND(G, d, a, b, c, in[2] + K2, 5);
+	ROUND(G, c, d, a, b, in[4] + K2, 9);
+	ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+	ROUND(H, a, b, c, d, in[3] + K3, 3);
+	ROUND(H, d, a, b, c, in[7] + K3, 9);
+	ROUND(H, c, d, a, b, in[2] + K3, 11);
+	ROUND(H, b, c, d, a, in[6] + K3, 15);
+	ROUND(H, a, b, c, d, in[1] + K3, 3);
+	ROUND(H, d, a, b, c, in[5] + K3, 9);
+	ROUND(H, c, d, a, b, in[0] + K3, 11);
+	ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+#undef F
+#undef G
+#undef H
+#undef ROUND
+
+static int HashChar(const char* name, size_t i, bool is_unsigned)
+{
+	if ( is_unsigned )
+		return (int) (unsigned char) name[i];
+	return (int) (signed char) name[i];
+}
+
+static uint32_t LegacyHash(const char* name, size_t length, bool is_unsigned)
+{
+	uint32_t hash;
+	uint32_t hash0 = 0x12A3FE2D;
+	uint32_t hash1 = 0x37ABE8F9;
+	for ( size_t i = 0; i < length; i++ )
+	{
+		int c = HashChar(name, i, is_unsigned);
+		hash = hash1 + (hash0 ^ (uint32_t) (c * 7152373));
+		if ( hash & 0x80000000 )
+			hash -= 0x7FFFFFFF;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+static void StringToHashBuffer(const char* name, size_t length, uint32_t* buf,
+                               int num, bool is_unsigned)
+{
+	uint32_t pad = (uint32_t) length | ((uint32_t) length << 8);
+	pad |= pad << 16;
+	uint32_t value = pad;
+	if ( (size_t) num * 4 < length )
+		length = num * 4;
+	for ( size_t i = 0; i < length; i++ )
+	{
+		value = (uint32_t) HashChar(name, i, is_unsigned) + (value << 8);
+		if ( i % 4 == 3 )
+		{
+			*buf++ = value;
+			value = pad;
+			num--;
+		}
+	}
+	if ( 0 <= --num )
+		*buf++ = value;
+	while ( 0 <= --num )
+		*buf++ = pad;
+}
+
+uint32_t DirectoryHash(const char* name, size_t length, uint8_t version,
+                       const uint32_t* seed)
+{
+	uint32_t buf[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+	if ( seed && (seed[0] || seed[1] || seed[2] || seed[3]) )
+		memcpy(buf, seed, sizeof(buf));
+	uint32_t in[8];
+	uint32_t hash = 0;
+	bool is_unsigned = EXT2_HASH_LEGACY_UNSIGNED <= version;
+	switch ( version )
+	{
+	case EXT2_HASH_LEGACY:
+	case EXT2_HASH_LEGACY_UNSIGNED:
+		hash = LegacyHash(name, length, is_unsigned);
+		break;
+	case EXT2_HASH_HALF_MD4:
+	case EXT2_HASH_HALF_MD4_UNSIGNED:
+		for ( size_t i = 0; i < length; i += 32 )
+		{
+			StringToHashBuffer(name + i, length - i, in, 8, is_unsigned);
+			HalfMD4Transform(buf, in);
+		}
+		hash = buf[1];
+		break;
+	case EXT2_HASH_TEA:
+	case EXT2_HASH_TEA_UNSIGNED:
+		for ( size_t i = 0; i < length; i += 16 )
+		{
+			StringToHashBuffer(name + i, length - i, in, 4, is_unsigned);
+			TEATransform(buf, in);
+		}
+		hash = buf[0];
+		break;
+	}
+	// The low bit marks hash collisions continuing in the next leaf and the
+	// largest hash is reserved as the end of directory marker.
+	hash &= ~1U;
+	if ( hash == HTREE_EOF << 1 )
+		hash = (HTREE_EOF - 1) << 1;
+	return hash;
+}
+
+static struct ext_dx_countlimit* CountLimit(struct ext_dx_entry* entries)
+{
+	return (struct ext_dx_countlimit*) entries;
+}
+
+static void ReleaseFrames(struct htree_frame* frames, size_t levels)
+{
+	for ( size_t i = 0; i < levels; i++ )
+	{
+		if ( frames[i].block )
+			frames[i].block->Unref();
+		frames[i].block = NULL;
+	}
+}
+
+static bool IsValidRoot(const uint8_t* block_data, uint32_t block_size)
+{
+	const struct ext_dirent* dot = (const struct ext_dirent*) block_data;
+	const struct ext_dirent* dotdot =
+		(const struct ext_dirent*) (block_data + 12);
+	const struct ext_dx_root_info* info = (const struct ext_dx_root_info*)
+		(block_data + HTREE_ROOT_INFO_OFFSET);
+	const struct ext_dx_countlimit* countlimit =
+		(const struct ext_dx_countlimit*)
+		(block_data + HTREE_ROOT_ENTRIES_OFFSET);
+	uint32_t limit = (block_size - HTREE_ROOT_ENTRIES_OFFSET) /
+	                 sizeof(struct ext_dx_entry);
+	return dot->reclen == 12 &&
+	       dot->name_len == 1 && dot->name[0] == '.' &&
+	       dotdot->reclen == block_size - 12 &&
+	       dotdot->name_len == 2 &&
+	       !info->reserved_zero &&
+	       info->info_length == sizeof(struct ext_dx_root_info) &&
+	       info->indirect_levels < HTREE_MAX_LEVELS &&
+	       info->hash_version <= EXT2_HASH_TEA &&
+	       countlimit->limit == limit &&
+	       1 <= countlimit->count && countlimit->count <= limit;
+}
+
+static bool IsValidNode(const uint8_t* block_data, uint32_t block_size)
+{
+	const struct ext_dirent* fake = (const struct ext_dirent*) block_data;
+	const struct ext_dx_countlimit* countlimit =
+		(const struct ext_dx_countlimit*)
+		(block_data + HTREE_NODE_ENTRIES_OFFSET);
+	uint32_t limit = (block_size - HTREE_NODE_ENTRIES_OFFSET) /
+	                 sizeof(struct ext_dx_entry);
+	return !fake->inode && fake->reclen == block_size &&
+	       countlimit->limit == limit &&
+	       1 <= countlimit->count && countlimit->count <= limit;
+}
+
+static uint8_t HashVersion(Filesystem* fs, const uint8_t* root_data)
+{
+	const struct ext_dx_root_info* info = (const struct ext_dx_root_info*)
+		(root_data + HTREE_ROOT_INFO_OFFSET);
+	uint8_t version = info->hash_version;
+	if ( fs->sb->s_flags & EXT2_FLAGS_UNSIGNED_HASH )
+		version += EXT2_HASH_LEGACY_UNSIGNED;
+	return version;
+}
+
+static uint32_t EntryBlock(const struct ext_dx_entry* entry)
+{
+	return entry->block & HTREE_BLOCK_MASK;
+}
+
+// Walk the index from the root down to the leaf whose hash range contains the
+// hash, recording the path in the frames.
+static bool Probe(Inode* dir, uint32_t hash, struct htree_frame* frames,
+                  size_t* levels_ptr)
+{
+	uint32_t block_size = dir->filesystem->block_size;
+	uint64_t num_blocks = dir->Size() / block_size;
+	for ( size_t i = 0; i < HTREE_MAX_LEVELS; i++ )
+		frames[i].block = NULL;
+	Block* block = dir->GetBlock(0);
+	if ( !block )
+		return false;
+	if ( !IsValidRoot(block->block_data, block_size) )
+		return block->Unref(), errno = EIO, false;
+	const struct ext_dx_root_info* info = (const struct ext_dx_root_info*)
+		(block->block_data + HTREE_ROOT_INFO_OFFSET);
+	size_t levels = info->indirect_levels + 1;
+	struct ext_dx_entry* entries = (struct ext_dx_entry*)
+		(block->block_data + HTREE_ROOT_ENTRIES_OFFSET);
+	for ( size_t level = 0; true; level++ )
+	{
+		// Find the last entry whose hash is at most the hash, where the first
+		// entry implicitly has the hash zero.
+		size_t count = CountLimit(entries)->count;
+		size_t low = 1;
+		size_t high = count;
+		while ( low < high )
+		{
+			size_t middle = low + (high - low) / 2;
+			if ( hash < entries[middle].hash )
+				high = middle;
+			else
+				low = middle + 1;
+		}
+		frames[level].block = block;
+		frames[level].entries = entries;
+		frames[level].at = entries + low - 1;
+		uint32_t child = EntryBlock(frames[level].at);
+		if ( !child || num_blocks <= child )
+			return ReleaseFrames(frames, level + 1), errno = EIO, false;
+		if ( level + 1 == levels )
+			break;
+		if ( !(block = dir->GetBlock(child)) )
+			return ReleaseFrames(frames, level + 1), false;
+		if ( !IsValidNode(block->block_data, block_size) )
+		{
+			block->Unref();
+			return ReleaseFrames(frames, level + 1), errno = EIO, false;
+		}
+		entries = (struct ext_dx_entry*)
+			(block->block_data + HTREE_NODE_ENTRIES_OFFSET);
+	}
+	*levels_ptr = levels;
+	return true;
+}
+
+// Advance the frames to the next leaf if it continues the hash collisions of
+// the current leaf.
+static bool NextLeaf(Inode* dir, uint32_t hash, struct htree_frame* frames,
+                     size_t levels)
+{
+	uint32_t block_size = dir->filesystem->block_size;
+	size_t level = levels - 1;
+	while ( true )
+	{
+		struct htree_frame* frame = &frames[level];
+		if ( frame->at + 1 < frame->entries + CountLimit(frame->entries)->count )
+		{
+			frame->at++;
+			break;
+		}
+		if ( level == 0 )
+			return false;
+		level--;
+	}
+	if ( (frames[level].at->hash & ~1U) != hash )
+		return false;
+	while ( ++level < levels )
+	{
+		Block* block = dir->GetBlock(EntryBlock(frames[level - 1].at));
+		if ( !block )
+			return false;
+		if ( !IsValidNode(block->block_data, block_size) )
+			return block->Unref(), errno = EIO, false;
+		frames[level].block->Unref();
+		frames[level].block = block;
+		frames[level].entries = (struct ext_dx_entry*)
+			(block->block_data + HTREE_NODE_ENTRIES_OFFSET);
+		frames[level].at = frames[level].entries;
+	}
+	return true;
+}
+
+static bool SearchLeaf(Block* block, uint32_t block_size, const char* elem,
+                       size_t elem_length, uint32_t* entry_offset)
+{
+	uint32_t offset = 0;
+	while ( offset + sizeof(struct ext_dirent) <= block_size )
+	{
+		const struct ext_dirent* entry =
+			(const struct ext_dirent*) (block->block_data + offset);
+		if ( entry->reclen < sizeof(struct ext_dirent) ||
+		     block_size - offset < entry->reclen )
+			return false;
+		if ( entry->inode &&
+		     entry->name_len == elem_length &&
+		     memcmp(elem, entry->name, elem_length) == 0 )
+			return *entry_offset = offset, true;
+		offset += entry->reclen;
+	}
+	return false;
+}
+
+// Store the entry in a hole in the leaf, either an unused entry or the slack
+// at the end of an entry, returning false if there is no room.
+static bool InsertInLeaf(Filesystem* fs, Block* block, const char* elem,
+                         size_t elem_length, Inode* dest)
+{
+	uint32_t block_size = fs->block_size;
+	size_t new_entry_size =
+		roundup(sizeof(struct ext_dirent) + elem_length, (size_t) 4);
+	struct ext_dirent* target = NULL;
+	uint32_t offset = 0;
+	while ( !target && offset + sizeof(struct ext_dirent) <= block_size )
+	{
+		struct ext_dirent* entry =
+			(struct ext_dirent*) (block->block_data + offset);
+		if ( entry->reclen < sizeof(struct ext_dirent) ||
+		     block_size - offset < entry->reclen )
+			return false;
+		size_t entry_size =
+			roundup(sizeof(struct ext_dirent) + entry->name_len, (size_t) 4);
+		if ( !entry->inode && new_entry_size <= entry->reclen )
+		{
+			block->BeginWrite();
+			target = entry;
+		}
+		else if ( entry->inode && entry_size <= entry->reclen &&
+		          new_entry_size <= entry->reclen - entry_size )
+		{
+			block->BeginWrite();
+			uint16_t reclen = entry->reclen;
+			entry->reclen = entry_size;
+			target = (struct ext_dirent*) ((uint8_t*) entry + entry_size);
+			target->reclen = reclen - entry_size;
+		}
+		offset += entry->reclen;
+	}
+	if ( !target )
+		return false;
+	target->inode = dest->inode_id;
+	target->name_len = elem_length;
+	if ( fs->sb->s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE )
+		target->file_type = EXT2_FT_OF_MODE(dest->Mode());
+	else
+		target->file_type = EXT2_FT_UNKNOWN;
+	memcpy(target->name, elem, elem_length);
+	block->FinishWrite();
+	return true;
+}
+
+static int CompareMapEntries(const void* a_ptr, const void* b_ptr)
+{
+	const struct htree_map_entry* a = (const struct htree_map_entry*) a_ptr;
+	const struct htree_map_entry* b = (const struct htree_map_entry*) b_ptr;
+	if ( a->hash < b->hash )
+		return -1;
+	if ( a->hash > b->hash )
+		return 1;
+	return a->offset < b->offset ? -1 : a->offset > b->offset ? 1 : 0;
+}
+
+static void PackEntries(uint8_t* dst, const uint8_t* src,
+                        const struct htree_map_entry* map, size_t count,
+                        uint32_t block_size)
+{
+	memset(dst, 0, block_size);
+	struct ext_dirent* last = (struct ext_dirent*) dst;
+	uint32_t offset = 0;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		last = (struct ext_dirent*) (dst + offset);
+		memcpy(last, src + map[i].offset, map[i].size);
+		last->reclen = map[i].size;
+		offset += map[i].size;
+	}
+	last->reclen = block_size - ((uint8_t*) last - dst);
+}
+
+static Block* AppendBlock(Inode* dir, uint32_t* block_id_ptr)
+{
+	uint32_t block_size = dir->filesystem->block_size;
+	uint64_t block_id = dir->Size() / block_size;
+	if ( HTREE_BLOCK_MASK < block_id )
+		return errno = ENOSPC, (Block*) NULL;
+	Block* block = dir->GetBlock(block_id);
+	if ( !block )
+		return NULL;
+	dir->SetSize(dir->Size() + block_size);
+	return *block_id_ptr = block_id, block;
+}
+
+static void InsertIndexEntry(struct htree_frame* frame, uint32_t hash,
+                             uint32_t block_id)
+{
+	struct ext_dx_countlimit* countlimit = CountLimit(frame->entries);
+	struct ext_dx_entry* end = frame->entries + countlimit->count;
+	struct ext_dx_entry* new_entry = frame->at + 1;
+	frame->block->BeginWrite();
+	memmove(new_entry + 1, new_entry, (end - new_entry) * sizeof(*end));
+	new_entry->hash = hash;
+	new_entry->block = block_id;
+	countlimit->count++;
+	frame->block->FinishWrite();
+}
+
+// Split the leaf in the middle by size and move the entries with the larger
+// hashes into a new leaf.
+static bool SplitLeaf(Inode* dir, Block* leaf, struct htree_frame* frame,
+                      uint8_t version)
+{
+	Filesystem* fs = dir->filesystem;
+	uint32_t block_size = fs->block_size;
+	size_t map_length = block_size / 12;
+	struct htree_map_entry* map = (struct htree_map_entry*)
+		malloc(sizeof(struct htree_map_entry) * map_length);
+	uint8_t* copy = (uint8_t*) malloc(block_size);
+	if ( !map || !copy )
+		return free(map), free(copy), false;
+	memcpy(copy, leaf->block_data, block_size);
+	size_t count = 0;
+	uint32_t offset = 0;
+	while ( offset + sizeof(struct ext_dirent) <= block_size )
+	{
+		const struct ext_dirent* entry =
+			(const struct ext_dirent*) (copy + offset);
+		if ( entry->reclen < sizeof(struct ext_dirent) ||
+		     block_size - offset < entry->reclen )
+			return free(map), free(copy), errno = EIO, false;
+		if ( entry->inode && entry->name_len && count < map_length )
+		{
+			map[count].hash = DirectoryHash(entry->name, entry->name_len,
+			                                version, fs->sb->s_hash_seed);
+			map[count].offset = offset;
+			map[count].size = roundup(sizeof(struct ext_dirent) +
+			                          entry->name_len, (size_t) 4);
+			count++;
+		}
+		offset += entry->reclen;
+	}
+	if ( count < 2 )
+		return free(map), free(copy), errno = ENOSPC, false;
+	qsort(map, count, sizeof(struct htree_map_entry), CompareMapEntries);
+	size_t move = 0;
+	size_t moved_size = 0;
+	for ( size_t i = count; 1 < i; i-- )
+	{
+		if ( block_size / 2 < moved_size + map[i - 1].size / 2 )
+			break;
+		moved_size += map[i - 1].size;
+		move++;
+	}
+	if ( !move )
+		move = 1;
+	size_t split = count - move;
+	uint32_t split_hash = map[split].hash;
+	if ( split_hash == map[split - 1].hash )
+		split_hash |= 1;
+	uint32_t new_block_id;
+	Block* new_block = AppendBlock(dir, &new_block_id);
+	if ( !new_block )
+		return free(map), free(copy), false;
+	new_block->BeginWrite();
+	PackEntries(new_block->block_data, copy, map + split, move, block_size);
+	new_block->FinishWrite();
+	new_block->Unref();
+	leaf->BeginWrite();
+	PackEntries(leaf->block_data, copy, map, split, block_size);
+	leaf->FinishWrite();
+	free(map);
+	free(copy);
+	InsertIndexEntry(frame, split_hash, new_block_id);
+	return true;
+}
+
+// Make room in a full index node by moving its upper half into a new node, or
+// by moving all the root entries into a new node below the root.
+static bool SplitIndex(Inode* dir, struct htree_frame* frames, size_t level)
+{
+	uint32_t block_size = dir->filesystem->block_size;
+	uint32_t node_limit = (block_size - HTREE_NODE_ENTRIES_OFFSET) /
+	                      sizeof(struct ext_dx_entry);
+	struct htree_frame* frame = &frames[level];
+	struct ext_dx_countlimit* countlimit = CountLimit(frame->entries);
+	if ( level == 0 )
+	{
+		struct ext_dx_root_info* info = (struct ext_dx_root_info*)
+			(frame->block->block_data + HTREE_ROOT_INFO_OFFSET);
+		if ( HTREE_MAX_LEVELS <= info->indirect_levels + 1 )
+			return errno = ENOSPC, false;
+		uint32_t node_id;
+		Block* node = AppendBlock(dir, &node_id);
+		if ( !node )
+			return false;
+		node->BeginWrite();
+		memset(node->block_data, 0, block_size);
+		struct ext_dirent* fake = (struct ext_dirent*) node->block_data;
+		fake->reclen = block_size;
+		struct ext_dx_entry* node_entries = (struct ext_dx_entry*)
+			(node->block_data + HTREE_NODE_ENTRIES_OFFSET);
+		memcpy(node_entries, frame->entries,
+		       countlimit->count * sizeof(struct ext_dx_entry));
+		CountLimit(node_entries)->limit = node_limit;
+		node->FinishWrite();
+		node->Unref();
+		frame->block->BeginWrite();
+		countlimit->count = 1;
+		frame->entries[0].block = node_id;
+		info->indirect_levels++;
+		frame->block->FinishWrite();
+		return true;
+	}
+	struct htree_frame* parent = &frames[level - 1];
+	if ( CountLimit(parent->entries)->count == CountLimit(parent->entries)->limit )
+		return errno = ENOSPC, false;
+	uint32_t node_id;
+	Block* node = AppendBlock(dir, &node_id);
+	if ( !node )
+		return false;
+	size_t keep = countlimit->count / 2;
+	size_t move = countlimit->count - keep;
+	uint32_t split_hash = frame->entries[keep].hash;
+	node->BeginWrite();
+	memset(node->block_data, 0, block_size);
+	struct ext_dirent* fake = (struct ext_dirent*) node->block_data;
+	fake->reclen = block_size;
+	struct ext_dx_entry* node_entries = (struct ext_dx_entry*)
+		(node->block_data + HTREE_NODE_ENTRIES_OFFSET);
+	memcpy(node_entries, frame->entries + keep,
+	       move * sizeof(struct ext_dx_entry));
+	CountLimit(node_entries)->limit = node_limit;
+	CountLimit(node_entries)->count = move;
+	node->FinishWrite();
+	node->Unref();
+	frame->block->BeginWrite();
+	countlimit->count = keep;
+	frame->block->FinishWrite();
+	InsertIndexEntry(parent, split_hash, node_id);
+	return true;
+}
+
+bool Inode::IsIndexed()
+{
+	if ( !(data->i_flags & EXT2_INDEX_FL) ||
+	     !(filesystem->sb->s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) ||
+	     Size() < 2 * filesystem->block_size )
+		return false;
+	Block* block = GetBlock(0);
+	if ( !block )
+		return false;
+	bool valid = IsValidRoot(block->block_data, filesystem->block_size);
+	block->Unref();
+	return valid;
+}
+
+void Inode::DropIndex()
+{
+	// The directory remains valid in the linear format.
+	BeginWrite();
+	data->i_flags &= ~EXT2_INDEX_FL;
+	FinishWrite();
+}
+
+Block* Inode::IndexFind(const char* elem, size_t elem_length,
+                        uint64_t* block_id, uint32_t* entry_offset)
+{
+	struct htree_frame frames[HTREE_MAX_LEVELS];
+	size_t levels;
+	Block* root = GetBlock(0);
+	if ( !root )
+		return NULL;
+	uint8_t version = HashVersion(filesystem, root->block_data);
+	root->Unref();
+	uint32_t hash = DirectoryHash(elem, elem_length, version,
+	                              filesystem->sb->s_hash_seed);
+	if ( !Probe(this, hash, frames, &levels) )
+		return NULL;
+	do
+	{
+		uint32_t leaf_id = EntryBlock(frames[levels - 1].at);
+		Block* leaf = GetBlock(leaf_id);
+		if ( !leaf )
+			return ReleaseFrames(frames, levels), (Block*) NULL;
+		if ( SearchLeaf(leaf, filesystem->block_size, elem, elem_length,
+		                entry_offset) )
+		{
+			ReleaseFrames(frames, levels);
+			return *block_id = leaf_id, leaf;
+		}
+		leaf->Unref();
+		errno = ENOENT;
+	} while ( NextLeaf(this, hash, frames, levels) );
+	ReleaseFrames(frames, levels);
+	return NULL;
+}
+
+bool Inode::IndexLink(const char* elem, size_t elem_length, Inode* dest)
+{
+	struct htree_frame frames[HTREE_MAX_LEVELS];
+	size_t levels;
+	Block* root = GetBlock(0);
+	if ( !root )
+		return false;
+	uint8_t version = HashVersion(filesystem, root->block_data);
+	root->Unref();
+	uint32_t hash = DirectoryHash(elem, elem_length, version,
+	                              filesystem->sb->s_hash_seed);
+	// Each split makes room in the leaf or an index node on the path, so the
+	// entry fits after a few attempts unless the index is full.
+	for ( size_t attempt = 0; attempt < HTREE_MAX_SPLITS; attempt++ )
+	{
+		if ( !Probe(this, hash, frames, &levels) )
+			return false;
+		struct htree_frame* frame = &frames[levels - 1];
+		Block* leaf = GetBlock(EntryBlock(frame->at));
+		if ( !leaf )
+			return ReleaseFrames(frames, levels), false;
+		if ( InsertInLeaf(filesystem, leaf, elem, elem_length, dest) )
+		{
+			leaf->Unref();
+			ReleaseFrames(frames, levels);
+			return true;
+		}
+		bool success;
+		struct ext_dx_countlimit* countlimit = CountLimit(frame->entries);
+		if ( countlimit->count < countlimit->limit )
+			success = SplitLeaf(this, leaf, frame, version);
+		else
+			success = SplitIndex(this, frames, levels - 1);
+		leaf->Unref();
+		ReleaseFrames(frames, levels);
+		if ( !success )
+			return false;
+	}
+	return errno = ENOSPC, false;
+}
+
+// Convert a directory consisting of a single full block into an indexed
+// directory, moving the entries after ".." into the first leaf.
+bool Inode::CreateIndex()
+{
+	uint32_t block_size = filesystem->block_size;
+	if ( Size() != block_size )
+		return errno = EINVAL, false;
+	Block* root = GetBlock(0);
+	if ( !root )
+		return false;
+	const struct ext_dirent* dot = (const struct ext_dirent*) root->block_data;
+	const struct ext_dirent* dotdot =
+		(const struct ext_dirent*) (root->block_data + 12);
+	if ( dot->reclen != 12 || dot->name_len != 1 || dot->name[0] != '.' ||
+	     dotdot->name_len != 2 || dotdot->name[0] != '.' ||
+	     dotdot->name[1] != '.' || dotdot->reclen < 12 ||
+	     block_size - 12 < dotdot->reclen )
+		return root->Unref(), errno = EINVAL, false;
+	size_t map_length = block_size / 12;
+	struct htree_map_entry* map = (struct htree_map_entry*)
+		malloc(sizeof(struct htree_map_entry) * map_length);
+	if ( !map )
+		return root->Unref(), false;
+	size_t count = 0;
+	uint32_t offset = 12 + dotdot->reclen;
+	while ( offset + sizeof(struct ext_dirent) <= block_size )
+	{
+		const struct ext_dirent* entry =
+			(const struct ext_dirent*) (root->block_data + offset);
+		if ( entry->reclen < sizeof(struct ext_dirent) ||
+		     block_size - offset < entry->reclen )
+			return free(map), root->Unref(), errno = EIO, false;
+		if ( entry->inode && entry->name_len && count < map_length )
+		{
+			map[count].hash = 0;
+			map[count].offset = offset;
+			map[count].size = roundup(sizeof(struct ext_dirent) +
+			                          entry->name_len, (size_t) 4);
+			count++;
+		}
+		offset += entry->reclen;
+	}
+	uint32_t leaf_id;
+	Block* leaf = AppendBlock(this, &leaf_id);
+	if ( !leaf )
+		return free(map), root->Unref(), false;
+	leaf->BeginWrite();
+	PackEntries(leaf->block_data, root->block_data, map, count, block_size);
+	leaf->FinishWrite();
+	leaf->Unref();
+	free(map);
+	uint8_t version = filesystem->sb->s_def_hash_version;
+	if ( EXT2_HASH_TEA < version )
+		version = EXT2_HASH_HALF_MD4;
+	root->BeginWrite();
+	struct ext_dirent* root_dotdot =
+		(struct ext_dirent*) (root->block_data + 12);
+	root_dotdot->reclen = block_size - 12;
+	memset(root->block_data + HTREE_ROOT_INFO_OFFSET, 0,
+	       block_size - HTREE_ROOT_INFO_OFFSET);
+	struct ext_dx_root_info* info = (struct ext_dx_root_info*)
+		(root->block_data + HTREE_ROOT_INFO_OFFSET);
+	info->hash_version = version;
+	info->info_length = sizeof(struct ext_dx_root_info);
+	struct ext_dx_entry* entries = (struct ext_dx_entry*)
+		(root->block_data + HTREE_ROOT_ENTRIES_OFFSET);
+	CountLimit(entries)->limit = (block_size - HTREE_ROOT_ENTRIES_OFFSET) /
+	                             sizeof(struct ext_dx_entry);
+	CountLimit(entries)->count = 1;
+	entries[0].block = leaf_id;
+	root->FinishWrite();
+	root->Unref();
+	BeginWrite();
+	data->i_flags |= EXT2_INDEX_FL;
+	FinishWrite();
+	return true;
+}
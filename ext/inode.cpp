@@ -52,8 +52,14 @@
 #define O_WRITE (O_WRONLY | O_RDWR)
 #endif
 
+static const uint32_t PREALLOC_MIN = 8;
+static const uint32_t PREALLOC_MAX = 1024;
+static const uint64_t READAHEAD_MIN = 4;
+static const uint64_t READAHEAD_MAX_BYTES = 1024 * 1024;
+
 Inode::Inode(Filesystem* filesystem, uint32_t inode_id)
 {
+	this->data_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 	this->prev_inode = NULL;
 	this->next_inode = NULL;
 	this->prev_hashed = NULL;
@@ -66,11 +72,20 @@ Inode::Inode(Filesystem* filesystem, uint32_t inode_id)
 	this->reference_count = 1;
 	this->remote_reference_count = 0;
 	this->inode_id = inode_id;
+	this->prealloc_block = 0;
+	this->prealloc_count = 0;
+	this->extent_cache_logical = 0;
+	this->extent_cache_physical = 0;
+	this->extent_cache_length = 0;
+	this->readahead_next = 0;
+	this->readahead_end = 0;
+	this->readahead_window = 0;
 	this->dirty = false;
 }
 
 Inode::~Inode()
 {
+	ReleasePreallocation();
 	Sync();
 	if ( data_block )
 		data_block->Unref();
@@ -162,7 +177,9 @@ void Inode::SetSize(uint64_t new_size)
 		actual_blocks += divup(logical_blocks - max_doubly, ENTRIES * ENTRIES * ENTRIES);
 
 	BeginWrite();
-	data->i_blocks = (actual_blocks * filesystem->block_size) / 512;
+	// Extent mapped files count their blocks as they are allocated and freed.
+	if ( !HasExtents() )
+		data->i_blocks = (actual_blocks * filesystem->block_size) / 512;
 	if ( EXT2_S_ISREG(data->i_mode) && largefile )
 		data->i_dir_acl = upper;
 	FinishWrite();
@@ -177,11 +194,7 @@ Block* Inode::GetBlockFromTable(Block* table, uint32_t index)
 	// TODO: If in read only mode, then perhaps return a zero block here.
 	if ( !filesystem->device->write )
 		return NULL;
-	uint32_t group_id = (inode_id - 1) / filesystem->sb->s_inodes_per_group;
-	assert(group_id < filesystem->num_groups);
-	BlockGroup* block_group = filesystem->GetBlockGroup(group_id);
-	uint32_t block_id = filesystem->AllocateBlock(block_group);
-	block_group->Unref();
+	uint32_t block_id = AllocateBlock(0);
 	if ( block_id )
 	{
 		Block* block = filesystem->device->GetBlockZeroed(block_id);
@@ -193,8 +206,60 @@ Block* Inode::GetBlockFromTable(Block* table, uint32_t index)
 	return NULL;
 }
 
+uint32_t Inode::AllocateBlock(uint32_t goal)
+{
+	pthread_mutex_lock(&data_lock);
+	if ( !prealloc_count )
+	{
+		// Continue after the previous preallocation window if there's no goal,
+		// or start in the inode's block group.
+		if ( !goal )
+			goal = prealloc_block;
+		if ( !goal )
+		{
+			uint32_t group_id = (inode_id - 1) / filesystem->sb->s_inodes_per_group;
+			goal = filesystem->sb->s_first_data_block +
+			       filesystem->sb->s_blocks_per_group * group_id;
+		}
+		// Reserve a window of contiguous blocks for regular files that grows
+		// with the file, so concurrently written files don't interleave their
+		// blocks. The rest of the window is returned when the inode is closed,
+		// though it is leaked until the next fsck if the system crashes first.
+		uint32_t wanted = 1;
+		if ( EXT2_S_ISREG(data->i_mode) )
+		{
+			uint64_t blocks = ((uint64_t) data->i_blocks * 512) /
+			                  filesystem->block_size;
+			wanted = blocks < PREALLOC_MIN ? PREALLOC_MIN :
+			         blocks < PREALLOC_MAX ? blocks : PREALLOC_MAX;
+		}
+		uint32_t count;
+		uint32_t block_id = filesystem->AllocateBlocks(goal, wanted, &count);
+		if ( !block_id )
+			return pthread_mutex_unlock(&data_lock), 0;
+		prealloc_block = block_id;
+		prealloc_count = count;
+	}
+	prealloc_count--;
+	uint32_t block_id = prealloc_block++;
+	pthread_mutex_unlock(&data_lock);
+	return block_id;
+}
+
+void Inode::ReleasePreallocation()
+{
+	pthread_mutex_lock(&data_lock);
+	if ( prealloc_count )
+		filesystem->FreeBlocks(prealloc_block, prealloc_count);
+	prealloc_count = 0;
+	pthread_mutex_unlock(&data_lock);
+}
+
 Block* Inode::GetBlock(uint64_t offset)
 {
+	if ( HasExtents() )
+		return GetExtentBlock(offset, true);
+
 	const uint64_t ENTRIES = filesystem->block_size / sizeof(uint32_t);
 	uint64_t block_direct = sizeof(data->i_block) / sizeof(uint32_t) - 3;
 	uint64_t block_singly = ENTRIES;
@@ -274,6 +339,119 @@ Block* Inode::GetBlock(uint64_t offset)
 	return NULL;
 }
 
+uint32_t Inode::MapBlock(uint64_t offset, uint32_t* length)
+{
+	// Look up where a block is stored without allocating it, along with how
+	// many of the following blocks are stored contiguously after it.
+	if ( HasExtents() )
+		return MapExtent(offset, length);
+	const uint64_t ENTRIES = filesystem->block_size / sizeof(uint32_t);
+	uint64_t block_direct = sizeof(data->i_block) / sizeof(uint32_t) - 3;
+	uint32_t* table = data->i_block;
+	uint64_t table_length = block_direct;
+	uint64_t index = offset;
+	Block* table_block = NULL;
+	if ( block_direct <= offset )
+	{
+		offset -= block_direct;
+		uint64_t span = ENTRIES;
+		int indirection = 1;
+		while ( span <= offset )
+		{
+			if ( indirection == 3 )
+				return 0;
+			offset -= span;
+			span *= ENTRIES;
+			indirection++;
+		}
+		index = block_direct + indirection - 1;
+		for ( int level = indirection; 0 < level; level-- )
+		{
+			uint32_t block_id = table[index];
+			if ( table_block )
+				table_block->Unref();
+			table_block = NULL;
+			if ( !block_id || filesystem->num_blocks <= block_id ||
+			     !(table_block = filesystem->device->GetBlock(block_id)) )
+				return 0;
+			table = (uint32_t*) table_block->block_data;
+			table_length = ENTRIES;
+			span /= ENTRIES;
+			index = offset / span;
+			offset %= span;
+		}
+	}
+	uint32_t block_id = table[index];
+	uint32_t count = 0;
+	if ( block_id && block_id < filesystem->num_blocks )
+		while ( index + count < table_length &&
+		        table[index + count] == block_id + count &&
+		        block_id + count < filesystem->num_blocks )
+			count++;
+	if ( table_block )
+		table_block->Unref();
+	if ( !count )
+		return 0;
+	*length = count;
+	return block_id;
+}
+
+void Inode::Readahead(uint64_t first, uint64_t end)
+{
+	// data_lock is held. Sequential reads grow a window of blocks that are
+	// loaded ahead of the reader, with a single read per contiguous run.
+	uint64_t request = end - first;
+	uint64_t window_max = READAHEAD_MAX_BYTES / filesystem->block_size;
+	if ( !window_max )
+		window_max = 1;
+	bool sequential = first == readahead_next;
+	if ( sequential )
+	{
+		uint64_t window = readahead_window * 2;
+		if ( window < READAHEAD_MIN * request )
+			window = READAHEAD_MIN * request;
+		readahead_window = window < window_max ? window : window_max;
+	}
+	else
+	{
+		readahead_window = 0;
+		readahead_end = 0;
+	}
+	readahead_next = end;
+	uint64_t from = first;
+	uint64_t to = end + readahead_window;
+	if ( sequential && first < readahead_end )
+	{
+		// Wait until the reader has consumed half the window.
+		if ( end + readahead_window / 2 <= readahead_end )
+			return;
+		from = readahead_end;
+	}
+	uint64_t file_blocks = divup(Size(), (uint64_t) filesystem->block_size);
+	if ( file_blocks < to )
+		to = file_blocks;
+	uint64_t cap = filesystem->device->block_limit / 4;
+	if ( cap < to - from )
+		to = from + cap;
+	if ( to <= from || to - from <= 1 )
+		return;
+	readahead_end = to;
+	for ( uint64_t logical = from; logical < to; )
+	{
+		uint32_t length;
+		uint32_t physical = MapBlock(logical, &length);
+		if ( !physical )
+		{
+			logical++;
+			continue;
+		}
+		if ( to - logical < length )
+			length = to - logical;
+		filesystem->device->Prefetch(physical, length);
+		logical += length;
+	}
+}
+
 bool Inode::FreeIndirect(uint64_t from, uint64_t offset, uint32_t block_id,
                          int indirection, uint64_t entry_span)
 {
@@ -312,9 +490,12 @@ bool Inode::FreeIndirect(uint64_t from, uint64_t offset, uint32_t block_id,
 void Inode::Truncate(uint64_t new_size)
 {
 	assert(filesystem->device->write);
+	pthread_mutex_lock(&data_lock);
 	uint64_t old_size = Size();
-	bool could_be_embedded = old_size == 0 && EXT2_S_ISLNK(Mode()) && !data->i_blocks;
-	bool is_embedded = 0 < old_size && old_size <= 60 && !data->i_blocks;
+	bool could_be_embedded = old_size == 0 && EXT2_S_ISLNK(Mode()) &&
+	                         !data->i_blocks && !HasExtents();
+	bool is_embedded = 0 < old_size && old_size <= 60 && !data->i_blocks &&
+	                   !HasExtents();
 	if ( could_be_embedded || is_embedded )
 	{
 		if ( new_size <= 60 )
@@ -327,6 +508,7 @@ void Inode::Truncate(uint64_t new_size)
 				memset(block_data + new_size, 0, old_size - new_size);
 			data->i_size = new_size;
 			data_block->FinishWrite();
+			pthread_mutex_unlock(&data_lock);
 			return;
 		}
 		if ( is_embedded && !UnembedInInode() )
@@ -342,7 +524,12 @@ void Inode::Truncate(uint64_t new_size)
 	// TODO: Enforce a filesize limit!
 	SetSize(new_size);
 	if ( old_size <= new_size )
+	{
+		pthread_mutex_unlock(&data_lock);
 		return;
+	}
+
+	ReleasePreallocation();
 
 	uint64_t old_num_blocks = divup(old_size, (uint64_t) filesystem->block_size);
 	uint64_t new_num_blocks = divup(new_size, (uint64_t) filesystem->block_size);
@@ -351,11 +538,24 @@ void Inode::Truncate(uint64_t new_size)
 	uint32_t partial = new_size % filesystem->block_size;
 	if ( partial )
 	{
-		Block* partial_block = GetBlock(new_num_blocks-1);
-		uint8_t* data = partial_block->block_data;
-		partial_block->BeginWrite();
-		memset(data + partial, 0, filesystem->block_size - partial);
-		partial_block->FinishWrite();
+		Block* partial_block = HasExtents() ?
+		                       GetExtentBlock(new_num_blocks-1, false) :
+		                       GetBlock(new_num_blocks-1);
+		if ( partial_block )
+		{
+			uint8_t* data = partial_block->block_data;
+			partial_block->BeginWrite();
+			memset(data + partial, 0, filesystem->block_size - partial);
+			partial_block->FinishWrite();
+			partial_block->Unref();
+		}
+	}
+
+	if ( HasExtents() )
+	{
+		TruncateExtents(new_num_blocks);
+		pthread_mutex_unlock(&data_lock);
+		return;
 	}
 
 	const uint64_t ENTRIES = filesystem->block_size / sizeof(uint32_t);
@@ -399,15 +599,20 @@ void Inode::Truncate(uint64_t new_size)
 	(void) max_triply;
 
 	FinishWrite();
+	pthread_mutex_unlock(&data_lock);
 }
 
-Inode* Inode::Open(const char* elem, int flags, mode_t mode)
+static bool IsDotOrDotDot(const char* elem)
 {
-	if ( !EXT2_S_ISDIR(Mode()) )
-		return errno = ENOTDIR, (Inode*) NULL;
-	size_t elem_length = strlen(elem);
-	if ( elem_length == 0 )
-		return errno = ENOENT, (Inode*) NULL;
+	return !strcmp(elem, ".") || !strcmp(elem, "..");
+}
+
+Block* Inode::FindEntry(const char* elem, size_t elem_length,
+                        uint64_t* block_id_ptr, uint32_t* entry_offset)
+{
+	// The "." and ".." entries are in the first block outside of the index.
+	if ( !IsDotOrDotDot(elem) && IsIndexed() )
+		return IndexFind(elem, elem_length, block_id_ptr, entry_offset);
 	uint64_t filesize = Size();
 	uint64_t offset = 0;
 	Block* block = NULL;
@@ -427,41 +632,63 @@ Inode* Inode::Open(const char* elem, int flags, mode_t mode)
 		     entry->name_len == elem_length &&
 		     memcmp(elem, entry->name, elem_length) == 0 )
 		{
-			uint8_t file_type = EXT2_FT_UNKNOWN;
-			if ( filesystem->sb->s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE )
-				file_type = entry->file_type;
-			uint32_t inode_id = entry->inode;
-			block->Unref();
-			if ( (flags & O_CREAT) && (flags & O_EXCL) )
-				return errno = EEXIST, (Inode*) NULL;
-			if ( (flags & O_DIRECTORY) &&
-			     file_type != EXT2_FT_UNKNOWN &&
-			     file_type != EXT2_FT_DIR &&
-			     file_type != EXT2_FT_SYMLINK )
-				return errno = ENOTDIR, (Inode*) NULL;
-			Inode* inode = filesystem->GetInode(inode_id);
-			if ( !inode )
-				return (Inode*) NULL;
-			if ( flags & O_DIRECTORY &&
-			     !EXT2_S_ISDIR(inode->Mode()) &&
-			     !EXT2_S_ISLNK(inode->Mode()) )
-			{
-				inode->Unref();
-				return errno = ENOTDIR, (Inode*) NULL;
-			}
-			if ( flags & O_WRITE && !filesystem->device->write )
-			{
-				inode->Unref();
-				return errno = EROFS, (Inode*) NULL;
-			}
-			if ( S_ISREG(inode->Mode()) && flags & O_WRITE && flags & O_TRUNC )
-				inode->Truncate(0);
-			return inode;
+			*block_id_ptr = block_id;
+			*entry_offset = entry_block_offset;
+			return block;
 		}
 		offset += entry->reclen;
 	}
 	if ( block )
 		block->Unref();
+	return errno = ENOENT, (Block*) NULL;
+}
+
+Inode* Inode::Open(const char* elem, int flags, mode_t mode)
+{
+	if ( !EXT2_S_ISDIR(Mode()) )
+		return errno = ENOTDIR, (Inode*) NULL;
+	size_t elem_length = strlen(elem);
+	if ( elem_length == 0 )
+		return errno = ENOENT, (Inode*) NULL;
+	uint64_t block_id;
+	uint32_t entry_offset;
+	if ( Block* block = FindEntry(elem, elem_length, &block_id, &entry_offset) )
+	{
+		const uint8_t* block_data = block->block_data + entry_offset;
+		const struct ext_dirent* entry = (const struct ext_dirent*) block_data;
+		uint8_t file_type = EXT2_FT_UNKNOWN;
+		if ( filesystem->sb->s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE )
+			file_type = entry->file_type;
+		uint32_t inode_id = entry->inode;
+		block->Unref();
+		if ( (flags & O_CREAT) && (flags & O_EXCL) )
+			return errno = EEXIST, (Inode*) NULL;
+		if ( (flags & O_DIRECTORY) &&
+		     file_type != EXT2_FT_UNKNOWN &&
+		     file_type != EXT2_FT_DIR &&
+		     file_type != EXT2_FT_SYMLINK )
+			return errno = ENOTDIR, (Inode*) NULL;
+		Inode* inode = filesystem->GetInode(inode_id);
+		if ( !inode )
+			return (Inode*) NULL;
+		if ( flags & O_DIRECTORY &&
+		     !EXT2_S_ISDIR(inode->Mode()) &&
+		     !EXT2_S_ISLNK(inode->Mode()) )
+		{
+			inode->Unref();
+			return errno = ENOTDIR, (Inode*) NULL;
+		}
+		if ( flags & O_WRITE && !filesystem->device->write )
+		{
+			inode->Unref();
+			return errno = EROFS, (Inode*) NULL;
+		}
+		if ( S_ISREG(inode->Mode()) && flags & O_WRITE && flags & O_TRUNC )
+			inode->Truncate(0);
+		return inode;
+	}
+	if ( errno != ENOENT )
+		return NULL;
 	if ( flags & O_CREAT )
 	{
 		if ( !filesystem->device->write )
@@ -482,6 +709,7 @@ Inode* Inode::Open(const char* elem, int flags, mode_t mode)
 		result->data->i_mtime = now.tv_sec;
 		// TODO: Set all the other inode properties!
 		result->FinishWrite();
+		result->InitializeExtents();
 		result->SetMode((mode & S_SETABLE) | S_IFREG);
 		result->SetUserId(request_uid);
 		result->SetGroupId(request_gid);
@@ -504,11 +732,53 @@ bool Inode::Link(const char* elem, Inode* dest, bool directories)
 	if ( !directories && EXT2_S_ISDIR(dest->Mode()) )
 		return errno = EISDIR, false;
 
-	// Search for a hole in which we can store the new directory entry and stop
-	// if we meet an existing link with the requested name.
 	size_t elem_length = strlen(elem);
 	if ( elem_length == 0 )
 		return errno = ENOENT, false;
+
+	// Indexed directories only need to look in the leaf the name hashes to.
+	if ( IsIndexed() )
+	{
+		uint64_t found_block_id;
+		uint32_t found_offset;
+		if ( Block* found = FindEntry(elem, elem_length, &found_block_id,
+		                              &found_offset) )
+			return found->Unref(), errno = EEXIST, false;
+		if ( errno != ENOENT )
+			return false;
+		if ( !filesystem->device->write )
+			return errno = EROFS, false;
+		if ( UINT16_MAX <= dest->data->i_links_count )
+			return errno = EMLINK, false;
+		if ( 255 < elem_length )
+			return errno = ENAMETOOLONG, false;
+		Modified();
+		if ( IsDotOrDotDot(elem) )
+		{
+			// The "." and ".." entries keep their place in front of the root.
+			Block* root = GetBlock(0);
+			if ( !root )
+				return false;
+			root->BeginWrite();
+			size_t entry_offset = elem_length == 1 ? 0 : 12;
+			struct ext_dirent* entry =
+				(struct ext_dirent*) (root->block_data + entry_offset);
+			entry->inode = dest->inode_id;
+			if ( filesystem->sb->s_feature_incompat & EXT2_FEATURE_INCOMPAT_FILETYPE )
+				entry->file_type = EXT2_FT_OF_MODE(dest->Mode());
+			root->FinishWrite();
+			root->Unref();
+		}
+		else if ( !IndexLink(elem, elem_length, dest) )
+			return false;
+		dest->BeginWrite();
+		dest->data->i_links_count++;
+		dest->FinishWrite();
+		return true;
+	}
+
+	// Search for a hole in which we can store the new directory entry and stop
+	// if we meet an existing link with the requested name.
 	size_t new_entry_size = roundup(sizeof(struct ext_dirent) + elem_length, (size_t) 4);
 	uint64_t filesize = Size();
 	uint64_t offset = 0;
@@ -566,6 +836,22 @@ bool Inode::Link(const char* elem, Inode* dest, bool directories)
 	if ( 255 < elem_length )
 		return errno = ENAMETOOLONG, false;
 
+	// Index the directory rather than growing it beyond its first block.
+	if ( !found_hole && filesize == filesystem->block_size &&
+	     filesystem->sb->s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX &&
+	     !IsDotOrDotDot(elem) )
+	{
+		if ( block )
+			block->Unref(),
+			block = NULL;
+		if ( CreateIndex() )
+			return Link(elem, dest, directories);
+	}
+
+	// Modifying the directory linearly makes any index stale.
+	if ( data->i_flags & EXT2_INDEX_FL )
+		DropIndex();
+
 	// We'll append another block if we failed to find a suitable hole.
 	if ( !found_hole )
 	{
@@ -629,114 +915,127 @@ Inode* Inode::UnlinkKeep(const char* elem, bool directories, bool force)
 	uint32_t block_size = filesystem->block_size;
 	uint64_t filesize = Size();
 	uint64_t num_blocks = divup(filesize, (uint64_t) block_size);
-	uint64_t offset = 0;
-	Block* block = NULL;
-	uint64_t block_id = 0;
+	bool indexed = IsIndexed();
+	uint64_t entry_block_id;
+	uint32_t entry_offset;
+	Block* block = FindEntry(elem, elem_length, &entry_block_id, &entry_offset);
+	if ( !block )
+		return NULL;
+
+	// Locate the previous entry in the block that the entry is merged into.
 	struct ext_dirent* last_entry = NULL;
-	while ( offset < filesize )
+	uint32_t offset = 0;
+	while ( offset < entry_offset )
 	{
-		uint64_t entry_block_id = offset / block_size;
-		uint64_t entry_block_offset = offset % block_size;
-		if ( block && block_id != entry_block_id )
-			last_entry = NULL,
-			block->Unref(),
-			block = NULL;
-		if ( !block && !(block = GetBlock(block_id = entry_block_id)) )
-			return NULL;
-		uint8_t* block_data = block->block_data + entry_block_offset;
-		struct ext_dirent* entry = (struct ext_dirent*) block_data;
-		if ( entry->inode &&
-		     entry->name_len == elem_length &&
-		     memcmp(elem, entry->name, elem_length) == 0 )
-		{
-			Inode* inode = filesystem->GetInode(entry->inode);
+		last_entry = (struct ext_dirent*) (block->block_data + offset);
+		if ( !last_entry->reclen )
+			break;
+		offset += last_entry->reclen;
+	}
+	if ( offset != entry_offset )
+		last_entry = NULL;
+	struct ext_dirent* entry =
+		(struct ext_dirent*) (block->block_data + entry_offset);
 
-			if ( !force && directories && !EXT2_S_ISDIR(inode->Mode()) )
-			{
-				inode->Unref();
-				block->Unref();
-				return errno = ENOTDIR, (Inode*) NULL;
-			}
+	Inode* inode = filesystem->GetInode(entry->inode);
+	if ( !inode )
+	{
+		block->Unref();
+		return (Inode*) NULL;
+	}
 
-			if ( !force && directories && !inode->IsEmptyDirectory() )
-			{
-				inode->Unref();
-				block->Unref();
-				return errno = ENOTEMPTY, (Inode*) NULL;
-			}
+	if ( !force && directories && !EXT2_S_ISDIR(inode->Mode()) )
+	{
+		inode->Unref();
+		block->Unref();
+		return errno = ENOTDIR, (Inode*) NULL;
+	}
 
-			if ( !force && !directories && EXT2_S_ISDIR(inode->Mode()) )
-			{
-				inode->Unref();
-				block->Unref();
-				return errno = EISDIR, (Inode*) NULL;
-			}
+	if ( !force && directories && !inode->IsEmptyDirectory() )
+	{
+		inode->Unref();
+		block->Unref();
+		return errno = ENOTEMPTY, (Inode*) NULL;
+	}
 
-			if ( !filesystem->device->write )
-			{
-				inode->Unref();
-				block->Unref();
-				return errno = EROFS, (Inode*) NULL;
-			}
+	if ( !force && !directories && EXT2_S_ISDIR(inode->Mode()) )
+	{
+		inode->Unref();
+		block->Unref();
+		return errno = EISDIR, (Inode*) NULL;
+	}
 
-			Modified();
+	if ( !filesystem->device->write )
+	{
+		inode->Unref();
+		block->Unref();
+		return errno = EROFS, (Inode*) NULL;
+	}
 
-			inode->BeginWrite();
-			inode->data->i_links_count--;
-			inode->FinishWrite();
+	Modified();
 
-			block->BeginWrite();
+	inode->BeginWrite();
+	inode->data->i_links_count--;
+	inode->FinishWrite();
 
-			entry->inode = 0;
-			entry->name_len = 0;
-			entry->file_type = 0;
+	// Modifying the directory linearly makes any index stale.
+	if ( !indexed && data->i_flags & EXT2_INDEX_FL )
+		DropIndex();
 
-			// Merge the current entry with the previous if any.
-			if ( last_entry )
-			{
-				last_entry->reclen += entry->reclen;
-				memset(entry, 0, entry->reclen);
-				entry = last_entry;
-			}
+	block->BeginWrite();
 
-			strncpy(entry->name + entry->name_len, "",
-			        entry->reclen - sizeof(struct ext_dirent) - entry->name_len);
+	// The "." and ".." entries keep their place in front of the index root.
+	if ( indexed && entry_block_id == 0 )
+	{
+		entry->inode = 0;
+		block->FinishWrite();
+		block->Unref();
+		return inode;
+	}
 
-			// If the entire block is empty, we'll need to remove it.
-			if ( !entry->name[0] && entry->reclen == block_size )
-			{
-				// If this is not the last block, we'll make it. This is faster
-				// than shifting the entire directory a single block. We don't
-				// actually copy this block to the end, since we'll truncate it
-				// regardless.
-				if ( entry_block_id + 1 != num_blocks )
-				{
-					Block* last_block = GetBlock(num_blocks-1);
-					if ( last_block )
-					{
-						memcpy(block->block_data, last_block->block_data, block_size);
-						last_block->Unref();
-						Truncate(filesize - block_size);
-					}
-				}
-				else
-				{
-					Truncate(filesize - block_size);
-				}
-			}
+	entry->inode = 0;
+	entry->name_len = 0;
+	entry->file_type = 0;
 
-			block->FinishWrite();
+	// Merge the current entry with the previous if any.
+	if ( last_entry )
+	{
+		last_entry->reclen += entry->reclen;
+		memset(entry, 0, entry->reclen);
+		entry = last_entry;
+	}
 
-			block->Unref();
+	strncpy(entry->name + entry->name_len, "",
+	        entry->reclen - sizeof(struct ext_dirent) - entry->name_len);
 
-			return inode;
+	// If the entire block is empty, we'll need to remove it. The blocks of an
+	// indexed directory are referenced by the index and stay in place.
+	if ( !indexed && !entry->name[0] && entry->reclen == block_size )
+	{
+		// If this is not the last block, we'll make it. This is faster than
+		// shifting the entire directory a single block. We don't actually copy
+		// this block to the end, since we'll truncate it regardless.
+		if ( entry_block_id + 1 != num_blocks )
+		{
+			Block* last_block = GetBlock(num_blocks-1);
+			if ( last_block )
+			{
+				memcpy(block->block_data, last_block->block_data, block_size);
+				last_block->Unref();
+				Truncate(filesize - block_size);
+			}
+		}
+		else
+		{
+			Truncate(filesize - block_size);
 		}
-		offset += entry->reclen;
-		last_entry = entry;
 	}
-	if ( block )
-		block->Unref();
-	return errno = ENOENT, (Inode*) NULL;
+
+	block->FinishWrite();
+
+	block->Unref();
+
+	return inode;
 }
 
 bool Inode::Unlink(const char* elem, bool directories, bool force)
@@ -759,34 +1058,48 @@ ssize_t Inode::ReadAt(uint8_t* buf, size_t s_count, off_t o_offset)
 	uint64_t sofar = 0;
 	uint64_t count = (uint64_t) s_count;
 	uint64_t offset = (uint64_t) o_offset;
+	pthread_mutex_lock(&data_lock);
 	uint64_t file_size = Size();
 	if ( file_size <= offset )
-		return 0;
+		return pthread_mutex_unlock(&data_lock), 0;
 	if ( file_size - offset < count )
 		count = file_size - offset;
 	// TODO: This case also needs to be handled in SetSize, Truncate, WriteAt,
 	//       and so on.
-	if ( 0 < file_size && file_size <= 60 && !data->i_blocks )
+	if ( 0 < file_size && file_size <= 60 && !data->i_blocks && !HasExtents() )
 	{
 		assert(offset + count <= 60);
 		unsigned char* block_data = (unsigned char*) &data->i_block[0];
 		memcpy(buf, block_data + offset, count);
+		pthread_mutex_unlock(&data_lock);
 		return (ssize_t) count;
 	}
+	Readahead(offset / filesystem->block_size,
+	          divup(offset + count, (uint64_t) filesystem->block_size));
 	while ( sofar < count )
 	{
 		uint64_t block_id = offset / filesystem->block_size;
 		uint32_t block_offset = offset % filesystem->block_size;
 		uint32_t block_left = filesystem->block_size - block_offset;
-		Block* block = GetBlock(block_id);
-		if ( !block )
-			return sofar ? sofar : -1;
 		size_t amount = count - sofar < block_left ? count - sofar : block_left;
+		// Holes in extent mapped files read as zeroes without allocating.
+		Block* block = HasExtents() ? GetExtentBlock(block_id, false) :
+		                              GetBlock(block_id);
+		if ( !block && HasExtents() && errno == ENOENT )
+		{
+			memset(buf + sofar, 0, amount);
+			sofar += amount;
+			offset += amount;
+			continue;
+		}
+		if ( !block )
+			return pthread_mutex_unlock(&data_lock), sofar ? sofar : -1;
 		memcpy(buf + sofar, block->block_data + block_offset, amount);
 		sofar += amount;
 		offset += amount;
 		block->Unref();
 	}
+	pthread_mutex_unlock(&data_lock);
 	return (ssize_t) sofar;
 }
 
@@ -800,6 +1113,7 @@ ssize_t Inode::WriteAt(const uint8_t* buf, size_t s_count, off_t o_offset)
 		return errno = EROFS, -1;
 	if ( SSIZE_MAX < s_count )
 		s_count = SSIZE_MAX;
+	pthread_mutex_lock(&data_lock);
 	Modified();
 	uint64_t sofar = 0;
 	uint64_t count = (uint64_t) s_count;
@@ -810,7 +1124,7 @@ ssize_t Inode::WriteAt(const uint8_t* buf, size_t s_count, off_t o_offset)
 		/* TODO: Overflow! off_t overflow? */{};
 	if ( file_size < end_at )
 		Truncate(end_at);
-	if ( 0 < end_at && end_at <= 60 && !data->i_blocks )
+	if ( 0 < end_at && end_at <= 60 && !data->i_blocks && !HasExtents() )
 	{
 		data_block->BeginWrite();
 		unsigned char* block_data = (unsigned char*) &data->i_block[0];
@@ -818,6 +1132,7 @@ ssize_t Inode::WriteAt(const uint8_t* buf, size_t s_count, off_t o_offset)
 		if ( data->i_size < end_at )
 			data->i_size = end_at;
 		data_block->FinishWrite();
+		pthread_mutex_unlock(&data_lock);
 		return (ssize_t) count;
 	}
 	while ( sofar < count )
@@ -827,7 +1142,8 @@ ssize_t Inode::WriteAt(const uint8_t* buf, size_t s_count, off_t o_offset)
 		uint32_t block_left = filesystem->block_size - block_offset;
 		Block* block = GetBlock(block_id);
 		if ( !block )
-			return sofar ? (ssize_t) sofar : -1;
+			return pthread_mutex_unlock(&data_lock),
+			       sofar ? (ssize_t) sofar : -1;
 		size_t amount = count - sofar < block_left ? count - sofar : block_left;
 		block->BeginWrite();
 		memcpy(block->block_data + block_offset, buf + sofar, amount);
@@ -836,6 +1152,7 @@ ssize_t Inode::WriteAt(const uint8_t* buf, size_t s_count, off_t o_offset)
 		sofar += amount;
 		offset += amount;
 	}
+	pthread_mutex_unlock(&data_lock);
 	return (ssize_t) sofar;
 }
 
@@ -964,6 +1281,7 @@ Inode* Inode::CreateDirectory(const char* path, mode_t mode)
 	result->data->i_mtime = now.tv_sec;
 	// TODO: Set all the other inode properties!
 	result->FinishWrite();
+	result->InitializeExtents();
 	result->SetMode((mode & S_SETABLE) | EXT2_S_IFDIR);
 	result->SetUserId(request_uid);
 	result->SetGroupId(request_gid);
@@ -1082,28 +1400,39 @@ void Inode::Delete()
 
 void Inode::Refer()
 {
+	pthread_mutex_lock(&filesystem->inode_cache_lock);
 	reference_count++;
+	pthread_mutex_unlock(&filesystem->inode_cache_lock);
 }
 
 void Inode::Unref()
 {
+	Filesystem* fs = filesystem;
+	pthread_mutex_lock(&fs->inode_cache_lock);
 	assert(0 < reference_count);
 	reference_count--;
 	if ( !reference_count && !remote_reference_count )
 	{
+		// The inode cache lock is held while the inode is destroyed, so it
+		// can't be found in the hash while it's being deleted.
 		if ( !data->i_links_count )
 			Delete();
 		delete this;
 	}
+	pthread_mutex_unlock(&fs->inode_cache_lock);
 }
 
 void Inode::RemoteRefer()
 {
+	pthread_mutex_lock(&filesystem->inode_cache_lock);
 	remote_reference_count++;
+	pthread_mutex_unlock(&filesystem->inode_cache_lock);
 }
 
 void Inode::RemoteUnref()
 {
+	Filesystem* fs = filesystem;
+	pthread_mutex_lock(&fs->inode_cache_lock);
 	assert(0 < remote_reference_count);
 	remote_reference_count--;
 	if ( !reference_count && !remote_reference_count )
@@ -1112,6 +1441,7 @@ void Inode::RemoteUnref()
 			Delete();
 		delete this;
 	}
+	pthread_mutex_unlock(&fs->inode_cache_lock);
 }
 
 void Inode::Modified()
@@ -1133,6 +1463,7 @@ void Inode::FinishWrite()
 	struct timespec now;
 	clock_gettime(CLOCK_REALTIME, &now);
 	data->i_ctime = now.tv_sec;
+	pthread_mutex_lock(&filesystem->inode_cache_lock);
 	if ( !dirty )
 	{
 		dirty = true;
@@ -1142,15 +1473,19 @@ void Inode::FinishWrite()
 			next_dirty->prev_dirty = this;
 		filesystem->dirty_inode = this;
 	}
+	pthread_mutex_unlock(&filesystem->inode_cache_lock);
 	data_block->FinishWrite();
 	Use();
 }
 
 void Inode::Sync()
 {
+	pthread_mutex_lock(&filesystem->inode_cache_lock);
 	if ( !dirty )
+	{
+		pthread_mutex_unlock(&filesystem->inode_cache_lock);
 		return;
-	data_block->Sync();
+	}
 	// TODO: The inode contents needs to be sync'd as well!
 	(prev_dirty ? prev_dirty->next_dirty : filesystem->dirty_inode) = next_dirty;
 	if ( next_dirty )
@@ -1158,13 +1493,21 @@ void Inode::Sync()
 	prev_dirty = NULL;
 	next_dirty = NULL;
 	dirty = false;
+	// Write back without the cache lock so other requests can look up inodes.
+	Block* block = data_block;
+	block->Refer();
+	pthread_mutex_unlock(&filesystem->inode_cache_lock);
+	block->Sync();
+	block->Unref();
 }
 
 void Inode::Use()
 {
 	data_block->Use();
+	pthread_mutex_lock(&filesystem->inode_cache_lock);
 	Unlink();
 	Prelink();
+	pthread_mutex_unlock(&filesystem->inode_cache_lock);
 }
 
 void Inode::Unlink()
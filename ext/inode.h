@@ -30,6 +30,7 @@ public:
 	~Inode();
 
 public:
+	pthread_mutex_t data_lock;
 	Inode* prev_inode;
 	Inode* next_inode;
 	Inode* prev_hashed;
@@ -42,6 +43,14 @@ public:
 	size_t reference_count;
 	size_t remote_reference_count;
 	uint32_t inode_id;
+	uint32_t prealloc_block;
+	uint32_t prealloc_count;
+	uint32_t extent_cache_logical;
+	uint32_t extent_cache_physical;
+	uint32_t extent_cache_length;
+	uint64_t readahead_next;
+	uint64_t readahead_end;
+	uint64_t readahead_window;
 	bool dirty;
 
 public:
@@ -58,6 +67,19 @@ public:
 	                  int indirection, uint64_t entry_span);
 	Block* GetBlock(uint64_t offset);
 	Block* GetBlockFromTable(Block* table, uint32_t index);
+	uint32_t MapBlock(uint64_t offset, uint32_t* length);
+	void Readahead(uint64_t first, uint64_t end);
+	uint32_t AllocateBlock(uint32_t goal);
+	void ReleasePreallocation();
+	bool HasExtents();
+	void InitializeExtents();
+	Block* GetExtentBlock(uint64_t offset, bool allocate);
+	uint32_t MapExtent(uint64_t offset, uint32_t* length);
+	bool InsertExtent(uint32_t logical, uint32_t physical, uint32_t length,
+	                  bool uninitialized);
+	void TruncateExtents(uint64_t new_num_blocks);
+	Block* FindEntry(const char* elem, size_t elem_length, uint64_t* block_id,
+	                 uint32_t* entry_offset);
 	Inode* Open(const char* elem, int flags, mode_t mode);
 	bool Link(const char* elem, Inode* dest, bool directories);
 	bool Symlink(const char* elem, const char* dest);
@@ -70,6 +92,12 @@ public:
 	Inode* CreateDirectory(const char* path, mode_t mode);
 	bool RemoveDirectory(const char* path);
 	bool IsEmptyDirectory();
+	bool IsIndexed();
+	void DropIndex();
+	Block* IndexFind(const char* elem, size_t elem_length, uint64_t* block_id,
+	                 uint32_t* entry_offset);
+	bool IndexLink(const char* elem, size_t elem_length, Inode* dest);
+	bool CreateIndex();
 	void Refer();
 	void Unref();
 	void RemoteRefer();
@@ -97,6 +97,28 @@ static void ether_hwaddress_print(const struct if_all* all, const void* ptr)
 	ether_address_print(all, &hwaddr);
 }
 
+static void loopback_loss_print(const struct if_all* all, const void* ptr)
+{
+	(void) all;
+	unsigned int loss = *(const unsigned int*) ptr;
+	printf("%u%%", loss);
+}
+
+static bool loopback_loss_parse(const struct if_all* all,
+                                void* ptr,
+                                const char* string)
+{
+	(void) all;
+	char* end;
+	errno = 0;
+	unsigned long loss = strtoul(string, &end, 10);
+	if ( errno || end == string || (*end && strcmp(end, "%") != 0) ||
+	     100 < loss )
+		return false;
+	*(unsigned int*) ptr = loss;
+	return true;
+}
+
 static bool mac_parse(struct ether_addr* addr, const char* string)
 {
 	for ( size_t i = 0; i < 6; i++ )
@@ -196,6 +218,8 @@ struct configuration ether_configurations[] =
 
 struct configuration loopback_configurations[] =
 {
+	{ "loss", CONFIGOFFSET(loopback, loss),
+	  loopback_loss_print, loopback_loss_parse, false },
 };
 
 struct configuration inet_configurations[] =
@@ -44,6 +44,8 @@ Clock::Clock()
 	last_interrupt_timer = NULL;
 	interrupt_work.handler = Clock__InterruptWork;
 	interrupt_work.context = this;
+	refresh_callback = NULL;
+	timer_callback = NULL;
 	current_time = timespec_nul();
 	current_advancement = timespec_nul();
 	resolution = timespec_nul();
@@ -75,6 +77,50 @@ void Clock::SetCallableFromInterrupts(bool callable_from_interrupts)
 	clock_callable_from_interrupt = callable_from_interrupts;
 }
 
+// Clocks that aren't advanced by a periodic tick are instead brought up to date
+// by the refresh callback whenever they're read, and the timer callback is told
+// whenever a timer is armed, so the hardware can be programmed to advance the
+// clock in time for it.
+
+void Clock::SetEventCallbacks(void (*refresh)(void),
+                              void (*timer)(struct timespec delay))
+{
+	refresh_callback = refresh;
+	timer_callback = timer;
+}
+
+void Clock::Refresh()
+{
+	if ( refresh_callback )
+		refresh_callback();
+}
+
+bool Clock::GetNextExpiry(struct timespec* delay)
+{
+	LockClock();
+	bool result = false;
+	if ( delay_timer )
+	{
+		*delay = timespec_sub(delay_timer->value.it_value,
+		                      current_advancement);
+		if ( timespec_lt(*delay, timespec_nul()) )
+			*delay = timespec_nul();
+		result = true;
+	}
+	if ( absolute_timer )
+	{
+		struct timespec until =
+			timespec_sub(absolute_timer->value.it_value, current_time);
+		if ( timespec_lt(until, timespec_nul()) )
+			until = timespec_nul();
+		if ( !result || timespec_lt(until, *delay) )
+			*delay = until;
+		result = true;
+	}
+	UnlockClock();
+	return result;
+}
+
 void Clock::LockClock()
 {
 	if ( clock_callable_from_interrupt )
@@ -113,11 +159,17 @@ void Clock::Set(struct timespec* now, struct timespec* res)
 
 	TriggerAbsolute();
 
+	if ( timer_callback && absolute_timer )
+		timer_callback(timespec_sub(absolute_timer->value.it_value,
+		                            current_time));
+
 	UnlockClock();
 }
 
 void Clock::Get(struct timespec* now, struct timespec* res)
 {
+	Refresh();
+
 	LockClock();
 
 	if ( now )
@@ -131,88 +183,131 @@ void Clock::Get(struct timespec* now, struct timespec* res)
 // We maintain two queues of timers; one for timers that sleep for a duration
 // and one that that sleeps until a certain point in time. This lets us deal
 // nicely with non-monotonic clocks and simplifies the code. The absolute timers
-// queue is simply sorted after their wake-up time, while the delay timers queue
-// is sorted after their delays, where each node stores the delay between it and
-// its previous node (if any, otherwise just the actual time left of the timer).
-// This data structure allows constant time detection of whether a timer should
-// be fired and the double-linked queue allow constant-time cancellation - this
-// is at the expense of linear time insertion, but it is kinda okay since timers
-// that are soon will always be at the start (and hence quick to insert), while
-// timers in the far future will be last and the calling thread probably
-// wouldn't mind a little delay.
-
-// TODO: If locking the clock means disabling interrupts, and a large numbers of
-//       timers are attached to this clock, then inserting a timer becomes
-//       expensive as the CPU locks up for a moment. Perhaps this is not as bad
-//       as it theoretically could be?
-
-void Clock::RegisterAbsolute(Timer* timer) // Lock acquired.
+// are keyed by their wake-up time, while the delay timers are keyed by the
+// amount the clock will have advanced when they expire. Each queue is a pairing
+// heap threaded through the timers themselves, so arming a timer takes constant
+// time, and expiring or cancelling one takes amortized logarithmic time, without
+// allocating memory while the clock is locked. A timer's child_timer is its
+// first child, next_timer is its next sibling, and prev_timer is its previous
+// sibling, or its parent if it's the first child.
+
+static Timer* MeldTimers(Timer* a, Timer* b)
 {
-	assert(!(timer->flags & TIMER_ACTIVE));
-	timer->flags |= TIMER_ACTIVE;
-
-	Timer* before = NULL;
-	for ( Timer* iter = absolute_timer; iter; iter = iter->next_timer )
+	if ( !a )
+		return b;
+	if ( !b )
+		return a;
+	if ( timespec_lt(b->value.it_value, a->value.it_value) )
 	{
-		if ( timespec_lt(timer->value.it_value, iter->value.it_value) )
-			break;
-		before = iter;
+		Timer* tmp = a;
+		a = b;
+		b = tmp;
 	}
-
-	timer->prev_timer = before;
-	timer->next_timer = before ? before->next_timer : absolute_timer;
-	if ( timer->next_timer ) timer->next_timer->prev_timer = timer;
-	(before ? before->next_timer : absolute_timer) = timer;
+	b->prev_timer = a;
+	b->next_timer = a->child_timer;
+	if ( a->child_timer )
+		a->child_timer->prev_timer = b;
+	a->child_timer = b;
+	return a;
 }
 
-void Clock::RegisterDelay(Timer* timer) // Lock acquired.
+// Combine the children of a removed timer into a single heap, by melding them
+// in pairs from the left and then melding the pairs from the right.
+static Timer* MeldChildTimers(Timer* timer)
 {
-	assert(!(timer->flags & TIMER_ACTIVE));
-	timer->flags |= TIMER_ACTIVE;
-
-	Timer* before = NULL;
-	for ( Timer* iter = delay_timer; iter; iter = iter->next_timer )
+	Timer* list = timer->child_timer;
+	timer->child_timer = NULL;
+	Timer* pairs = NULL;
+	while ( list )
 	{
-		if ( timespec_lt(timer->value.it_value, iter->value.it_value) )
-			break;
-		timer->value.it_value = timespec_sub(timer->value.it_value, iter->value.it_value);
-		before = iter;
+		Timer* a = list;
+		Timer* b = a->next_timer;
+		list = b ? b->next_timer : NULL;
+		a->prev_timer = a->next_timer = NULL;
+		if ( b )
+			b->prev_timer = b->next_timer = NULL;
+		Timer* pair = MeldTimers(a, b);
+		pair->next_timer = pairs;
+		pairs = pair;
+	}
+	Timer* result = NULL;
+	while ( pairs )
+	{
+		Timer* pair = pairs;
+		pairs = pair->next_timer;
+		pair->next_timer = NULL;
+		result = MeldTimers(result, pair);
 	}
+	return result;
+}
 
-	timer->prev_timer = before;
-	timer->next_timer = before ? before->next_timer : delay_timer;
-	if ( timer->next_timer ) timer->next_timer->prev_timer = timer;
-	(before ? before->next_timer : delay_timer) = timer;
+static Timer* InsertTimer(Timer* root, Timer* timer)
+{
+	timer->prev_timer = timer->next_timer = timer->child_timer = NULL;
+	return MeldTimers(root, timer);
+}
 
+static Timer* RemoveTimer(Timer* root, Timer* timer)
+{
+	if ( timer == root )
+		return MeldChildTimers(timer);
+	if ( timer->prev_timer->child_timer == timer )
+		timer->prev_timer->child_timer = timer->next_timer;
+	else
+		timer->prev_timer->next_timer = timer->next_timer;
 	if ( timer->next_timer )
-		timer->next_timer->value.it_value =
-			timespec_sub(timer->next_timer->value.it_value, timer->value.it_value);
+		timer->next_timer->prev_timer = timer->prev_timer;
+	timer->prev_timer = timer->next_timer = NULL;
+	return MeldTimers(root, MeldChildTimers(timer));
+}
+
+void Clock::RegisterAbsolute(Timer* timer) // Lock acquired.
+{
+	assert(!(timer->flags & TIMER_ACTIVE));
+	timer->flags |= TIMER_ACTIVE;
+	absolute_timer = InsertTimer(absolute_timer, timer);
+}
+
+void Clock::RegisterDelay(Timer* timer) // Lock acquired.
+{
+	assert(!(timer->flags & TIMER_ACTIVE));
+	timer->flags |= TIMER_ACTIVE;
+	timer->value.it_value = timespec_add(current_advancement,
+	                                     timer->value.it_value);
+	delay_timer = InsertTimer(delay_timer, timer);
 }
 
 void Clock::Register(Timer* timer)
 {
+	struct timespec delay = timer->value.it_value;
 	if ( timer->flags & TIMER_ABSOLUTE )
+	{
+		delay = timespec_sub(delay, current_time);
 		RegisterAbsolute(timer);
+	}
 	else
 		RegisterDelay(timer);
+	if ( timer_callback )
+		timer_callback(delay);
 }
 
 void Clock::UnlinkAbsolute(Timer* timer) // Lock acquired.
 {
 	assert(timer->flags & TIMER_ACTIVE);
-	(timer->prev_timer ? timer->prev_timer->next_timer : absolute_timer) = timer->next_timer;
-	if ( timer->next_timer ) timer->next_timer->prev_timer = timer->prev_timer;
-	timer->prev_timer = timer->next_timer = NULL;
+	absolute_timer = RemoveTimer(absolute_timer, timer);
 	timer->flags &= ~TIMER_ACTIVE;
 }
 
 void Clock::UnlinkDelay(Timer* timer) // Lock acquired.
 {
 	assert(timer->flags & TIMER_ACTIVE);
-	(timer->prev_timer ? timer->prev_timer->next_timer : delay_timer) = timer->next_timer;
-	if ( timer->next_timer ) timer->next_timer->prev_timer = timer->prev_timer;
-	if ( timer->next_timer ) timer->next_timer->value.it_value = timespec_add(timer->next_timer->value.it_value, timer->value.it_value);
-	timer->prev_timer = timer->next_timer = NULL;
+	delay_timer = RemoveTimer(delay_timer, timer);
+	// Inactive delay timers store how much time was left.
+	if ( timespec_lt(current_advancement, timer->value.it_value) )
+		timer->value.it_value = timespec_sub(timer->value.it_value,
+		                                     current_advancement);
+	else
+		timer->value.it_value = timespec_nul();
 	timer->flags &= ~TIMER_ACTIVE;
 }
 
@@ -267,6 +362,7 @@ static void timer_wakeup(Clock* /*clock*/, Timer* /*timer*/, void* ctx)
 
 struct timespec Clock::SleepDelay(struct timespec duration)
 {
+	Refresh();
 	LockClock();
 	struct timespec start_advancement = current_advancement;
 	UnlockClock();
@@ -283,6 +379,7 @@ struct timespec Clock::SleepDelay(struct timespec duration)
 	timer.Set(&timerspec, NULL, timer_flags, timer_wakeup, thread);
 	kthread_wait_futex_signal();
 	timer.Cancel();
+	Refresh();
 	LockClock();
 	struct timespec end_advancement = current_advancement;
 	UnlockClock();
@@ -307,6 +404,7 @@ struct timespec Clock::SleepUntil(struct timespec expiration)
 	timer.Set(&timerspec, NULL, timer_flags, timer_wakeup, thread);
 	kthread_wait_futex_signal();
 	timer.Cancel();
+	Refresh();
 	LockClock();
 	struct timespec now = current_time;
 	UnlockClock();
@@ -322,26 +420,21 @@ void Clock::Advance(struct timespec duration)
 
 	current_time = timespec_add(current_time, duration);
 	current_advancement = timespec_add(current_advancement, duration);
-	TriggerDelay(duration);
+	TriggerDelay();
 	TriggerAbsolute();
 
 	UnlockClock();
 }
 
 // Fire timers that wait for a certain amount of time.
-void Clock::TriggerDelay(struct timespec unaccounted) // Lock acquired.
+void Clock::TriggerDelay() // Lock acquired.
 {
 	while ( Timer* timer = delay_timer )
 	{
-		if ( timespec_lt(unaccounted, timer->value.it_value) )
-		{
-			timer->value.it_value = timespec_sub(timer->value.it_value, unaccounted);
+		if ( timespec_lt(current_advancement, timer->value.it_value) )
 			break;
-		}
-		unaccounted = timespec_sub(unaccounted, timer->value.it_value);
+		delay_timer = MeldChildTimers(timer);
 		timer->value.it_value = timespec_nul();
-		if ( (delay_timer = delay_timer->next_timer) )
-			delay_timer->prev_timer = NULL;
 		FireTimer(timer);
 	}
 }
@@ -353,8 +446,7 @@ void Clock::TriggerAbsolute() // Lock acquired.
 	{
 		if ( timespec_lt(current_time, timer->value.it_value) )
 			break;
-		if ( (absolute_timer = absolute_timer->next_timer) )
-			absolute_timer->prev_timer = NULL;
+		absolute_timer = MeldChildTimers(timer);
 		FireTimer(timer);
 	}
 }
@@ -27,6 +27,7 @@
 #include <sortix/kernel/copy.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/kthread.h>
+#include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/segment.h>
 #include <sortix/kernel/string.h>
@@ -90,6 +91,11 @@ bool CopyToUser(void* userdst_ptr, const void* ksrc_ptr, size_t count)
 		size_t segment_available = segment->addr + segment->size - userdst;
 		if ( segment_available < amount )
 			amount = segment_available;
+		if ( !Memory::PrepareUserWrite(process, userdst, amount) )
+		{
+			result = false;
+			break;
+		}
 		memcpy((void*) userdst, (const void*) ksrc, amount);
 		userdst += amount;
 		ksrc += amount;
@@ -120,6 +126,11 @@ bool CopyFromUser(void* kdst_ptr, const void* usersrc_ptr, size_t count)
 		size_t segment_available = segment->addr + segment->size - usersrc;
 		if ( segment_available < amount )
 			amount = segment_available;
+		if ( !Memory::PrepareUserRead(process, usersrc, amount) )
+		{
+			result = false;
+			break;
+		}
 		memcpy((void*) kdst, (const void*) usersrc, amount);
 		kdst += amount;
 		usersrc += amount;
@@ -143,6 +154,8 @@ bool ReadAtomicFromUser(int* kdst_ptr, const int* usersrc_ptr)
 	size_t segment_available = segment->addr + segment->size - usersrc;
 	if ( segment_available < sizeof(int) )
 		return errno = EFAULT, false;
+	if ( !Memory::PrepareUserRead(process, usersrc, sizeof(int)) )
+		return false;
 	*kdst_ptr = __atomic_load_n(usersrc_ptr, __ATOMIC_SEQ_CST);
 	return true;
 }
@@ -186,6 +199,11 @@ bool ZeroUser(void* userdst_ptr, size_t count)
 		size_t segment_available = segment->addr + segment->size - userdst;
 		if ( segment_available < amount )
 			amount = segment_available;
+		if ( !Memory::PrepareUserWrite(process, userdst, amount) )
+		{
+			result = false;
+			break;
+		}
 		memset((void*) userdst, 0, amount);
 		userdst += amount;
 		count -= amount;
@@ -216,6 +234,15 @@ char* GetStringFromUser(const char* usersrc_str)
 			return errno = EFAULT, (char*) NULL;
 		}
 		size_t segment_available = segment->addr + segment->size - current_at;
+		// Scan a page at a time as the pages may need to be paged in.
+		size_t page_available = Page::Size() - (current_at & (Page::Size() - 1));
+		if ( page_available < segment_available )
+			segment_available = page_available;
+		if ( !Memory::PrepareUserRead(process, current_at, 1) )
+		{
+			kthread_mutex_unlock(&process->segment_lock);
+			return (char*) NULL;
+		}
 		volatile const char* str = (volatile const char*) current_at;
 		size_t length = 0;
 		for ( ; length < segment_available; length++ )
@@ -251,4 +278,52 @@ char* GetStringFromUser(const char* usersrc_str)
 	return result;
 }
 
+// Pages in any demand paged memory in the user-space buffer ahead of time, for
+// callers that can't page in memory midway through the operation.
+bool FaultInUser(const void* userptr, size_t count)
+{
+	Process* process = CurrentProcess();
+	assert(IsInProcessAddressSpace(process));
+	ScopedLock lock(&process->segment_lock);
+	return Memory::PrepareUserRead(process, (uintptr_t) userptr, count);
+}
+
+// Pins the page containing the caller's buffer at ptr so a device can transfer
+// directly to or from it, and returns its physical address. User-space pages
+// are kept alive by a page reference even if they are unmapped meanwhile, while
+// kernel buffers are owned by the caller for the duration of the transfer. The
+// write parameter is whether the device will write to the page.
+bool PinPage(ioctx_t* ctx, const void* ptr, bool write, addr_t* physical)
+{
+	uintptr_t page = Page::AlignDown((uintptr_t) ptr);
+	if ( ctx->copy_to_dest != CopyToUser )
+	{
+		if ( !Memory::LookUp(page, physical, NULL) )
+			return errno = EFAULT, false;
+		return true;
+	}
+	Process* process = CurrentProcess();
+	assert(IsInProcessAddressSpace(process));
+	ScopedLock lock(&process->segment_lock);
+	struct segment* segment = FindSegment(process, page);
+	if ( !segment || !(segment->prot & (write ? PROT_WRITE : PROT_READ)) )
+		return errno = EFAULT, false;
+	// Shared file mappings are written back when the processor has dirtied the
+	// pages, which doesn't happen when a device writes to them.
+	if ( write && segment->inode && (segment->flags & MAP_SHARED) )
+		return errno = EPERM, false;
+	if ( write ? !Memory::PrepareUserWrite(process, page, Page::Size()) :
+	             !Memory::PrepareUserRead(process, page, Page::Size()) )
+		return false;
+	if ( !Memory::LookUp(page, physical, NULL) )
+		return errno = EFAULT, false;
+	return Page::Share(*physical);
+}
+
+void UnpinPage(ioctx_t* ctx, addr_t physical)
+{
+	if ( ctx->copy_to_dest == CopyToUser )
+		Page::Release(physical, PAGE_USAGE_USER_SPACE);
+}
+
 } // namespace Sortix
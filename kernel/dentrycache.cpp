@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * dentrycache.cpp
+ * Cache of directory entries.
+ */
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sortix/kernel/dentrycache.h>
+#include <sortix/kernel/inode.h>
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/kthread.h>
+#include <sortix/kernel/refcount.h>
+#include <sortix/kernel/string.h>
+
+namespace Sortix {
+namespace DentryCache {
+
+// Filesystems whose lookups are expensive remember the result of looking up a
+// name in a directory, both the inode it names and that it doesn't exist. The
+// entries are evicted in least recently used order and must be removed by the
+// filesystem whenever the name changes meaning. A lookup that misses returns
+// the current generation, which is advanced by every removal, and its result
+// is only inserted if nothing was removed in the mean time, as the result may
+// otherwise predate the removal. Releasing an inode may remove the entries of
+// a directory in turn, so removed entries are deleted by whoever is already
+// deleting entries rather than recursively.
+
+struct dentry_dir
+{
+	struct dentry_dir* hash_next;
+	struct dentry* first_entry;
+	dev_t dev;
+	ino_t ino;
+};
+
+struct dentry
+{
+	struct dentry* hash_next;
+	struct dentry* dir_prev;
+	struct dentry* dir_next;
+	struct dentry* lru_prev;
+	struct dentry* lru_next;
+	struct dentry_dir* dir;
+	Ref<Inode> inode;
+	char* name;
+	size_t hash;
+};
+
+static const size_t DIR_BUCKETS = 256;
+static const size_t DENTRY_BUCKETS = 1024;
+static const size_t DENTRIES_MAX = 8192;
+
+static kthread_mutex_t dcache_lock = KTHREAD_MUTEX_INITIALIZER;
+static struct dentry_dir* dirs[DIR_BUCKETS];
+static struct dentry* dentries[DENTRY_BUCKETS];
+static struct dentry* mru_dentry = NULL;
+static struct dentry* lru_dentry = NULL;
+static struct dentry* dying_dentries = NULL;
+static size_t dentries_used = 0;
+static unsigned long dcache_generation = 0;
+static bool reaping = false;
+
+static size_t HashDirectory(dev_t dev, ino_t ino)
+{
+	uintmax_t hash = (uintmax_t) dev * 31 + (uintmax_t) ino;
+	return (size_t) (hash ^ (hash >> 8)) % DIR_BUCKETS;
+}
+
+static size_t HashEntry(dev_t dev, ino_t dir, const char* name)
+{
+	uintmax_t hash = (uintmax_t) dev * 31 + (uintmax_t) dir;
+	for ( size_t i = 0; name[i]; i++ )
+		hash = (hash ^ (unsigned char) name[i]) * 16777619U;
+	return (size_t) (hash ^ (hash >> 16));
+}
+
+static struct dentry_dir* FindDirectory(dev_t dev, ino_t ino)
+{
+	// dcache_lock is held.
+	struct dentry_dir* dir = dirs[HashDirectory(dev, ino)];
+	while ( dir && !(dir->dev == dev && dir->ino == ino) )
+		dir = dir->hash_next;
+	return dir;
+}
+
+static struct dentry_dir* CreateDirectory(dev_t dev, ino_t ino)
+{
+	// dcache_lock is held.
+	struct dentry_dir* dir = new struct dentry_dir;
+	if ( !dir )
+		return NULL;
+	dir->first_entry = NULL;
+	dir->dev = dev;
+	dir->ino = ino;
+	size_t bucket = HashDirectory(dev, ino);
+	dir->hash_next = dirs[bucket];
+	dirs[bucket] = dir;
+	return dir;
+}
+
+static void DeleteDirectoryIfUnused(struct dentry_dir* dir)
+{
+	// dcache_lock is held.
+	if ( dir->first_entry )
+		return;
+	struct dentry_dir** link = &dirs[HashDirectory(dir->dev, dir->ino)];
+	while ( *link != dir )
+		link = &(*link)->hash_next;
+	*link = dir->hash_next;
+	delete dir;
+}
+
+static struct dentry* Find(dev_t dev, ino_t dir, const char* name, size_t hash)
+{
+	// dcache_lock is held.
+	struct dentry* entry = dentries[hash % DENTRY_BUCKETS];
+	while ( entry && !(entry->hash == hash && entry->dir->dev == dev &&
+	                   entry->dir->ino == dir && !strcmp(entry->name, name)) )
+		entry = entry->hash_next;
+	return entry;
+}
+
+static void LinkEntry(struct dentry* entry)
+{
+	// dcache_lock is held.
+	entry->lru_prev = NULL;
+	entry->lru_next = mru_dentry;
+	if ( mru_dentry )
+		mru_dentry->lru_prev = entry;
+	mru_dentry = entry;
+	if ( !lru_dentry )
+		lru_dentry = entry;
+}
+
+static void UnlinkEntry(struct dentry* entry)
+{
+	// dcache_lock is held.
+	(entry->lru_prev ? entry->lru_prev->lru_next : mru_dentry) =
+		entry->lru_next;
+	(entry->lru_next ? entry->lru_next->lru_prev : lru_dentry) =
+		entry->lru_prev;
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void RemoveEntry(struct dentry* entry)
+{
+	// dcache_lock is held. The entry is deleted by Reap.
+	struct dentry** link = &dentries[entry->hash % DENTRY_BUCKETS];
+	while ( *link != entry )
+		link = &(*link)->hash_next;
+	*link = entry->hash_next;
+	if ( entry->dir_prev )
+		entry->dir_prev->dir_next = entry->dir_next;
+	else
+		entry->dir->first_entry = entry->dir_next;
+	if ( entry->dir_next )
+		entry->dir_next->dir_prev = entry->dir_prev;
+	UnlinkEntry(entry);
+	DeleteDirectoryIfUnused(entry->dir);
+	entry->dir = NULL;
+	dentries_used--;
+	entry->hash_next = dying_dentries;
+	dying_dentries = entry;
+}
+
+static void RemoveDirectory(struct dentry_dir* dir)
+{
+	// dcache_lock is held.
+	while ( dir->first_entry && dir->first_entry->dir_next )
+		RemoveEntry(dir->first_entry);
+	// The directory is deleted along with its last entry.
+	if ( dir->first_entry )
+		RemoveEntry(dir->first_entry);
+}
+
+static void Reap()
+{
+	// Releasing the last reference to an inode may talk to its filesystem, so
+	// the removed entries are deleted without the lock held.
+	kthread_mutex_lock(&dcache_lock);
+	if ( reaping )
+	{
+		kthread_mutex_unlock(&dcache_lock);
+		return;
+	}
+	reaping = true;
+	while ( struct dentry* entry = dying_dentries )
+	{
+		dying_dentries = NULL;
+		kthread_mutex_unlock(&dcache_lock);
+		while ( entry )
+		{
+			struct dentry* next = entry->hash_next;
+			delete[] entry->name;
+			delete entry;
+			entry = next;
+		}
+		kthread_mutex_lock(&dcache_lock);
+	}
+	reaping = false;
+	kthread_mutex_unlock(&dcache_lock);
+}
+
+bool Lookup(dev_t dev, ino_t dir, const char* name, Ref<Inode>* result,
+            unsigned long* generation)
+{
+	size_t hash = HashEntry(dev, dir, name);
+	ScopedLock lock(&dcache_lock);
+	struct dentry* entry = Find(dev, dir, name, hash);
+	if ( !entry )
+		return *generation = dcache_generation, false;
+	UnlinkEntry(entry);
+	LinkEntry(entry);
+	*result = entry->inode;
+	return true;
+}
+
+void Insert(dev_t dev, ino_t dir, const char* name, Ref<Inode> inode,
+            unsigned long generation)
+{
+	size_t hash = HashEntry(dev, dir, name);
+	kthread_mutex_lock(&dcache_lock);
+	if ( generation == dcache_generation )
+	{
+		if ( struct dentry* entry = Find(dev, dir, name, hash) )
+			RemoveEntry(entry);
+		if ( DENTRIES_MAX <= dentries_used )
+			RemoveEntry(lru_dentry);
+		struct dentry_dir* directory = FindDirectory(dev, dir);
+		if ( !directory )
+			directory = CreateDirectory(dev, dir);
+		struct dentry* entry = NULL;
+		if ( directory && (entry = new struct dentry) &&
+		     !(entry->name = String::Clone(name)) )
+		{
+			delete entry;
+			entry = NULL;
+		}
+		if ( entry )
+		{
+			entry->inode = inode;
+			entry->dir = directory;
+			entry->hash = hash;
+			size_t bucket = hash % DENTRY_BUCKETS;
+			entry->hash_next = dentries[bucket];
+			dentries[bucket] = entry;
+			entry->dir_prev = NULL;
+			entry->dir_next = directory->first_entry;
+			if ( directory->first_entry )
+				directory->first_entry->dir_prev = entry;
+			directory->first_entry = entry;
+			LinkEntry(entry);
+			dentries_used++;
+		}
+		else if ( directory )
+			DeleteDirectoryIfUnused(directory);
+	}
+	kthread_mutex_unlock(&dcache_lock);
+	Reap();
+}
+
+Ref<Inode> Remove(dev_t dev, ino_t dir, const char* name)
+{
+	size_t hash = HashEntry(dev, dir, name);
+	Ref<Inode> result;
+	kthread_mutex_lock(&dcache_lock);
+	dcache_generation++;
+	if ( struct dentry* entry = Find(dev, dir, name, hash) )
+	{
+		result = entry->inode;
+		RemoveEntry(entry);
+	}
+	kthread_mutex_unlock(&dcache_lock);
+	Reap();
+	return result;
+}
+
+void InvalidateDirectory(dev_t dev, ino_t dir)
+{
+	kthread_mutex_lock(&dcache_lock);
+	dcache_generation++;
+	if ( struct dentry_dir* directory = FindDirectory(dev, dir) )
+		RemoveDirectory(directory);
+	kthread_mutex_unlock(&dcache_lock);
+	Reap();
+}
+
+void InvalidateDevice(dev_t dev)
+{
+	kthread_mutex_lock(&dcache_lock);
+	dcache_generation++;
+	for ( size_t i = 0; i < DIR_BUCKETS; i++ )
+	{
+		struct dentry_dir* directory = dirs[i];
+		while ( directory )
+		{
+			struct dentry_dir* next = directory->hash_next;
+			if ( directory->dev == dev )
+				RemoveDirectory(directory);
+			directory = next;
+		}
+	}
+	kthread_mutex_unlock(&dcache_lock);
+	Reap();
+}
+
+} // namespace DentryCache
+} // namespace Sortix
@@ -46,6 +46,7 @@
 #include <sortix/kernel/kthread.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/refcount.h>
+#include <sortix/kernel/slab.h>
 #include <sortix/kernel/string.h>
 #include <sortix/kernel/vnode.h>
 
@@ -147,10 +148,24 @@ size_t TruncateIOVec(struct iovec* iov, int iovcnt, off_t limit)
 
 // TODO: Add security checks.
 
+static struct slab_cache descriptor_cache =
+	SLAB_CACHE_INITIALIZER("descriptor", Descriptor);
+
+void* Descriptor::operator new(size_t size)
+{
+	return SlabAllocate(&descriptor_cache, size);
+}
+
+void Descriptor::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&descriptor_cache, ptr, size);
+}
+
 Descriptor::Descriptor()
 {
 	current_offset_lock = KTHREAD_MUTEX_INITIALIZER;
 	this->vnode = Ref<Vnode>(NULL);
+	this->epoll_watches = NULL;
 	this->ino = 0;
 	this->dev = 0;
 	this->type = 0;
@@ -164,6 +179,7 @@ Descriptor::Descriptor(Ref<Vnode> vnode, int dflags)
 {
 	current_offset_lock = KTHREAD_MUTEX_INITIALIZER;
 	this->vnode = Ref<Vnode>(NULL);
+	this->epoll_watches = NULL;
 	this->ino = 0;
 	this->dev = 0;
 	this->type = 0;
@@ -185,6 +201,9 @@ void Descriptor::LateConstruct(Ref<Vnode> vnode, int dflags)
 
 Descriptor::~Descriptor()
 {
+	// No more watches can be added once the last reference is gone.
+	if ( epoll_watches )
+		CancelEpollWatches(this);
 }
 
 bool Descriptor::SetFlags(int new_dflags)
@@ -1121,7 +1140,8 @@ Ref<Descriptor> Descriptor::fsm_mount(ioctx_t* ctx,
                                       const struct stat* rootst,
                                       int flags)
 {
-	if ( flags & ~(FSM_MOUNT_NOFOLLOW | FSM_MOUNT_NONBLOCK) )
+	if ( flags & ~(FSM_MOUNT_NOFOLLOW | FSM_MOUNT_NONBLOCK |
+	               FSM_MOUNT_MULTIPLEX | FSM_MOUNT_CACHE) )
 		return errno = EINVAL, Ref<Descriptor>(NULL);
 	int result_dflags = O_READ | O_WRITE;
 	if ( flags & FSM_MOUNT_NOFOLLOW ) result_dflags |= O_NONBLOCK;
@@ -1199,4 +1219,84 @@ int Descriptor::getsockname(ioctx_t* ctx, uint8_t* addr, size_t* addrsize)
 	return vnode->getsockname(ctx, addr, addrsize);
 }
 
+int Descriptor::epoll_ctl(ioctx_t* ctx, int op, int fd, Ref<Descriptor> desc,
+                          const struct epoll_event* event)
+{
+	return vnode->epoll_ctl(ctx, op, fd, desc, event);
+}
+
+int Descriptor::epoll_wait(ioctx_t* ctx, struct epoll_event* events,
+                           int maxevents, struct timespec timeout)
+{
+	return vnode->epoll_wait(ctx, events, maxevents, timeout);
+}
+
+// Copy the file through a kernel buffer if the output can't reference its
+// pages directly.
+static ssize_t sendfile_copy(ioctx_t* ctx, Descriptor* out, Ref<Descriptor> in,
+                             off_t off, size_t count)
+{
+	ioctx_t kctx; SetupKernelIOCtx(&kctx);
+	kctx.dflags = ctx->dflags;
+	size_t buffer_size = count < 65536 ? count : 65536;
+	uint8_t* buffer = new uint8_t[buffer_size];
+	if ( !buffer )
+		return -1;
+	size_t sofar = 0;
+	while ( sofar < count )
+	{
+		size_t amount = count - sofar;
+		if ( buffer_size < amount )
+			amount = buffer_size;
+		ssize_t num_read = in->pread(&kctx, buffer, amount, off + sofar);
+		if ( num_read < 0 && !sofar )
+			return delete[] buffer, -1;
+		if ( num_read <= 0 )
+			break;
+		size_t done = 0;
+		while ( done < (size_t) num_read )
+		{
+			ssize_t num_written = out->write(&kctx, buffer + done,
+			                                 num_read - done);
+			if ( num_written < 0 && !sofar && !done )
+				return delete[] buffer, -1;
+			if ( num_written <= 0 )
+				break;
+			done += num_written;
+		}
+		sofar += done;
+		if ( done < (size_t) num_read )
+			break;
+	}
+	delete[] buffer;
+	return sofar;
+}
+
+ssize_t Descriptor::sendfile(ioctx_t* ctx, Ref<Descriptor> in, off_t* offset,
+                             size_t count)
+{
+	if ( !(dflags & O_WRITE) || !(in->dflags & O_READ) )
+		return errno = EBADF, -1;
+	if ( !S_ISREG(in->type) || in.Get() == this )
+		return errno = EINVAL, -1;
+	if ( SSIZE_MAX < count )
+		count = SSIZE_MAX;
+	ScopedLock lock(&in->current_offset_lock);
+	off_t off = offset ? *offset : in->current_offset;
+	if ( off < 0 )
+		return errno = EINVAL, -1;
+	off_t available = OFF_MAX - off;
+	if ( (uintmax_t) available < (uintmax_t) count )
+		count = available;
+	int old_ctx_dflags = ctx->dflags;
+	ctx->dflags = ContextFlags(old_ctx_dflags, dflags);
+	ssize_t result = vnode->sendfile(ctx, in->vnode->inode, off, count);
+	if ( result < 0 && errno == ENOTSUP )
+		result = sendfile_copy(ctx, this, in, off, count);
+	ctx->dflags = old_ctx_dflags;
+	if ( 0 < result )
+		*(offset ? offset : &in->current_offset) = off + result;
+	return result;
+}
+
 } // namespace Sortix
@@ -30,6 +30,7 @@
 #include <sortix/mman.h>
 
 #include <sortix/kernel/addralloc.h>
+#include <sortix/kernel/blockqueue.h>
 #include <sortix/kernel/clock.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kthread.h>
@@ -52,6 +53,17 @@ static inline void ahci_port_flush(volatile struct port_regs* port_regs)
 	(void) port_regs->pxcmd;
 }
 
+// Each command table is followed by its physical region descriptor table and
+// must be 128-byte aligned. Give each table a page, so transfers straight to
+// and from the caller's pages can have a descriptor per page.
+static const size_t COMMAND_TABLE_SIZE = 4096;
+static const size_t PRDT_MAX =
+	(COMMAND_TABLE_SIZE - sizeof(struct command_table)) / sizeof(struct prd);
+
+// The largest transfer in a single command, which is also the most a physical
+// region descriptor can describe.
+static const size_t TRANSFER_MAX = 4 * 1024 * 1024;
+
 static inline void delay(unsigned int usecs)
 {
 	struct timespec delay =
@@ -73,34 +85,62 @@ static void copy_ata_string(char* dest, const char* src, size_t length)
 	dest[length] = '\0';
 }
 
+static void Port__InterruptWork(void* context)
+{
+	((Port*) context)->InterruptWork();
+}
+
 Port::Port(HBA* hba, uint32_t port_index)
 {
 	port_lock = KTHREAD_MUTEX_INITIALIZER;
+	slot_cond = KTHREAD_COND_INITIALIZER;
+	for ( size_t i = 0; i < 32; i++ )
+		completion_conds[i] = KTHREAD_COND_INITIALIZER;
+	interrupt_work.handler = Port__InterruptWork;
+	interrupt_work.context = this;
+	memset(slot_requests, 0, sizeof(slot_requests));
 	memset(&control_alloc, 0, sizeof(control_alloc));
 	memset(&dma_alloc, 0, sizeof(dma_alloc));
 	this->hba = hba;
 	regs = &hba->regs->ports[port_index];
-	control_physical_frame = 0;
+	memset(control_physical_frames, 0, sizeof(control_physical_frames));
 	dma_physical_frame = 0;
+	control_pages = 0;
+	control_pages_mapped = 0;
+	queue = NULL;
 	this->port_index = port_index;
-	is_control_page_mapped = false;
+	slot_count = 0;
+	queue_depth = 0;
+	slots_used = 0;
+	slots_issued = 0;
+	slots_failed = 0;
+	slots_finished = 0;
 	is_dma_page_mapped = false;
-	interrupt_signaled = false;
-	transfer_in_progress = false;
+	is_ncq = false;
+	draining = false;
+	error_signaled = false;
+	interrupt_work_scheduled = false;
 }
 
 Port::~Port()
 {
-	if ( transfer_in_progress )
-		FinishTransferDMA();
-	if ( is_control_page_mapped )
-		Memory::Unmap(control_alloc.from);
+	// Let any scheduled interrupt work finish before the port goes away.
+	regs->pxie = 0;
+	ahci_port_flush(regs);
+	while ( __atomic_load_n(&interrupt_work_scheduled, __ATOMIC_SEQ_CST) )
+		kthread_yield();
+	kthread_mutex_lock(&port_lock);
+	kthread_mutex_unlock(&port_lock);
+	delete queue;
+	for ( size_t i = 0; i < control_pages_mapped; i++ )
+		Memory::Unmap(control_alloc.from + i * Page::Size());
 	FreeKernelAddress(&control_alloc);
 	if ( is_dma_page_mapped )
 		Memory::Unmap(dma_alloc.from);
 	FreeKernelAddress(&dma_alloc);
-	if ( control_physical_frame )
-		Page::Put(control_physical_frame, PAGE_USAGE_DRIVER);
+	for ( size_t i = 0; i < control_pages; i++ )
+		if ( control_physical_frames[i] )
+			Page::Put(control_physical_frames[i], PAGE_USAGE_DRIVER);
 	if ( dma_physical_frame )
 		Page::Put(dma_physical_frame, PAGE_USAGE_DRIVER);
 }
@@ -126,10 +166,22 @@ bool Port::Initialize()
 	// Clear error bits.
 	regs->pxserr = regs->pxserr;
 
-	if ( !(control_physical_frame = Page::Get(PAGE_USAGE_DRIVER)) )
+	// The command list and the received FIS are in the first control page and
+	// the command tables of each command slot fill the following pages. The
+	// block requests are transferred straight to and from their pages, and the
+	// other commands transfer their data through the dma page.
+	slot_count = CAP_NCS(hba->regs->cap);
+	queue_depth = slot_count;
+	size_t tables_per_page = Page::Size() / COMMAND_TABLE_SIZE;
+	control_pages = 1 + (slot_count + tables_per_page - 1) / tables_per_page;
+
+	for ( size_t i = 0; i < control_pages; i++ )
 	{
-		LogF("error: control page allocation failure");
-		return false;
+		if ( !(control_physical_frames[i] = Page::Get(PAGE_USAGE_DRIVER)) )
+		{
+			LogF("error: control page allocation failure");
+			return false;
+		}
 	}
 
 	if ( !(dma_physical_frame = Page::Get(PAGE_USAGE_DRIVER)) )
@@ -138,7 +190,7 @@ bool Port::Initialize()
 		return false;
 	}
 
-	if ( !AllocateKernelAddress(&control_alloc, Page::Size()) )
+	if ( !AllocateKernelAddress(&control_alloc, control_pages * Page::Size()) )
 	{
 		LogF("error: control page virtual address allocation failure");
 		return false;
@@ -151,12 +203,15 @@ bool Port::Initialize()
 	}
 
 	int prot = PROT_KREAD | PROT_KWRITE;
-	is_control_page_mapped =
-		Memory::Map(control_physical_frame, control_alloc.from, prot);
-	if ( !is_control_page_mapped )
+	for ( ; control_pages_mapped < control_pages; control_pages_mapped++ )
 	{
-		LogF("error: control page virtual address allocation failure");
-		return false;
+		addr_t virt = control_alloc.from + control_pages_mapped * Page::Size();
+		if ( !Memory::Map(control_physical_frames[control_pages_mapped], virt,
+		                  prot) )
+		{
+			LogF("error: control page virtual address allocation failure");
+			return false;
+		}
 	}
 
 	Memory::Flush();
@@ -164,7 +219,6 @@ bool Port::Initialize()
 	is_dma_page_mapped = Memory::Map(dma_physical_frame, dma_alloc.from, prot);
 	if ( !is_dma_page_mapped )
 	{
-
 		LogF("dma page virtual address allocation failure");
 		return false;
 	}
@@ -202,9 +256,9 @@ bool Port::FinishInitialize()
 	regs->pxserr = regs->pxserr;
 
 	uintptr_t virt = control_alloc.from;
-	uintptr_t phys = control_physical_frame;
+	uintptr_t phys = control_physical_frames[0];
 
-	memset((void*) virt, 0, Page::Size());
+	memset((void*) virt, 0, control_pages * Page::Size());
 
 	size_t offset = 0;
 
@@ -220,22 +274,24 @@ bool Port::FinishInitialize()
 	regs->pxfbu = pxf_addr >> 32;
 	offset += sizeof(struct fis);
 
-	ctbl = (volatile struct command_table*) (virt + offset);
-	uint64_t ctba_addr = phys + offset;
-	clist[0].ctba = ctba_addr >> 0;
-	clist[0].ctbau = ctba_addr >> 32;
-	offset += sizeof(struct command_table);
+	assert(offset <= Page::Size());
 
-	prdt = (volatile struct prd*) (virt + offset);
-	offset += sizeof(struct prd);
-	// TODO: There can be more of these, fill until end of page!
+	size_t tables_per_page = Page::Size() / COMMAND_TABLE_SIZE;
+	for ( uint32_t i = 0; i < slot_count; i++ )
+	{
+		size_t page = 1 + i / tables_per_page;
+		size_t table_offset = i % tables_per_page * COMMAND_TABLE_SIZE;
+		ctbls[i] = (volatile struct command_table*)
+			(virt + page * Page::Size() + table_offset);
+		uint64_t ctba_addr = control_physical_frames[page] + table_offset;
+		clist[i].ctba = ctba_addr >> 0;
+		clist[i].ctbau = ctba_addr >> 32;
+	}
 
 	// Enable FIS receive.
 	regs->pxcmd = regs->pxcmd | PXCMD_FRE;
 	ahci_port_flush(regs);
 
-	assert(offset <= Page::Size());
-
 	uint32_t ssts = regs->pxssts;
 	uint32_t pxtfd = regs->pxtfd;
 
@@ -267,14 +323,11 @@ bool Port::FinishInitialize()
 	             PXIE_DSE | PXIE_SDBE | PXIE_DPE;
 	ahci_port_flush(regs);
 
-	CommandDMA(ATA_CMD_IDENTIFY, 512, false);
-	if ( !AwaitInterrupt(500 /*ms*/) )
+	if ( !Command(ATA_CMD_IDENTIFY, 512, 500 /*ms*/) )
 	{
-		LogF("error: IDENTIFY timed out");
-		transfer_in_progress = false;
+		LogF("error: IDENTIFY failed");
 		return false;
 	}
-	transfer_in_progress = false;
 
 	memcpy(identify_data, (void*) dma_alloc.from, sizeof(identify_data));
 
@@ -287,6 +340,16 @@ bool Port::FinishInitialize()
 
 	this->is_lba48 = words[83] & (1 << 10);
 
+	// Queue the reads and writes with the device if both it and the controller
+	// support native command queuing, using the command slot as the tag.
+	if ( is_lba48 && (hba->regs->cap & CAP_SNCQ) && (words[76] & (1 << 8)) )
+	{
+		uint32_t device_depth = (words[75] & 0x1F) + 1;
+		if ( device_depth < queue_depth )
+			queue_depth = device_depth;
+		is_ncq = true;
+	}
+
 	copy_ata_string(serial, (const char*) &words[10], sizeof(serial) - 1);
 	copy_ata_string(revision, (const char*) &words[23], sizeof(revision) - 1);
 	copy_ata_string(model, (const char*) &words[27], sizeof(model) - 1);
@@ -330,6 +393,17 @@ bool Port::FinishInitialize()
 	this->block_count = (blkcnt_t) block_count;
 	this->block_size = (blkcnt_t) block_size;
 
+	// The block queue issues requests up to the most blocks a command can
+	// transfer, with a physical region descriptor per segment.
+	blkcnt_t blocks_max = is_lba48 ? 65535 : 255;
+	if ( (blkcnt_t) (TRANSFER_MAX / block_size) < blocks_max )
+		blocks_max = TRANSFER_MAX / block_size;
+	if ( !(queue = new BlockQueue(this, queue_depth, blocks_max, PRDT_MAX)) )
+	{
+		LogF("error: block queue allocation failure");
+		return errno = ENOMEM, false;
+	}
+
 	return true;
 }
 
@@ -403,14 +477,96 @@ bool Port::Reset()
 	return true;
 }
 
-void Port::Seek(blkcnt_t block_index, size_t count)
+int Port::ClaimSlot()
+{
+	ScopedLock lock(&port_lock);
+	if ( draining )
+		return -1;
+	for ( unsigned int i = 0; i < queue_depth; i++ )
+	{
+		uint32_t bit = 1U << i;
+		if ( slots_used & bit )
+			continue;
+		slots_used |= bit;
+		slots_failed &= ~bit;
+		return (int) i;
+	}
+	return -1;
+}
+
+volatile struct prd* Port::PRDT(unsigned int slot)
 {
+	return (volatile struct prd*)
+		((uintptr_t) ctbls[slot] + sizeof(struct command_table));
+}
+
+uint16_t Port::BounceBuffer(unsigned int slot, size_t size)
+{
+	if ( !size )
+		return 0;
+	assert(size <= Page::Size());
+	assert((size & 1) == 0); /* sizes & addresses must be 2-byte aligned */
+	volatile struct prd* prdt = PRDT(slot);
+	prdt[0].dba  = (uint64_t) dma_physical_frame >>  0 & 0xFFFFFFFF;
+	prdt[0].dbau = (uint64_t) dma_physical_frame >> 32 & 0xFFFFFFFF;
+	prdt[0].reserved1 = 0;
+	prdt[0].dw3 = size - 1;
+	return 1;
+}
+
+// Describe the segments of the request and the requests merged into it in the
+// physical region descriptor table, merging physically contiguous segments.
+// The block queue ensures the requests have at most PRDT_MAX segments.
+uint16_t Port::RequestBuffer(unsigned int slot, struct block_request* request)
+{
+	volatile struct prd* prdt = PRDT(slot);
+	uint16_t prdtl = 0;
+	uint64_t prd_end = 0;
+	for ( ; request; request = request->merge_next )
+	{
+		for ( size_t i = 0; i < request->segment_count; i++ )
+		{
+			uint64_t address = request->segments[i].physical;
+			size_t amount = request->segments[i].size;
+			size_t prd_size = prdtl ? (prdt[prdtl-1].dw3 & 0x3FFFFF) + 1 : 0;
+			if ( prdtl && address == prd_end &&
+			     prd_size + amount <= TRANSFER_MAX )
+				prdt[prdtl-1].dw3 = prd_size + amount - 1;
+			else
+			{
+				assert(prdtl < PRDT_MAX);
+				prdt[prdtl].dba  = address >>  0 & 0xFFFFFFFF;
+				prdt[prdtl].dbau = address >> 32 & 0xFFFFFFFF;
+				prdt[prdtl].reserved1 = 0;
+				prdt[prdtl].dw3 = amount - 1;
+				prdtl++;
+			}
+			prd_end = address + amount;
+		}
+	}
+	return prdtl;
+}
+
+void Port::IssueCommand(unsigned int slot, uint8_t cmd, blkcnt_t block_index,
+                        size_t num_blocks, uint16_t prdtl, bool write)
+{
+	// Set up the command table.
+	volatile struct command_table* ctbl = ctbls[slot];
+	memset((void*) &ctbl->cfis, 0, sizeof(ctbl->cfis));
+	ctbl->cfis.type = 0x27;
+	ctbl->cfis.pm_port = 0;
+	ctbl->cfis.c_bit = 1;
+	ctbl->cfis.command = cmd;
 	uintmax_t lba = (uintmax_t) block_index;
-	if ( is_lba48 )
+	bool queued = cmd == ATA_CMD_READ_FPDMA_QUEUED ||
+	              cmd == ATA_CMD_WRITE_FPDMA_QUEUED;
+	if ( queued )
 	{
-		memset((void *)&ctbl->cfis, 0, sizeof(ctbl->cfis));
-		ctbl->cfis.count_0_7  = (count >> 0) & 0xff;
-		ctbl->cfis.count_8_15 = (count >> 8) & 0xff;
+		// Queued commands keep the count in the features and the tag in the
+		// upper bits of the count.
+		ctbl->cfis.features_0_7  = (num_blocks >> 0) & 0xff;
+		ctbl->cfis.features_8_15 = (num_blocks >> 8) & 0xff;
+		ctbl->cfis.count_0_7  = slot << 3;
 		ctbl->cfis.lba_0_7    = (lba >> 0) & 0xff;
 		ctbl->cfis.lba_8_15   = (lba >> 8) & 0xff;
 		ctbl->cfis.lba_16_23  = (lba >> 16) & 0xff;
@@ -419,80 +575,226 @@ void Port::Seek(blkcnt_t block_index, size_t count)
 		ctbl->cfis.lba_40_47  = (lba >> 40) & 0xff;
 		ctbl->cfis.device = 0x40;
 	}
-	else
+	else if ( num_blocks && is_lba48 )
 	{
-		ctbl->cfis.count_0_7  = (count >> 0) & 0xff;
+		ctbl->cfis.count_0_7  = (num_blocks >> 0) & 0xff;
+		ctbl->cfis.count_8_15 = (num_blocks >> 8) & 0xff;
 		ctbl->cfis.lba_0_7    = (lba >> 0) & 0xff;
 		ctbl->cfis.lba_8_15   = (lba >> 8) & 0xff;
 		ctbl->cfis.lba_16_23  = (lba >> 16) & 0xff;
-		ctbl->cfis.device = 0x40 | ((lba >> 24) & 0xf);
+		ctbl->cfis.lba_24_31  = (lba >> 24) & 0xff;
+		ctbl->cfis.lba_32_39  = (lba >> 32) & 0xff;
+		ctbl->cfis.lba_40_47  = (lba >> 40) & 0xff;
+		ctbl->cfis.device = 0x40;
 	}
-}
-
-void Port::CommandDMA(uint8_t cmd, size_t size, bool write)
-{
-	if ( 0 < size )
+	else if ( num_blocks )
 	{
-		assert(size <= Page::Size());
-		assert((size & 1) == 0); /* sizes & addresses must be 2-byte aligned */
+		ctbl->cfis.count_0_7  = (num_blocks >> 0) & 0xff;
+		ctbl->cfis.lba_0_7    = (lba >> 0) & 0xff;
+		ctbl->cfis.lba_8_15   = (lba >> 8) & 0xff;
+		ctbl->cfis.lba_16_23  = (lba >> 16) & 0xff;
+		ctbl->cfis.device = 0x40 | ((lba >> 24) & 0xf);
 	}
 
 	// Set up the command header.
 	uint16_t fis_length = 5 /* dwords */;
-	uint16_t prdtl = size ? 1 : 0;
-	uint16_t clist_0_dw0l = fis_length;
+	uint16_t dw0l = fis_length;
 	if ( write )
-		clist_0_dw0l |= COMMAND_HEADER_DW0_WRITE;
-	clist[0].dw0l = clist_0_dw0l;
-	clist[0].prdtl = prdtl;
-	clist[0].prdbc = 0;
+		dw0l |= COMMAND_HEADER_DW0_WRITE;
+	clist[slot].dw0l = dw0l;
+	clist[slot].prdtl = prdtl;
+	clist[slot].prdbc = 0;
+
+	// Execute the command.
+	ScopedLock lock(&port_lock);
+	uint32_t bit = 1U << slot;
+	slots_issued |= bit;
+	if ( queued )
+		regs->pxsact = bit;
+	regs->pxci = bit;
+	ahci_port_flush(regs);
+}
 
-	// Set up the physical region descriptor.
-	if ( prdtl )
+bool Port::AwaitCommand(unsigned int slot, unsigned int msecs)
+{
+	uint32_t bit = 1U << slot;
+	Clock* clock = Time::GetClock(CLOCK_BOOTTIME);
+	struct timespec now;
+	clock->Get(&now, NULL);
+	struct timespec timeout =
+		timespec_make(msecs / 1000, (msecs % 1000) * 1000000L);
+	struct timespec deadline = timespec_add(now, timeout);
+	ScopedLock lock(&port_lock);
+	// The interrupt work completes the command, or the port is recovered after
+	// an error and the command is failed. The device owns the memory until
+	// then, so the wait can't be cancelled by a signal.
+	while ( slots_issued & bit )
 	{
-		uint32_t prdt_0_dbc = size - 1;
-		uint32_t prdt_0_dw3 = prdt_0_dbc;
-		prdt[0].dba  = (uint64_t) dma_physical_frame >>  0 & 0xFFFFFFFF;
-		prdt[0].dbau = (uint64_t) dma_physical_frame >> 32 & 0xFFFFFFFF;
-		prdt[0].reserved1 = 0;
-		prdt[0].dw3 = prdt_0_dw3;
+		if ( kthread_cond_wait_until(&completion_conds[slot], &port_lock,
+		                             clock, deadline) )
+			continue;
+		Complete();
+		if ( slots_issued & bit )
+			Recover("command timed out");
 	}
+	if ( slots_failed & bit )
+		return errno = EIO, false;
+	return true;
+}
 
-	// Set up the command table.
-	ctbl->cfis.type = 0x27;
-	ctbl->cfis.pm_port = 0;
-	ctbl->cfis.c_bit = 1;
-	ctbl->cfis.command = cmd;
+// Wake the threads waiting for the commands that have completed, and mark the
+// block requests that have completed as finished. The port lock must be held.
+void Port::Complete()
+{
+	if ( error_signaled )
+		Recover("command failed");
+	uint32_t done = slots_issued & ~(regs->pxci | regs->pxsact);
+	slots_issued &= ~done;
+	for ( unsigned int i = 0; i < slot_count; i++ )
+	{
+		if ( !(done & (1U << i)) )
+			continue;
+		if ( slot_requests[i] )
+			slots_finished |= 1U << i;
+		else
+			kthread_cond_signal(&completion_conds[i]);
+	}
+}
 
-	// Anticipate we will be delivered an IRQ.
-	PrepareAwaitInterrupt();
-	transfer_in_progress = true;
-	transfer_size = size;
-	transfer_is_write = write;
+// Complete the finished block requests through the block queue, which issues
+// more requests, so the port lock must not be held.
+void Port::FinishRequests()
+{
+	struct block_request* requests[32];
+	int errnums[32];
+	size_t count = 0;
+	kthread_mutex_lock(&port_lock);
+	for ( unsigned int i = 0; i < slot_count; i++ )
+	{
+		uint32_t bit = 1U << i;
+		if ( !(slots_finished & bit) )
+			continue;
+		requests[count] = slot_requests[i];
+		errnums[count] = slots_failed & bit ? EIO : 0;
+		count++;
+		slot_requests[i] = NULL;
+		slots_used &= ~bit;
+	}
+	slots_finished = 0;
+	if ( count )
+		kthread_cond_broadcast(&slot_cond);
+	kthread_mutex_unlock(&port_lock);
+	for ( size_t i = 0; i < count; i++ )
+		queue->Complete(requests[i], errnums[i]);
+}
 
-	// Execute the command.
-	regs->pxci = 1;
+// The command engine stops on errors and stopping it cancels every outstanding
+// command, as the device also aborts all its queued commands on an error. Fail
+// the commands that hadn't completed and restart the engine. The port lock must
+// be held.
+void Port::Recover(const char* what)
+{
+	uint32_t lost = slots_issued & (regs->pxci | regs->pxsact);
+	LogF("error: %s (tfd 0x%x, serr 0x%x), failing %u commands", what,
+	     (unsigned int) regs->pxtfd, (unsigned int) regs->pxserr,
+	     __builtin_popcount(lost));
+	regs->pxcmd = regs->pxcmd & ~PXCMD_ST;
+	ahci_port_flush(regs);
+	if ( !WaitClear(&regs->pxcmd, PXCMD_CR, false, 500) )
+		LogF("error: timeout waiting for PXCMD_CR to clear");
+	regs->pxserr = regs->pxserr;
+	regs->pxis = regs->pxis;
+	ahci_port_flush(regs);
+	if ( (regs->pxtfd & (ATA_STATUS_BSY | ATA_STATUS_DRQ)) &&
+	     (hba->regs->cap & CAP_SCLO) )
+	{
+		regs->pxcmd = regs->pxcmd | PXCMD_CLO;
+		ahci_port_flush(regs);
+		if ( !WaitClear(&regs->pxcmd, PXCMD_CLO, false, 500) )
+			LogF("error: timeout waiting for PXCMD_CLO to clear");
+	}
+	regs->pxcmd = regs->pxcmd | PXCMD_ST;
 	ahci_port_flush(regs);
+	error_signaled = false;
+	slots_failed |= lost;
+	slots_issued &= ~lost;
+	for ( unsigned int i = 0; i < slot_count; i++ )
+	{
+		if ( !(lost & (1U << i)) )
+			continue;
+		if ( slot_requests[i] )
+			slots_finished |= 1U << i;
+		else
+			kthread_cond_signal(&completion_conds[i]);
+	}
 }
 
-bool Port::FinishTransferDMA()
+// Run a command that can't be queued with other commands, once the commands in
+// flight have completed.
+bool Port::Command(uint8_t cmd, size_t size, unsigned int msecs)
 {
-	assert(transfer_in_progress);
+	kthread_mutex_lock(&port_lock);
+	while ( draining )
+		kthread_cond_wait(&slot_cond, &port_lock);
+	draining = true;
+	while ( slots_used )
+		kthread_cond_wait(&slot_cond, &port_lock);
+	slots_used = 1U << 0;
+	slots_failed = 0;
+	kthread_mutex_unlock(&port_lock);
+	IssueCommand(0, cmd, 0, 0, BounceBuffer(0, size), false);
+	bool result = AwaitCommand(0, msecs);
+	int errnum = errno;
+	kthread_mutex_lock(&port_lock);
+	slots_used = 0;
+	draining = false;
+	kthread_cond_broadcast(&slot_cond);
+	kthread_mutex_unlock(&port_lock);
+	// Issue the block requests that were queued in the mean time.
+	if ( queue )
+		queue->Dispatch();
+	errno = errnum;
+	return result;
+}
 
-	// Wait for an interrupt to arrive.
-	if ( !AwaitInterrupt(10000 /*ms*/) )
+size_t Port::IssueRequests(struct block_request** requests, size_t count)
+{
+	uint8_t read_cmd = is_ncq ? ATA_CMD_READ_FPDMA_QUEUED :
+	                   is_lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+	uint8_t write_cmd = is_ncq ? ATA_CMD_WRITE_FPDMA_QUEUED :
+	                    is_lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+	for ( size_t i = 0; i < count; i++ )
 	{
-		const char* op = transfer_is_write ? "write" : "read";
-		LogF("error: %s timed out", op);
-		transfer_in_progress = false;
-		return errno = EIO, false;
+		struct block_request* request = requests[i];
+		int slot = ClaimSlot();
+		if ( slot < 0 )
+			return i;
+		size_t num_blocks = 0;
+		for ( struct block_request* r = request; r; r = r->merge_next )
+			num_blocks += r->block_count;
+		slot_requests[slot] = request;
+		IssueCommand(slot, request->write ? write_cmd : read_cmd,
+		             request->block_index, num_blocks,
+		             RequestBuffer(slot, request), request->write);
 	}
+	return count;
+}
 
-	while ( transfer_is_write && regs->pxtfd & ATA_STATUS_BSY )
-		kthread_yield();
+// A block request has been in flight for too long, so collect any missed
+// completions, and otherwise recover the port and fail the commands in flight.
+void Port::ExpireRequests()
+{
+	kthread_mutex_lock(&port_lock);
+	Complete();
+	if ( slots_issued )
+		Recover("command timed out");
+	kthread_mutex_unlock(&port_lock);
+	FinishRequests();
+}
 
-	transfer_in_progress = false;
-	return true;
+BlockQueue* Port::GetBlockQueue()
+{
+	return queue;
 }
 
 off_t Port::GetSize()
@@ -553,139 +855,25 @@ const unsigned char* Port::GetATAIdentify(size_t* size_ptr)
 int Port::sync(ioctx_t* ctx)
 {
 	(void) ctx;
-	ScopedLock lock(&port_lock);
-	if ( transfer_in_progress && !FinishTransferDMA() )
-		return -1;
-	PrepareAwaitInterrupt();
 	uint8_t cmd = is_lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE;
-	CommandDMA(cmd, 0, false);
 	// TODO: This might take longer than 30 seconds according to the spec. But
 	//       how long? Let's say twice that?
-	if ( !AwaitInterrupt(2 * 30000 /*ms*/) )
-	{
-		LogF("error: cache flush timed out");
-		transfer_in_progress = false;
-		return errno = EIO, -1;
-	}
-	transfer_in_progress = false;
-	if ( regs->pxtfd & (ATA_STATUS_ERR | ATA_STATUS_DF) )
+	if ( !Command(cmd, 0, 2 * 30000 /*ms*/) )
 	{
-		LogF("error: IO error");
-		return errno = EIO, -1;
+		LogF("error: cache flush failed");
+		return -1;
 	}
 	return 0;
 }
 
 ssize_t Port::pread(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off)
 {
-	ScopedLock lock(&port_lock);
-	ssize_t result = 0;
-	while ( count )
-	{
-		if ( device_size <= off )
-			break;
-		if ( (uintmax_t) device_size - off < (uintmax_t) count )
-			count = (size_t) device_size - off;
-		uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
-		uintmax_t block_offset = (uintmax_t) off % (uintmax_t) block_size;
-		uintmax_t amount = block_offset + count;
-		if ( Page::Size() < amount )
-			amount = Page::Size();
-		size_t num_blocks = (amount + block_size - 1) / block_size;
-		uintmax_t full_amount = num_blocks * block_size;
-		// If an asynchronous operation is in progress, let it finish.
-		if ( transfer_in_progress && !FinishTransferDMA() )
-			return result ? result : -1;
-		unsigned char* dma_data = (unsigned char*) dma_alloc.from;
-		unsigned char* data = dma_data + block_offset;
-		size_t data_size = amount - block_offset;
-		Seek(block_index, num_blocks);
-		uint8_t cmd = is_lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
-		CommandDMA(cmd, (size_t) full_amount, false);
-		if ( !FinishTransferDMA() )
-			return result ? result : -1;
-		if ( !ctx->copy_to_dest(buf, data, data_size) )
-			return result ? result : -1;
-		buf += data_size;
-		count -= data_size;
-		result += data_size;
-		off += data_size;
-	}
-	return result;
+	return queue->Transfer(ctx, buf, count, off, false);
 }
 
 ssize_t Port::pwrite(ioctx_t* ctx, const unsigned char* buf, size_t count, off_t off)
 {
-	ScopedLock lock(&port_lock);
-	ssize_t result = 0;
-	while ( count )
-	{
-		if ( device_size <= off )
-			break;
-		if ( (uintmax_t) device_size - off < (uintmax_t) count )
-			count = (size_t) device_size - off;
-		uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
-		uintmax_t block_offset = (uintmax_t) off % (uintmax_t) block_size;
-		uintmax_t amount = block_offset + count;
-		if ( Page::Size() < amount )
-			amount = Page::Size();
-		size_t num_blocks = (amount + block_size - 1) / block_size;
-		uintmax_t full_amount =  num_blocks * block_size;
-		// If an asynchronous operation is in progress, let it finish.
-		if ( transfer_in_progress && !FinishTransferDMA() )
-			return result ? result : -1;
-		unsigned char* dma_data = (unsigned char*) dma_alloc.from;
-		unsigned char* data = dma_data + block_offset;
-		size_t data_size = amount - block_offset;
-		if ( block_offset || amount < full_amount )
-		{
-			Seek(block_index, num_blocks);
-			uint8_t cmd = is_lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
-			CommandDMA(cmd, (size_t) full_amount, false);
-			if ( !FinishTransferDMA() )
-				return result ? result : -1;
-		}
-		if ( !ctx->copy_from_src(data, buf, data_size) )
-			return result ? result : -1;
-		Seek(block_index, num_blocks);
-		uint8_t cmd = is_lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
-		CommandDMA(cmd, (size_t) full_amount, true);
-		// Let the transfer finish asynchronously so the caller can prepare the
-		// next write operation to keep the write pipeline busy.
-		buf += data_size;
-		count -= data_size;
-		result += data_size;
-		off += data_size;
-	}
-	return result;
-}
-
-void Port::PrepareAwaitInterrupt()
-{
-	interrupt_signaled = false;
-}
-
-bool Port::AwaitInterrupt(unsigned int msecs)
-{
-	struct timespec timeout = timespec_make(msecs / 1000, (msecs % 1000) * 1000000L);
-	Clock* clock = Time::GetClock(CLOCK_BOOTTIME);
-	struct timespec begun;
-	clock->Get(&begun, NULL);
-	while ( true )
-	{
-		struct timespec now;
-		clock->Get(&now, NULL);
-		if ( interrupt_signaled )
-			return true;
-		struct timespec elapsed = timespec_sub(now, begun);
-		if ( timespec_le(timeout, elapsed) )
-			return errno = ETIMEDOUT, false;
-		// TODO: Can't safely back out here unless the pending operation is
-		//       is properly cancelled.
-		//if ( Signal::IsPending() )
-		//	return errno = EINTR, false;
-		kthread_yield();
-	}
+	return queue->Transfer(ctx, (unsigned char*) buf, count, off, true);
 }
 
 void Port::OnInterrupt()
@@ -700,16 +888,29 @@ void Port::OnInterrupt()
 
 	// Handle error interrupts.
 	if ( is & PORT_INTR_ERROR )
-	{
 		regs->pxserr = regs->pxserr;
-		// TODO: How exactly should this be handled?
-	}
 
-	if ( !interrupt_signaled )
-	{
-		interrupt_signaled = true;
-		// TODO: Priority schedule the blocking thread now.
-	}
+	// The command engine has stopped and the commands in flight must be failed
+	// and the port restarted.
+	if ( is & (PXIE_TFEE | PXIE_HBFE | PXIE_HBDE | PXIE_IFE) )
+		error_signaled = true;
+
+	// The waiting threads are woken by the interrupt worker thread, as the
+	// port lock can't be taken in the interrupt handler.
+	if ( !__atomic_exchange_n(&interrupt_work_scheduled, true,
+	                          __ATOMIC_SEQ_CST) )
+		Interrupt::ScheduleWork(&interrupt_work);
+}
+
+void Port::InterruptWork()
+{
+	kthread_mutex_lock(&port_lock);
+	// Interrupts from now on schedule the work again, and the completions are
+	// found by checking the command issue registers afterwards.
+	__atomic_store_n(&interrupt_work_scheduled, false, __ATOMIC_SEQ_CST);
+	Complete();
+	kthread_mutex_unlock(&port_lock);
+	FinishRequests();
 }
 
 } // namespace AHCI
@@ -26,7 +26,9 @@
 #include <stdint.h>
 
 #include <sortix/kernel/addralloc.h>
+#include <sortix/kernel/blockqueue.h>
 #include <sortix/kernel/harddisk.h>
+#include <sortix/kernel/interrupt.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kthread.h>
 
@@ -35,9 +37,9 @@ namespace AHCI {
 
 struct command_header;
 struct command_table;
+struct prd;
 struct fis;
 struct port_regs;
-struct prd;
 
 class HBA;
 
@@ -62,24 +64,38 @@ public:
 	virtual int sync(ioctx_t* ctx);
 	virtual ssize_t pread(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off);
 	virtual ssize_t pwrite(ioctx_t* ctx, const unsigned char* buf, size_t count, off_t off);
+	virtual BlockQueue* GetBlockQueue();
+	virtual size_t IssueRequests(struct block_request** requests, size_t count);
+	virtual void ExpireRequests();
 
 public:
 	bool Initialize();
 	bool FinishInitialize();
 	void OnInterrupt();
+	void InterruptWork();
 
 private:
 	__attribute__((format(printf, 2, 3)))
 	void LogF(const char* format, ...);
 	bool Reset();
-	void Seek(blkcnt_t block_index, size_t count);
-	void CommandDMA(uint8_t cmd, size_t size, bool write);
-	bool FinishTransferDMA();
-	void PrepareAwaitInterrupt();
-	bool AwaitInterrupt(unsigned int msescs);
+	int ClaimSlot();
+	volatile struct prd* PRDT(unsigned int slot);
+	uint16_t BounceBuffer(unsigned int slot, size_t size);
+	uint16_t RequestBuffer(unsigned int slot, struct block_request* request);
+	void IssueCommand(unsigned int slot, uint8_t cmd, blkcnt_t block_index,
+	                  size_t num_blocks, uint16_t prdtl, bool write);
+	bool AwaitCommand(unsigned int slot, unsigned int msecs);
+	void Complete();
+	void FinishRequests();
+	bool Command(uint8_t cmd, size_t size, unsigned int msecs);
+	void Recover(const char* what);
 
 private:
 	kthread_mutex_t port_lock;
+	kthread_cond_t slot_cond;
+	kthread_cond_t completion_conds[32];
+	struct interrupt_work interrupt_work;
+	struct block_request* slot_requests[32];
 	unsigned char identify_data[512];
 	char serial[20 + 1];
 	char revision[8 + 1];
@@ -90,24 +106,31 @@ private:
 	volatile struct port_regs* regs;
 	volatile struct command_header* clist;
 	volatile struct fis* fis;
-	volatile struct command_table* ctbl;
-	volatile struct prd* prdt;
-	addr_t control_physical_frame;
+	volatile struct command_table* ctbls[32];
+	addr_t control_physical_frames[1 + 32];
 	addr_t dma_physical_frame;
+	size_t control_pages;
+	size_t control_pages_mapped;
+	BlockQueue* queue;
 	uint32_t port_index;
-	bool is_control_page_mapped;
+	uint32_t slot_count;
+	uint32_t queue_depth;
+	uint32_t slots_used;
+	uint32_t slots_issued;
+	uint32_t slots_failed;
+	uint32_t slots_finished;
 	bool is_dma_page_mapped;
 	bool is_lba48;
+	bool is_ncq;
+	bool draining;
 	off_t device_size;
 	blksize_t block_count;
 	blkcnt_t block_size;
 	uint16_t cylinder_count;
 	uint16_t head_count;
 	uint16_t sector_count;
-	volatile bool interrupt_signaled;
-	bool transfer_in_progress;
-	size_t transfer_size;
-	bool transfer_is_write;
+	volatile bool error_signaled;
+	bool interrupt_work_scheduled;
 
 };
 
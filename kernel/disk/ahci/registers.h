@@ -49,6 +49,8 @@ namespace AHCI {
 #define ATA_CMD_FLUSH_CACHE             0xE7 /**< FLUSH CACHE. */
 #define ATA_CMD_FLUSH_CACHE_EXT         0xEA /**< FLUSH CACHE EXT. */
 #define ATA_CMD_IDENTIFY                0xEC /**< IDENTIFY DEVICE. */
+#define ATA_CMD_READ_FPDMA_QUEUED       0x60 /**< READ FPDMA QUEUED. */
+#define ATA_CMD_WRITE_FPDMA_QUEUED      0x61 /**< WRITE FPDMA QUEUED. */
 #endif
 
 struct fis
@@ -29,6 +29,7 @@
 
 #include <sortix/kernel/addralloc.h>
 #include <sortix/kernel/clock.h>
+#include <sortix/kernel/copy.h>
 #include <sortix/kernel/ioport.h>
 #include <sortix/kernel/kthread.h>
 #include <sortix/kernel/log.h>
@@ -63,6 +64,11 @@ static void sleep_400_nanoseconds()
 	clock->SleepDelay(delay);
 }
 
+static void Port__InterruptWork(void* context)
+{
+	((Port*) context)->InterruptWork();
+}
+
 Port::Port(Channel* channel, unsigned int port_index)
 {
 	this->channel = channel;
@@ -72,6 +78,11 @@ Port::Port(Channel* channel, unsigned int port_index)
 	is_control_page_mapped = false;
 	is_dma_page_mapped = false;
 	interrupt_signaled = false;
+	interrupt_work_scheduled = false;
+	interrupt_lock = KTHREAD_MUTEX_INITIALIZER;
+	interrupt_cond = KTHREAD_COND_INITIALIZER;
+	interrupt_work.handler = Port__InterruptWork;
+	interrupt_work.context = this;
 	transfer_in_progress = false;
 	control_physical_frame = 0;
 	dma_physical_frame = 0;
@@ -81,6 +92,11 @@ Port::~Port()
 {
 	if ( transfer_in_progress )
 		FinishTransferDMA();
+	// Let any scheduled interrupt work finish before the port goes away.
+	while ( __atomic_load_n(&interrupt_work_scheduled, __ATOMIC_SEQ_CST) )
+		kthread_yield();
+	kthread_mutex_lock(&interrupt_lock);
+	kthread_mutex_unlock(&interrupt_lock);
 	if ( is_control_page_mapped )
 	{
 		Memory::Unmap(control_alloc.from);
@@ -437,6 +453,91 @@ void Port::Seek(blkcnt_t block_index, size_t count)
 	outport8(channel->port_base + REG_LBA_HIGH, lba >> 16 & 0xFF);
 }
 
+// The physical region descriptor table fills the control page.
+static const size_t PRDT_MAX = 4096 / sizeof(struct prd);
+
+// Returns how much of the request can be transferred straight to and from the
+// caller's pages, which must be whole blocks at an even address and fit in the
+// physical region descriptor table with a descriptor per page.
+size_t Port::DirectSize(const unsigned char* buf, size_t count, off_t off)
+{
+	if ( is_packet_interface || !is_using_dma )
+		return 0;
+	if ( (uintmax_t) off % (uintmax_t) block_size || (uintptr_t) buf & 1 )
+		return 0;
+	size_t size = PRDT_MAX * Page::Size() - (uintptr_t) buf % Page::Size();
+	size_t blocks_max = is_lba48 ? 65535 : 255;
+	if ( blocks_max * block_size < size )
+		size = blocks_max * block_size;
+	if ( count < size )
+		size = count;
+	return size - size % block_size;
+}
+
+// Describe the caller's buffer in the physical region descriptor table,
+// merging physically contiguous pages within the same 64 KiB region as the
+// descriptors can't cross such a boundary. Returns the number of descriptors,
+// or zero if any of the pages couldn't be pinned or are out of reach of the
+// bus master.
+size_t Port::PinBuffer(ioctx_t* ctx, unsigned char* buf, size_t size,
+                       bool write)
+{
+	size_t prdtl = 0;
+	uint64_t prd_end = 0;
+	size_t offset = 0;
+	while ( offset < size )
+	{
+		uintptr_t ptr = (uintptr_t) buf + offset;
+		size_t page_offset = ptr % Page::Size();
+		size_t amount = Page::Size() - page_offset;
+		if ( size - offset < amount )
+			amount = size - offset;
+		addr_t physical;
+		if ( !PinPage(ctx, (const void*) ptr, !write, &physical) )
+		{
+			UnpinBuffer(ctx, prdtl);
+			return 0;
+		}
+		if ( 0x100000000ULL < (uint64_t) physical + Page::Size() )
+		{
+			UnpinPage(ctx, physical);
+			UnpinBuffer(ctx, prdtl);
+			return 0;
+		}
+		uint64_t address = (uint64_t) physical + page_offset;
+		if ( prdtl && address == prd_end && (address & 0xFFFF) )
+		{
+			size_t prd_size = prdt[prdtl-1].count;
+			prdt[prdtl-1].count = prd_size + amount; // 65536 wraps to 0.
+		}
+		else
+		{
+			assert(prdtl < PRDT_MAX);
+			prdt[prdtl].physical = address & 0xFFFFFFFF;
+			prdt[prdtl].count = amount;
+			prdt[prdtl].flags = 0;
+			prdtl++;
+		}
+		prd_end = address + amount;
+		offset += amount;
+	}
+	prdt[prdtl-1].flags = PRD_FLAG_EOT;
+	return prdtl;
+}
+
+void Port::UnpinBuffer(ioctx_t* ctx, size_t prdtl)
+{
+	for ( size_t i = 0; i < prdtl; i++ )
+	{
+		addr_t address = prdt[i].physical;
+		size_t count = prdt[i].count;
+		size_t size = count ? count : 65536;
+		for ( addr_t page = Page::AlignDown(address); page < address + size;
+		      page += Page::Size() )
+			UnpinPage(ctx, page);
+	}
+}
+
 void Port::CommandDMA(uint8_t cmd, size_t size, bool write)
 {
 	assert(size);
@@ -449,6 +550,11 @@ void Port::CommandDMA(uint8_t cmd, size_t size, bool write)
 	prdt->count = size;
 	prdt->flags = PRD_FLAG_EOT;
 
+	StartDMA(cmd, size, write);
+}
+
+void Port::StartDMA(uint8_t cmd, size_t size, bool write)
+{
 	// Tell the hardware the location of the PRDT.
 	uint32_t bm_prdt = control_physical_frame >> 0 & 0xFFFFFFFF;
 	outport32(channel->busmaster_base + BUSMASTER_REG_PDRT, bm_prdt);
@@ -719,6 +825,9 @@ ssize_t Port::pread(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off)
 	ssize_t result = 0;
 	while ( count )
 	{
+		// Stop between the commands if a signal arrives.
+		if ( Signal::IsPending() )
+			return result ? result : (errno = EINTR, -1);
 		ScopedLock lock(&channel->hw_lock);
 		channel->SelectDrive(port_index);
 		if ( device_size <= off )
@@ -735,6 +844,25 @@ ssize_t Port::pread(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off)
 		// If an asynchronous operation is in progress, let it finish.
 		if ( transfer_in_progress && !FinishTransferDMA() )
 			return result ? result : -1;
+		// Transfer whole blocks straight into the caller's pages if possible.
+		size_t direct_size = DirectSize(buf, count, off);
+		size_t pinned =
+			direct_size ? PinBuffer(ctx, buf, direct_size, false) : 0;
+		if ( pinned )
+		{
+			Seek(block_index, direct_size / block_size);
+			uint8_t cmd = is_lba48 ? CMD_READ_DMA_EXT : CMD_READ_DMA;
+			StartDMA(cmd, direct_size, false);
+			bool success = FinishTransferDMA();
+			UnpinBuffer(ctx, pinned);
+			if ( !success )
+				return result ? result : -1;
+			buf += direct_size;
+			count -= direct_size;
+			result += direct_size;
+			off += direct_size;
+			continue;
+		}
 		unsigned char* dma_data = (unsigned char*) dma_alloc.from;
 		unsigned char* data = dma_data + block_offset;
 		size_t data_size = amount - block_offset;
@@ -788,6 +916,9 @@ ssize_t Port::pwrite(ioctx_t* ctx, const unsigned char* buf, size_t count, off_t
 	ssize_t result = 0;
 	while ( count )
 	{
+		// Stop between the commands if a signal arrives.
+		if ( Signal::IsPending() )
+			return result ? result : (errno = EINTR, -1);
 		ScopedLock lock(&channel->hw_lock);
 		channel->SelectDrive(port_index);
 		if ( device_size <= off )
@@ -804,6 +935,27 @@ ssize_t Port::pwrite(ioctx_t* ctx, const unsigned char* buf, size_t count, off_t
 		// If an asynchronous operation is in progress, let it finish.
 		if ( transfer_in_progress && !FinishTransferDMA() )
 			return result ? result : -1;
+		// Transfer whole blocks straight from the caller's pages if possible,
+		// waiting for the transfer as the pages are only pinned meanwhile.
+		size_t direct_size = DirectSize(buf, count, off);
+		unsigned char* src = (unsigned char*) buf;
+		size_t pinned =
+			direct_size ? PinBuffer(ctx, src, direct_size, true) : 0;
+		if ( pinned )
+		{
+			Seek(block_index, direct_size / block_size);
+			uint8_t cmd = is_lba48 ? CMD_WRITE_DMA_EXT : CMD_WRITE_DMA;
+			StartDMA(cmd, direct_size, true);
+			bool success = FinishTransferDMA();
+			UnpinBuffer(ctx, pinned);
+			if ( !success )
+				return result ? result : -1;
+			buf += direct_size;
+			count -= direct_size;
+			result += direct_size;
+			off += direct_size;
+			continue;
+		}
 		unsigned char* dma_data = (unsigned char*) dma_alloc.from;
 		unsigned char* data = dma_data + block_offset;
 		size_t data_size = amount - block_offset;
@@ -861,23 +1013,19 @@ bool Port::AwaitInterrupt(unsigned int msecs)
 {
 	struct timespec timeout = timespec_make(msecs / 1000, (msecs % 1000) * 1000000L);
 	Clock* clock = Time::GetClock(CLOCK_BOOTTIME);
-	struct timespec begun;
-	clock->Get(&begun, NULL);
-	while ( true )
-	{
-		struct timespec now;
-		clock->Get(&now, NULL);
-		if ( interrupt_signaled )
-			return true;
-		struct timespec elapsed = timespec_sub(now, begun);
-		if ( timespec_le(timeout, elapsed) )
+	struct timespec now;
+	clock->Get(&now, NULL);
+	struct timespec deadline = timespec_add(now, timeout);
+	// The device owns the memory until the command completes, so the wait can't
+	// be cancelled by a signal.
+	ScopedLock lock(&interrupt_lock);
+	while ( !interrupt_signaled )
+	{
+		if ( !kthread_cond_wait_until(&interrupt_cond, &interrupt_lock, clock,
+		                              deadline) && !interrupt_signaled )
 			return errno = ETIMEDOUT, false;
-		// TODO: Can't safely back out here unless the pending operation is
-		//       is properly cancelled.
-		//if ( Signal::IsPending() )
-		//	return errno = EINTR, false;
-		kthread_yield();
 	}
+	return true;
 }
 
 void Port::OnInterrupt()
@@ -894,9 +1042,20 @@ void Port::OnInterrupt()
 	if ( !interrupt_signaled )
 	{
 		interrupt_signaled = true;
-		// TODO: Priority schedule the blocking thread now.
+		// The waiting thread is woken by the interrupt worker thread, as the
+		// interrupt lock can't be taken in the interrupt handler.
+		if ( !__atomic_exchange_n(&interrupt_work_scheduled, true,
+		                          __ATOMIC_SEQ_CST) )
+			Interrupt::ScheduleWork(&interrupt_work);
 	}
 }
 
+void Port::InterruptWork()
+{
+	ScopedLock lock(&interrupt_lock);
+	__atomic_store_n(&interrupt_work_scheduled, false, __ATOMIC_SEQ_CST);
+	kthread_cond_signal(&interrupt_cond);
+}
+
 } // namespace ATA
 } // namespace Sortix
@@ -26,6 +26,7 @@
 
 #include <sortix/kernel/addralloc.h>
 #include <sortix/kernel/harddisk.h>
+#include <sortix/kernel/interrupt.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kthread.h>
 
@@ -68,7 +69,11 @@ private:
 	bool ReadCapacityATAPI(bool no_error = false);
 	void Seek(blkcnt_t block_index, size_t count);
 	bool CommandATAPI(size_t response_size, bool no_error = false);
+	size_t DirectSize(const unsigned char* buf, size_t count, off_t off);
+	size_t PinBuffer(ioctx_t* ctx, unsigned char* buf, size_t size, bool write);
+	void UnpinBuffer(ioctx_t* ctx, size_t prdtl);
 	void CommandDMA(uint8_t cmd, size_t size, bool write);
+	void StartDMA(uint8_t cmd, size_t size, bool write);
 	void CommandPIO(uint8_t cmd, size_t size, bool write);
 	bool FinishTransferDMA();
 	bool TransferPIO(size_t size, bool write, bool no_error = false);
@@ -76,6 +81,9 @@ private:
 	bool AwaitInterrupt(unsigned int msescs);
 	void OnInterrupt();
 
+public:
+	void InterruptWork();
+
 private:
 	unsigned char identify_data[512];
 	char serial[20 + 1];
@@ -100,6 +108,10 @@ private:
 	uint16_t head_count;
 	uint16_t sector_count;
 	volatile bool interrupt_signaled;
+	bool interrupt_work_scheduled;
+	kthread_mutex_t interrupt_lock;
+	kthread_cond_t interrupt_cond;
+	struct interrupt_work interrupt_work;
 	bool transfer_in_progress;
 	size_t transfer_size;
 	bool transfer_is_write;
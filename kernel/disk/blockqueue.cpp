@@ -0,0 +1,544 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * disk/blockqueue.cpp
+ * Block request queue and I/O scheduler for harddisks.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <timespec.h>
+
+#include <sortix/clock.h>
+
+#include <sortix/kernel/blockqueue.h>
+#include <sortix/kernel/clock.h>
+#include <sortix/kernel/copy.h>
+#include <sortix/kernel/harddisk.h>
+#include <sortix/kernel/ioctx.h>
+#include <sortix/kernel/kthread.h>
+#include <sortix/kernel/memorymanagement.h>
+#include <sortix/kernel/signal.h>
+#include <sortix/kernel/time.h>
+
+namespace Sortix {
+
+// Queued requests are served in block order, but reads are served after half a
+// second at most and writes after five seconds, so a sweep across the disk
+// can't starve them. Reads are given priority as a thread is usually waiting.
+static const unsigned int READ_EXPIRE_MS = 500;
+static const unsigned int WRITE_EXPIRE_MS = 5000;
+
+// The requests in flight on the device are expired if they haven't completed
+// within this many milliseconds.
+static const unsigned int REQUEST_TIMEOUT_MS = 10000;
+
+// The number of requests a transfer keeps in flight.
+static const size_t TRANSFER_WINDOW = 32;
+
+// A part of a transfer for the caller, which is either done straight to and
+// from the caller's pages or through a bounce buffer.
+struct block_transfer
+{
+	struct block_request request;
+	unsigned char* buf;
+	unsigned char* bounce;
+	size_t bounce_offset;
+	size_t data_size;
+};
+
+static struct timespec Later(struct timespec now, unsigned int msecs)
+{
+	struct timespec delay =
+		timespec_make(msecs / 1000, (msecs % 1000) * 1000000L);
+	return timespec_add(now, delay);
+}
+
+static struct timespec Now()
+{
+	struct timespec now;
+	Time::GetClock(CLOCK_BOOTTIME)->Get(&now, NULL);
+	return now;
+}
+
+static blkcnt_t ChainBlocks(struct block_request* request)
+{
+	blkcnt_t count = 0;
+	for ( ; request; request = request->merge_next )
+		count += request->block_count;
+	return count;
+}
+
+static size_t ChainSegments(struct block_request* request)
+{
+	size_t count = 0;
+	for ( ; request; request = request->merge_next )
+		count += request->segment_count;
+	return count;
+}
+
+static void UnpinSegments(ioctx_t* ctx, struct block_request* request)
+{
+	for ( size_t i = 0; i < request->segment_count; i++ )
+		UnpinPage(ctx, Page::AlignDown(request->segments[i].physical));
+	request->segment_count = 0;
+}
+
+// Describe each page of the buffer with a segment, pinning the pages so they
+// stay in place while the device accesses them.
+static bool PinSegments(ioctx_t* ctx, struct block_request* request,
+                        unsigned char* buf, size_t size)
+{
+	request->segment_count = 0;
+	size_t offset = 0;
+	while ( offset < size )
+	{
+		uintptr_t ptr = (uintptr_t) buf + offset;
+		size_t page_offset = ptr % Page::Size();
+		size_t amount = Page::Size() - page_offset;
+		if ( size - offset < amount )
+			amount = size - offset;
+		addr_t physical;
+		if ( !PinPage(ctx, (const void*) ptr, !request->write, &physical) )
+		{
+			UnpinSegments(ctx, request);
+			return false;
+		}
+		struct block_segment* segment =
+			&request->segments[request->segment_count++];
+		segment->physical = physical + page_offset;
+		segment->size = amount;
+		offset += amount;
+	}
+	return true;
+}
+
+static void FreeTransfer(struct block_transfer* transfer)
+{
+	delete[] transfer->request.segments;
+	delete[] transfer->bounce;
+	delete transfer;
+}
+
+BlockQueue::BlockQueue(Harddisk* harddisk, size_t depth, blkcnt_t blocks_max,
+                       size_t segments_max)
+{
+	queue_lock = KTHREAD_MUTEX_INITIALIZER;
+	completion_cond = KTHREAD_COND_INITIALIZER;
+	this->harddisk = harddisk;
+	sort_first = NULL;
+	sort_last = NULL;
+	fifo_first = NULL;
+	fifo_last = NULL;
+	device_size = harddisk->GetSize();
+	block_size = harddisk->GetBlockSize();
+	this->blocks_max = blocks_max;
+	head_position = 0;
+	this->segments_max = segments_max;
+	this->depth = depth;
+	in_flight = 0;
+}
+
+BlockQueue::~BlockQueue()
+{
+}
+
+// Whether the second request can be chained after the first request without
+// the merged request growing too large for the device. The queue lock must be
+// held.
+bool BlockQueue::CanMerge(struct block_request* first,
+                          struct block_request* second)
+{
+	return first->write == second->write &&
+	       first->block_index + ChainBlocks(first) == second->block_index &&
+	       ChainBlocks(first) + ChainBlocks(second) <= blocks_max &&
+	       ChainSegments(first) + ChainSegments(second) <= segments_max;
+}
+
+// Merge the request into the queued request for the blocks just before it, or
+// merge the queued request for the blocks just after it into the request. The
+// queue lock must be held.
+bool BlockQueue::Merge(struct block_request* request)
+{
+	struct block_request* next = sort_first;
+	while ( next && next->block_index <= request->block_index )
+		next = next->sort_next;
+	struct block_request* prev = next ? next->sort_prev : sort_last;
+	if ( prev && CanMerge(prev, request) )
+	{
+		prev->merge_last->merge_next = request;
+		prev->merge_last = request;
+		return true;
+	}
+	if ( next && CanMerge(request, next) )
+	{
+		Remove(next);
+		request->merge_next = next;
+		request->merge_last = next->merge_last;
+		if ( timespec_lt(next->deadline, request->deadline) )
+			request->deadline = next->deadline;
+		Insert(request);
+		return true;
+	}
+	return false;
+}
+
+// Add the request to the list sorted by block and the list sorted by deadline.
+// The queue lock must be held.
+void BlockQueue::Insert(struct block_request* request)
+{
+	struct block_request* prev = sort_last;
+	while ( prev && request->block_index < prev->block_index )
+		prev = prev->sort_prev;
+	request->sort_prev = prev;
+	request->sort_next = prev ? prev->sort_next : sort_first;
+	if ( request->sort_next )
+		request->sort_next->sort_prev = request;
+	else
+		sort_last = request;
+	if ( prev )
+		prev->sort_next = request;
+	else
+		sort_first = request;
+	prev = fifo_last;
+	while ( prev && timespec_lt(request->deadline, prev->deadline) )
+		prev = prev->fifo_prev;
+	request->fifo_prev = prev;
+	request->fifo_next = prev ? prev->fifo_next : fifo_first;
+	if ( request->fifo_next )
+		request->fifo_next->fifo_prev = request;
+	else
+		fifo_last = request;
+	if ( prev )
+		prev->fifo_next = request;
+	else
+		fifo_first = request;
+}
+
+// The queue lock must be held.
+void BlockQueue::Remove(struct block_request* request)
+{
+	if ( request->sort_prev )
+		request->sort_prev->sort_next = request->sort_next;
+	else
+		sort_first = request->sort_next;
+	if ( request->sort_next )
+		request->sort_next->sort_prev = request->sort_prev;
+	else
+		sort_last = request->sort_prev;
+	if ( request->fifo_prev )
+		request->fifo_prev->fifo_next = request->fifo_next;
+	else
+		fifo_first = request->fifo_next;
+	if ( request->fifo_next )
+		request->fifo_next->fifo_prev = request->fifo_prev;
+	else
+		fifo_last = request->fifo_prev;
+}
+
+// Serve the oldest request once its deadline has passed, and otherwise sweep
+// across the disk in one direction, serving the first request at or after the
+// end of the previous request, and starting over from the lowest block at the
+// end of the disk. The queue lock must be held.
+struct block_request* BlockQueue::Pick(struct timespec now)
+{
+	if ( !fifo_first )
+		return NULL;
+	if ( timespec_le(fifo_first->deadline, now) )
+		return fifo_first;
+	for ( struct block_request* request = sort_first;
+	      request;
+	      request = request->sort_next )
+		if ( head_position <= request->block_index )
+			return request;
+	return sort_first;
+}
+
+void BlockQueue::Submit(struct block_request* request)
+{
+	struct timespec now = Now();
+	request->merge_next = NULL;
+	request->merge_last = request;
+	request->deadline =
+		Later(now, request->write ? WRITE_EXPIRE_MS : READ_EXPIRE_MS);
+	request->errnum = 0;
+	request->dispatched = false;
+	request->completed = false;
+	kthread_mutex_lock(&queue_lock);
+	if ( !Merge(request) )
+		Insert(request);
+	kthread_mutex_unlock(&queue_lock);
+	Dispatch();
+}
+
+// Issue a batch of queued requests to the driver, as many as the device has
+// room for. The driver may accept only some of them, such as while it runs a
+// command that can't be queued, and then dispatches the queue again after.
+void BlockQueue::Dispatch()
+{
+	struct block_request* batch[32];
+	size_t count = 0;
+	kthread_mutex_lock(&queue_lock);
+	struct timespec now = Now();
+	while ( in_flight < depth && count < 32 )
+	{
+		struct block_request* request = Pick(now);
+		if ( !request )
+			break;
+		Remove(request);
+		head_position = request->block_index + ChainBlocks(request);
+		for ( struct block_request* r = request; r; r = r->merge_next )
+		{
+			r->dispatched = true;
+			r->timeout = Later(now, REQUEST_TIMEOUT_MS);
+		}
+		batch[count++] = request;
+		in_flight++;
+	}
+	kthread_mutex_unlock(&queue_lock);
+	if ( !count )
+		return;
+	size_t issued = harddisk->IssueRequests(batch, count);
+	if ( issued == count )
+		return;
+	kthread_mutex_lock(&queue_lock);
+	for ( size_t i = issued; i < count; i++ )
+	{
+		for ( struct block_request* r = batch[i]; r; r = r->merge_next )
+			r->dispatched = false;
+		Insert(batch[i]);
+		in_flight--;
+	}
+	kthread_mutex_unlock(&queue_lock);
+}
+
+// Called by the driver when a request it accepted has completed, which also
+// completes the requests merged into it.
+void BlockQueue::Complete(struct block_request* request, int errnum)
+{
+	kthread_mutex_lock(&queue_lock);
+	in_flight--;
+	kthread_mutex_unlock(&queue_lock);
+	while ( request )
+	{
+		struct block_request* next = request->merge_next;
+		request->errnum = errnum;
+		request->done(request);
+		request = next;
+	}
+	Dispatch();
+}
+
+void BlockQueue::TransferDone(struct block_request* request)
+{
+	BlockQueue* queue = (BlockQueue*) request->context;
+	ScopedLock lock(&queue->queue_lock);
+	request->completed = true;
+	kthread_cond_broadcast(&queue->completion_cond);
+}
+
+// Wait for a transfer request to complete. The device owns the memory until
+// then, so the wait can't be cancelled by a signal. The driver is asked to
+// expire its requests if the request has been in flight for too long.
+bool BlockQueue::Wait(struct block_request* request)
+{
+	Clock* clock = Time::GetClock(CLOCK_BOOTTIME);
+	kthread_mutex_lock(&queue_lock);
+	while ( !request->completed )
+	{
+		struct timespec deadline = request->dispatched ? request->timeout :
+		                           Later(Now(), REQUEST_TIMEOUT_MS);
+		if ( kthread_cond_wait_until(&completion_cond, &queue_lock, clock,
+		                             deadline) )
+			continue;
+		struct timespec now = Now();
+		if ( request->completed || !request->dispatched ||
+		     timespec_lt(now, request->timeout) )
+			continue;
+		request->timeout = Later(now, REQUEST_TIMEOUT_MS);
+		kthread_mutex_unlock(&queue_lock);
+		harddisk->ExpireRequests();
+		kthread_mutex_lock(&queue_lock);
+	}
+	int errnum = request->errnum;
+	kthread_mutex_unlock(&queue_lock);
+	if ( errnum )
+		return errno = errnum, false;
+	return true;
+}
+
+// Prepare the next part of a transfer, which is whole blocks straight to and
+// from the caller's pages if they are aligned, and otherwise up to a page
+// through a bounce buffer, reading the blocks first for a partial write.
+struct block_transfer* BlockQueue::Prepare(ioctx_t* ctx, unsigned char* buf,
+                                           size_t count, off_t off, bool write)
+{
+	uintmax_t block_index = (uintmax_t) off / (uintmax_t) block_size;
+	uintmax_t block_offset = (uintmax_t) off % (uintmax_t) block_size;
+	struct block_transfer* transfer = new struct block_transfer;
+	if ( !transfer )
+		return NULL;
+	memset(transfer, 0, sizeof(*transfer));
+	struct block_request* request = &transfer->request;
+	request->block_index = (blkcnt_t) block_index;
+	request->done = TransferDone;
+	request->context = this;
+	request->write = write;
+	transfer->buf = buf;
+	size_t page_offset = (uintptr_t) buf % Page::Size();
+	if ( !block_offset && !((uintptr_t) buf & 1) )
+	{
+		size_t direct_size = segments_max * Page::Size() - page_offset;
+		if ( (uintmax_t) blocks_max * block_size < direct_size )
+			direct_size = blocks_max * block_size;
+		if ( count < direct_size )
+			direct_size = count;
+		direct_size -= direct_size % block_size;
+		size_t pages =
+			(page_offset + direct_size + Page::Size() - 1) / Page::Size();
+		if ( direct_size &&
+		     (request->segments = new struct block_segment[pages]) )
+		{
+			if ( PinSegments(ctx, request, buf, direct_size) )
+			{
+				request->block_count = direct_size / block_size;
+				transfer->data_size = direct_size;
+				return transfer;
+			}
+			delete[] request->segments;
+			request->segments = NULL;
+		}
+	}
+	uintmax_t amount = block_offset + count;
+	if ( Page::Size() < amount )
+		amount = Page::Size();
+	size_t num_blocks = (amount + block_size - 1) / block_size;
+	size_t full_amount = num_blocks * block_size;
+	size_t pages = full_amount / Page::Size() + 2;
+	ioctx_t kctx;
+	SetupKernelIOCtx(&kctx);
+	if ( !(transfer->bounce = new unsigned char[full_amount]) ||
+	     !(request->segments = new struct block_segment[pages]) ||
+	     !PinSegments(&kctx, request, transfer->bounce, full_amount) )
+	{
+		FreeTransfer(transfer);
+		return NULL;
+	}
+	request->block_count = num_blocks;
+	transfer->bounce_offset = block_offset;
+	transfer->data_size = amount - block_offset;
+	if ( write )
+	{
+		if ( block_offset || amount < full_amount )
+		{
+			request->write = false;
+			Submit(request);
+			bool success = Wait(request);
+			request->write = true;
+			if ( !success )
+			{
+				FreeTransfer(transfer);
+				return NULL;
+			}
+		}
+		if ( !ctx->copy_from_src(transfer->bounce + block_offset, buf,
+		                         transfer->data_size) )
+		{
+			FreeTransfer(transfer);
+			return NULL;
+		}
+	}
+	return transfer;
+}
+
+// Wait for a part of a transfer, and copy the data read through the bounce
+// buffer to the caller unless an earlier part of the transfer failed.
+bool BlockQueue::Reap(ioctx_t* ctx, struct block_transfer* transfer, bool copy)
+{
+	struct block_request* request = &transfer->request;
+	bool success = Wait(request);
+	if ( !transfer->bounce )
+		UnpinSegments(ctx, request);
+	else if ( success && copy && !request->write )
+		success = ctx->copy_to_dest(transfer->buf,
+		                            transfer->bounce + transfer->bounce_offset,
+		                            transfer->data_size);
+	FreeTransfer(transfer);
+	return success;
+}
+
+ssize_t BlockQueue::Transfer(ioctx_t* ctx, unsigned char* buf, size_t count,
+                             off_t off, bool write)
+{
+	struct block_transfer* pending[TRANSFER_WINDOW];
+	size_t issued = 0;
+	size_t reaped = 0;
+	bool failed = false;
+	bool cancelled = false;
+	ssize_t result = 0;
+	while ( true )
+	{
+		while ( !failed && !cancelled && count &&
+		        issued - reaped < TRANSFER_WINDOW )
+		{
+			// Stop submitting requests if a signal arrives, and finish the
+			// requests in flight.
+			if ( Signal::IsPending() )
+			{
+				cancelled = true;
+				break;
+			}
+			if ( device_size <= off )
+			{
+				count = 0;
+				break;
+			}
+			if ( (uintmax_t) device_size - off < (uintmax_t) count )
+				count = (size_t) device_size - off;
+			struct block_transfer* transfer =
+				Prepare(ctx, buf, count, off, write);
+			if ( !transfer )
+			{
+				failed = true;
+				break;
+			}
+			Submit(&transfer->request);
+			pending[issued++ % TRANSFER_WINDOW] = transfer;
+			buf += transfer->data_size;
+			count -= transfer->data_size;
+			off += transfer->data_size;
+		}
+		if ( issued == reaped )
+			break;
+		// Reap the requests in order so only the successful prefix of the
+		// transfer is reported as transferred.
+		struct block_transfer* transfer = pending[reaped++ % TRANSFER_WINDOW];
+		size_t data_size = transfer->data_size;
+		if ( !Reap(ctx, transfer, !failed) )
+			failed = true;
+		if ( !failed )
+			result += data_size;
+	}
+	if ( failed && !result )
+		return -1;
+	if ( cancelled && !result )
+		return errno = EINTR, -1;
+	return result;
+}
+
+} // namespace Sortix
@@ -27,6 +27,7 @@
 
 #include <sortix/stat.h>
 
+#include <sortix/kernel/blockqueue.h>
 #include <sortix/kernel/harddisk.h>
 #include <sortix/kernel/inode.h>
 #include <sortix/kernel/kthread.h>
@@ -78,12 +79,16 @@ off_t PortNode::lseek(ioctx_t* /*ctx*/, off_t offset, int whence)
 
 ssize_t PortNode::pread(ioctx_t* ctx, uint8_t* buf, size_t count, off_t off)
 {
+	if ( BlockQueue* queue = harddisk->GetBlockQueue() )
+		return queue->Transfer(ctx, (unsigned char*) buf, count, off, false);
 	return harddisk->pread(ctx, (unsigned char*) buf, count, off);
 }
 
 ssize_t PortNode::pwrite(ioctx_t* ctx, const uint8_t* buf, size_t count,
                         off_t off)
 {
+	if ( BlockQueue* queue = harddisk->GetBlockQueue() )
+		return queue->Transfer(ctx, (unsigned char*) buf, count, off, true);
 	return harddisk->pwrite(ctx, (const unsigned char*) buf, count, off);
 }
 
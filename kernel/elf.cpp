@@ -34,6 +34,8 @@
 #include <sortix/mman.h>
 
 #include <sortix/kernel/elf.h>
+#include <sortix/kernel/inode.h>
+#include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/process.h>
@@ -47,8 +49,51 @@ static bool is_power_of_two(uintptr_t value)
 	return value && !(value & (value - 1));
 }
 
-uintptr_t Load(const void* file_ptr, size_t file_size, Auxiliary* aux)
+size_t HeaderSize(const void* file_ptr, size_t size, size_t file_size)
 {
+	const unsigned char* file = (const unsigned char*) file_ptr;
+
+	// The elf header comes first.
+	if ( size < sizeof(Elf_Ehdr) )
+		return file_size < sizeof(Elf_Ehdr) ? file_size : sizeof(Elf_Ehdr);
+	if ( memcmp(file, ELFMAG, SELFMAG) != 0 )
+		return size;
+	if ( (uintptr_t) file & (alignof(Elf_Ehdr) - 1) )
+		return size;
+	const Elf_Ehdr* header = (const Elf_Ehdr*) file;
+
+	// Then the program headers, which Load rejects if they're invalid.
+	if ( header->e_phentsize < sizeof(Elf_Phdr) ||
+	     (header->e_phoff & (alignof(Elf_Phdr) - 1)) ||
+	     file_size < header->e_phoff ||
+	     (file_size - header->e_phoff) / header->e_phentsize < header->e_phnum )
+		return size;
+	size_t needed = header->e_phoff + header->e_phnum * header->e_phentsize;
+	if ( size < needed )
+		return needed;
+
+	// And the notes, while the other segments are read when needed.
+	for ( Elf_Half i = 0; i < header->e_phnum; i++ )
+	{
+		size_t pheader_offset = header->e_phoff + i * header->e_phentsize;
+		const Elf_Phdr* pheader = (const Elf_Phdr*) (file + pheader_offset);
+		if ( pheader->p_type != PT_NOTE ||
+		     file_size < pheader->p_offset ||
+		     file_size - pheader->p_offset < pheader->p_filesz )
+			continue;
+		size_t note_end = pheader->p_offset + pheader->p_filesz;
+		if ( needed < note_end )
+			needed = note_end;
+	}
+
+	return needed;
+}
+
+uintptr_t Load(const void* file_ptr, size_t buffer_size, size_t file_size,
+               Inode* inode, Auxiliary* aux)
+{
+	assert(inode || buffer_size == file_size);
+
 	memset(aux, 0, sizeof(*aux));
 
 	Process* process = CurrentProcess();
@@ -60,7 +105,7 @@ uintptr_t Load(const void* file_ptr, size_t file_size, Auxiliary* aux)
 
 	const unsigned char* file = (const unsigned char*) file_ptr;
 
-	if ( file_size < EI_NIDENT )
+	if ( buffer_size < EI_NIDENT )
 		return errno = ENOEXEC, 0;
 
 	if ( memcmp(file, ELFMAG, SELFMAG) != 0 )
@@ -95,7 +140,7 @@ uintptr_t Load(const void* file_ptr, size_t file_size, Auxiliary* aux)
 	if ( file[EI_ABIVERSION] != 0 )
 		return errno = EINVAL, 0;
 
-	if ( file_size < sizeof(Elf_Ehdr) )
+	if ( buffer_size < sizeof(Elf_Ehdr) )
 		return errno = EINVAL, 0;
 	if ( (uintptr_t) file & (alignof(Elf_Ehdr) - 1) )
 		return errno = EINVAL, 0;
@@ -104,7 +149,7 @@ uintptr_t Load(const void* file_ptr, size_t file_size, Auxiliary* aux)
 	if ( header->e_ehsize < sizeof(Elf_Ehdr) )
 		return errno = EINVAL, 0;
 
-	if ( file_size < header->e_ehsize )
+	if ( buffer_size < header->e_ehsize )
 		return errno = EINVAL, 0;
 
 #if defined(__i386__)
@@ -144,7 +189,8 @@ uintptr_t Load(const void* file_ptr, size_t file_size, Auxiliary* aux)
 
 	for ( Elf32_Half i = 0; i < header->e_phnum; i++ )
 	{
-		size_t max_phs = (file_size - header->e_phoff) / header->e_phentsize;
+		size_t max_phs = header->e_phoff <= buffer_size ?
+		                 (buffer_size - header->e_phoff) / header->e_phentsize : 0;
 		if ( max_phs <= i )
 			return errno = EINVAL, 0;
 		size_t pheader_offset = header->e_phoff + i * header->e_phentsize;
@@ -172,7 +218,14 @@ uintptr_t Load(const void* file_ptr, size_t file_size, Auxiliary* aux)
 			if ( pheader->p_memsz < pheader->p_filesz )
 				return errno = EINVAL, 0;
 
-			aux->tls_file_offset = pheader->p_offset;
+			// The initialization image is copied from the loaded segments.
+			if ( pheader->p_filesz &&
+			     (pheader->p_vaddr < userspace_addr ||
+			      userspace_end < pheader->p_vaddr ||
+			      userspace_end - pheader->p_vaddr < pheader->p_filesz) )
+				return errno = EINVAL, 0;
+
+			aux->tls_vaddr = pheader->p_vaddr;
 			aux->tls_file_size = pheader->p_filesz;
 			aux->tls_mem_size = pheader->p_memsz;
 			aux->tls_mem_align = pheader->p_align;
@@ -181,6 +234,9 @@ uintptr_t Load(const void* file_ptr, size_t file_size, Auxiliary* aux)
 
 		if ( pheader->p_type == PT_NOTE )
 		{
+			if ( buffer_size < pheader->p_offset ||
+			     buffer_size - pheader->p_offset < pheader->p_filesz )
+				return errno = EINVAL, 0;
 			size_t notes_offset = 0;
 			while ( notes_offset < pheader->p_filesz )
 			{
@@ -273,13 +329,37 @@ uintptr_t Load(const void* file_ptr, size_t file_size, Auxiliary* aux)
 			uintptr_t map_end = Page::AlignUp(pheader->p_vaddr + pheader->p_memsz);
 			size_t map_size = map_end - map_start;
 
+			// The file contents are paged in on demand and shared with the file
+			// copy-on-write, if the contents start at the same offset in the
+			// page in the file as in memory. The rest of the segment is zero.
+			bool demand_paged = inode && pheader->p_filesz &&
+			                    pheader->p_vaddr % Page::Size() ==
+			                    pheader->p_offset % Page::Size();
+			uintptr_t file_end = pheader->p_vaddr + pheader->p_filesz;
+			uintptr_t file_map_end =
+				demand_paged ? Page::AlignUp(file_end) : map_start;
+
 			struct segment segment;
 			segment.addr =  map_start;
 			segment.size = map_size;
 			segment.prot = kprot;
+			segment.flags = MAP_PRIVATE;
+			segment.inode = NULL;
+			segment.offset = 0;
 
 			assert(IsUserspaceSegment(&segment));
 
+			struct segment file_segment = segment;
+			file_segment.size = file_map_end - map_start;
+			file_segment.prot = prot | kprot;
+			file_segment.inode = inode;
+			file_segment.offset = (off_t) (pheader->p_offset -
+			                               (pheader->p_vaddr - map_start));
+
+			struct segment zero_segment = segment;
+			zero_segment.addr = file_map_end;
+			zero_segment.size = map_end - file_map_end;
+
 			kthread_mutex_lock(&process->segment_write_lock);
 			kthread_mutex_lock(&process->segment_lock);
 
@@ -290,23 +370,69 @@ uintptr_t Load(const void* file_ptr, size_t file_size, Auxiliary* aux)
 				return errno = EINVAL, 0;
 			}
 
-			if ( !Memory::MapRange(segment.addr, segment.size, kprot, PAGE_USAGE_USER_SPACE) )
+			if ( file_segment.size && !AddSegment(process, &file_segment) )
 			{
 				kthread_mutex_unlock(&process->segment_lock);
 				kthread_mutex_unlock(&process->segment_write_lock);
 				return errno = EINVAL, 0;
 			}
 
-			if ( !AddSegment(process, &segment) )
+			if ( zero_segment.size )
 			{
-				Memory::UnmapRange(segment.addr, segment.size, PAGE_USAGE_USER_SPACE);
-				kthread_mutex_unlock(&process->segment_lock);
-				kthread_mutex_unlock(&process->segment_write_lock);
-				return errno = EINVAL, 0;
+				if ( !Memory::MapRange(zero_segment.addr, zero_segment.size, kprot, PAGE_USAGE_USER_SPACE) )
+				{
+					kthread_mutex_unlock(&process->segment_lock);
+					kthread_mutex_unlock(&process->segment_write_lock);
+					return errno = EINVAL, 0;
+				}
+
+				if ( !AddSegment(process, &zero_segment) )
+				{
+					Memory::UnmapRange(zero_segment.addr, zero_segment.size, PAGE_USAGE_USER_SPACE);
+					kthread_mutex_unlock(&process->segment_lock);
+					kthread_mutex_unlock(&process->segment_write_lock);
+					return errno = EINVAL, 0;
+				}
+
+				memset((void*) zero_segment.addr, 0, zero_segment.size);
+			}
+
+			if ( demand_paged )
+			{
+				// The last page is copied now if it continues with zeroes.
+				size_t tail = file_map_end - file_end;
+				if ( tail && pheader->p_filesz < pheader->p_memsz )
+				{
+					if ( !Memory::PrepareUserWrite(process, file_end, tail) )
+					{
+						kthread_mutex_unlock(&process->segment_lock);
+						kthread_mutex_unlock(&process->segment_write_lock);
+						return 0;
+					}
+					memset((void*) file_end, 0, tail);
+				}
+			}
+			else if ( inode )
+			{
+				ioctx_t ctx; SetupKernelIOCtx(&ctx);
+				uint8_t* dest = (uint8_t*) pheader->p_vaddr;
+				for ( size_t sofar = 0; sofar < pheader->p_filesz; )
+				{
+					ssize_t amount = inode->pread(&ctx, dest + sofar,
+					                              pheader->p_filesz - sofar,
+					                              pheader->p_offset + sofar);
+					if ( amount <= 0 )
+					{
+						kthread_mutex_unlock(&process->segment_lock);
+						kthread_mutex_unlock(&process->segment_write_lock);
+						return amount == 0 ? (errno = EEOF, 0) : 0;
+					}
+					sofar += amount;
+				}
 			}
+			else
+				memcpy((void*) pheader->p_vaddr, file + pheader->p_offset, pheader->p_filesz);
 
-			memset((void*) segment.addr, 0, segment.size);
-			memcpy((void*) pheader->p_vaddr, file + pheader->p_offset, pheader->p_filesz);
 			Memory::ProtectMemory(CurrentProcess(), segment.addr, segment.size, prot);
 
 			kthread_mutex_unlock(&process->segment_lock);
@@ -0,0 +1,669 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * epoll.cpp
+ * Scalable input/output event notification.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <timespec.h>
+
+#include <sortix/clock.h>
+#include <sortix/epoll.h>
+#include <sortix/fcntl.h>
+#include <sortix/poll.h>
+#include <sortix/sigset.h>
+#include <sortix/stat.h>
+#include <sortix/timespec.h>
+
+#include <sortix/kernel/clock.h>
+#include <sortix/kernel/copy.h>
+#include <sortix/kernel/descriptor.h>
+#include <sortix/kernel/dtable.h>
+#include <sortix/kernel/inode.h>
+#include <sortix/kernel/ioctx.h>
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/kthread.h>
+#include <sortix/kernel/poll.h>
+#include <sortix/kernel/process.h>
+#include <sortix/kernel/refcount.h>
+#include <sortix/kernel/signal.h>
+#include <sortix/kernel/slab.h>
+#include <sortix/kernel/syscall.h>
+#include <sortix/kernel/thread.h>
+#include <sortix/kernel/time.h>
+#include <sortix/kernel/vnode.h>
+
+namespace Sortix {
+
+class EpollNode;
+
+// A descriptor registered in an event queue. The poll node stays registered on
+// the descriptor's poll channels for the lifetime of the watch, and signals on
+// those channels put the watch on the ready list of the event queue. The watch
+// doesn't keep the descriptor alive, but is linked on the descriptor, whose
+// destruction cancels the watch and puts it on the ready list, where the event
+// queue notices and removes it.
+struct epoll_watch
+{
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
+	struct epoll_watch* hash_next;
+	struct epoll_watch* ready_prev;
+	struct epoll_watch* ready_next;
+	struct epoll_watch* desc_prev;
+	struct epoll_watch* desc_next;
+	EpollNode* epoll;
+	Descriptor* desc;
+	PollNode node;
+	epoll_data_t data;
+	uint32_t events;
+	int fd;
+	bool ready;
+	bool disabled;
+};
+
+static struct slab_cache epoll_watch_cache =
+	SLAB_CACHE_INITIALIZER("epoll watch", struct epoll_watch);
+
+void* epoll_watch::operator new(size_t size)
+{
+	return SlabAllocate(&epoll_watch_cache, size);
+}
+
+void epoll_watch::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&epoll_watch_cache, ptr, size);
+}
+
+// Protects the descriptor pointers of the watches, the lists of watches on the
+// descriptors, and cancelling the poll nodes of the watches, which both the
+// event queue and the destruction of the descriptor can do.
+static kthread_mutex_t epoll_desc_lock = KTHREAD_MUTEX_INITIALIZER;
+
+static void LinkWatch(struct epoll_watch* watch,
+                      Descriptor* desc) // epoll_desc_lock taken
+{
+	watch->desc = desc;
+	watch->desc_prev = NULL;
+	watch->desc_next = desc->epoll_watches;
+	if ( desc->epoll_watches )
+		desc->epoll_watches->desc_prev = watch;
+	desc->epoll_watches = watch;
+}
+
+static void UnlinkWatch(struct epoll_watch* watch) // epoll_desc_lock taken
+{
+	if ( watch->desc_prev )
+		watch->desc_prev->desc_next = watch->desc_next;
+	else
+		watch->desc->epoll_watches = watch->desc_next;
+	if ( watch->desc_next )
+		watch->desc_next->desc_prev = watch->desc_prev;
+	watch->desc = NULL;
+}
+
+// Stop the watch from being woken and detach it from its descriptor.
+static void DetachWatch(struct epoll_watch* watch)
+{
+	ScopedLock lock(&epoll_desc_lock);
+	if ( watch->desc )
+		UnlinkWatch(watch);
+	watch->node.Cancel();
+}
+
+// Get a reference to the descriptor of the watch, unless it's been destroyed.
+static Ref<Descriptor> WatchedDescriptor(struct epoll_watch* watch)
+{
+	ScopedLock lock(&epoll_desc_lock);
+	Ref<Descriptor> desc;
+	if ( watch->desc && watch->desc->TryRefer_Renamed() )
+		desc.Import((uintptr_t) watch->desc);
+	return desc;
+}
+
+class EpollNode : public AbstractInode
+{
+public:
+	EpollNode(uid_t owner, gid_t group, mode_t mode);
+	virtual ~EpollNode();
+	virtual bool pass();
+	virtual int poll(ioctx_t* ctx, PollNode* node);
+	virtual int epoll_ctl(ioctx_t* ctx, int op, int fd, Ref<Descriptor> desc,
+	                      const struct epoll_event* event);
+	virtual int epoll_wait(ioctx_t* ctx, struct epoll_event* events,
+	                       int maxevents, struct timespec timeout);
+	void Forget(struct epoll_watch* watch);
+
+private:
+	static void Wake(void* context);
+	struct epoll_watch* Lookup(int fd);
+	bool Grow();
+	void Unlink(struct epoll_watch* watch);
+	void Enqueue(struct epoll_watch* watch);
+	void Dequeue(struct epoll_watch* watch);
+	int Add(ioctx_t* ctx, int fd, Ref<Descriptor> desc,
+	        const struct epoll_event* event);
+	void Modify(struct epoll_watch* watch, const struct epoll_event* event);
+	void Remove(struct epoll_watch* watch);
+	short Check(ioctx_t* ctx, struct epoll_watch* watch,
+	            Ref<Descriptor> desc);
+	int Harvest(ioctx_t* ctx, struct epoll_event* events, int maxevents);
+
+private:
+	kthread_mutex_t ctl_lock;
+	kthread_mutex_t ready_lock;
+	kthread_cond_t ready_cond;
+	PollChannel poll_channel;
+	struct epoll_watch** buckets;
+	size_t buckets_length;
+	size_t watches_count;
+	struct epoll_watch* ready_first;
+	struct epoll_watch* ready_last;
+	size_t ready_count;
+
+};
+
+EpollNode::EpollNode(uid_t owner, gid_t group, mode_t mode)
+{
+	inode_type = INODE_TYPE_UNKNOWN;
+	this->dev = 0;
+	this->ino = (ino_t) this;
+	this->stat_uid = owner;
+	this->stat_gid = group;
+	this->type = S_IFNEVERWRAP;
+	this->stat_mode = (mode & S_SETABLE) | this->type;
+	ctl_lock = KTHREAD_MUTEX_INITIALIZER;
+	ready_lock = KTHREAD_MUTEX_INITIALIZER;
+	ready_cond = KTHREAD_COND_INITIALIZER;
+	buckets = NULL;
+	buckets_length = 0;
+	watches_count = 0;
+	ready_first = NULL;
+	ready_last = NULL;
+	ready_count = 0;
+}
+
+EpollNode::~EpollNode()
+{
+	for ( size_t i = 0; i < buckets_length; i++ )
+	{
+		while ( buckets[i] )
+		{
+			struct epoll_watch* watch = buckets[i];
+			buckets[i] = watch->hash_next;
+			DetachWatch(watch);
+			delete watch;
+		}
+	}
+	delete[] buckets;
+}
+
+// The registrations refer to file descriptors in the process that made them,
+// which mean nothing to the processes the event queue could be passed to.
+bool EpollNode::pass()
+{
+	return false;
+}
+
+int EpollNode::poll(ioctx_t* /*ctx*/, PollNode* node)
+{
+	// Event queues can't be registered in event queues, as event queues
+	// registered in each other would deadlock waking each other.
+	if ( node->master->wake_callback )
+		return errno = EINVAL, -1;
+	ScopedLock lock(&ready_lock);
+	short status = ready_first ? POLLIN | POLLRDNORM : 0;
+	short ret_status = status & node->events;
+	if ( ret_status )
+	{
+		node->master->revents |= ret_status;
+		return 0;
+	}
+	poll_channel.Register(node);
+	return errno = EAGAIN, -1;
+}
+
+// Called with the lock of the poll channel that was signaled.
+void EpollNode::Wake(void* context)
+{
+	struct epoll_watch* watch = (struct epoll_watch*) context;
+	EpollNode* epoll = watch->epoll;
+	ScopedLock lock(&epoll->ready_lock);
+	if ( !watch->ready )
+		epoll->Enqueue(watch);
+}
+
+struct epoll_watch* EpollNode::Lookup(int fd) // ctl_lock taken
+{
+	if ( !buckets_length )
+		return NULL;
+	size_t index = (size_t) fd & (buckets_length - 1);
+	for ( struct epoll_watch* watch = buckets[index]; watch;
+	      watch = watch->hash_next )
+		if ( watch->fd == fd )
+			return watch;
+	return NULL;
+}
+
+bool EpollNode::Grow() // ctl_lock taken
+{
+	size_t new_length = buckets_length ? 2 * buckets_length : 16;
+	struct epoll_watch** new_buckets = new struct epoll_watch*[new_length];
+	if ( !new_buckets )
+		return false;
+	for ( size_t i = 0; i < new_length; i++ )
+		new_buckets[i] = NULL;
+	for ( size_t i = 0; i < buckets_length; i++ )
+	{
+		while ( buckets[i] )
+		{
+			struct epoll_watch* watch = buckets[i];
+			buckets[i] = watch->hash_next;
+			size_t index = (size_t) watch->fd & (new_length - 1);
+			watch->hash_next = new_buckets[index];
+			new_buckets[index] = watch;
+		}
+	}
+	delete[] buckets;
+	buckets = new_buckets;
+	buckets_length = new_length;
+	return true;
+}
+
+void EpollNode::Unlink(struct epoll_watch* watch) // ctl_lock taken
+{
+	size_t index = (size_t) watch->fd & (buckets_length - 1);
+	struct epoll_watch** link = &buckets[index];
+	while ( *link != watch )
+		link = &(*link)->hash_next;
+	*link = watch->hash_next;
+	watches_count--;
+}
+
+void EpollNode::Enqueue(struct epoll_watch* watch) // ready_lock taken
+{
+	assert(!watch->ready);
+	watch->ready = true;
+	watch->ready_prev = ready_last;
+	watch->ready_next = NULL;
+	if ( ready_last )
+		ready_last->ready_next = watch;
+	else
+		ready_first = watch;
+	ready_last = watch;
+	if ( ready_count++ == 0 )
+	{
+		kthread_cond_broadcast(&ready_cond);
+		poll_channel.Signal(POLLIN | POLLRDNORM);
+	}
+}
+
+void EpollNode::Dequeue(struct epoll_watch* watch) // ready_lock taken
+{
+	assert(watch->ready);
+	watch->ready = false;
+	if ( watch->ready_prev )
+		watch->ready_prev->ready_next = watch->ready_next;
+	else
+		ready_first = watch->ready_next;
+	if ( watch->ready_next )
+		watch->ready_next->ready_prev = watch->ready_prev;
+	else
+		ready_last = watch->ready_prev;
+	ready_count--;
+}
+
+int EpollNode::Add(ioctx_t* ctx, int fd, Ref<Descriptor> desc,
+                   const struct epoll_event* event) // ctl_lock taken
+{
+	if ( buckets_length <= watches_count && !Grow() )
+		return -1;
+	struct epoll_watch* watch = new struct epoll_watch;
+	if ( !watch )
+		return -1;
+	watch->hash_next = NULL;
+	watch->ready_prev = NULL;
+	watch->ready_next = NULL;
+	watch->epoll = this;
+	watch->desc = NULL;
+	watch->data = event->data;
+	watch->events = event->events;
+	watch->fd = fd;
+	watch->ready = false;
+	watch->disabled = false;
+	// Register on the poll channels without asking for any events, so the
+	// descriptor can't answer the poll right away without registering, and
+	// then start listening for the requested events. Readiness that happened
+	// in between is noticed when the watch is checked below.
+	watch->node.events = 0;
+	watch->node.revents = 0;
+	watch->node.wake_callback = Wake;
+	watch->node.wake_context = watch;
+	if ( desc->poll(ctx, &watch->node) < 0 && errno != EAGAIN )
+	{
+		watch->node.Cancel();
+		delete watch;
+		return -1;
+	}
+	watch->node.events = (short) event->events | POLL__ONLY_REVENTS;
+	kthread_mutex_lock(&epoll_desc_lock);
+	LinkWatch(watch, desc.Get());
+	kthread_mutex_unlock(&epoll_desc_lock);
+	size_t index = (size_t) fd & (buckets_length - 1);
+	watch->hash_next = buckets[index];
+	buckets[index] = watch;
+	watches_count++;
+	ScopedLock lock(&ready_lock);
+	if ( !watch->ready )
+		Enqueue(watch);
+	return 0;
+}
+
+void EpollNode::Modify(struct epoll_watch* watch,
+                       const struct epoll_event* event) // ctl_lock taken
+{
+	watch->data = event->data;
+	watch->events = event->events;
+	watch->disabled = false;
+	watch->node.events = (short) event->events | POLL__ONLY_REVENTS;
+	ScopedLock lock(&ready_lock);
+	if ( !watch->ready )
+		Enqueue(watch);
+}
+
+void EpollNode::Remove(struct epoll_watch* watch) // ctl_lock taken
+{
+	// Once cancelled, the watch can no longer be woken.
+	DetachWatch(watch);
+	kthread_mutex_lock(&ready_lock);
+	if ( watch->ready )
+		Dequeue(watch);
+	kthread_mutex_unlock(&ready_lock);
+	Unlink(watch);
+	delete watch;
+}
+
+// The descriptor of the watch has been destroyed and the watch cancelled, so
+// put it on the ready list for the next wait to remove it.
+void EpollNode::Forget(struct epoll_watch* watch) // epoll_desc_lock taken
+{
+	ScopedLock lock(&ready_lock);
+	if ( !watch->ready )
+		Enqueue(watch);
+}
+
+// Poll the descriptor once for its current events.
+short EpollNode::Check(ioctx_t* ctx, struct epoll_watch* watch,
+                       Ref<Descriptor> desc)
+{
+	if ( watch->disabled )
+		return 0;
+	kthread_mutex_t wake_mutex = KTHREAD_MUTEX_INITIALIZER;
+	kthread_cond_t wake_cond = KTHREAD_COND_INITIALIZER;
+	bool woken = false;
+	PollNode node;
+	node.wake_mutex = &wake_mutex;
+	node.wake_cond = &wake_cond;
+	node.woken = &woken;
+	node.events = (short) watch->events | POLL__ONLY_REVENTS;
+	node.revents = 0;
+	if ( desc->poll(ctx, &node) < 0 && errno != EAGAIN )
+		node.revents |= POLLERR;
+	node.Cancel();
+	return node.revents;
+}
+
+// Report the ready watches. Level-triggered watches go back on the ready list
+// while their events persist, and are checked again on the next call. Only the
+// watches that were on the list at the start are visited, so each is reported
+// at most once per call.
+int EpollNode::Harvest(ioctx_t* ctx, struct epoll_event* events,
+                       int maxevents)
+{
+	ScopedLock lock(&ctl_lock);
+	kthread_mutex_lock(&ready_lock);
+	size_t budget = ready_count;
+	kthread_mutex_unlock(&ready_lock);
+	int count = 0;
+	while ( budget-- && count < maxevents )
+	{
+		kthread_mutex_lock(&ready_lock);
+		struct epoll_watch* watch = ready_first;
+		if ( watch )
+			Dequeue(watch);
+		kthread_mutex_unlock(&ready_lock);
+		if ( !watch )
+			break;
+		Ref<Descriptor> desc = WatchedDescriptor(watch);
+		if ( !desc )
+		{
+			Remove(watch);
+			continue;
+		}
+		short revents = Check(ctx, watch, desc);
+		if ( !revents )
+			continue;
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = (uint16_t) revents;
+		event.data = watch->data;
+		if ( !ctx->copy_to_dest(&events[count], &event, sizeof(event)) )
+		{
+			ScopedLock ready(&ready_lock);
+			if ( !watch->ready )
+				Enqueue(watch);
+			return -1;
+		}
+		count++;
+		if ( watch->events & EPOLLONESHOT )
+		{
+			watch->disabled = true;
+			watch->node.events = 0;
+		}
+		else if ( !(watch->events & EPOLLET) )
+		{
+			ScopedLock ready(&ready_lock);
+			if ( !watch->ready )
+				Enqueue(watch);
+		}
+	}
+	return count;
+}
+
+int EpollNode::epoll_ctl(ioctx_t* ctx, int op, int fd, Ref<Descriptor> desc,
+                         const struct epoll_event* user_event)
+{
+	struct epoll_event event;
+	if ( op != EPOLL_CTL_DEL &&
+	     !ctx->copy_from_src(&event, user_event, sizeof(event)) )
+		return -1;
+	ScopedLock lock(&ctl_lock);
+	struct epoll_watch* watch = Lookup(fd);
+	Ref<Descriptor> watched;
+	// The registration is gone if its descriptor has been destroyed.
+	if ( watch && !(watched = WatchedDescriptor(watch)) )
+	{
+		Remove(watch);
+		watch = NULL;
+	}
+	switch ( op )
+	{
+	case EPOLL_CTL_ADD:
+		if ( watch && watched == desc )
+			return errno = EEXIST, -1;
+		// The file descriptor was closed and reused since it was registered.
+		if ( watch )
+			Remove(watch);
+		return Add(ctx, fd, desc, &event);
+	case EPOLL_CTL_MOD:
+		if ( !watch || watched != desc )
+			return errno = ENOENT, -1;
+		Modify(watch, &event);
+		return 0;
+	case EPOLL_CTL_DEL:
+		if ( !watch )
+			return errno = ENOENT, -1;
+		Remove(watch);
+		return 0;
+	}
+	return errno = EINVAL, -1;
+}
+
+int EpollNode::epoll_wait(ioctx_t* ctx, struct epoll_event* events,
+                          int maxevents, struct timespec timeout)
+{
+	if ( maxevents <= 0 )
+		return errno = EINVAL, -1;
+	Clock* clock = Time::GetClock(CLOCK_MONOTONIC);
+	struct timespec deadline = timeout;
+	if ( 0 <= timeout.tv_sec )
+	{
+		struct timespec now;
+		clock->Get(&now, NULL);
+		deadline = timespec_add(now, timeout);
+	}
+	while ( true )
+	{
+		int count = Harvest(ctx, events, maxevents);
+		if ( count != 0 )
+			return count;
+		if ( timeout.tv_sec == 0 && timeout.tv_nsec == 0 )
+			return 0;
+		ScopedLock lock(&ready_lock);
+		while ( !ready_first )
+		{
+			if ( timeout.tv_sec < 0 )
+			{
+				if ( !kthread_cond_wait_signal(&ready_cond, &ready_lock) )
+					return errno = EINTR, -1;
+			}
+			else if ( !kthread_cond_wait_until_signal(&ready_cond, &ready_lock,
+			                                          clock, deadline) )
+				return errno == ETIMEDOUT ? 0 : -1;
+		}
+	}
+}
+
+// Cancel the watches of a descriptor that is being destroyed. The event queues
+// can't be destroyed meanwhile, as they detach their watches under the lock.
+void CancelEpollWatches(Descriptor* desc)
+{
+	ScopedLock lock(&epoll_desc_lock);
+	while ( desc->epoll_watches )
+	{
+		struct epoll_watch* watch = desc->epoll_watches;
+		UnlinkWatch(watch);
+		watch->node.Cancel();
+		watch->epoll->Forget(watch);
+	}
+}
+
+int sys_epoll_create1(int flags)
+{
+	int fdflags = 0;
+	if ( flags & EPOLL_CLOEXEC ) fdflags |= FD_CLOEXEC;
+	if ( flags & EPOLL_CLOFORK ) fdflags |= FD_CLOFORK;
+	flags &= ~(EPOLL_CLOEXEC | EPOLL_CLOFORK);
+
+	if ( flags )
+		return errno = EINVAL, -1;
+
+	Process* process = CurrentProcess();
+	Ref<Inode> inode(new EpollNode(process->uid, process->gid, 0600));
+	if ( !inode )
+		return -1;
+	Ref<Vnode> vnode(new Vnode(inode, Ref<Vnode>(NULL), 0, 0));
+	if ( !vnode )
+		return -1;
+	inode.Reset();
+	Ref<Descriptor> desc(new Descriptor(vnode, O_READ | O_WRITE));
+	if ( !desc )
+		return -1;
+	vnode.Reset();
+
+	Ref<DescriptorTable> dtable = process->GetDTable();
+	return dtable->Allocate(desc, fdflags);
+}
+
+int sys_epoll_ctl(int epfd, int op, int fd, const struct epoll_event* event)
+{
+	Process* process = CurrentProcess();
+	Ref<Descriptor> epdesc = process->GetDescriptor(epfd);
+	if ( !epdesc )
+		return -1;
+	// Registrations for file descriptors that have been closed can still be
+	// deleted.
+	Ref<Descriptor> desc = process->GetDescriptor(fd);
+	if ( !desc && (op != EPOLL_CTL_DEL || fd < 0) )
+		return -1;
+	ioctx_t ctx; SetupUserIOCtx(&ctx);
+	return epdesc->epoll_ctl(&ctx, op, fd, desc, event);
+}
+
+int sys_epoll_pwait(int epfd, struct epoll_event* events, int maxevents,
+                    const struct timespec* user_timeout,
+                    const sigset_t* user_sigmask)
+{
+	struct timespec timeout;
+	if ( !user_timeout )
+		timeout = timespec_make(-1, 0);
+	else if ( !CopyFromUser(&timeout, user_timeout, sizeof(timeout)) )
+		return -1;
+	else if ( !timespec_is_canonical(timeout) || timeout.tv_sec < 0 )
+		return errno = EINVAL, -1;
+
+	Ref<Descriptor> desc = CurrentProcess()->GetDescriptor(epfd);
+	if ( !desc )
+		return -1;
+
+	sigset_t oldsigmask;
+	if ( user_sigmask )
+	{
+		sigset_t sigmask;
+		if ( !CopyFromUser(&sigmask, user_sigmask, sizeof(sigset_t)) )
+			return -1;
+		Signal::UpdateMask(SIG_SETMASK, &sigmask, &oldsigmask);
+	}
+
+	ioctx_t ctx; SetupUserIOCtx(&ctx);
+	int ret = desc->epoll_wait(&ctx, events, maxevents, timeout);
+
+	if ( user_sigmask )
+	{
+		if ( !(ret < 0 && errno == EINTR && Signal::IsPending()) )
+			Signal::UpdateMask(SIG_SETMASK, &oldsigmask, NULL);
+		else
+		{
+			// The pending signal might only be pending with the temporary
+			// signal mask, so don't restore it. Instead ask for the real signal
+			// mask to be restored after the signal has been processed.
+			Thread* thread = CurrentThread();
+			thread->has_saved_signal_mask = true;
+			memcpy(&thread->saved_signal_mask, &oldsigmask, sizeof(sigset_t));
+		}
+	}
+
+	return ret;
+}
+
+} // namespace Sortix
@@ -118,10 +118,31 @@ void BlockCache::ReleaseBlock(BlockCacheBlock* block)
 	assert(block->information & BCACHE_PRESENT);
 	assert(block->information & BCACHE_USED);
 	blocks_used--;
+	uint8_t* block_data = BlockDataUnlocked(block);
+	// The block's page may still be memory mapped into user-space, in which
+	// case the mappings take over the page and the block gets a fresh page.
+	addr_t shared_addr;
+	if ( Memory::LookUp((addr_t) block_data, &shared_addr, NULL) &&
+	     Page::IsShared(shared_addr) )
+	{
+		Memory::Unmap((addr_t) block_data);
+		Page::ChangeUsage(shared_addr, PAGE_USAGE_FILESYSTEM_CACHE,
+		                  PAGE_USAGE_USER_SPACE);
+		Page::Release(shared_addr, PAGE_USAGE_USER_SPACE);
+		addr_t fresh_addr = Page::Get(PAGE_USAGE_FILESYSTEM_CACHE);
+		if ( !fresh_addr )
+		{
+			blocks_allocated--;
+			UnlinkBlock(block);
+			block->information &= ~(BCACHE_USED | BCACHE_PRESENT);
+			return;
+		}
+		Memory::Map(fresh_addr, (addr_t) block_data, PROT_KREAD | PROT_KWRITE);
+		Memory::InvalidatePage((addr_t) block_data);
+	}
 	if ( blocks_per_area < unused_block_count )
 	{
 		blocks_allocated--;
-		uint8_t* block_data = BlockDataUnlocked(block);
 		addr_t block_data_addr = Memory::Unmap((addr_t) block_data);
 		Page::Put(block_data_addr, PAGE_USAGE_FILESYSTEM_CACHE);
 		// TODO: We leak this block's meta information here. Rather, we should
@@ -444,6 +465,31 @@ off_t FileCache::lseek(ioctx_t* /*ctx*/, off_t offset, int whence)
 	return errno = EINVAL, -1;
 }
 
+addr_t FileCache::mmap_page(ioctx_t* /*ctx*/, off_t off)
+{
+	ScopedLock lock(&fcache_mutex);
+	if ( off < 0 || file_size <= off )
+		return errno = ENXIO, 0;
+	size_t block_num = (size_t) (off / Page::Size());
+	assert(block_num < blocks_used);
+	BlockCacheBlock* block = blocks[block_num];
+	uint8_t* block_data = kernel_block_cache->BlockData(block);
+	// The block is mapped as is, so it must not contain anything after the end
+	// of the file.
+	off_t block_end = off + (off_t) Page::Size();
+	off_t data_end = file_size < block_end ? file_size : block_end;
+	if ( file_written < data_end )
+		InitializeFileData(data_end);
+	memset(block_data + (data_end - off), 0, block_end - data_end);
+	addr_t block_data_addr;
+	if ( !Memory::LookUp((addr_t) block_data, &block_data_addr, NULL) )
+		return errno = EFAULT, 0;
+	if ( !Page::Share(block_data_addr) )
+		return 0;
+	kernel_block_cache->MarkUsed(block);
+	return block_data_addr;
+}
+
 //bool FileCache::ChangeBackend(FileCacheBackend* backend, bool sync_old)
 //{
 //}
@@ -167,6 +167,25 @@ ssize_t File::pwritev(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 	return ret;
 }
 
+bool File::mmap_page_supported()
+{
+	return true;
+}
+
+addr_t File::mmap_page(ioctx_t* ctx, off_t off)
+{
+	return fcache.mmap_page(ctx, off);
+}
+
+int File::msync_page(ioctx_t* /*ctx*/, off_t /*off*/, const uint8_t* /*page*/)
+{
+	// The mapped pages are the file contents, so it only needs to be marked as
+	// modified.
+	ScopedLock lock(&metalock);
+	stat_mtim = Time::Get(CLOCK_REALTIME);
+	return 0;
+}
+
 ssize_t File::readlink(ioctx_t* ctx, char* buf, size_t bufsize)
 {
 	if ( !S_ISLNK(type) )
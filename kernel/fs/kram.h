@@ -45,6 +45,9 @@ public:
 	                       off_t off);
 	virtual ssize_t pwritev(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 	                        off_t off);
+	virtual bool mmap_page_supported();
+	virtual addr_t mmap_page(ioctx_t* ctx, off_t off);
+	virtual int msync_page(ioctx_t* ctx, off_t off, const uint8_t* page);
 	virtual ssize_t readlink(ioctx_t* ctx, char* buf, size_t bufsiz);
 	virtual ssize_t tcgetblob(ioctx_t* ctx, const char* name, void* buffer,
 	                          size_t count);
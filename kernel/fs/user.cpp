@@ -29,6 +29,7 @@
 #include <string.h>
 #include <timespec.h>
 
+#include <sortix/clock.h>
 #include <sortix/dirent.h>
 #include <sortix/fcntl.h>
 #include <sortix/ioctl.h>
@@ -38,28 +39,40 @@
 
 #include <fsmarshall-msg.h>
 
+#include <sortix/kernel/copy.h>
+#include <sortix/kernel/dentrycache.h>
 #include <sortix/kernel/descriptor.h>
 #include <sortix/kernel/inode.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/kthread.h>
+#include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/mtable.h>
+#include <sortix/kernel/pagecache.h>
 #include <sortix/kernel/poll.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/refcount.h>
 #include <sortix/kernel/scheduler.h>
 #include <sortix/kernel/syscall.h>
 #include <sortix/kernel/thread.h>
+#include <sortix/kernel/time.h>
 #include <sortix/kernel/vnode.h>
 
 namespace Sortix {
 namespace UserFS {
 
+static const size_t MUX_REQUEST_MAX = 1024 * 1024;
+static const size_t MUX_WRITE_MAX = 128 * 1024;
+static const size_t MUX_FREE_CHANNELS_MAX = 32;
+static const size_t NOTIFY_SIZE_MAX = 4096;
+static const long ATTR_CACHE_MS = 1000;
+
 class ChannelDirection;
 class Channel;
 class ChannelNode;
 class Server;
 class ServerNode;
+class SessionNode;
 class Unode;
 
 class ChannelDirection
@@ -67,6 +80,7 @@ class ChannelDirection
 public:
 	ChannelDirection();
 	~ChannelDirection();
+	void Reset();
 	size_t Send(ioctx_t* ctx, const void* ptr, size_t least, size_t max);
 	size_t Recv(ioctx_t* ctx, void* ptr, size_t least, size_t max);
 	void SendClose();
@@ -89,6 +103,14 @@ public:
 
 };
 
+enum mux_state
+{
+	MUX_STATE_BUILDING,
+	MUX_STATE_PENDING,
+	MUX_STATE_IN_FLIGHT,
+	MUX_STATE_DONE,
+};
+
 class Channel
 {
 public:
@@ -96,6 +118,7 @@ public:
 	~Channel();
 
 public:
+	void Reset(ioctx_t* ioctx);
 	void InformSystemTids(uintptr_t client_tid, uintptr_t server_tid);
 
 public:
@@ -124,6 +147,12 @@ public:
 	size_t UserRecv(ioctx_t* ctx, void* ptr, size_t least, size_t max);
 	void UserClose();
 
+public:
+	size_t MuxSend(ioctx_t* ctx, const void* ptr, size_t count);
+	size_t MuxReply(ioctx_t* ctx, const void* ptr, size_t count);
+	void MuxReplyAbort();
+	void MuxRequestFree();
+
 private:
 	kthread_mutex_t kernel_lock;
 	kthread_mutex_t user_lock;
@@ -137,6 +166,20 @@ public:
 	uid_t uid;
 	gid_t gid;
 
+public:
+	// State of a request on a multiplexed server, protected by its mux_lock.
+	Server* mux_server;
+	Channel* mux_prev;
+	Channel* mux_next;
+	uint8_t* request;
+	size_t request_used;
+	size_t request_size;
+	size_t request_capacity;
+	size_t request_id;
+	size_t mux_refs;
+	enum mux_state mux_state;
+	uint8_t request_inline[256];
+
 };
 
 class ChannelNode : public AbstractInode
@@ -157,7 +200,7 @@ private:
 class Server : public Refcountable
 {
 public:
-	Server();
+	Server(bool multiplexed, bool cacheable);
 	virtual ~Server();
 	void Disconnect();
 	void Unmount();
@@ -165,6 +208,41 @@ public:
 	Channel* Accept(ioctx_t* ctx);
 	Ref<Inode> BootstrapNode(ino_t ino, mode_t type);
 	Ref<Inode> OpenNode(ino_t ino, mode_t type);
+	bool IsMultiplexed() { return multiplexed; }
+	bool IsCacheable() { return cacheable; }
+	void Invalidate(ino_t ino, const char* name);
+	void InvalidateAll();
+	unsigned long AttributeGeneration()
+	{
+		return __atomic_load_n(&attr_generation, __ATOMIC_ACQUIRE);
+	}
+
+public:
+	bool Submit(Channel* channel);
+	void Finish(Channel* channel);
+	Channel* Receive(ioctx_t* ctx, SessionNode* session);
+	Channel* Reply(size_t request_id);
+	void Release(Channel* channel);
+	void Shutdown();
+
+private:
+	void Link(Channel** first, Channel** last, Channel* channel);
+	void Unlink(Channel** first, Channel** last, Channel* channel);
+	void Put(Channel* channel);
+
+private:
+	kthread_mutex_t mux_lock;
+	kthread_cond_t mux_cond;
+	Channel* pending_first;
+	Channel* pending_last;
+	Channel* in_flight_first;
+	Channel* in_flight_last;
+	Channel* free_channels;
+	size_t free_channels_count;
+	size_t next_request_id;
+	unsigned long attr_generation;
+	bool multiplexed;
+	bool cacheable;
 
 private:
 	kthread_mutex_t connect_lock;
@@ -191,6 +269,39 @@ private:
 
 };
 
+class SessionNode : public AbstractInode
+{
+public:
+	SessionNode(Ref<Server> server);
+	virtual ~SessionNode();
+	virtual ssize_t read(ioctx_t* ctx, uint8_t* buf, size_t count);
+	virtual ssize_t write(ioctx_t* ctx, const uint8_t* buf, size_t count);
+	virtual int shutdown(ioctx_t* ctx, int how);
+
+private:
+	void Notify();
+
+public:
+	bool shut;
+
+private:
+	ioctx_t kctx;
+	kthread_mutex_t read_lock;
+	kthread_mutex_t write_lock;
+	Ref<Server> server;
+	Channel* reading;
+	size_t reading_offset;
+	Channel* replying;
+	size_t reply_left;
+	size_t reply_header_used;
+	size_t reply_header_sent;
+	struct fsm_msg_header reply_header;
+	uint8_t* notify;
+	size_t notify_used;
+	bool notifying;
+
+};
+
 class Unode : public Inode
 {
 public:
@@ -218,7 +329,9 @@ public:
 	                       off_t off);
 	virtual ssize_t pwritev(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 	                       off_t off);
-
+	virtual bool mmap_page_supported();
+	virtual addr_t mmap_page(ioctx_t* ctx, off_t off);
+	virtual int msync_page(ioctx_t* ctx, off_t off, const uint8_t* page);
 	virtual int utimens(ioctx_t* ctx, const struct timespec* times);
 	virtual int isatty(ioctx_t* ctx);
 	virtual ssize_t readdirents(ioctx_t* ctx, struct dirent* dirent,
@@ -273,6 +386,12 @@ public:
 	virtual int shutdown(ioctx_t* ctx, int how);
 	virtual int getpeername(ioctx_t* ctx, uint8_t* addr, size_t* addrsize);
 	virtual int getsockname(ioctx_t* ctx, uint8_t* addr, size_t* addrsize);
+	virtual int epoll_ctl(ioctx_t* ctx, int op, int fd, Ref<Descriptor> desc,
+	                      const struct epoll_event* event);
+	virtual int epoll_wait(ioctx_t* ctx, struct epoll_event* events,
+	                       int maxevents, struct timespec timeout);
+	virtual ssize_t sendfile(ioctx_t* ctx, Ref<Inode> file, off_t offset,
+	                         size_t count);
 
 private:
 	bool SendMessage(Channel* channel, size_t type, void* ptr, size_t size,
@@ -281,10 +400,26 @@ private:
 	void RecvError(Channel* channel);
 	bool RecvBoolean(Channel* channel);
 	void UnexpectedResponse(Channel* channel, struct fsm_msg_header* hdr);
+	ssize_t SendRead(ioctx_t* ctx, uint8_t* buf, size_t count, off_t off);
+	ssize_t SendWrite(ioctx_t* ctx, const uint8_t* buf, size_t count,
+	                  off_t off);
+	static ssize_t PageCacheRead(void* user, ioctx_t* ctx, uint8_t* buf,
+	                             size_t count, off_t off);
+	Ref<Inode> SendOpen(ioctx_t* ctx, const char* filename, int flags,
+	                    mode_t mode);
+	void InvalidateEntry(const char* filename);
+	void InvalidateAttributes();
 
 private:
 	ioctx_t kctx;
 	Ref<Server> server;
+	kthread_mutex_t attr_lock;
+	struct stat attr_st;
+	struct timespec attr_expires;
+	unsigned long attr_generation;
+	unsigned long attr_changes;
+	bool attr_valid;
+	bool cache_validated;
 
 };
 
@@ -294,21 +429,26 @@ private:
 
 ChannelDirection::ChannelDirection()
 {
-	buffer_used = 0;
-	buffer_offset = 0;
 	transfer_lock = KTHREAD_MUTEX_INITIALIZER;
 	not_empty = KTHREAD_COND_INITIALIZER;
 	not_full = KTHREAD_COND_INITIALIZER;
-	still_reading = true;
-	still_writing = true;
-	sender_system_tid = 0;
-	receiver_system_tid = 0;
+	Reset();
 }
 
 ChannelDirection::~ChannelDirection()
 {
 }
 
+void ChannelDirection::Reset()
+{
+	buffer_used = 0;
+	buffer_offset = 0;
+	still_reading = true;
+	still_writing = true;
+	sender_system_tid = 0;
+	receiver_system_tid = 0;
+}
+
 size_t ChannelDirection::Send(ioctx_t* ctx, const void* ptr, size_t least, size_t max)
 {
 	const uint8_t* src = (const uint8_t*) ptr;
@@ -413,14 +553,32 @@ Channel::Channel(ioctx_t* ctx)
 	kernel_lock = KTHREAD_MUTEX_INITIALIZER;
 	user_lock = KTHREAD_MUTEX_INITIALIZER;
 	destruction_lock = KTHREAD_MUTEX_INITIALIZER;
-	user_closed = false;
-	kernel_closed = false;
-	uid = ctx ? ctx->uid : 0;
-	gid = ctx ? ctx->gid : 0;
+	request = request_inline;
+	request_capacity = sizeof(request_inline);
+	Reset(ctx);
 }
 
 Channel::~Channel()
 {
+	MuxRequestFree();
+}
+
+void Channel::Reset(ioctx_t* ctx)
+{
+	from_kernel.Reset();
+	from_user.Reset();
+	user_closed = false;
+	kernel_closed = false;
+	uid = ctx ? ctx->uid : 0;
+	gid = ctx ? ctx->gid : 0;
+	mux_server = NULL;
+	mux_prev = NULL;
+	mux_next = NULL;
+	request_used = 0;
+	request_size = 0;
+	request_id = 0;
+	mux_refs = 0;
+	mux_state = MUX_STATE_BUILDING;
 }
 
 void Channel::InformSystemTids(uintptr_t client_tid, uintptr_t server_tid)
@@ -434,6 +592,8 @@ void Channel::InformSystemTids(uintptr_t client_tid, uintptr_t server_tid)
 size_t Channel::KernelSend(ioctx_t* ctx, const void* ptr, size_t least,
                             size_t max)
 {
+	if ( mux_server )
+		return MuxSend(ctx, ptr, max);
 	ScopedLockSignal outer_lock(&kernel_lock);
 	if ( !outer_lock.IsAcquired() )
 		return errno = EINTR, 0;
@@ -455,6 +615,13 @@ size_t Channel::KernelRecv(ioctx_t* ctx, void* ptr, size_t least, size_t max)
 
 void Channel::KernelClose()
 {
+	if ( mux_server )
+	{
+		// Any reply still being sent is thrown away.
+		from_user.RecvClose();
+		mux_server->Finish(this);
+		return;
+	}
 	// No lock needed, this thread is the last to use this object as kernel.
 	from_kernel.SendClose();
 	from_user.RecvClose();
@@ -502,6 +669,72 @@ void Channel::UserClose()
 		delete this;
 }
 
+// Requests to a multiplexed server are buffered until complete, so the server
+// never sees a partial request even if the sender faults or is interrupted, and
+// the session can hand out whole requests in any order.
+size_t Channel::MuxSend(ioctx_t* ctx, const void* ptr, size_t count)
+{
+	if ( mux_state != MUX_STATE_BUILDING )
+		return errno = EINVAL, 0;
+	if ( MUX_REQUEST_MAX - request_used < count ||
+	     (request_size && request_size - request_used < count) )
+		return errno = EMSGSIZE, 0;
+	size_t needed = request_used + count;
+	if ( request_capacity < needed )
+	{
+		size_t new_capacity = request_size ? request_size : 2 * needed;
+		if ( new_capacity < needed || MUX_REQUEST_MAX < new_capacity )
+			new_capacity = needed;
+		uint8_t* new_request = new uint8_t[new_capacity];
+		if ( !new_request )
+			return 0;
+		memcpy(new_request, request, request_used);
+		MuxRequestFree();
+		request = new_request;
+		request_capacity = new_capacity;
+	}
+	if ( !ctx->copy_from_src(request + request_used, ptr, count) )
+		return 0;
+	request_used += count;
+	struct fsm_msg_header hdr;
+	if ( !request_size && sizeof(hdr) <= request_used )
+	{
+		memcpy(&hdr, request, sizeof(hdr));
+		if ( MUX_REQUEST_MAX - sizeof(hdr) < hdr.msgsize )
+			return errno = EMSGSIZE, 0;
+		request_size = sizeof(hdr) + hdr.msgsize;
+		if ( request_size < request_used )
+			return errno = EINVAL, 0;
+	}
+	if ( request_size && request_used == request_size &&
+	     !mux_server->Submit(this) )
+		return 0;
+	return count;
+}
+
+// Forwards part of the reply to the kernel thread waiting for it. The rest of
+// the reply is silently discarded if that thread has given up on the request.
+size_t Channel::MuxReply(ioctx_t* ctx, const void* ptr, size_t count)
+{
+	size_t amount = from_user.Send(ctx, ptr, count, count);
+	if ( amount < count && errno == ECONNRESET )
+		return count;
+	return amount;
+}
+
+void Channel::MuxReplyAbort()
+{
+	from_user.SendClose();
+}
+
+void Channel::MuxRequestFree()
+{
+	if ( request != request_inline )
+		delete[] request;
+	request = request_inline;
+	request_capacity = sizeof(request_inline);
+}
+
 //
 // Implementation of ChannelNode.
 //
@@ -546,8 +779,20 @@ ssize_t ChannelNode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
 // Implementation of Server.
 //
 
-Server::Server()
-{
+Server::Server(bool multiplexed, bool cacheable)
+{
+	mux_lock = KTHREAD_MUTEX_INITIALIZER;
+	mux_cond = KTHREAD_COND_INITIALIZER;
+	pending_first = NULL;
+	pending_last = NULL;
+	in_flight_first = NULL;
+	in_flight_last = NULL;
+	free_channels = NULL;
+	free_channels_count = 0;
+	next_request_id = 1;
+	attr_generation = 0;
+	this->multiplexed = multiplexed;
+	this->cacheable = cacheable;
 	connect_lock = KTHREAD_MUTEX_INITIALIZER;
 	connecting_cond = KTHREAD_COND_INITIALIZER;
 	connectable_cond = KTHREAD_COND_INITIALIZER;
@@ -559,6 +804,13 @@ Server::Server()
 
 Server::~Server()
 {
+	while ( free_channels )
+	{
+		Channel* channel = free_channels;
+		free_channels = channel->mux_next;
+		delete channel;
+	}
+	PageCache::InvalidateDevice((dev_t) this);
 }
 
 void Server::Disconnect()
@@ -566,6 +818,28 @@ void Server::Disconnect()
 	ScopedLock lock(&connect_lock);
 	disconnected = true;
 	kthread_cond_signal(&connectable_cond);
+	if ( multiplexed )
+	{
+		// Fail the requests the server will never answer.
+		ScopedLock mux_lock_scope(&mux_lock);
+		Channel** lists[2][2] =
+		{
+			{ &pending_first, &pending_last },
+			{ &in_flight_first, &in_flight_last },
+		};
+		for ( size_t i = 0; i < 2; i++ )
+		{
+			while ( Channel* channel = *lists[i][0] )
+			{
+				Unlink(lists[i][0], lists[i][1], channel);
+				channel->mux_state = MUX_STATE_DONE;
+				channel->MuxReplyAbort();
+				if ( !--channel->mux_refs )
+					Put(channel);
+			}
+		}
+		kthread_cond_broadcast(&mux_cond);
+	}
 }
 
 void Server::Unmount()
@@ -573,10 +847,35 @@ void Server::Unmount()
 	ScopedLock lock(&connect_lock);
 	unmounted = true;
 	kthread_cond_signal(&connecting_cond);
+	if ( multiplexed )
+	{
+		ScopedLock mux_lock_scope(&mux_lock);
+		kthread_cond_broadcast(&mux_cond);
+	}
 }
 
 Channel* Server::Connect(ioctx_t* ctx)
 {
+	if ( multiplexed )
+	{
+		// The request is queued once it has been sent in full, so there's no
+		// need to wait for the server to accept a connection.
+		ScopedLock lock(&mux_lock);
+		if ( disconnected )
+			return errno = ECONNREFUSED, (Channel*) NULL;
+		Channel* channel = free_channels;
+		if ( channel )
+		{
+			free_channels = channel->mux_next;
+			free_channels_count--;
+			channel->Reset(ctx);
+		}
+		else if ( !(channel = new Channel(ctx)) )
+			return NULL;
+		channel->mux_server = this;
+		channel->mux_refs = 1;
+		return channel;
+	}
 	Channel* channel = new Channel(ctx);
 	if ( !channel )
 		return NULL;
@@ -602,6 +901,8 @@ Channel* Server::Connect(ioctx_t* ctx)
 
 Channel* Server::Accept(ioctx_t* ctx)
 {
+	if ( multiplexed )
+		return errno = EINVAL, (Channel*) NULL;
 	ScopedLock lock(&connect_lock);
 	listener_system_tid = CurrentThread()->system_tid;
 	while ( !connecting && !unmounted )
@@ -629,6 +930,144 @@ Ref<Inode> Server::OpenNode(ino_t ino, mode_t type)
 	return BootstrapNode(ino, type);
 }
 
+void Server::Link(Channel** first, Channel** last, Channel* channel)
+{
+	// mux_lock is held.
+	channel->mux_prev = *last;
+	channel->mux_next = NULL;
+	(*last ? (*last)->mux_next : *first) = channel;
+	*last = channel;
+}
+
+void Server::Unlink(Channel** first, Channel** last, Channel* channel)
+{
+	// mux_lock is held.
+	(channel->mux_prev ? channel->mux_prev->mux_next : *first) =
+		channel->mux_next;
+	(channel->mux_next ? channel->mux_next->mux_prev : *last) =
+		channel->mux_prev;
+	channel->mux_prev = NULL;
+	channel->mux_next = NULL;
+}
+
+void Server::Put(Channel* channel)
+{
+	// mux_lock is held.
+	if ( MUX_FREE_CHANNELS_MAX <= free_channels_count )
+	{
+		delete channel;
+		return;
+	}
+	channel->MuxRequestFree();
+	channel->mux_next = free_channels;
+	free_channels = channel;
+	free_channels_count++;
+}
+
+bool Server::Submit(Channel* channel)
+{
+	ScopedLock lock(&mux_lock);
+	if ( disconnected )
+		return errno = ECONNREFUSED, false;
+	channel->request_id = next_request_id++;
+	size_t offset = offsetof(struct fsm_msg_header, request_id);
+	memcpy(channel->request + offset, &channel->request_id,
+	       sizeof(channel->request_id));
+	channel->mux_state = MUX_STATE_PENDING;
+	channel->mux_refs++;
+	Link(&pending_first, &pending_last, channel);
+	kthread_cond_signal(&mux_cond);
+	return true;
+}
+
+void Server::Finish(Channel* channel)
+{
+	ScopedLock lock(&mux_lock);
+	if ( channel->mux_state == MUX_STATE_PENDING )
+	{
+		Unlink(&pending_first, &pending_last, channel);
+		channel->mux_refs--;
+	}
+	else if ( channel->mux_state == MUX_STATE_IN_FLIGHT )
+	{
+		Unlink(&in_flight_first, &in_flight_last, channel);
+		channel->mux_refs--;
+	}
+	channel->mux_state = MUX_STATE_DONE;
+	if ( !--channel->mux_refs )
+		Put(channel);
+}
+
+Channel* Server::Receive(ioctx_t* ctx, SessionNode* session)
+{
+	ScopedLock lock(&mux_lock);
+	while ( !pending_first )
+	{
+		if ( unmounted || disconnected || session->shut )
+			return errno = 0, (Channel*) NULL;
+		if ( ctx->dflags & O_NONBLOCK )
+			return errno = EWOULDBLOCK, (Channel*) NULL;
+		if ( !kthread_cond_wait_signal(&mux_cond, &mux_lock) )
+			return errno = EINTR, (Channel*) NULL;
+	}
+	Channel* channel = pending_first;
+	Unlink(&pending_first, &pending_last, channel);
+	Link(&in_flight_first, &in_flight_last, channel);
+	channel->mux_state = MUX_STATE_IN_FLIGHT;
+	channel->mux_refs++;
+	return channel;
+}
+
+Channel* Server::Reply(size_t request_id)
+{
+	ScopedLock lock(&mux_lock);
+	for ( Channel* channel = in_flight_first; channel; channel = channel->mux_next )
+	{
+		if ( channel->request_id != request_id )
+			continue;
+		// The in-flight reference is handed over to the replying session.
+		Unlink(&in_flight_first, &in_flight_last, channel);
+		channel->mux_state = MUX_STATE_DONE;
+		return channel;
+	}
+	return NULL;
+}
+
+void Server::Release(Channel* channel)
+{
+	ScopedLock lock(&mux_lock);
+	if ( !--channel->mux_refs )
+		Put(channel);
+}
+
+void Server::Shutdown()
+{
+	ScopedLock lock(&mux_lock);
+	kthread_cond_broadcast(&mux_cond);
+}
+
+void Server::Invalidate(ino_t ino, const char* name)
+{
+	// The server changed the filesystem on its own, so forget what the kernel
+	// remembers about the directory entry, or about the inode if no name.
+	__atomic_add_fetch(&attr_generation, 1, __ATOMIC_RELEASE);
+	dev_t dev = (dev_t) this;
+	if ( name )
+		DentryCache::Remove(dev, ino, name);
+	else
+	{
+		DentryCache::InvalidateDirectory(dev, ino);
+		PageCache::Invalidate(dev, ino, 0, OFF_MAX);
+	}
+}
+
+void Server::InvalidateAll()
+{
+	__atomic_add_fetch(&attr_generation, 1, __ATOMIC_RELEASE);
+	DentryCache::InvalidateDevice((dev_t) this);
+	PageCache::InvalidateDevice((dev_t) this);
+}
+
 //
 // Implementation of ServerNode.
 //
@@ -646,6 +1085,8 @@ ServerNode::ServerNode(Ref<Server> server)
 ServerNode::~ServerNode()
 {
 	server->Disconnect();
+	// The cached entries keep the inodes and thus the server alive.
+	DentryCache::InvalidateDevice((dev_t) server.Get());
 }
 
 Ref<Inode> ServerNode::accept4(ioctx_t* ctx, uint8_t* addr, size_t* addrlen,
@@ -657,6 +1098,8 @@ Ref<Inode> ServerNode::accept4(ioctx_t* ctx, uint8_t* addr, size_t* addrlen,
 	size_t out_addrlen = 0;
 	if ( addrlen && !ctx->copy_to_dest(addrlen, &out_addrlen, sizeof(out_addrlen)) )
 		return Ref<Inode>(NULL);
+	if ( server->IsMultiplexed() )
+		return Ref<Inode>(new SessionNode(server));
 	Ref<ChannelNode> node(new ChannelNode);
 	if ( !node )
 		return Ref<Inode>(NULL);
@@ -667,10 +1110,201 @@ Ref<Inode> ServerNode::accept4(ioctx_t* ctx, uint8_t* addr, size_t* addrlen,
 	return node;
 }
 
+//
+// Implementation of SessionNode.
+//
+
+// A session is a long-lived connection to a multiplexed server. Each read
+// returns bytes from at most one request, starting with its header carrying the
+// request id, and the replies are written to any session in any order, each
+// starting with a header carrying the id of the request it answers. The server
+// may also write notifications that don't answer any request.
+
+SessionNode::SessionNode(Ref<Server> server)
+{
+	inode_type = INODE_TYPE_STREAM;
+	this->server = server;
+	this->type = S_IFCHR;
+	this->dev = (dev_t) this;
+	this->ino = 0;
+	SetupKernelIOCtx(&kctx);
+	read_lock = KTHREAD_MUTEX_INITIALIZER;
+	write_lock = KTHREAD_MUTEX_INITIALIZER;
+	shut = false;
+	reading = NULL;
+	reading_offset = 0;
+	replying = NULL;
+	reply_left = 0;
+	reply_header_used = 0;
+	reply_header_sent = 0;
+	notify = NULL;
+	notify_used = 0;
+	notifying = false;
+	// TODO: Set uid, gid, mode.
+}
+
+SessionNode::~SessionNode()
+{
+	if ( reading )
+		server->Release(reading);
+	if ( replying )
+	{
+		// The rest of the reply will never come.
+		replying->MuxReplyAbort();
+		server->Release(replying);
+	}
+	delete[] notify;
+}
+
+ssize_t SessionNode::read(ioctx_t* ctx, uint8_t* buf, size_t count)
+{
+	ScopedLockSignal lock(&read_lock);
+	if ( !lock.IsAcquired() )
+		return errno = EINTR, -1;
+	if ( !reading )
+	{
+		if ( !(reading = server->Receive(ctx, this)) )
+			return errno ? -1 : 0;
+		reading_offset = 0;
+	}
+	size_t left = reading->request_size - reading_offset;
+	if ( left < count )
+		count = left;
+	if ( !ctx->copy_to_dest(buf, reading->request + reading_offset, count) )
+		return -1;
+	reading_offset += count;
+	if ( reading_offset == reading->request_size )
+	{
+		server->Release(reading);
+		reading = NULL;
+	}
+	return (ssize_t) count;
+}
+
+ssize_t SessionNode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
+{
+	ScopedLockSignal lock(&write_lock);
+	if ( !lock.IsAcquired() )
+		return errno = EINTR, -1;
+	size_t sofar = 0;
+	while ( sofar < count )
+	{
+		// Assemble the header of the next reply.
+		if ( reply_header_used < sizeof(reply_header) )
+		{
+			size_t amount = sizeof(reply_header) - reply_header_used;
+			if ( count - sofar < amount )
+				amount = count - sofar;
+			uint8_t* header = (uint8_t*) &reply_header;
+			if ( !ctx->copy_from_src(header + reply_header_used, buf + sofar,
+			                         amount) )
+				return sofar ? (ssize_t) sofar : -1;
+			reply_header_used += amount;
+			sofar += amount;
+			if ( reply_header_used < sizeof(reply_header) )
+				break;
+			reply_left = reply_header.msgsize;
+			reply_header_sent = 0;
+			if ( reply_header.msgtype == FSM_NOTIFY_INVALIDATE )
+			{
+				// Notifications are collected whole before being handled.
+				notifying = true;
+				notify_used = 0;
+				if ( reply_left <= NOTIFY_SIZE_MAX )
+					notify = new uint8_t[reply_left + 1];
+				replying = NULL;
+			}
+			else
+				replying = server->Reply(reply_header.request_id);
+			// The server answered, so it doesn't want the rest of the request.
+			if ( reading && reading == replying )
+			{
+				server->Release(reading);
+				reading = NULL;
+			}
+		}
+		if ( replying && reply_header_sent < sizeof(reply_header) )
+		{
+			uint8_t* header = (uint8_t*) &reply_header;
+			size_t amount = sizeof(reply_header) - reply_header_sent;
+			size_t done = replying->MuxReply(&kctx, header + reply_header_sent,
+			                                 amount);
+			reply_header_sent += done;
+			if ( done < amount )
+				return sofar ? (ssize_t) sofar : -1;
+		}
+		size_t amount = count - sofar;
+		if ( reply_left < amount )
+			amount = reply_left;
+		size_t done = amount;
+		if ( replying && amount )
+			done = replying->MuxReply(ctx, buf + sofar, amount);
+		else if ( notify && amount )
+		{
+			if ( !ctx->copy_from_src(notify + notify_used, buf + sofar, amount) )
+				return sofar ? (ssize_t) sofar : -1;
+			notify_used += amount;
+		}
+		reply_left -= done;
+		sofar += done;
+		if ( !reply_left )
+		{
+			if ( replying )
+				server->Release(replying);
+			if ( notifying )
+				Notify();
+			replying = NULL;
+			reply_header_used = 0;
+		}
+		if ( done < amount )
+			return sofar ? (ssize_t) sofar : -1;
+	}
+	return (ssize_t) sofar;
+}
+
+void SessionNode::Notify()
+{
+	struct fsm_notify_invalidate msg;
+	if ( notify && sizeof(msg) <= notify_used &&
+	     (memcpy(&msg, notify, sizeof(msg)), true) &&
+	     msg.namelen <= notify_used - sizeof(msg) )
+	{
+		char* name = (char*) notify + sizeof(msg);
+		name[msg.namelen] = '\0';
+		server->Invalidate(msg.ino, msg.namelen ? name : NULL);
+	}
+	else
+		server->InvalidateAll();
+	delete[] notify;
+	notify = NULL;
+	notifying = false;
+}
+
+int SessionNode::shutdown(ioctx_t* /*ctx*/, int how)
+{
+	if ( how & ~(SHUT_RD | SHUT_WR) )
+		return errno = EINVAL, -1;
+	if ( how & SHUT_RD )
+	{
+		shut = true;
+		server->Shutdown();
+	}
+	return 0;
+}
+
 //
 // Implementation of Unode.
 //
 
+// Paging in memory mapped files from this server in the middle of a transfer
+// would wait for the server while it is busy with the transfer, so the user's
+// buffer is paged in before the request is sent.
+static void FaultInBuffer(ioctx_t* ctx, const void* buf, size_t count)
+{
+	if ( ctx->copy_to_dest == CopyToUser )
+		FaultInUser(buf, count);
+}
+
 Unode::Unode(Ref<Server> server, ino_t ino, mode_t type)
 {
 	SetupKernelIOCtx(&kctx);
@@ -678,6 +1312,11 @@ Unode::Unode(Ref<Server> server, ino_t ino, mode_t type)
 	this->ino = ino;
 	this->dev = (dev_t) server.Get();
 	this->type = type;
+	this->attr_lock = KTHREAD_MUTEX_INITIALIZER;
+	this->attr_generation = 0;
+	this->attr_changes = 0;
+	this->attr_valid = false;
+	this->cache_validated = false;
 
 	// Let the remote know that the kernel is using this inode.
 	Thread* thread = CurrentThread();
@@ -697,6 +1336,10 @@ Unode::Unode(Ref<Server> server, ino_t ino, mode_t type)
 
 Unode::~Unode()
 {
+	// The inode number may be reused once the server is done with the inode,
+	// so the cached entries must not outlive the directory.
+	if ( server->IsCacheable() && S_ISDIR(type) )
+		DentryCache::InvalidateDirectory(dev, ino);
 	// Let the remote know that the kernel is no longer using this inode.
 	Thread* thread = CurrentThread();
 	bool saved = thread->force_no_signals;
@@ -721,6 +1364,7 @@ bool Unode::SendMessage(Channel* channel, size_t type, void* ptr, size_t size,
 	hdr.msgsize = size + extra;
 	hdr.uid = channel->uid;
 	hdr.gid = channel->gid;
+	hdr.request_id = 0;
 	if ( !channel->KernelSend(&kctx, &hdr, sizeof(hdr)) )
 		return false;
 	if ( !channel->KernelSend(&kctx, ptr, size) )
@@ -803,6 +1447,23 @@ int Unode::sync(ioctx_t* ctx)
 
 int Unode::stat(ioctx_t* ctx, struct stat* st)
 {
+	// The attributes are remembered for a short while if the files only change
+	// through the kernel, unless the server says otherwise.
+	bool cacheable = server->IsCacheable();
+	unsigned long generation = server->AttributeGeneration();
+	unsigned long changes = 0;
+	if ( cacheable )
+	{
+		struct stat cached;
+		kthread_mutex_lock(&attr_lock);
+		bool hit = attr_valid && attr_generation == generation &&
+		           timespec_lt(Time::Get(CLOCK_MONOTONIC), attr_expires);
+		cached = attr_st;
+		changes = attr_changes;
+		kthread_mutex_unlock(&attr_lock);
+		if ( hit )
+			return ctx->copy_to_dest(st, &cached, sizeof(*st)) ? 0 : -1;
+	}
 	// stat(2) isn't allowed to fail with EINTR.
 	sigset_t set, oldset;
 	sigfillset(&set);
@@ -815,16 +1476,53 @@ int Unode::stat(ioctx_t* ctx, struct stat* st)
 		struct fsm_resp_stat resp;
 		msg.ino = ino;
 		if ( SendMessage(channel, FSM_REQ_STAT, &msg, sizeof(msg)) &&
-			 RecvMessage(channel, FSM_RESP_STAT, &resp, sizeof(resp)) &&
-			 (resp.st.st_dev = (dev_t) server.Get(), true) &&
-			 ctx->copy_to_dest(st, &resp.st, sizeof(*st)) )
-			ret = 0;
+			 RecvMessage(channel, FSM_RESP_STAT, &resp, sizeof(resp)) )
+		{
+			resp.st.st_dev = (dev_t) server.Get();
+			if ( cacheable )
+			{
+				// Attributes fetched before a change are not remembered.
+				kthread_mutex_lock(&attr_lock);
+				if ( attr_changes == changes )
+				{
+					struct timespec timeout =
+						timespec_make(ATTR_CACHE_MS / 1000,
+						              ATTR_CACHE_MS % 1000 * 1000000L);
+					attr_st = resp.st;
+					attr_expires =
+						timespec_add(Time::Get(CLOCK_MONOTONIC), timeout);
+					attr_generation = generation;
+					attr_valid = true;
+				}
+				kthread_mutex_unlock(&attr_lock);
+			}
+			if ( ctx->copy_to_dest(st, &resp.st, sizeof(*st)) )
+				ret = 0;
+		}
 		channel->KernelClose();
 	}
 	Signal::UpdateMask(SIG_SETMASK, &oldset, NULL);
 	return ret;
 }
 
+void Unode::InvalidateAttributes()
+{
+	ScopedLock lock(&attr_lock);
+	attr_valid = false;
+	attr_changes++;
+}
+
+void Unode::InvalidateEntry(const char* filename)
+{
+	// The name changed meaning, and this directory and the inode it named may
+	// have changed their link count and timestamps.
+	InvalidateAttributes();
+	if ( !server->IsCacheable() )
+		return;
+	if ( Ref<Inode> inode = DentryCache::Remove(dev, ino, filename) )
+		((Unode*) inode.Get())->InvalidateAttributes();
+}
+
 int Unode::statvfs(ioctx_t* ctx, struct statvfs* stvfs)
 {
 	Channel* channel = server->Connect(ctx);
@@ -857,6 +1555,7 @@ int Unode::chmod(ioctx_t* ctx, mode_t mode)
 	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
 	channel->KernelClose();
+	InvalidateAttributes();
 	return ret;
 }
 
@@ -874,6 +1573,7 @@ int Unode::chown(ioctx_t* ctx, uid_t owner, gid_t group)
 	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
 	channel->KernelClose();
+	InvalidateAttributes();
 	return ret;
 }
 
@@ -895,6 +1595,8 @@ int Unode::truncate(ioctx_t* ctx, off_t length)
 			 RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
 			ret = 0;
 		channel->KernelClose();
+		InvalidateAttributes();
+		PageCache::Invalidate(dev, ino, length, OFF_MAX);
 	}
 	Signal::UpdateMask(SIG_SETMASK, &oldset, NULL);
 	return ret;
@@ -922,6 +1624,7 @@ off_t Unode::lseek(ioctx_t* ctx, off_t offset, int whence)
 
 ssize_t Unode::read(ioctx_t* ctx, uint8_t* buf, size_t count)
 {
+	FaultInBuffer(ctx, buf, count);
 	Channel* channel = server->Connect(ctx);
 	if ( !channel )
 		return -1;
@@ -969,6 +1672,31 @@ ssize_t Unode::readv(ioctx_t* ctx, const struct iovec* iov, int iovcnt)
 }
 
 ssize_t Unode::pread(ioctx_t* ctx, uint8_t* buf, size_t count, off_t off)
+{
+	FaultInBuffer(ctx, buf, count);
+	if ( !(server->IsCacheable() && S_ISREG(type)) )
+		return SendRead(ctx, buf, count, off);
+	// The server only changes its files when asked by the kernel, so regular
+	// files are read through the page cache. The cached pages are checked the
+	// first time as the inode number may have belonged to a deleted file.
+	struct stat st;
+	bool validate = !cache_validated;
+	if ( validate && stat(&kctx, &st) < 0 )
+		return -1;
+	ssize_t result = PageCache::Read(dev, ino, ctx, buf, count, off,
+	                                 validate ? &st : NULL, PageCacheRead,
+	                                 this);
+	cache_validated = true;
+	return result;
+}
+
+ssize_t Unode::PageCacheRead(void* user, ioctx_t* ctx, uint8_t* buf,
+                             size_t count, off_t off)
+{
+	return ((Unode*) user)->SendRead(ctx, buf, count, off);
+}
+
+ssize_t Unode::SendRead(ioctx_t* ctx, uint8_t* buf, size_t count, off_t off)
 {
 	Channel* channel = server->Connect(ctx);
 	if ( !channel )
@@ -1023,6 +1751,26 @@ ssize_t Unode::preadv(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 
 ssize_t Unode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
 {
+	// Multiplexed requests are buffered whole in the kernel, so send large
+	// writes in pieces.
+	if ( server->IsMultiplexed() && MUX_WRITE_MAX < count )
+	{
+		size_t sofar = 0;
+		while ( sofar < count )
+		{
+			size_t amount = count - sofar;
+			if ( MUX_WRITE_MAX < amount )
+				amount = MUX_WRITE_MAX;
+			ssize_t done = write(ctx, buf + sofar, amount);
+			if ( done < 0 )
+				return sofar ? (ssize_t) sofar : -1;
+			sofar += done;
+			if ( (size_t) done < amount )
+				break;
+		}
+		return (ssize_t) sofar;
+	}
+	FaultInBuffer(ctx, buf, count);
 	Channel* channel = server->Connect(ctx);
 	if ( !channel )
 		return -1;
@@ -1035,6 +1783,7 @@ ssize_t Unode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
 	hdr.msgsize = sizeof(msg) + count;
 	hdr.uid = ctx->uid;
 	hdr.gid = ctx->gid;
+	hdr.request_id = 0;
 	struct fsm_resp_write resp;
 	if ( channel->KernelSend(&kctx, &hdr, sizeof(hdr)) &&
 	     channel->KernelSend(&kctx, &msg, sizeof(msg)) &&
@@ -1042,6 +1791,9 @@ ssize_t Unode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
 	     RecvMessage(channel, FSM_RESP_WRITE, &resp, sizeof(resp)) )
 		ret = (ssize_t) resp.count;
 	channel->KernelClose();
+	InvalidateAttributes();
+	// The offset of the write is only known by the server.
+	PageCache::Invalidate(dev, ino, 0, OFF_MAX);
 	return ret;
 }
 
@@ -1073,6 +1825,35 @@ ssize_t Unode::writev(ioctx_t* ctx, const struct iovec* iov, int iovcnt)
 
 ssize_t Unode::pwrite(ioctx_t* ctx, const uint8_t* buf, size_t count, off_t off)
 {
+	FaultInBuffer(ctx, buf, count);
+	ssize_t ret = SendWrite(ctx, buf, count, off);
+	PageCache::Invalidate(dev, ino, off, count);
+	return ret;
+}
+
+ssize_t Unode::SendWrite(ioctx_t* ctx, const uint8_t* buf, size_t count,
+                         off_t off)
+{
+	if ( server->IsMultiplexed() && MUX_WRITE_MAX < count )
+	{
+		size_t sofar = 0;
+		while ( sofar < count )
+		{
+			size_t amount = count - sofar;
+			if ( MUX_WRITE_MAX < amount )
+				amount = MUX_WRITE_MAX;
+			off_t offset;
+			if ( __builtin_add_overflow(off, sofar, &offset) )
+				return sofar ? (ssize_t) sofar : (errno = EOVERFLOW, -1);
+			ssize_t done = SendWrite(ctx, buf + sofar, amount, offset);
+			if ( done < 0 )
+				return sofar ? (ssize_t) sofar : -1;
+			sofar += done;
+			if ( (size_t) done < amount )
+				break;
+		}
+		return (ssize_t) sofar;
+	}
 	Channel* channel = server->Connect(ctx);
 	if ( !channel )
 		return -1;
@@ -1086,6 +1867,7 @@ ssize_t Unode::pwrite(ioctx_t* ctx, const uint8_t* buf, size_t count, off_t off)
 	hdr.msgsize = sizeof(msg) + count;
 	hdr.uid = ctx->uid;
 	hdr.gid = ctx->gid;
+	hdr.request_id = 0;
 	struct fsm_resp_write resp;
 	if ( channel->KernelSend(&kctx, &hdr, sizeof(hdr)) &&
 	     channel->KernelSend(&kctx, &msg, sizeof(msg)) &&
@@ -1093,6 +1875,7 @@ ssize_t Unode::pwrite(ioctx_t* ctx, const uint8_t* buf, size_t count, off_t off)
 	     RecvMessage(channel, FSM_RESP_WRITE, &resp, sizeof(resp)) )
 		ret = (ssize_t) resp.count;
 	channel->KernelClose();
+	InvalidateAttributes();
 	return ret;
 }
 
@@ -1126,6 +1909,69 @@ ssize_t Unode::pwritev(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 	return sofar;
 }
 
+bool Unode::mmap_page_supported()
+{
+	// Files are paged in through the page cache without asking the server.
+	return true;
+}
+
+addr_t Unode::mmap_page(ioctx_t* /*ctx*/, off_t off)
+{
+	// The page fault can't be interrupted by signals.
+	Thread* thread = CurrentThread();
+	bool saved = thread->force_no_signals;
+	thread->force_no_signals = true;
+	thread->DoUpdatePendingSignal();
+	// The file may have changed since it was cached, so check whether the
+	// cached pages are still current the first time this inode is mapped.
+	addr_t result = 0;
+	struct stat st;
+	bool validate = !cache_validated;
+	if ( !validate || stat(&kctx, &st) == 0 )
+	{
+		result = PageCache::GetPage(dev, ino, off, validate ? &st : NULL,
+		                            PageCacheRead, this);
+		cache_validated = true;
+	}
+	thread->force_no_signals = saved;
+	thread->DoUpdatePendingSignal();
+	return result;
+}
+
+int Unode::msync_page(ioctx_t* /*ctx*/, off_t off, const uint8_t* page)
+{
+	addr_t phys;
+	if ( !Memory::LookUp((addr_t) page, &phys, NULL) )
+		return errno = EFAULT, -1;
+	// The changes would be lost if the write back was interrupted by signals.
+	Thread* thread = CurrentThread();
+	bool saved = thread->force_no_signals;
+	thread->force_no_signals = true;
+	thread->DoUpdatePendingSignal();
+	// Only the part of the page inside the file is written back, and the
+	// cached copy of the page is kept as it has the same contents.
+	int ret = -1;
+	struct stat st;
+	if ( stat(&kctx, &st) == 0 )
+	{
+		off_t left = off < st.st_size ? st.st_size - off : 0;
+		size_t count = (uintmax_t) left < Page::Size() ? (size_t) left :
+		               Page::Size();
+		ssize_t amount = count ? SendWrite(&kctx, page, count, off) : 0;
+		if ( 0 <= amount && (size_t) amount < count )
+			errno = EIO;
+		else if ( 0 <= amount && (!count || stat(&kctx, &st) == 0) )
+		{
+			if ( count )
+				PageCache::UpdatePage(dev, ino, off, phys, &st);
+			ret = 0;
+		}
+	}
+	thread->force_no_signals = saved;
+	thread->DoUpdatePendingSignal();
+	return ret;
+}
+
 int Unode::utimens(ioctx_t* ctx, const struct timespec* times)
 {
 	Channel* channel = server->Connect(ctx);
@@ -1140,6 +1986,7 @@ int Unode::utimens(ioctx_t* ctx, const struct timespec* times)
 	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
 	channel->KernelClose();
+	InvalidateAttributes();
 	return ret;
 }
 
@@ -1204,6 +2051,38 @@ ssize_t Unode::readdirents(ioctx_t* ctx, struct dirent* dirent, size_t size,
 
 Ref<Inode> Unode::open(ioctx_t* ctx, const char* filename, int flags,
                        mode_t mode)
+{
+	// Lookups are answered from the directory entry cache, while the opens that
+	// may create, write or truncate the file are left to the server.
+	bool lookup = server->IsCacheable() &&
+	              !(flags & (O_CREATE | O_WRITE | O_TRUNC)) &&
+	              strcmp(filename, ".") != 0 && strcmp(filename, "..") != 0;
+	unsigned long generation = 0;
+	if ( lookup )
+	{
+		Ref<Inode> inode;
+		if ( DentryCache::Lookup(dev, ino, filename, &inode, &generation) )
+		{
+			if ( !inode )
+				return errno = ENOENT, Ref<Inode>(NULL);
+			if ( (flags & O_DIRECTORY) &&
+			     !S_ISDIR(inode->type) && !S_ISLNK(inode->type) )
+				return errno = ENOTDIR, Ref<Inode>(NULL);
+			return inode;
+		}
+	}
+	Ref<Inode> result = SendOpen(ctx, filename, flags, mode);
+	int errnum = errno;
+	if ( lookup && (result || errnum == ENOENT) )
+		DentryCache::Insert(dev, ino, filename, result, generation);
+	else if ( flags & O_CREATE )
+		InvalidateEntry(filename);
+	errno = errnum;
+	return result;
+}
+
+Ref<Inode> Unode::SendOpen(ioctx_t* ctx, const char* filename, int flags,
+                           mode_t mode)
 {
 	// open(2) may EINTR on slow devices but is used by stat(2) and readlink(2)
 	// wnich aren't allowed to EINTR.
@@ -1254,6 +2133,7 @@ int Unode::mkdir(ioctx_t* ctx, const char* filename, mode_t mode)
 	     RecvMessage(channel, FSM_RESP_MKDIR, &resp, sizeof(resp)) )
 		ret = 0;
 	channel->KernelClose();
+	InvalidateEntry(filename);
 	return ret;
 }
 
@@ -1275,6 +2155,8 @@ int Unode::link(ioctx_t* ctx, const char* filename, Ref<Inode> node)
 	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
 	channel->KernelClose();
+	InvalidateEntry(filename);
+	((Unode*) node.Get())->InvalidateAttributes();
 	return ret;
 }
 
@@ -1299,6 +2181,7 @@ int Unode::unlink(ioctx_t* ctx, const char* filename)
 	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
 	channel->KernelClose();
+	InvalidateEntry(filename);
 	return ret;
 }
 
@@ -1323,6 +2206,7 @@ int Unode::rmdir(ioctx_t* ctx, const char* filename)
 	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
 	channel->KernelClose();
+	InvalidateEntry(filename);
 	return ret;
 }
 
@@ -1350,6 +2234,7 @@ int Unode::symlink(ioctx_t* ctx, const char* oldname, const char* filename)
 	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
 	channel->KernelClose();
+	InvalidateEntry(filename);
 	return ret;
 }
 
@@ -1511,6 +2396,8 @@ int Unode::rename_here(ioctx_t* ctx, Ref<Inode> from, const char* oldname,
 	     RecvMessage(channel, FSM_RESP_SUCCESS, NULL, 0) )
 		ret = 0;
 	channel->KernelClose();
+	InvalidateEntry(newname);
+	((Unode*) from.Get())->InvalidateEntry(oldname);
 	return ret;
 }
 
@@ -1662,6 +2549,8 @@ ssize_t Unode::tcsetblob(ioctx_t* ctx, const char* name, const void* buffer, siz
 int Unode::unmounted(ioctx_t* /*ctx*/)
 {
 	server->Unmount();
+	// The cached entries keep the inodes and thus the server alive.
+	DentryCache::InvalidateDevice(dev);
 	return 0;
 }
 
@@ -1807,11 +2696,32 @@ int Unode::getsockname(ioctx_t* /*ctx*/, uint8_t* /*addr*/,
 	return errno = ENOTSOCK, -1;
 }
 
+int Unode::epoll_ctl(ioctx_t* /*ctx*/, int /*op*/, int /*fd*/,
+                     Ref<Descriptor> /*desc*/,
+                     const struct epoll_event* /*event*/)
+{
+	return errno = EINVAL, -1;
+}
+
+int Unode::epoll_wait(ioctx_t* /*ctx*/, struct epoll_event* /*events*/,
+                      int /*maxevents*/, struct timespec /*timeout*/)
+{
+	return errno = EINVAL, -1;
+}
+
+ssize_t Unode::sendfile(ioctx_t* /*ctx*/, Ref<Inode> /*file*/,
+                        off_t /*offset*/, size_t /*count*/)
+{
+	return errno = ENOTSUP, -1;
+}
+
 bool Bootstrap(Ref<Inode>* out_root,
                Ref<Inode>* out_server,
-               const struct stat* rootst)
+               const struct stat* rootst,
+               int flags)
 {
-	Ref<Server> server(new Server());
+	Ref<Server> server(new Server(flags & FSM_MOUNT_MULTIPLEX,
+	                              flags & FSM_MOUNT_CACHE));
 	if ( !server )
 		return false;
 
@@ -28,7 +28,8 @@
 namespace Sortix {
 namespace UserFS {
 
-bool Bootstrap(Ref<Inode>* out_root, Ref<Inode>* out_server, const struct stat* rootst);
+bool Bootstrap(Ref<Inode>* out_root, Ref<Inode>* out_server,
+               const struct stat* rootst, int flags);
 
 } // namespace UserFS
 } // namespace Sortix
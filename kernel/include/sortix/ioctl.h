@@ -57,5 +57,7 @@
 #define NIOC_SETCONFIG_ETHER __IOCTL(15, __IOCTL_TYPE_PTR)
 #define NIOC_GETCONFIG_INET __IOCTL(16, __IOCTL_TYPE_PTR)
 #define NIOC_SETCONFIG_INET __IOCTL(17, __IOCTL_TYPE_PTR)
+#define NIOC_GETCONFIG_LOOPBACK __IOCTL(18, __IOCTL_TYPE_PTR)
+#define NIOC_SETCONFIG_LOOPBACK __IOCTL(19, __IOCTL_TYPE_PTR)
 
 #endif
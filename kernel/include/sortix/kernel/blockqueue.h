@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sortix/kernel/blockqueue.h
+ * Block request queue and I/O scheduler for harddisks.
+ */
+
+#ifndef _INCLUDE_SORTIX_KERNEL_BLOCKQUEUE_H
+#define _INCLUDE_SORTIX_KERNEL_BLOCKQUEUE_H
+
+#include <sys/types.h>
+
+#include <stddef.h>
+
+#include <sortix/timespec.h>
+
+#include <sortix/kernel/decl.h>
+#include <sortix/kernel/ioctx.h>
+#include <sortix/kernel/kthread.h>
+
+namespace Sortix {
+
+class Harddisk;
+struct block_transfer;
+
+// A physically contiguous part of the memory transferred by a request. The
+// address and size must be 2-byte aligned.
+struct block_segment
+{
+	addr_t physical;
+	size_t size;
+};
+
+// A transfer of whole blocks between the disk and the physical memory in the
+// segments. Requests for adjacent blocks are merged while they are queued and
+// are then chained after the first request, which is issued in their place.
+// The done callback is called for each request when it completes, with errnum
+// set to zero on success.
+struct block_request
+{
+	struct block_request* sort_prev;
+	struct block_request* sort_next;
+	struct block_request* fifo_prev;
+	struct block_request* fifo_next;
+	struct block_request* merge_next;
+	struct block_request* merge_last;
+	struct block_segment* segments;
+	size_t segment_count;
+	blkcnt_t block_index;
+	blkcnt_t block_count;
+	struct timespec deadline;
+	struct timespec timeout;
+	void (*done)(struct block_request* request);
+	void* context;
+	int errnum;
+	bool write;
+	bool dispatched;
+	bool completed;
+};
+
+class BlockQueue
+{
+public:
+	BlockQueue(Harddisk* harddisk, size_t depth, blkcnt_t blocks_max,
+	           size_t segments_max);
+	~BlockQueue();
+
+public:
+	void Submit(struct block_request* request);
+	void Dispatch();
+	void Complete(struct block_request* request, int errnum);
+	ssize_t Transfer(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off,
+	                 bool write);
+
+private:
+	bool CanMerge(struct block_request* first, struct block_request* second);
+	bool Merge(struct block_request* request);
+	void Insert(struct block_request* request);
+	void Remove(struct block_request* request);
+	struct block_request* Pick(struct timespec now);
+	bool Wait(struct block_request* request);
+	struct block_transfer* Prepare(ioctx_t* ctx, unsigned char* buf,
+	                               size_t count, off_t off, bool write);
+	bool Reap(ioctx_t* ctx, struct block_transfer* transfer, bool copy);
+	static void TransferDone(struct block_request* request);
+
+private:
+	kthread_mutex_t queue_lock;
+	kthread_cond_t completion_cond;
+	Harddisk* harddisk;
+	struct block_request* sort_first;
+	struct block_request* sort_last;
+	struct block_request* fifo_first;
+	struct block_request* fifo_last;
+	off_t device_size;
+	blksize_t block_size;
+	blkcnt_t blocks_max;
+	blkcnt_t head_position;
+	size_t segments_max;
+	size_t depth;
+	size_t in_flight;
+
+};
+
+} // namespace Sortix
+
+#endif
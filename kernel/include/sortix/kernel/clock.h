@@ -44,6 +44,8 @@ public:
 	Timer* first_interrupt_timer;
 	Timer* last_interrupt_timer;
 	struct interrupt_work interrupt_work;
+	void (*refresh_callback)(void);
+	void (*timer_callback)(struct timespec delay);
 	struct timespec current_time;
 	struct timespec current_advancement;
 	struct timespec resolution;
@@ -54,6 +56,10 @@ public:
 
 public:
 	void SetCallableFromInterrupts(bool callable_from_interrupts);
+	void SetEventCallbacks(void (*refresh)(void),
+	                       void (*timer)(struct timespec delay));
+	void Refresh();
+	bool GetNextExpiry(struct timespec* delay);
 	void Set(struct timespec* now, struct timespec* res);
 	void Get(struct timespec* now, struct timespec* res);
 	void Advance(struct timespec duration);
@@ -74,7 +80,7 @@ public: // These should only be called if the clock is locked.
 
 private: // These should only be called if the clock is locked.
 	void FireTimer(Timer* timer);
-	void TriggerDelay(struct timespec unaccounted);
+	void TriggerDelay();
 	void TriggerAbsolute();
 
 public: // Only for use by Clock__InterruptWork.
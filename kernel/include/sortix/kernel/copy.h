@@ -22,6 +22,9 @@
 
 #include <stddef.h>
 
+#include <sortix/kernel/decl.h>
+#include <sortix/kernel/ioctx.h>
+
 namespace Sortix {
 
 bool CopyToUser(void* userdst, const void* ksrc, size_t count);
@@ -32,6 +35,9 @@ bool ReadAtomicFromUser(int* kdst, const int* usersrc);
 bool ZeroKernel(void* kdst, size_t count);
 bool ZeroUser(void* userdst, size_t count);
 char* GetStringFromUser(const char* str);
+bool FaultInUser(const void* userptr, size_t count);
+bool PinPage(ioctx_t* ctx, const void* ptr, bool write, addr_t* physical);
+void UnpinPage(ioctx_t* ctx, addr_t physical);
 
 } // namespace Sortix
 
@@ -30,6 +30,9 @@ namespace Sortix {
 // Functions for 32-bit and 64-bit x86.
 #if defined(__i386__) || defined(__x86_64__)
 namespace CPU {
+const size_t MAX_CPUS = 32;
+size_t GetId();
+size_t GetCount();
 void Reboot();
 void ShutDown();
 } // namespace CPU
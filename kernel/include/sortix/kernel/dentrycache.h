@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sortix/kernel/dentrycache.h
+ * Cache of directory entries.
+ */
+
+#ifndef _INCLUDE_SORTIX_KERNEL_DENTRYCACHE_H
+#define _INCLUDE_SORTIX_KERNEL_DENTRYCACHE_H
+
+#include <sys/types.h>
+
+#include <sortix/kernel/refcount.h>
+
+namespace Sortix {
+
+class Inode;
+
+namespace DentryCache {
+
+bool Lookup(dev_t dev, ino_t dir, const char* name, Ref<Inode>* result,
+            unsigned long* generation);
+void Insert(dev_t dev, ino_t dir, const char* name, Ref<Inode> inode,
+            unsigned long generation);
+Ref<Inode> Remove(dev_t dev, ino_t dir, const char* name);
+void InvalidateDirectory(dev_t dev, ino_t dir);
+void InvalidateDevice(dev_t dev);
+
+} // namespace DentryCache
+} // namespace Sortix
+
+#endif
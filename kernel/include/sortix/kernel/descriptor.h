@@ -30,6 +30,7 @@
 #include <sortix/kernel/refcount.h>
 
 struct dirent;
+struct epoll_event;
 struct iovec;
 struct msghdr;
 struct stat;
@@ -43,6 +44,7 @@ namespace Sortix {
 class PollNode;
 class Inode;
 class Vnode;
+struct epoll_watch;
 struct ioctx_struct;
 typedef struct ioctx_struct ioctx_t;
 
@@ -55,6 +57,8 @@ private:
 public:
 	Descriptor(Ref<Vnode> vnode, int dflags);
 	virtual ~Descriptor();
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 	Ref<Descriptor> Fork();
 	bool SetFlags(int new_dflags);
 	int GetFlags();
@@ -125,6 +129,12 @@ public:
 	int shutdown(ioctx_t* ctx, int how);
 	int getpeername(ioctx_t* ctx, uint8_t* addr, size_t* addrsize);
 	int getsockname(ioctx_t* ctx, uint8_t* addr, size_t* addrsize);
+	int epoll_ctl(ioctx_t* ctx, int op, int fd, Ref<Descriptor> desc,
+	              const struct epoll_event* event);
+	int epoll_wait(ioctx_t* ctx, struct epoll_event* events, int maxevents,
+	               struct timespec timeout);
+	ssize_t sendfile(ioctx_t* ctx, Ref<Descriptor> in, off_t* offset,
+	                 size_t count);
 
 private:
 	Ref<Descriptor> open_elem(ioctx_t* ctx, const char* filename, int flags,
@@ -138,6 +148,7 @@ public: /* These must never change after construction. */
 
 public:
 	Ref<Vnode> vnode;
+	struct epoll_watch* epoll_watches;
 
 private:
 	kthread_mutex_t current_offset_lock;
@@ -148,6 +159,7 @@ private:
 
 };
 
+void CancelEpollWatches(Descriptor* desc);
 int LinkInodeInDir(ioctx_t* ctx, Ref<Descriptor> dir, const char* name,
                    Ref<Inode> inode);
 Ref<Descriptor> OpenDirContainingPath(ioctx_t* ctx, Ref<Descriptor> from,
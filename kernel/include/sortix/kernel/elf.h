@@ -24,11 +24,14 @@
 #include <stdint.h>
 
 namespace Sortix {
+
+class Inode;
+
 namespace ELF {
 
 struct Auxiliary
 {
-	size_t tls_file_offset;
+	uintptr_t tls_vaddr;
 	size_t tls_file_size;
 	size_t tls_mem_size;
 	size_t tls_mem_align;
@@ -36,9 +39,16 @@ struct Auxiliary
 	size_t uthread_align;
 };
 
-// Reads the elf file into the current address space and returns the entry
-// address of the program, or 0 upon failure.
-uintptr_t Load(const void* file, size_t filelen, Auxiliary* aux);
+// Returns how much of the start of the elf file is needed to load it, given
+// the first size bytes of the file.
+size_t HeaderSize(const void* file, size_t size, size_t filelen);
+
+// Loads the elf file into the current address space and returns the entry
+// address of the program, or 0 upon failure. The buffer contains the first
+// size bytes of the file (see HeaderSize). The segments are paged in from the
+// inode on demand if given, otherwise the buffer contains the whole file.
+uintptr_t Load(const void* file, size_t size, size_t filelen, Inode* inode,
+               Auxiliary* aux);
 
 } // namespace ELF
 } // namespace Sortix
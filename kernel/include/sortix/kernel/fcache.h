@@ -110,6 +110,7 @@ public:
 	                off_t off);
 	int truncate(ioctx_t* ctx, off_t length);
 	off_t lseek(ioctx_t* ctx, off_t offset, int whence);
+	addr_t mmap_page(ioctx_t* ctx, off_t off);
 	//bool ChangeBackend(FileCacheBackend* backend, bool sync_old);
 	off_t GetFileSize();
 
@@ -22,10 +22,15 @@
 
 #include <sys/types.h>
 
+#include <stddef.h>
+
 #include <sortix/kernel/ioctx.h>
 
 namespace Sortix {
 
+class BlockQueue;
+struct block_request;
+
 class Harddisk
 {
 public:
@@ -45,6 +50,20 @@ public:
 	virtual ssize_t pread(ioctx_t* ctx, unsigned char* buf, size_t count, off_t off) = 0;
 	virtual ssize_t pwrite(ioctx_t* ctx, const unsigned char* buf, size_t count, off_t off) = 0;
 
+public:
+	// Drivers that run requests asynchronously have a block queue that issues
+	// batches of requests to them, of which they return how many they accepted,
+	// and they complete the requests through the queue. Requests in flight past
+	// their timeout are expired, upon which the driver fails the lost requests.
+	virtual BlockQueue* GetBlockQueue() { return NULL; }
+	virtual size_t IssueRequests(struct block_request** requests, size_t count)
+	{
+		(void) requests;
+		(void) count;
+		return 0;
+	}
+	virtual void ExpireRequests() { }
+
 };
 
 } // namespace Sortix
@@ -27,9 +27,11 @@
 
 #include <sortix/timespec.h>
 
+#include <sortix/kernel/decl.h>
 #include <sortix/kernel/refcount.h>
 
 struct dirent;
+struct epoll_event;
 struct iovec;
 struct msghdr;
 struct stat;
@@ -40,6 +42,7 @@ struct winsize;
 
 namespace Sortix {
 
+class Descriptor;
 class PollNode;
 struct ioctx_struct;
 typedef struct ioctx_struct ioctx_t;
@@ -79,6 +82,9 @@ public:
 	                       off_t off) = 0;
 	virtual ssize_t pwritev(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 	                       off_t off) = 0;
+	virtual bool mmap_page_supported() = 0;
+	virtual addr_t mmap_page(ioctx_t* ctx, off_t off) = 0;
+	virtual int msync_page(ioctx_t* ctx, off_t off, const uint8_t* page) = 0;
 	virtual int utimens(ioctx_t* ctx, const struct timespec* times) = 0;
 	virtual int isatty(ioctx_t* ctx) = 0;
 	virtual ssize_t readdirents(ioctx_t* ctx, struct dirent* dirent,
@@ -134,6 +140,12 @@ public:
 	virtual int shutdown(ioctx_t* ctx, int how) = 0;
 	virtual int getpeername(ioctx_t* ctx, uint8_t* addr, size_t* addrsize) = 0;
 	virtual int getsockname(ioctx_t* ctx, uint8_t* addr, size_t* addrsize) = 0;
+	virtual int epoll_ctl(ioctx_t* ctx, int op, int fd, Ref<Descriptor> desc,
+	                      const struct epoll_event* event) = 0;
+	virtual int epoll_wait(ioctx_t* ctx, struct epoll_event* events,
+	                       int maxevents, struct timespec timeout) = 0;
+	virtual ssize_t sendfile(ioctx_t* ctx, Ref<Inode> file, off_t offset,
+	                         size_t count) = 0;
 
 };
 
@@ -189,6 +201,9 @@ public:
 	                       off_t off);
 	virtual ssize_t pwritev(ioctx_t* ctx, const struct iovec* iov, int iovcnt,
 	                       off_t off);
+	virtual bool mmap_page_supported();
+	virtual addr_t mmap_page(ioctx_t* ctx, off_t off);
+	virtual int msync_page(ioctx_t* ctx, off_t off, const uint8_t* page);
 	virtual int utimens(ioctx_t* ctx, const struct timespec* times);
 	virtual int isatty(ioctx_t* ctx);
 	virtual ssize_t readdirents(ioctx_t* ctx, struct dirent* dirent,
@@ -243,6 +258,12 @@ public:
 	virtual int shutdown(ioctx_t* ctx, int how);
 	virtual int getpeername(ioctx_t* ctx, uint8_t* addr, size_t* addrsize);
 	virtual int getsockname(ioctx_t* ctx, uint8_t* addr, size_t* addrsize);
+	virtual int epoll_ctl(ioctx_t* ctx, int op, int fd, Ref<Descriptor> desc,
+	                      const struct epoll_event* event);
+	virtual int epoll_wait(ioctx_t* ctx, struct epoll_event* events,
+	                       int maxevents, struct timespec timeout);
+	virtual ssize_t sendfile(ioctx_t* ctx, Ref<Inode> file, off_t offset,
+	                         size_t count);
 
 };
 
@@ -68,6 +68,10 @@ const unsigned int IRQ12 = 44;
 const unsigned int IRQ13 = 45;
 const unsigned int IRQ14 = 46;
 const unsigned int IRQ15 = 47;
+const unsigned int LAPIC_TIMER = 48;
+const unsigned int IPI_RESCHEDULE = 49;
+const unsigned int IPI_TLB_SHOOTDOWN = 50;
+const unsigned int LAPIC_SPURIOUS = 255;
 #endif
 
 extern "C" unsigned long asm_is_cpu_interrupted;
@@ -121,6 +125,7 @@ inline bool SetEnabled(bool is_enabled)
 void RegisterHandler(unsigned int index, struct interrupt_handler* handler);
 void UnregisterHandler(unsigned int index, struct interrupt_handler* handler);
 void Init();
+void InitCPU();
 void WorkerThread(void* user);
 void ScheduleWork(struct interrupt_work* work);
 
@@ -23,9 +23,11 @@
 #include <stddef.h>
 
 #include <sortix/signal.h>
+#include <sortix/timespec.h>
 
 namespace Sortix {
 
+class Clock;
 class Thread;
 
 void kthread_yield();
@@ -50,6 +52,11 @@ typedef struct kthread_cond kthread_cond_t;
 const kthread_cond_t KTHREAD_COND_INITIALIZER = { NULL, NULL };
 void kthread_cond_wait(kthread_cond_t* cond, kthread_mutex_t* mutex);
 bool kthread_cond_wait_signal(kthread_cond_t* cond, kthread_mutex_t* mutex);
+bool kthread_cond_wait_until(kthread_cond_t* cond, kthread_mutex_t* mutex,
+                             Clock* clock, struct timespec deadline);
+bool kthread_cond_wait_until_signal(kthread_cond_t* cond,
+                                    kthread_mutex_t* mutex,
+                                    Clock* clock, struct timespec deadline);
 void kthread_cond_signal(kthread_cond_t* cond);
 void kthread_cond_broadcast(kthread_cond_t* cond);
 
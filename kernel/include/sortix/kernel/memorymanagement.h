@@ -20,6 +20,8 @@
 #ifndef _INCLUDE_SORTIX_KERNEL_MEMORYMANAGEMENT_H
 #define _INCLUDE_SORTIX_KERNEL_MEMORYMANAGEMENT_H
 
+#include <sys/types.h>
+
 #include <stddef.h>
 #include <stdint.h>
 
@@ -29,6 +31,7 @@ typedef struct multiboot_info multiboot_info_t;
 
 namespace Sortix {
 
+class Inode;
 class Process;
 
 enum page_usage
@@ -62,6 +65,10 @@ addr_t Get32Bit(enum page_usage usage);
 addr_t Get32BitUnlocked(enum page_usage usage);
 void Put(addr_t page, enum page_usage usage);
 void PutUnlocked(addr_t page, enum page_usage usage);
+bool Share(addr_t page);
+bool IsShared(addr_t page);
+void Release(addr_t page, enum page_usage usage);
+void ChangeUsage(addr_t page, enum page_usage from, enum page_usage to);
 void Lock();
 void Unlock();
 
@@ -98,6 +105,8 @@ addr_t GetAddressSpace();
 addr_t SwitchAddressSpace(addr_t addrspace);
 void DestroyAddressSpace(addr_t fallback);
 bool Map(addr_t physical, addr_t mapto, int prot);
+bool MapCopyOnWrite(addr_t physical, addr_t mapto, int prot);
+bool MapShared(addr_t physical, addr_t mapto, int prot);
 bool MapPAT(addr_t physical, addr_t mapto, int prot, addr_t mtype);
 addr_t Unmap(addr_t mapto);
 addr_t Physical(addr_t mapto);
@@ -107,6 +116,8 @@ int ProvidedProtection(int prot);
 void PageProtect(addr_t mapto, int protection);
 void PageProtectAdd(addr_t mapto, int protection);
 void PageProtectSub(addr_t mapto, int protection);
+bool CopyOnWrite(addr_t mapto, int prot);
+bool ClearDirty(addr_t mapto);
 bool MapRange(addr_t where, size_t bytes, int protection, enum page_usage usage);
 bool UnmapRange(addr_t where, size_t bytes, enum page_usage usage);
 void Statistics(size_t* used, size_t* total, size_t* purposes);
@@ -116,7 +127,14 @@ void GetKernelVirtualArea(addr_t* from, size_t* size);
 void GetUserVirtualArea(uintptr_t* from, size_t* size);
 void UnmapMemory(Process* process, uintptr_t addr, size_t size);
 bool ProtectMemory(Process* process, uintptr_t addr, size_t size, int prot);
-bool MapMemory(Process* process, uintptr_t addr, size_t size, int prot);
+bool MapMemory(Process* process, uintptr_t addr, size_t size, int prot,
+               int flags);
+bool MapFileMemory(Process* process, uintptr_t addr, size_t size, int prot,
+                   int flags, Inode* inode, off_t offset);
+bool SyncMemory(Process* process, uintptr_t addr, size_t size);
+bool PrepareUserRead(Process* process, uintptr_t addr, size_t size);
+bool PrepareUserWrite(Process* process, uintptr_t addr, size_t size);
+bool HandlePageFault(uintptr_t addr, bool write, bool present);
 
 } // namespace Memory
 } // namespace Sortix
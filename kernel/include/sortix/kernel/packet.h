@@ -32,11 +32,29 @@ namespace Sortix {
 
 class NetworkInterface;
 
+// The space reserved in front of transmitted packets for the lower layer
+// headers, so they can be prepended without copying the packet.
+static const size_t PACKET_HEADROOM = 64;
+
+// The maximum number of pages referenced by a packet after its buffer.
+static const size_t PACKET_FRAGMENTS_MAX = 4;
+
+struct packet_fragment
+{
+	addr_t phys;
+	size_t offset;
+	size_t length;
+};
+
 class Packet : public Refcountable
 {
 public:
 	Packet(paddrmapped_t pmap);
 	virtual ~Packet();
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
+	bool AddFragment(addr_t phys, size_t offset, size_t length);
+	size_t DataLength();
 
 public:
 	paddrmapped_t pmap;
@@ -45,10 +63,13 @@ public:
 	size_t offset;
 	NetworkInterface* netif;
 	Ref<Packet> next;
+	struct packet_fragment fragments[PACKET_FRAGMENTS_MAX];
+	size_t fragments_used;
 
 };
 
 Ref<Packet> GetPacket();
+Ref<Packet> PrependPacket(Ref<Packet> pkt, size_t size);
 
 } // namespace Sortix
 
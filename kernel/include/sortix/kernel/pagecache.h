@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sortix/kernel/pagecache.h
+ * Cache of file pages for memory mapping files.
+ */
+
+#ifndef _INCLUDE_SORTIX_KERNEL_PAGECACHE_H
+#define _INCLUDE_SORTIX_KERNEL_PAGECACHE_H
+
+#include <sys/types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sortix/kernel/decl.h>
+
+struct stat;
+
+namespace Sortix {
+
+struct ioctx_struct;
+typedef struct ioctx_struct ioctx_t;
+
+namespace PageCache {
+
+// Reads the file contents when pages are missing from the cache.
+typedef ssize_t (*ReadFunction)(void* user, ioctx_t* ctx, uint8_t* buf,
+                                size_t count, off_t offset);
+
+void Init();
+addr_t GetPage(dev_t dev, ino_t ino, off_t offset, const struct stat* st,
+               ReadFunction read_function, void* user);
+ssize_t Read(dev_t dev, ino_t ino, ioctx_t* ctx, uint8_t* buf, size_t count,
+             off_t offset, const struct stat* st, ReadFunction read_function,
+             void* user);
+void UpdatePage(dev_t dev, ino_t ino, off_t offset, addr_t page,
+                const struct stat* st);
+void Invalidate(dev_t dev, ino_t ino, off_t offset, off_t length);
+void InvalidateDevice(dev_t dev);
+
+} // namespace PageCache
+} // namespace Sortix
+
+#endif
@@ -38,6 +38,7 @@ public:
 
 private:
 	void SignalUnlocked(short events);
+	void UnregisterUnlocked(PollNode* node);
 
 private:
 	struct PollNode* first;
@@ -52,8 +53,14 @@ class PollNode
 	friend class PollChannel;
 
 public:
-	PollNode() { next = NULL; prev = NULL; channel = NULL; master = this; slave = NULL; }
+	PollNode()
+	{
+		next = NULL; prev = NULL; channel = NULL; master = this; slave = NULL;
+		wake_callback = NULL; wake_context = NULL;
+	}
 	~PollNode() { delete slave; }
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 
 private:
 	PollNode* next;
@@ -70,6 +77,10 @@ public:
 	short events;
 	short revents;
 	bool* woken;
+	// Persistent registrations are notified through this callback instead,
+	// which is called with the channel lock held.
+	void (*wake_callback)(void* context);
+	void* wake_context;
 
 public:
 	void Cancel();
@@ -161,8 +161,8 @@ public:
 
 public:
 	int Execute(const char* programname, const uint8_t* program,
-	            size_t programsize, int argc, const char* const* argv,
-	            int envc, const char* const* envp,
+	            size_t programsize, size_t filesize, Inode* inode, int argc,
+	            const char* const* argv, int envc, const char* const* envp,
 	            struct thread_registers* regs);
 	void ResetAddressSpace();
 	void ExitThroughSignal(int signal);
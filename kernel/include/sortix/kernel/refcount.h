@@ -33,6 +33,7 @@ public:
 public:
 	void Refer_Renamed();
 	void Unref_Renamed();
+	bool TryRefer_Renamed();
 	size_t Refcount() const { return refcount; }
 	bool IsUnique() const { return refcount == 1; }
 
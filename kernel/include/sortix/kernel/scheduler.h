@@ -20,6 +20,10 @@
 #ifndef _INCLUDE_SORTIX_KERNEL_SCHEDULER_H
 #define _INCLUDE_SORTIX_KERNEL_SCHEDULER_H
 
+#include <stddef.h>
+
+#include <sortix/timespec.h>
+
 #include <sortix/kernel/decl.h>
 #include <sortix/kernel/registers.h>
 
@@ -40,17 +44,20 @@ void SwitchTo(struct interrupt_context* intctx, Thread* new_thread);
 void SetThreadState(Thread* thread, ThreadState state, bool wake_only = false);
 void SetSignalPending(Thread* thread, unsigned long is_pending);
 ThreadState GetThreadState(Thread* thread);
-void SetIdleThread(Thread* thread);
+void SetIdleThread(Thread* thread, size_t cpu = 0);
 void SetInitProcess(Process* init);
 Process* GetInitProcess();
 Process* GetKernelProcess();
 void InterruptYieldCPU(struct interrupt_context* intctx, void* user);
 void ThreadExitCPU(struct interrupt_context* intctx, void* user);
+void InterruptReschedule(struct interrupt_context* intctx, void* user);
+void InterruptPreempt(struct interrupt_context* intctx);
 void SaveInterruptedContext(const struct interrupt_context* intctx,
                             struct thread_registers* registers);
 void LoadInterruptedContext(struct interrupt_context* intctx,
                             const struct thread_registers* registers);
 void ScheduleTrueThread();
+void ChargeThread(Thread* thread, struct timespec runtime);
 
 } // namespace Scheduler
 } // namespace Sortix
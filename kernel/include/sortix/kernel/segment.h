@@ -20,18 +20,28 @@
 #ifndef _INCLUDE_SORTIX_KERNEL_SEGMENT_H
 #define _INCLUDE_SORTIX_KERNEL_SEGMENT_H
 
+#include <sys/types.h>
+
 #include <stddef.h>
 #include <stdint.h>
 
 namespace Sortix {
 
+class Inode;
 class Process;
 
+// The file of the shared mapping isn't open for writing, so the mapping can't
+// be made writable.
+#define SEGMENT_READ_ONLY_FILE (1 << 16)
+
 struct segment
 {
 	uintptr_t addr;
 	size_t size;
 	int prot;
+	int flags; // MAP_SHARED or MAP_PRIVATE, and SEGMENT_READ_ONLY_FILE.
+	Inode* inode; // Referenced file the segment is paged in from, or NULL.
+	off_t offset; // Offset in the file of the start of the segment.
 };
 
 static inline int segmentcmp(const void* a_ptr, const void* b_ptr)
@@ -50,6 +60,7 @@ bool IsUserspaceSegment(const struct segment* segment);
 struct segment* FindOverlappingSegment(Process* process, const struct segment* new_segment);
 bool IsSegmentOverlapping(Process* process, const struct segment* new_segment);
 bool AddSegment(Process* process, const struct segment* new_segment);
+void ReleaseSegmentBacking(struct segment* segment);
 bool PlaceSegment(struct segment* solution, Process* process, void* addr_ptr,
                   size_t size, int flags);
 
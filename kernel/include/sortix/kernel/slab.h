@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sortix/kernel/slab.h
+ * Object caches for frequently allocated kernel objects.
+ */
+
+#ifndef _INCLUDE_SORTIX_KERNEL_SLAB_H
+#define _INCLUDE_SORTIX_KERNEL_SLAB_H
+
+#include <stddef.h>
+
+#include <sortix/kernel/cpu.h>
+#include <sortix/kernel/kthread.h>
+
+namespace Sortix {
+
+struct slab;
+struct slab_magazine;
+
+// A cache of objects of one size that are packed into page sized slabs without
+// per-object headers. Freed objects are kept in a magazine per processor and
+// reused without locking. Allocations of other sizes, such as of subclasses of
+// the cached type, and objects too large for a slab are passed to the heap.
+struct slab_cache
+{
+	struct slab_cache* next;
+	const char* name;
+	size_t object_size;
+	size_t object_align;
+	kthread_mutex_t lock;
+	struct slab* partial;
+	struct slab* empty;
+	struct slab_magazine* magazines[CPU::MAX_CPUS];
+	size_t objects_per_slab;
+	size_t slab_count;
+	size_t objects_used;
+};
+
+#define SLAB_CACHE_INITIALIZER(name, type) \
+	{ NULL, name, sizeof(type), alignof(type), KTHREAD_MUTEX_INITIALIZER, \
+	  NULL, NULL, \
+	  { NULL }, 0, 0, 0 }
+
+void* SlabAllocate(struct slab_cache* cache, size_t size);
+void SlabFree(struct slab_cache* cache, void* ptr, size_t size);
+void SlabStatistics(size_t* total, size_t* used);
+
+} // namespace Sortix
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sortix/kernel/smp.h
+ * Symmetric multiprocessing.
+ */
+
+#ifndef _INCLUDE_SORTIX_KERNEL_SMP_H
+#define _INCLUDE_SORTIX_KERNEL_SMP_H
+
+#include <stddef.h>
+
+#include <sortix/kernel/decl.h>
+
+namespace Sortix {
+namespace SMP {
+
+// The kernel proper runs on one processor at a time, while user-space runs on
+// all of them. A processor owns the kernel from it enters the kernel until it
+// returns to user-space or goes idle, so the existing practice of disabling
+// interrupts to exclude other threads remains sound.
+void Init();
+void Idle();
+void YieldKernel();
+bool IsOnline(size_t cpu);
+void Reschedule(size_t cpu);
+void SetSignalPending(size_t cpu, unsigned long is_pending);
+void FlushTLB();
+
+} // namespace SMP
+} // namespace Sortix
+
+#endif
@@ -28,6 +28,7 @@
 #include <stdint.h>
 
 #include <sortix/dirent.h>
+#include <sortix/epoll.h>
 #include <sortix/exit.h>
 #include <sortix/fork.h>
 #include <sortix/itimerspec.h>
@@ -66,6 +67,10 @@ int sys_dispmsg_issue(void*, size_t);
 int sys_dup(int);
 int sys_dup2(int, int);
 int sys_dup3(int, int, int);
+int sys_epoll_create1(int);
+int sys_epoll_ctl(int, int, int, const struct epoll_event*);
+int sys_epoll_pwait(int, struct epoll_event*, int, const struct timespec*,
+                    const sigset_t*);
 int sys_execve(const char*, char* const*, char* const*);
 int sys_exit_thread(int, int, const struct exit_thread*);
 int sys_faccessat(int, const char*, int, int);
@@ -123,6 +128,7 @@ int sys_mkpartition(int, off_t, off_t, int);
 int sys_mkpty(int*, int*, int);
 void* sys_mmap_wrapper(struct mmap_request*);
 int sys_mprotect(const void*, size_t, int);
+int sys_msync(void*, size_t, int);
 int sys_munmap(void*, size_t);
 int sys_openat(int, const char*, int, mode_t);
 int sys_pipe2(int*, int);
@@ -145,6 +151,7 @@ int sys_renameat(int, const char*, int, const char*);
 void sys_scram(int, const void*);
 int sys_sched_yield(void);
 ssize_t sys_send(int, const void*, size_t, int);
+ssize_t sys_sendfile(int, int, off_t*, size_t);
 ssize_t sys_sendmsg(int, const struct msghdr*, int);
 int sys_setdnsconfig(const struct dnsconfig*);
 int sys_setegid(gid_t);
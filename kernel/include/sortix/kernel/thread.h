@@ -71,6 +71,8 @@ class Thread
 public:
 	Thread();
 	~Thread();
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 
 public:
 	const char* name;
@@ -83,6 +85,11 @@ public:
 	Thread* nextsibling;
 	Thread* scheduler_list_prev;
 	Thread* scheduler_list_next;
+	Thread* scheduler_heap_prev;
+	Thread* scheduler_heap_next;
+	Thread* scheduler_heap_child;
+	size_t scheduler_cpu;
+	int64_t scheduler_vruntime;
 	volatile ThreadState state;
 	sigset_t signal_pending;
 	sigset_t signal_mask;
@@ -36,7 +36,10 @@ namespace Time {
 
 void Init();
 void Start();
+void StartCPU();
+void OnCPUSwitch(bool system_mode, bool idle);
 void OnTick(struct timespec tick_period, bool system_mode);
+void OnCPUTick(struct timespec tick_period, bool system_mode);
 void InitializeProcessClocks(Process* process);
 void InitializeThreadClocks(Thread* thread);
 struct timespec Get(clockid_t clock);
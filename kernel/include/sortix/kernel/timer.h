@@ -70,6 +70,7 @@ public:
 	Clock* clock;
 	Timer* prev_timer;
 	Timer* next_timer;
+	Timer* child_timer;
 	Timer* next_interrupt_timer;
 	void (*callback)(Clock* clock, Timer* timer, void* user);
 	void* user;
@@ -29,6 +29,7 @@
 #include <sortix/kernel/refcount.h>
 
 struct dirent;
+struct epoll_event;
 struct iovec;
 struct msghdr;
 struct stat;
@@ -39,6 +40,7 @@ struct winsize;
 
 namespace Sortix {
 
+class Descriptor;
 class PollNode;
 class Inode;
 struct ioctx_struct;
@@ -55,6 +57,8 @@ public: /* These must never change after construction and is read-only. */
 public:
 	Vnode(Ref<Inode> inode, Ref<Vnode> mountedat, ino_t rootino, dev_t rootdev);
 	virtual ~Vnode();
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 	bool pass();
 	void unpass();
 	int sync(ioctx_t* ctx);
@@ -122,6 +126,12 @@ public:
 	int shutdown(ioctx_t* ctx, int how);
 	int getpeername(ioctx_t* ctx, uint8_t* addr, size_t* addrsize);
 	int getsockname(ioctx_t* ctx, uint8_t* addr, size_t* addrsize);
+	int epoll_ctl(ioctx_t* ctx, int op, int fd, Ref<Descriptor> desc,
+	              const struct epoll_event* event);
+	int epoll_wait(ioctx_t* ctx, struct epoll_event* events, int maxevents,
+	               struct timespec timeout);
+	ssize_t sendfile(ioctx_t* ctx, Ref<Inode> file, off_t offset,
+	                 size_t count);
 
 public /*TODO: private*/:
 	Ref<Inode> inode;
@@ -22,6 +22,8 @@
 
 #define MEMUSAGE_TOTAL 0
 #define MEMUSAGE_USED 1
+#define MEMUSAGE_SLAB 2
+#define MEMUSAGE_SLAB_USED 3
 
 #define MEMUSAGE_PURPOSE_FIRST 16
 #define MEMUSAGE_PURPOSE_PHYSICAL (MEMUSAGE_PURPOSE_FIRST + 0)
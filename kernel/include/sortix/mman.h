@@ -47,4 +47,8 @@
 
 #define MAP_FAILED ((void*) -1)
 
+#define MS_ASYNC (1<<0)
+#define MS_SYNC (1<<1)
+#define MS_INVALIDATE (1<<2)
+
 #endif
@@ -190,6 +190,11 @@
 #define SYSCALL_SETDNSCONFIG 167
 #define SYSCALL_FUTEX 168
 #define SYSCALL_MEMUSAGE 169
-#define SYSCALL_MAX_NUM 170 /* index of highest constant + 1 */
+#define SYSCALL_MSYNC 170
+#define SYSCALL_EPOLL_CREATE1 171
+#define SYSCALL_EPOLL_CTL 172
+#define SYSCALL_EPOLL_PWAIT 173
+#define SYSCALL_SENDFILE 174
+#define SYSCALL_MAX_NUM 175 /* index of highest constant + 1 */
 
 #endif
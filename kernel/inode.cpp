@@ -357,6 +357,22 @@ ssize_t AbstractInode::pwritev(ioctx_t* ctx, const struct iovec* iov,
 	return sofar;
 }
 
+bool AbstractInode::mmap_page_supported()
+{
+	return false;
+}
+
+addr_t AbstractInode::mmap_page(ioctx_t* /*ctx*/, off_t /*off*/)
+{
+	return errno = ENODEV, 0;
+}
+
+int AbstractInode::msync_page(ioctx_t* /*ctx*/, off_t /*off*/,
+                              const uint8_t* /*page*/)
+{
+	return errno = ENODEV, -1;
+}
+
 int AbstractInode::utimens(ioctx_t* /*ctx*/, const struct timespec* times)
 {
 	ScopedLock lock(&metalock);
@@ -656,4 +672,23 @@ int AbstractInode::getsockname(ioctx_t* /*ctx*/, uint8_t* /*addr*/,
 	return errno = ENOTSOCK, -1;
 }
 
+int AbstractInode::epoll_ctl(ioctx_t* /*ctx*/, int /*op*/, int /*fd*/,
+                             Ref<Descriptor> /*desc*/,
+                             const struct epoll_event* /*event*/)
+{
+	return errno = EINVAL, -1;
+}
+
+int AbstractInode::epoll_wait(ioctx_t* /*ctx*/, struct epoll_event* /*events*/,
+                              int /*maxevents*/, struct timespec /*timeout*/)
+{
+	return errno = EINVAL, -1;
+}
+
+ssize_t AbstractInode::sendfile(ioctx_t* /*ctx*/, Ref<Inode> /*file*/,
+                                off_t /*offset*/, size_t /*count*/)
+{
+	return errno = ENOTSUP, -1;
+}
+
 } // namespace Sortix
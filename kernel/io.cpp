@@ -869,6 +869,26 @@ ssize_t sys_sendmsg(int fd, const struct msghdr* msg, int flags)
 	return desc->sendmsg(&ctx, msg, flags);
 }
 
+ssize_t sys_sendfile(int out_fd, int in_fd, off_t* user_offset, size_t count)
+{
+	Ref<Descriptor> out = CurrentProcess()->GetDescriptor(out_fd);
+	if ( !out )
+		return -1;
+	Ref<Descriptor> in = CurrentProcess()->GetDescriptor(in_fd);
+	if ( !in )
+		return -1;
+	off_t offset;
+	if ( user_offset && !CopyFromUser(&offset, user_offset, sizeof(offset)) )
+		return -1;
+	ioctx_t ctx; SetupUserIOCtx(&ctx);
+	ssize_t result = out->sendfile(&ctx, in, user_offset ? &offset : NULL,
+	                               count);
+	if ( 0 < result && user_offset &&
+	     !CopyToUser(user_offset, &offset, sizeof(offset)) )
+		return -1;
+	return result;
+}
+
 ssize_t sys_recvmsg(int fd, struct msghdr* msg, int flags)
 {
 	Ref<Descriptor> desc = CurrentProcess()->GetDescriptor(fd);
@@ -990,8 +1010,9 @@ int sys_fsm_fsbind(int rootfd, int mpointfd, int flags)
 int sys_fsm_mountat(int dirfd, const char* path, const struct stat* rootst, int flags)
 {
 	if ( flags & ~(FSM_MOUNT_CLOEXEC | FSM_MOUNT_CLOFORK |
-	               FSM_MOUNT_NOFOLLOW | FSM_MOUNT_NONBLOCK) )
-		return -1;
+	               FSM_MOUNT_NOFOLLOW | FSM_MOUNT_NONBLOCK |
+	               FSM_MOUNT_MULTIPLEX | FSM_MOUNT_CACHE) )
+		return errno = EINVAL, -1;
 	int fdflags = 0;
 	if ( flags & FSM_MOUNT_CLOEXEC ) fdflags |= FD_CLOEXEC;
 	if ( flags & FSM_MOUNT_CLOFORK ) fdflags |= FD_CLOFORK;
@@ -38,6 +38,7 @@
 #include <sortix/wait.h>
 
 #include <sortix/kernel/copy.h>
+#include <sortix/kernel/cpu.h>
 #include <sortix/kernel/decl.h>
 #include <sortix/kernel/descriptor.h>
 #include <sortix/kernel/dtable.h>
@@ -50,6 +51,7 @@
 #include <sortix/kernel/log.h>
 #include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/mtable.h>
+#include <sortix/kernel/pagecache.h>
 #include <sortix/kernel/panic.h>
 #include <sortix/kernel/pci.h>
 #include <sortix/kernel/process.h>
@@ -58,6 +60,7 @@
 #include <sortix/kernel/refcount.h>
 #include <sortix/kernel/scheduler.h>
 #include <sortix/kernel/signal.h>
+#include <sortix/kernel/smp.h>
 #include <sortix/kernel/string.h>
 #include <sortix/kernel/textbuffer.h>
 #include <sortix/kernel/thread.h>
@@ -91,6 +94,7 @@
 #include "net/udp.h"
 #include "poll.h"
 #include "pty.h"
+#include "selftest.h"
 #include "uart.h"
 #include "vga.h"
 
@@ -118,6 +122,7 @@ static char** argv;
 static multiboot_info_t* bootinfo;
 static bool enable_em = true;
 static bool enable_network_drivers = true;
+static bool enable_self_test = false;
 
 static char* cmdline_tokenize(char** saved)
 {
@@ -281,6 +286,8 @@ extern "C" void KernelInit(unsigned long magic, multiboot_info_t* bootinfo_p)
 			enable_network_drivers = true;
 		else if ( !strcmp(arg, "--no-random-seed") )
 			no_random_seed = true;
+		else if ( !strcmp(arg, "--self-test") )
+			enable_self_test = true;
 		else
 		{
 			Log::PrintF("\r\e[J");
@@ -390,13 +397,7 @@ static void SystemIdleThread(void* /*user*/)
 	// then we are run. Note that we must never do any real work here as the
 	// idle thread must always be runnable.
 	while ( true )
-	{
-#if defined(__i386__) || defined(__x86_64__)
-		asm volatile ("hlt");
-#else
-#warning "Implement a power efficient kernel idle thread"
-#endif
-	}
+		SMP::Idle();
 }
 
 static void BootThread(void* /*user*/)
@@ -432,6 +433,18 @@ static void BootThread(void* /*user*/)
 	if ( !worker_thread )
 		Panic("Unable to create general purpose worker thread");
 
+	// Bring up the other processors.
+	SMP::Init();
+
+	// Create a general purpose worker thread for each additional processor.
+	for ( size_t i = 1; i < CPU::GetCount(); i++ )
+		if ( !RunKernelThread(Worker::Thread, NULL, "worker") )
+			Panic("Unable to create general purpose worker thread");
+
+	// Test the kernel facilities if requested.
+	if ( enable_self_test && !SelfTest::Run() )
+		Log::PrintF("kernel: warning: self-test failed\n");
+
 	//
 	// Stage 4. Initialize the Filesystem
 	//
@@ -439,6 +452,9 @@ static void BootThread(void* /*user*/)
 	// Bring up the filesystem cache.
 	FileCache::Init();
 
+	// Initialize the page cache.
+	PageCache::Init();
+
 	Ref<DescriptorTable> dtable(new DescriptorTable());
 	if ( !dtable )
 		Panic("Unable to allocate descriptor table");
@@ -756,8 +772,8 @@ static void InitThread(void* /*user*/)
 	struct thread_registers regs;
 	assert((((uintptr_t) &regs) & (alignof(regs)-1)) == 0);
 
-	if ( process->Execute(initpath, program, programsize, argc, argv, envc,
-	                       envp, &regs) )
+	if ( process->Execute(initpath, program, programsize, programsize, NULL,
+	                      argc, argv, envc, envp, &regs) )
 		PanicF("Unable to execute %s.", initpath);
 
 	delete[] program;
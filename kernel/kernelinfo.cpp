@@ -19,8 +19,10 @@
 
 #include <brand.h>
 #include <errno.h>
+#include <stdio.h>
 
 #include <sortix/kernel/copy.h>
+#include <sortix/kernel/cpu.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/syscall.h>
 
@@ -39,6 +41,12 @@ static const char* KernelInfo(const char* req)
 	if ( strcmp(req, "buildtime") == 0 ) { return __TIME__; }
 #if defined(__i386__) || defined(__x86_64__)
 	if ( strcmp(req, "firmware") == 0 ) { return "bios"; }
+	if ( strcmp(req, "cpus") == 0 )
+	{
+		static char cpus[sizeof(size_t) * 3];
+		snprintf(cpus, sizeof(cpus), "%zu", CPU::GetCount());
+		return cpus;
+	}
 #else
 	#warning "Name your system firmware here"
 #endif
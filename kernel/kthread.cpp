@@ -17,16 +17,19 @@
  * Utility and synchronization mechanisms for kernel threads.
  */
 
+#include <errno.h>
 #include <limits.h>
 
 #include <sortix/signal.h>
 
+#include <sortix/kernel/clock.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/kthread.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/scheduler.h>
 #include <sortix/kernel/signal.h>
 #include <sortix/kernel/thread.h>
+#include <sortix/kernel/timer.h>
 #include <sortix/kernel/worker.h>
 
 #include "uart.h"
@@ -110,6 +113,14 @@ void kthread_spinlock_lock(kthread_mutex_t* mutex)
 		if ( __atomic_compare_exchange_n(mutex, &state, desired, false,
 	                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) )
 			break;
+		// Wait for the lock to be released before trying to take it again,
+		// without bouncing the cache line between the processors.
+		while ( __atomic_load_n(mutex, __ATOMIC_RELAXED) != UNLOCKED )
+		{
+#if defined(__i386__) || defined(__x86_64__)
+			asm volatile ("pause");
+#endif
+		}
 	}
 }
 
@@ -349,6 +360,86 @@ bool kthread_cond_wait_signal(kthread_cond_t* cond, kthread_mutex_t* mutex)
 	return result;
 }
 
+// The timer marks the element as timed out unless it has already been woken,
+// in which case the element is left for the signaling thread, which removes it
+// from the condition before marking it woken.
+static const int COND_TIMED_OUT = 2;
+
+static void kthread_cond_timeout(Clock* /*clock*/, Timer* /*timer*/, void* ctx)
+{
+	kthread_cond_elem_t* elem = (kthread_cond_elem_t*) ctx;
+	int expected = 0;
+	int desired = COND_TIMED_OUT;
+	if ( __atomic_compare_exchange_n(&elem->woken, &expected, desired, false,
+	                                 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) )
+		kutex_wake(&elem->woken, 1);
+}
+
+static bool kthread_cond_wait_until_internal(kthread_cond_t* cond,
+                                             kthread_mutex_t* mutex,
+                                             Clock* clock,
+                                             struct timespec deadline,
+                                             bool signal)
+{
+	if ( signal && Signal::IsPending() )
+		return errno = EINTR, false;
+	kthread_cond_elem_t elem;
+	elem.next = NULL;
+	elem.prev = cond->last;
+	elem.woken = 0;
+	if ( cond->last )
+		cond->last->next = &elem;
+	if ( !cond->first )
+		cond->first = &elem;
+	cond->last = &elem;
+	Timer timer;
+	timer.Attach(clock);
+	struct itimerspec timerspec;
+	timerspec.it_value = deadline;
+	timerspec.it_interval.tv_sec = 0;
+	timerspec.it_interval.tv_nsec = 0;
+	int timer_flags = TIMER_ABSOLUTE | TIMER_FUNC_INTERRUPT_HANDLER;
+	timer.Set(&timerspec, NULL, timer_flags, kthread_cond_timeout, &elem);
+	kthread_mutex_unlock(mutex);
+	bool interrupted = false;
+	while ( !__atomic_load_n(&elem.woken, __ATOMIC_SEQ_CST) )
+	{
+		if ( !kutex_wait(&elem.woken, 0, signal) )
+		{
+			interrupted = true;
+			break;
+		}
+	}
+	timer.Cancel();
+	kthread_mutex_lock(mutex);
+	if ( __atomic_load_n(&elem.woken, __ATOMIC_SEQ_CST) == 1 )
+		return true;
+	if ( elem.next )
+		elem.next->prev = elem.prev;
+	else
+		cond->last = elem.prev;
+	if ( elem.prev )
+		elem.prev->next = elem.next;
+	else
+		cond->first = elem.next;
+	return errno = interrupted ? EINTR : ETIMEDOUT, false;
+}
+
+bool kthread_cond_wait_until(kthread_cond_t* cond, kthread_mutex_t* mutex,
+                             Clock* clock, struct timespec deadline)
+{
+	return kthread_cond_wait_until_internal(cond, mutex, clock, deadline,
+	                                        false);
+}
+
+bool kthread_cond_wait_until_signal(kthread_cond_t* cond,
+                                    kthread_mutex_t* mutex,
+                                    Clock* clock, struct timespec deadline)
+{
+	return kthread_cond_wait_until_internal(cond, mutex, clock, deadline,
+	                                        true);
+}
+
 void kthread_cond_signal(kthread_cond_t* cond)
 {
 	if ( cond->first )
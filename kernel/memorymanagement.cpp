@@ -31,12 +31,15 @@
 
 #include <sortix/kernel/copy.h>
 #include <sortix/kernel/descriptor.h>
+#include <sortix/kernel/inode.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/segment.h>
+#include <sortix/kernel/slab.h>
 #include <sortix/kernel/syscall.h>
+#include <sortix/kernel/vnode.h>
 
 namespace Sortix {
 
@@ -62,6 +65,9 @@ int sys_memusage(const size_t* user_statistics,
 	size_t total;
 	size_t purposes[PAGE_USAGE_NUM_KINDS];
 	Memory::Statistics(&used, &total, purposes);
+	size_t slab_total;
+	size_t slab_used;
+	SlabStatistics(&slab_total, &slab_used);
 	for ( size_t start = 0; start < length; )
 	{
 		const size_t BLOCK = 32;
@@ -80,6 +86,10 @@ int sys_memusage(const size_t* user_statistics,
 				value = total;
 			else if ( statistic == MEMUSAGE_USED )
 				value = used;
+			else if ( statistic == MEMUSAGE_SLAB )
+				value = slab_total;
+			else if ( statistic == MEMUSAGE_SLAB_USED )
+				value = slab_used;
 			else if ( MEMUSAGE_PURPOSE_FIRST <= statistic &&
 			          statistic <= MEMUSAGE_PURPOSE_LAST )
 				value = purposes[statistic - MEMUSAGE_PURPOSE_FIRST];
@@ -113,10 +123,16 @@ void UnmapMemory(Process* process, uintptr_t addr, size_t size)
 	if ( !size )
 		return;
 
+	// Write back the changes to shared file mappings before they go away.
+	SyncMemory(process, addr, size);
+
 	struct segment unmap_segment;
 	unmap_segment.addr = addr;
 	unmap_segment.size = size;
 	unmap_segment.prot = 0;
+	unmap_segment.flags = 0;
+	unmap_segment.inode = NULL;
+	unmap_segment.offset = 0;
 	while ( struct segment* conflict = FindOverlappingSegment(process,
 	                                                          &unmap_segment) )
 	{
@@ -127,6 +143,7 @@ void UnmapMemory(Process* process, uintptr_t addr, size_t size)
 			size_t conflict_index = conflict_offset / sizeof(struct segment);
 			Memory::UnmapRange(conflict->addr, conflict->size, PAGE_USAGE_USER_SPACE);
 			Memory::Flush();
+			ReleaseSegmentBacking(conflict);
 			if ( conflict_index + 1 == process->segments_used )
 			{
 				process->segments_used--;
@@ -147,6 +164,10 @@ void UnmapMemory(Process* process, uintptr_t addr, size_t size)
 			right_segment.addr = addr + size;
 			right_segment.size = conflict->addr + conflict->size - (addr + size);
 			right_segment.prot = conflict->prot;
+			right_segment.flags = conflict->flags;
+			right_segment.inode = conflict->inode;
+			right_segment.offset = conflict->offset +
+			                       (off_t) (right_segment.addr - conflict->addr);
 			conflict->size = addr - conflict->addr;
 			// TODO: This shouldn't really fail as we free memory above, but
 			//       this code isn't really provably reliable.
@@ -161,6 +182,7 @@ void UnmapMemory(Process* process, uintptr_t addr, size_t size)
 			Memory::UnmapRange(conflict->addr, addr + size - conflict->addr, PAGE_USAGE_USER_SPACE);
 			Memory::Flush();
 			conflict->size = conflict->addr + conflict->size - (addr + size);
+			conflict->offset += (off_t) (addr + size - conflict->addr);
 			conflict->addr = addr + size;
 			continue;
 		}
@@ -200,6 +222,10 @@ bool ProtectMemory(Process* process, uintptr_t addr, size_t size, int prot)
 		if ( !segment )
 			return errno = EINVAL, false;
 
+		// Shared mappings of files not open for writing can't be writable.
+		if ( (segment->flags & SEGMENT_READ_ONLY_FILE) && (prot & PROT_WRITE) )
+			return errno = EACCES, false;
+
 		// Split the segment into two if it begins before our search region.
 		if ( segment->addr < search_region.addr )
 		{
@@ -207,6 +233,10 @@ bool ProtectMemory(Process* process, uintptr_t addr, size_t size, int prot)
 			new_segment.addr = search_region.addr;
 			new_segment.size = segment->addr + segment->size - new_segment.addr;
 			new_segment.prot = segment->prot;
+			new_segment.flags = segment->flags;
+			new_segment.inode = segment->inode;
+			new_segment.offset = segment->offset +
+			                     (off_t) (new_segment.addr - segment->addr);
 			segment->size = search_region.addr - segment->addr;
 
 			if ( !AddSegment(process, &new_segment) )
@@ -225,6 +255,10 @@ bool ProtectMemory(Process* process, uintptr_t addr, size_t size, int prot)
 			new_segment.addr = addr + size;
 			new_segment.size = segment->addr + segment->size - new_segment.addr;
 			new_segment.prot = segment->prot;
+			new_segment.flags = segment->flags;
+			new_segment.inode = segment->inode;
+			new_segment.offset = segment->offset +
+			                     (off_t) (new_segment.addr - segment->addr);
 			segment->size = addr + size - segment->addr;
 
 			if ( !AddSegment(process, &new_segment) )
@@ -250,15 +284,21 @@ bool ProtectMemory(Process* process, uintptr_t addr, size_t size, int prot)
 		struct segment* segment = FindOverlappingSegment(process, &search_region);
 		assert(segment);
 
-		if ( segment->prot != prot )
+		// The kernel can't write to the file pages on behalf of the process
+		// either.
+		int segment_prot = prot;
+		if ( segment->flags & SEGMENT_READ_ONLY_FILE )
+			segment_prot &= ~PROT_KWRITE;
+
+		if ( segment->prot != segment_prot )
 		{
 			// TODO: There is a moment of inconsistency here when the segment
 			//       table itself has another protection written than what
 			//       what applies to the actual pages.
 			// TODO: SECURTIY: Does this have security implications?
-			segment->prot = prot;
+			segment->prot = segment_prot;
 			for ( size_t i = 0; i < segment->size; i += Page::Size() )
-				Memory::PageProtect(segment->addr + i, prot);
+				Memory::PageProtect(segment->addr + i, segment_prot);
 			Memory::Flush();
 		}
 
@@ -268,7 +308,30 @@ bool ProtectMemory(Process* process, uintptr_t addr, size_t size, int prot)
 	return true;
 }
 
-bool MapMemory(Process* process, uintptr_t addr, size_t size, int prot)
+// Shared memory is marked as such in the page tables, so the pages are shared
+// rather than copied when the address space is forked.
+static bool MapSharedRange(uintptr_t addr, size_t size, int prot)
+{
+	for ( uintptr_t page = addr; page < addr + size; page += Page::Size() )
+	{
+		addr_t phys = Page::Get(PAGE_USAGE_USER_SPACE);
+		if ( !phys )
+		{
+			UnmapRange(addr, page - addr, PAGE_USAGE_USER_SPACE);
+			return false;
+		}
+		if ( !MapShared(phys, page, prot) )
+		{
+			Page::Put(phys, PAGE_USAGE_USER_SPACE);
+			UnmapRange(addr, page - addr, PAGE_USAGE_USER_SPACE);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MapMemory(Process* process, uintptr_t addr, size_t size, int prot,
+               int flags)
 {
 	// process->segment_write_lock is held.
 	// process->segment_lock is held.
@@ -282,8 +345,16 @@ bool MapMemory(Process* process, uintptr_t addr, size_t size, int prot)
 	new_segment.addr = addr;
 	new_segment.size = size;
 	new_segment.prot = prot;
+	new_segment.flags = flags;
+	new_segment.inode = NULL;
+	new_segment.offset = 0;
 
-	if ( !MapRange(new_segment.addr, new_segment.size, new_segment.prot, PAGE_USAGE_USER_SPACE) )
+	if ( flags & MAP_SHARED )
+	{
+		if ( !MapSharedRange(new_segment.addr, new_segment.size, new_segment.prot) )
+			return false;
+	}
+	else if ( !MapRange(new_segment.addr, new_segment.size, new_segment.prot, PAGE_USAGE_USER_SPACE) )
 		return false;
 	Memory::Flush();
 
@@ -304,6 +375,165 @@ bool MapMemory(Process* process, uintptr_t addr, size_t size, int prot)
 	return true;
 }
 
+bool MapFileMemory(Process* process, uintptr_t addr, size_t size, int prot,
+                   int flags, Inode* inode, off_t offset)
+{
+	// process->segment_write_lock is held.
+	// process->segment_lock is held.
+	assert(Page::IsAligned(addr));
+	assert(Page::IsAligned(size));
+	assert(Page::IsAligned(offset));
+	assert(process == CurrentProcess());
+
+	UnmapMemory(process, addr, size);
+
+	// The pages are not mapped until they are first accessed.
+	struct segment new_segment;
+	new_segment.addr = addr;
+	new_segment.size = size;
+	new_segment.prot = prot;
+	new_segment.flags = flags;
+	new_segment.inode = inode;
+	new_segment.offset = offset;
+
+	return AddSegment(process, &new_segment);
+}
+
+static bool FaultInPage(struct segment* segment, uintptr_t page)
+{
+	// process->segment_lock is held.
+
+	if ( LookUp(page, NULL, NULL) )
+		return true;
+	if ( !segment->inode || !(segment->prot & PROT_USER) )
+		return errno = EFAULT, false;
+
+	// Share the page with the file, copy-on-write unless the mapping is shared.
+	off_t offset = segment->offset + (off_t) (page - segment->addr);
+	ioctx_t ctx; SetupKernelIOCtx(&ctx);
+	addr_t phys = segment->inode->mmap_page(&ctx, offset);
+	if ( phys )
+	{
+		bool mapped = segment->flags & MAP_SHARED ?
+		              MapShared(phys, page, segment->prot) :
+		              MapCopyOnWrite(phys, page, segment->prot);
+		if ( !mapped )
+			return Page::Release(phys, PAGE_USAGE_USER_SPACE), false;
+		InvalidatePage(page);
+		return true;
+	}
+	if ( errno != ENXIO )
+		return false;
+
+	// Pages entirely after the end of the file are zero filled, and writes to
+	// them are never written back to the file.
+	if ( !(phys = Page::Get(PAGE_USAGE_USER_SPACE)) )
+		return false;
+	if ( !Map(phys, page, PROT_KREAD | PROT_KWRITE) )
+		return Page::Put(phys, PAGE_USAGE_USER_SPACE), false;
+	InvalidatePage(page);
+	memset((void*) page, 0, Page::Size());
+	PageProtect(page, segment->prot);
+	InvalidatePage(page);
+	return true;
+}
+
+bool SyncMemory(Process* process, uintptr_t addr, size_t size)
+{
+	// process->segment_lock is held.
+
+	// The hardware marks the shared pages that have been written to as dirty,
+	// and those pages are written back to the file.
+	uintptr_t end = UINTPTR_MAX - addr < size ? UINTPTR_MAX : addr + size;
+	bool success = true;
+	for ( size_t i = 0; i < process->segments_used; i++ )
+	{
+		struct segment* segment = &process->segments[i];
+		if ( !(segment->flags & MAP_SHARED) || !segment->inode )
+			continue;
+		uintptr_t from = addr < segment->addr ? segment->addr : addr;
+		uintptr_t to = segment->addr + segment->size;
+		if ( end < to )
+			to = end;
+		ioctx_t ctx; SetupKernelIOCtx(&ctx);
+		for ( uintptr_t page = from; page < to; page += Page::Size() )
+		{
+			if ( !ClearDirty(page) )
+				continue;
+			off_t offset = segment->offset + (off_t) (page - segment->addr);
+			if ( segment->inode->msync_page(&ctx, offset,
+			                                (const uint8_t*) page) < 0 )
+				success = false;
+		}
+	}
+	return success;
+}
+
+bool PrepareUserRead(Process* process, uintptr_t addr, size_t size)
+{
+	// process->segment_lock is held.
+	assert(process == CurrentProcess());
+
+	// The kernel can't recover from faulting on user-space, so any demand paged
+	// memory is paged in ahead of the access.
+	uintptr_t end = addr + size;
+	for ( uintptr_t page = Page::AlignDown(addr); page < end; page += Page::Size() )
+	{
+		struct segment search_region;
+		search_region.addr = page;
+		search_region.size = Page::Size();
+		search_region.prot = 0;
+		struct segment* segment = FindOverlappingSegment(process, &search_region);
+		if ( !segment )
+			return errno = EFAULT, false;
+		if ( !FaultInPage(segment, page) )
+			return false;
+	}
+	return true;
+}
+
+bool PrepareUserWrite(Process* process, uintptr_t addr, size_t size)
+{
+	// process->segment_lock is held.
+	assert(process == CurrentProcess());
+
+	// The kernel can't recover from faulting on writes to user-space, so any
+	// pages shared copy-on-write are copied ahead of the write.
+	uintptr_t end = addr + size;
+	for ( uintptr_t page = Page::AlignDown(addr); page < end; page += Page::Size() )
+	{
+		struct segment search_region;
+		search_region.addr = page;
+		search_region.size = Page::Size();
+		search_region.prot = 0;
+		struct segment* segment = FindOverlappingSegment(process, &search_region);
+		if ( !segment )
+			return errno = EFAULT, false;
+		if ( !FaultInPage(segment, page) || !CopyOnWrite(page, segment->prot) )
+			return false;
+	}
+	return true;
+}
+
+bool HandlePageFault(uintptr_t addr, bool write, bool present)
+{
+	Process* process = CurrentProcess();
+	ScopedLock lock(&process->segment_lock);
+	uintptr_t page = Page::AlignDown(addr);
+	struct segment search_region;
+	search_region.addr = page;
+	search_region.size = Page::Size();
+	search_region.prot = 0;
+	struct segment* segment = FindOverlappingSegment(process, &search_region);
+	if ( !segment )
+		return false;
+	if ( !present && !FaultInPage(segment, page) )
+		return false;
+	if ( write && (segment->prot & PROT_WRITE) )
+		return CopyOnWrite(page, segment->prot);
+	return !present;
+}
+
 } // namespace Memory
 } // namespace Sortix
 
@@ -335,9 +565,6 @@ void* sys_mmap(void* addr_ptr, size_t size, int prot, int flags, int fd,
 	// Verify that MAP_PRIVATE and MAP_SHARED are not both set.
 	if ( bool(flags & MAP_PRIVATE) == bool(flags & MAP_SHARED) )
 		return errno = EINVAL, MAP_FAILED;
-	// TODO: MAP_SHARED is not currently supported.
-	if ( flags & MAP_SHARED )
-		return errno = EINVAL, MAP_FAILED;
 	// Verify the fíle descriptor and the offset is suitable set if needed.
 	if ( !(flags & MAP_ANONYMOUS) &&
 	     (fd < 0 || offset < 0 || (offset & (Page::Size()-1))) )
@@ -366,6 +593,8 @@ void* sys_mmap(void* addr_ptr, size_t size, int prot, int flags, int fd,
 	// Verify whether the backing file is usable for memory mapping.
 	ioctx_t ctx; SetupUserIOCtx(&ctx);
 	Ref<Descriptor> desc;
+	Ref<Inode> inode;
+	bool read_only_file = false;
 	if ( !(flags & MAP_ANONYMOUS) )
 	{
 		if ( !(desc = process->GetDescriptor(fd)) )
@@ -376,12 +605,32 @@ void* sys_mmap(void* addr_ptr, size_t size, int prot, int flags, int fd,
 		// Verify that we have read access to the file.
 		if ( desc->read(&ctx, NULL, 0) != 0 )
 			return errno = EACCES, MAP_FAILED;
-		// Verify that we have write access to the file if needed.
-		if ( (prot & PROT_WRITE) && !(flags & MAP_PRIVATE) &&
-		     desc->write(&ctx, NULL, 0) != 0 )
-			return errno = EACCES, MAP_FAILED;
+		// Verify that we have write access to the file if needed. Shared
+		// mappings of files not open for writing remember it, so they can't
+		// be made writable later.
+		if ( (flags & MAP_SHARED) && desc->write(&ctx, NULL, 0) != 0 )
+		{
+			if ( prot & PROT_WRITE )
+				return errno = EACCES, MAP_FAILED;
+			read_only_file = true;
+		}
+		// Page in the file on demand if it supports it, otherwise read it in
+		// its entirety when mapping it. Pages after the end of the file are
+		// zero filled when faulted in.
+		if ( S_ISREG(desc->type) && desc->vnode->inode->mmap_page_supported() )
+			inode = desc->vnode->inode;
+		// Shared mappings must be backed by the file itself.
+		if ( !inode && (flags & MAP_SHARED) )
+			return errno = ENODEV, MAP_FAILED;
 	}
 
+	// The protection of the finished mapping.
+	int final_prot = prot | PROT_FORK;
+	if ( prot & PROT_READ )
+		final_prot |= PROT_KREAD;
+	if ( prot & PROT_WRITE )
+		final_prot |= PROT_KWRITE;
+
 	ScopedLock lock1(&process->segment_write_lock);
 	ScopedLock lock2(&process->segment_lock);
 
@@ -392,10 +641,27 @@ void* sys_mmap(void* addr_ptr, size_t size, int prot, int flags, int fd,
 		new_segment.size = aligned_size;
 	else if ( !PlaceSegment(&new_segment, process, (void*) addr, aligned_size, flags) )
 		return errno = ENOMEM, MAP_FAILED;
+
+	int map_flags = flags & (MAP_SHARED | MAP_PRIVATE);
+	if ( read_only_file )
+		map_flags |= SEGMENT_READ_ONLY_FILE;
+
+	// Map the file without reading it, its pages are shared with the file as
+	// they are accessed, copy-on-write if the mapping is private.
+	if ( inode )
+	{
+		if ( !Memory::MapFileMemory(process, new_segment.addr, new_segment.size,
+		                            final_prot, map_flags, inode.Get(), offset) )
+			return MAP_FAILED;
+		return (void*) new_segment.addr;
+	}
+
 	new_segment.prot = PROT_KWRITE | PROT_FORK;
 
-	// Allocate a memory segment with the desired properties.
-	if ( !Memory::MapMemory(process, new_segment.addr, new_segment.size, new_segment.prot) )
+	// Allocate a memory segment with the desired properties. Shared anonymous
+	// memory is allocated up front, so it is shared with any forked children.
+	if ( !Memory::MapMemory(process, new_segment.addr, new_segment.size,
+	                        new_segment.prot, map_flags) )
 		return MAP_FAILED;
 
 	// The pread will copy to user-space right requires this lock to be free.
@@ -431,12 +697,8 @@ void* sys_mmap(void* addr_ptr, size_t size, int prot, int flags, int fd,
 
 	// Finally switch to the desired page protections.
 	kthread_mutex_lock(&process->segment_lock);
-	if ( prot & PROT_READ )
-		prot |= PROT_KREAD;
-	if ( prot & PROT_WRITE )
-		prot |= PROT_KWRITE;
-	prot |= PROT_FORK;
-	Memory::ProtectMemory(CurrentProcess(), new_segment.addr, new_segment.size, prot);
+	Memory::ProtectMemory(CurrentProcess(), new_segment.addr, new_segment.size,
+	                      final_prot);
 	kthread_mutex_unlock(&process->segment_lock);
 
 	lock1.Reset();
@@ -488,6 +750,47 @@ int sys_munmap(void* addr_ptr, size_t size)
 	return 0;
 }
 
+int sys_msync(void* addr_ptr, size_t size, int flags)
+{
+	// Verify that that the address is suitable aligned.
+	uintptr_t addr = (uintptr_t) addr_ptr;
+	if ( !Page::IsAligned(addr) )
+		return errno = EINVAL, -1;
+	// Verify that we understand all the flags and they don't conflict.
+	if ( flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE) )
+		return errno = EINVAL, -1;
+	if ( (flags & MS_ASYNC) && (flags & MS_SYNC) )
+		return errno = EINVAL, -1;
+
+	size = Page::AlignUp(size);
+	if ( UINTPTR_MAX - addr < size )
+		return errno = ENOMEM, -1;
+
+	Process* process = CurrentProcess();
+	ScopedLock lock1(&process->segment_write_lock);
+	ScopedLock lock2(&process->segment_lock);
+
+	// Verify that the whole range is mapped.
+	for ( size_t offset = 0; offset < size; )
+	{
+		struct segment search_region;
+		search_region.addr = addr + offset;
+		search_region.size = Page::Size();
+		search_region.prot = 0;
+		struct segment* segment = FindOverlappingSegment(process, &search_region);
+		if ( !segment )
+			return errno = ENOMEM, -1;
+		offset = segment->addr + segment->size - addr;
+	}
+
+	// The changes are written back right away even if MS_ASYNC, and there's
+	// nothing to invalidate as the mappings share the pages of the file.
+	if ( !Memory::SyncMemory(process, addr, size) )
+		return errno = EIO, -1;
+
+	return 0;
+}
+
 // TODO: We use a wrapper system call here because there are too many parameters
 //       to mmap for some platforms. We should extend the system call ABI so we
 //       can do system calls with huge parameter lists and huge return values
@@ -293,7 +293,7 @@ private:
 	void RegisterInterrupts();
 	bool AddReceiveDescriptor(Ref<Packet> pkt);
 	bool AddTransmitDescriptor(Ref<Packet> pkt);
-	bool CanAddTransmit();
+	bool CanAddTransmit(Ref<Packet> pkt);
 	static void InterruptHandler(struct interrupt_context*, void*);
 	static void InterruptWorkHandler(void* context);
 	void OnInterrupt();
@@ -342,7 +342,8 @@ EM::EM(uint32_t devaddr, size_t number, int features)
 {
 	snprintf(ifinfo.name, sizeof(ifinfo.name), "em%zu", number);
 	ifinfo.type = IF_TYPE_ETHERNET;
-	ifinfo.features = IF_FEATURE_ETHERNET_CRC_OFFLOAD;
+	ifinfo.features = IF_FEATURE_ETHERNET_CRC_OFFLOAD |
+	                  IF_FEATURE_SCATTER_GATHER;
 	ifinfo.addrlen = ETHER_ADDR_LEN;
 	ifstatus.mtu = ETHERMTU;
 	this->devaddr = devaddr;
@@ -509,20 +510,37 @@ bool EM::AddReceiveDescriptor(Ref<Packet> pkt) // ordered via interrupt worker
 
 bool EM::AddTransmitDescriptor(Ref<Packet> pkt) // tx_lock must be locked.
 {
-	uint32_t next_desc = tx_tail + 1;
-	if ( tx_count <= next_desc )
-		next_desc = 0;
-	if ( next_desc == tx_prochead )
+	if ( !CanAddTransmit(pkt) )
 		return false;
-	struct tx_desc_tcpdata* desc = &tdesc[tx_tail];
-	desc->address = pkt->pmap.phys;
-	desc->lencmd = EM_TDESC_LENGTH(pkt->length) | EM_TDESC_TYPE_TCPDATA |
-	               EM_TDESC_CMD_RS | EM_TDESC_CMD_EOP | EM_TDESC_CMD_IFCS;
-	desc->status = 0;
-	desc->opts = 0;
-	desc->special = 0;
-	tpackets[tx_tail] = pkt;
-	tx_tail = next_desc;
+	// The packet buffer with the headers and each fragment has a descriptor,
+	// and the last descriptor ends the packet and keeps it alive until sent.
+	size_t count = 1 + pkt->fragments_used;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		struct tx_desc_tcpdata* desc = &tdesc[tx_tail];
+		uint32_t lencmd = EM_TDESC_TYPE_TCPDATA | EM_TDESC_CMD_RS;
+		if ( i == 0 )
+		{
+			desc->address = pkt->pmap.phys + pkt->offset;
+			lencmd |= EM_TDESC_LENGTH(pkt->length - pkt->offset);
+		}
+		else
+		{
+			struct packet_fragment* fragment = &pkt->fragments[i - 1];
+			desc->address = fragment->phys + fragment->offset;
+			lencmd |= EM_TDESC_LENGTH(fragment->length);
+		}
+		if ( i + 1 == count )
+		{
+			lencmd |= EM_TDESC_CMD_EOP | EM_TDESC_CMD_IFCS;
+			tpackets[tx_tail] = pkt;
+		}
+		desc->lencmd = lencmd;
+		desc->status = 0;
+		desc->opts = 0;
+		desc->special = 0;
+		tx_tail = tx_tail + 1 < tx_count ? tx_tail + 1 : 0;
+	}
 	// TODO: Research whether this is needed, or whether the paging bits do
 	//       the right thing. Do those bits work on all systems?
 	//asm volatile ("wbinvd");
@@ -530,22 +548,18 @@ bool EM::AddTransmitDescriptor(Ref<Packet> pkt) // tx_lock must be locked.
 	return true;
 }
 
-bool EM::CanAddTransmit() // tx_lock must be locked.
+bool EM::CanAddTransmit(Ref<Packet> pkt) // tx_lock must be locked.
 {
-	uint32_t next_desc = tx_tail + 1;
-	if ( tx_count <= next_desc )
-		next_desc = 0;
-	if ( next_desc == tx_prochead )
-		return false;
-	return true;
+	// One descriptor is always left unused so the full ring isn't empty.
+	uint32_t used = tx_prochead <= tx_tail ? tx_tail - tx_prochead :
+	                tx_count - tx_prochead + tx_tail;
+	return 1 + pkt->fragments_used < tx_count - used;
 }
 
 bool EM::Send(Ref<Packet> pkt)
 {
 	ScopedLock lock(&tx_lock);
-	if ( !tx_queue_first &&
-	     CanAddTransmit() &&
-	     AddTransmitDescriptor(pkt) )
+	if ( !tx_queue_first && AddTransmitDescriptor(pkt) )
 		return true;
 	if ( tx_queue_last )
 	{
@@ -704,7 +718,7 @@ void EM::InterruptWork()
 		}
 		unhandled &= ~EM_INTERRUPT_TXQE;
 	}
-	while ( tx_queue_first && CanAddTransmit() )
+	while ( tx_queue_first && CanAddTransmit(tx_queue_first) )
 	{
 		Ref<Packet> pkt = tx_queue_first;
 		tx_queue_first = pkt->next;
@@ -104,33 +104,37 @@ bool Send(Ref<Packet> pktin,
           uint16_t ether_type,
           NetworkInterface* netif)
 {
-	if ( ETHERMTU < pktin->length )
+	size_t inlen = pktin->DataLength();
+	if ( ETHERMTU < inlen )
 		return errno = EMSGSIZE, false;
-	Ref<Packet> pkt = GetPacket();
+	size_t padding = inlen < ETHERMIN ? ETHERMIN - inlen : 0;
+	bool crc = !(netif->ifinfo.features & IF_FEATURE_ETHERNET_CRC_OFFLOAD);
+	// The padding and checksum can't be appended after any fragments, which
+	// only the interfaces gathering the fragments can transmit.
+	if ( pktin->fragments_used &&
+	     (!(netif->ifinfo.features & IF_FEATURE_SCATTER_GATHER) ||
+	      padding || crc) )
+		return errno = EINVAL, false;
+	Ref<Packet> pkt = PrependPacket(pktin, sizeof(struct ether_header));
 	if ( !pkt )
 		return false;
-	const unsigned char* in = pktin->from;
-	size_t inlen = pktin->length;
-	size_t padding = inlen < ETHERMIN ? ETHERMIN - inlen : 0;
-	unsigned char* out = pkt->from;
 	struct ether_header hdr;
 	struct ether_footer ftr;
-	size_t outlen = sizeof(hdr) /* ETHER_HDR_LEN */ + inlen + padding;
-	if ( !(netif->ifinfo.features & IF_FEATURE_ETHERNET_CRC_OFFLOAD) )
-		outlen += sizeof(ftr) /* ETHER_CRC_LEN */;
-	if ( pkt->pmap.size < outlen )
+	size_t tail = padding + (crc ? sizeof(ftr) /* ETHER_CRC_LEN */ : 0);
+	if ( pkt->pmap.size - pkt->length < tail )
 		return errno = EMSGSIZE, false;
-	pkt->length = outlen;
+	unsigned char* out = pkt->from + pkt->offset;
 	memcpy(&hdr.ether_dhost, dst, sizeof(struct ether_addr));
 	memcpy(&hdr.ether_shost, src, sizeof(struct ether_addr));
 	hdr.ether_type = htobe16(ether_type);
 	memcpy(out, &hdr, sizeof(hdr));
-	memcpy(out + sizeof(hdr), in, inlen);
-	memset(out + sizeof(hdr) + inlen, 0, padding);
-	if ( !(netif->ifinfo.features & IF_FEATURE_ETHERNET_CRC_OFFLOAD) )
+	memset(pkt->from + pkt->length, 0, padding);
+	pkt->length += padding;
+	if ( crc )
 	{
-		ftr.ether_crc = htole32(crc32(0, out, pkt->length));
-		memcpy(out + sizeof(hdr) + inlen + padding, &ftr, sizeof(ftr));
+		ftr.ether_crc = htole32(crc32(0, out, pkt->length - pkt->offset));
+		memcpy(pkt->from + pkt->length, &ftr, sizeof(ftr));
+		pkt->length += sizeof(ftr);
 	}
 	return netif->Send(pkt);
 }
@@ -42,6 +42,7 @@
 #include <sortix/kernel/poll.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/refcount.h>
+#include <sortix/kernel/slab.h>
 #include <sortix/kernel/sockopt.h>
 
 #include "fs.h"
@@ -86,6 +87,8 @@ class StreamSocket : public AbstractInode
 public:
 	StreamSocket(uid_t owner, gid_t group, mode_t mode, Ref<Manager> manager);
 	virtual ~StreamSocket();
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 	virtual bool pass();
 	virtual void unpass();
 	virtual Ref<Inode> accept4(ioctx_t* ctx, uint8_t* addr, size_t* addrsize,
@@ -162,6 +165,19 @@ static void QueueRemove(StreamSocket** first, StreamSocket** last,
 		*last = socket->prev_socket;
 }
 
+static struct slab_cache stream_socket_cache =
+	SLAB_CACHE_INITIALIZER("stream socket", StreamSocket);
+
+void* StreamSocket::operator new(size_t size)
+{
+	return SlabAllocate(&stream_socket_cache, size);
+}
+
+void StreamSocket::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&stream_socket_cache, ptr, size);
+}
+
 StreamSocket::StreamSocket(uid_t owner, gid_t group, mode_t mode,
                            Ref<Manager> manager)
 {
@@ -166,7 +166,8 @@ int NetworkInterfaceNode::ioctl(ioctx_t* ctx, int cmd, uintptr_t arg)
 
 	if ( cmd == NIOC_SETCONFIG ||
 	     cmd == NIOC_SETCONFIG_ETHER ||
-	     cmd == NIOC_SETCONFIG_INET )
+	     cmd == NIOC_SETCONFIG_INET ||
+	     cmd == NIOC_SETCONFIG_LOOPBACK )
 	{
 		ScopedLock outer(&ARP::arp_lock);
 		ScopedLock inner(&netif->cfg_lock);
@@ -187,7 +188,16 @@ int NetworkInterfaceNode::ioctl(ioctx_t* ctx, int cmd, uintptr_t arg)
 			if ( !ctx->copy_from_src(&new_cfg.inet, ptr, sizeof(new_cfg.inet)) )
 				return -1;
 			break;
+		case NIOC_SETCONFIG_LOOPBACK:
+			if ( !ctx->copy_from_src(&new_cfg.loopback, ptr,
+			                         sizeof(new_cfg.loopback)) )
+				return -1;
+			break;
 		}
+		if ( 100 < new_cfg.loopback.loss ||
+		     (new_cfg.loopback.loss &&
+		      netif->ifinfo.type != IF_TYPE_LOOPBACK) )
+			return errno = EINVAL, -1;
 		// Let the ARP cache know the configuration changed, so it can purge any
 		// entries that are no longer valid.
 		ARP::OnConfiguration(netif, &netif->cfg, &new_cfg);
@@ -224,6 +234,11 @@ int NetworkInterfaceNode::ioctl(ioctx_t* ctx, int cmd, uintptr_t arg)
 		                        sizeof(netif->cfg.inet)) )
 			return -1;
 		return 0;
+	case NIOC_GETCONFIG_LOOPBACK:
+		if ( !ctx->copy_to_dest(ptr, &netif->cfg.loopback,
+		                        sizeof(netif->cfg.loopback)) )
+			return -1;
+		return 0;
 	default:
 		return errno = ENOTTY, -1;
 	}
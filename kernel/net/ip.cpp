@@ -84,6 +84,17 @@ uint16_t ipsum_buf(uint16_t sum, const void* bufptr, size_t size)
 	return sum;
 }
 
+// Adds a buffer that begins at the given offset into the summed data, which
+// unlike ipsum_buf may be odd as the sum of the buffer is then byte swapped.
+uint16_t ipsum_buf_at(uint16_t sum, const void* bufptr, size_t size,
+                      size_t offset)
+{
+	uint16_t part = ipsum_buf(0, bufptr, size);
+	if ( offset & 1 )
+		part = part << 8 | part >> 8;
+	return ipsum_word(sum, part);
+}
+
 uint16_t ipsum_finish(uint16_t sum)
 {
 	return ~sum;
@@ -339,20 +350,17 @@ bool Send(Ref<Packet> pktin,
           unsigned int ifindex,
           bool broadcast)
 {
-	Ref<Packet> pkt = GetPacket();
+	size_t inlen = pktin->DataLength();
+	if ( UINT16_MAX - sizeof(struct ipv4) < inlen )
+		return errno = EMSGSIZE, false;
+	Ref<Packet> pkt = PrependPacket(pktin, sizeof(struct ipv4));
 	if ( !pkt )
 		return false;
-	size_t mtu = pkt->pmap.size;
-	if ( mtu < sizeof(struct ipv4) ||
-	     mtu - sizeof(struct ipv4) < pktin->length )
-		return errno = EMSGSIZE, -1;
-	pkt->length = sizeof(struct ipv4) + pktin->length;
-	unsigned char* in = pktin->from;
-	unsigned char* out = pkt->from;
+	unsigned char* out = pkt->from + pkt->offset;
 	struct ipv4 hdr;
 	hdr.version_ihl = IPV4_VERSION_MAKE(4) | IPV4_IHL_MAKE(5);
 	hdr.dscp_ecn = 0;
-	hdr.length = htobe16(pkt->length);
+	hdr.length = htobe16(sizeof(struct ipv4) + inlen);
 	hdr.identification = htobe16(0); // TODO: Assign identification to packets.
 	hdr.fragment = htobe16(0);
 	hdr.ttl = 0x40; // TODO: This should be configurable.
@@ -362,7 +370,6 @@ bool Send(Ref<Packet> pktin,
 	memcpy(hdr.destination, dst, sizeof(struct in_addr));
 	hdr.checksum = htobe16(ipsum(&hdr, sizeof(hdr)));
 	memcpy(out, &hdr, sizeof(hdr));
-	memcpy(out + sizeof(struct ipv4), in, pktin->length);
 
 	NetworkInterface* netif = LocateInterface(src, dst, ifindex);
 	if ( !netif )
@@ -418,7 +425,8 @@ bool GetSourceIP(const struct in_addr* src,
                  const struct in_addr* dst,
                  struct in_addr* sendfrom,
                  unsigned int ifindex,
-                 size_t* mtu)
+                 size_t* mtu,
+                 int* features)
 {
 	NetworkInterface* netif = LocateInterface(src, dst, ifindex);
 	if ( !netif )
@@ -428,6 +436,8 @@ bool GetSourceIP(const struct in_addr* src,
 		memcpy(sendfrom, &netif->cfg.inet.address, sizeof(struct in_addr));
 	if ( mtu )
 		*mtu = Ether::GetMTU(netif) - sizeof(struct ipv4);
+	if ( features )
+		*features = netif->ifinfo.features;
 	return true;
 }
 
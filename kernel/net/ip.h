@@ -31,6 +31,8 @@ namespace IP {
 uint16_t ipsum(const void* bufptr, size_t size);
 uint16_t ipsum_word(uint16_t sum, uint16_t word);
 uint16_t ipsum_buf(uint16_t sum, const void* bufptr, size_t size);
+uint16_t ipsum_buf_at(uint16_t sum, const void* bufptr, size_t size,
+                      size_t offset);
 uint16_t ipsum_finish(uint16_t sum);
 void Handle(Ref<Packet> pkt,
             const struct ether_addr* src,
@@ -46,7 +48,8 @@ bool GetSourceIP(const struct in_addr* src,
                  const struct in_addr* dst,
                  struct in_addr* sendfrom,
                  unsigned int ifindex,
-                 size_t* mtu = NULL);
+                 size_t* mtu = NULL,
+                 int* features = NULL);
 Ref<Inode> Socket(int type, int protocol);
 
 } // namespace IP
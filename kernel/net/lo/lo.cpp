@@ -21,6 +21,7 @@
 
 #include <arpa/inet.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
@@ -42,6 +43,9 @@
 // again to run later (to avoid starving other tasks using the shared worker
 // thread). The packet queue is a singly linked list of packets.
 
+// The loopback device can be configured to drop a percentage of the packets
+// sent on it, which simulates a lossy network for testing.
+
 namespace Sortix {
 namespace Loopback {
 
@@ -125,6 +129,11 @@ void Loopback::Recv()
 
 bool Loopback::Send(Ref<Packet> pkt)
 {
+	kthread_mutex_lock(&cfg_lock);
+	unsigned int loss = cfg.loopback.loss;
+	kthread_mutex_unlock(&cfg_lock);
+	if ( loss && arc4random_uniform(100) < loss )
+		return true;
 	kthread_mutex_lock(&socket_lock);
 	if ( last_packet )
 		last_packet->next = pkt;
@@ -20,12 +20,14 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
 
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/kthread.h>
 #include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/packet.h>
 #include <sortix/kernel/pci-mmio.h>
+#include <sortix/kernel/slab.h>
 
 namespace Sortix {
 
@@ -44,12 +46,26 @@ static size_t packet_cache_used = 0;
 static size_t packet_cache_allocated = 0;
 static size_t packet_count = 0;
 
+static struct slab_cache packet_object_cache =
+	SLAB_CACHE_INITIALIZER("packet", Packet);
+
+void* Packet::operator new(size_t size)
+{
+	return SlabAllocate(&packet_object_cache, size);
+}
+
+void Packet::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&packet_object_cache, ptr, size);
+}
+
 Packet::Packet(paddrmapped_t _pmap) : pmap(_pmap)
 {
 	from = (unsigned char*) pmap.from;
 	length = 0;
 	offset = 0;
 	netif = NULL;
+	fragments_used = 0;
 	packet_count++;
 }
 
@@ -57,6 +73,8 @@ Packet::~Packet()
 {
 	// Refuse to do recursive destructor calls that could stack overflow.
 	assert(!next);
+	for ( size_t i = 0; i < fragments_used; i++ )
+		Page::Release(fragments[i].phys, PAGE_USAGE_USER_SPACE);
 	ScopedLock lock(&packet_cache_lock);
 	if ( packet_cache_used < packet_cache_allocated )
 		packet_cache[packet_cache_used++] = pmap;
@@ -101,4 +119,59 @@ Ref<Packet> GetPacket()
 	return pkt;
 }
 
+// Appends a reference to part of a page after the data in the buffer, which
+// lets the network interface gather the page without the data being copied.
+bool Packet::AddFragment(addr_t phys, size_t offset, size_t length)
+{
+	assert(offset <= Page::Size() && length <= Page::Size() - offset);
+	if ( fragments_used == PACKET_FRAGMENTS_MAX )
+		return errno = ENOBUFS, false;
+	if ( !Page::Share(phys) )
+		return false;
+	struct packet_fragment* fragment = &fragments[fragments_used++];
+	fragment->phys = phys;
+	fragment->offset = offset;
+	fragment->length = length;
+	return true;
+}
+
+size_t Packet::DataLength()
+{
+	size_t result = length - offset;
+	for ( size_t i = 0; i < fragments_used; i++ )
+		result += fragments[i].length;
+	return result;
+}
+
+// Makes room for a header of the given size in front of the packet data. The
+// header is prepended in place if the packet has the headroom, otherwise the
+// packet is copied into a new packet with headroom.
+Ref<Packet> PrependPacket(Ref<Packet> pkt, size_t size)
+{
+	assert(pkt->offset <= pkt->length);
+	if ( size <= pkt->offset )
+	{
+		pkt->offset -= size;
+		return pkt;
+	}
+	assert(size <= PACKET_HEADROOM);
+	Ref<Packet> copy = GetPacket();
+	if ( !copy )
+		return Ref<Packet>(NULL);
+	size_t inlen = pkt->length - pkt->offset;
+	if ( copy->pmap.size - PACKET_HEADROOM < inlen )
+		return errno = EMSGSIZE, Ref<Packet>(NULL);
+	memcpy(copy->from + PACKET_HEADROOM, pkt->from + pkt->offset, inlen);
+	copy->offset = PACKET_HEADROOM - size;
+	copy->length = PACKET_HEADROOM + inlen;
+	for ( size_t i = 0; i < pkt->fragments_used; i++ )
+	{
+		struct packet_fragment* fragment = &pkt->fragments[i];
+		if ( !copy->AddFragment(fragment->phys, fragment->offset,
+		                        fragment->length) )
+			return Ref<Packet>(NULL);
+	}
+	return copy;
+}
+
 } // namespace Sortix
@@ -21,14 +21,7 @@
 // TODO: PUSH.
 // TODO: URG.
 // TODO: Nagle's algorithm, MSG_MORE, TCP_CORK, TCP_NODELAY, etc.
-// TODO: TCP options.
-// TODO: Maximum Segment Size (respect TCP_MSS).
-// TODO: Efficient receieve queue when out of order.
 // TODO: Efficient backlog / half-open. Avoid denial of service attacks.
-// TODO: Measure average round trip time for efficient retransmission?
-// TODO: High speed extensions.
-// TODO: Anti-congestion extensions.
-// TODO: Selective acknowledgements.
 // TODO: Implement all RFC 1122 TCP requirements.
 // TODO: Probing Zero Windows per RFC 1122 4.2.2.17.
 // TODO: os-test all the things.
@@ -54,6 +47,7 @@
 #ifndef IOV_MAX
 #include <sortix/limits.h>
 #endif
+#include <sortix/mman.h>
 
 #include <sortix/kernel/clock.h>
 #include <sortix/kernel/copy.h>
@@ -62,9 +56,11 @@
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/kthread.h>
+#include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/packet.h>
 #include <sortix/kernel/poll.h>
 #include <sortix/kernel/process.h>
+#include <sortix/kernel/slab.h>
 #include <sortix/kernel/sockopt.h>
 #include <sortix/kernel/thread.h>
 #include <sortix/kernel/time.h>
@@ -75,9 +71,30 @@
 #include "tcp.h"
 
 #define BUFFER_SIZE 65536 // Documented in tcp(4).
+#define BUFFER_SIZE_MIN 4096 // Documented in tcp(4).
+#define BUFFER_SIZE_MAX 4194304 // Documented in tcp(4).
+
+#define MSS_MIN 64 // Documented in tcp(4).
 
 #define NUM_RETRANSMISSIONS 6 // Documented in tcp(4)
 
+// Retransmission timeouts in microseconds (RFC 6298).
+#define RTO_INITIAL 1000000 // Documented in tcp(4).
+#define RTO_MIN 200000 // Documented in tcp(4).
+#define RTO_MAX 60000000 // Documented in tcp(4).
+
+#define CWND_MAX 1073741824
+
+// The maximum number of sequence ranges tracked out of order.
+#define REASSEMBLY_MAX 64 // Documented in tcp(4).
+#define SACKED_MAX 32
+
+// The maximum number of file pages referenced by the outgoing data.
+#define OUTGOING_PAGES_MAX 1024
+
+// Smaller parts of pages are copied rather than gathered by the interface.
+#define FRAGMENT_MIN 256
+
 namespace Sortix {
 namespace TCP {
 
@@ -152,6 +169,194 @@ static inline bool mod32_gt(tcp_seq a, tcp_seq b)
 	return (int32_t) (a - b) > 0;
 }
 
+// A range of sequence numbers from start (inclusive) to end (exclusive).
+struct tcp_range
+{
+	tcp_seq start;
+	tcp_seq end;
+};
+
+// A part of a file page sent with sendfile(2) that is part of the outgoing
+// data, which is referenced and mapped rather than copied.
+struct tcp_page
+{
+	// The position of the data in the outgoing data.
+	uint64_t position;
+	// The amount of bytes written to the outgoing ring buffer before the data.
+	uint64_t ring;
+	// The kernel mapping of the page.
+	addralloc_t mapping;
+	// The physical address of the page.
+	addr_t phys;
+	// The offset of the data in the page.
+	size_t offset;
+	// The amount of data in the page.
+	size_t length;
+};
+
+// The options in a segment that are understood.
+struct tcp_options
+{
+	struct tcp_range sack[TCP_MAX_SACK];
+	size_t sack_count;
+	uint32_t tsval;
+	uint32_t tsecr;
+	uint16_t mss;
+	uint8_t wscale;
+	bool has_mss;
+	bool has_wscale;
+	bool has_ts;
+	bool has_sack_permitted;
+};
+
+static void ParseOptions(struct tcp_options* opts,
+                         const unsigned char* opt,
+                         size_t optlen)
+{
+	memset(opts, 0, sizeof(*opts));
+	size_t i = 0;
+	while ( i < optlen )
+	{
+		unsigned char kind = opt[i];
+		if ( kind == TCPOPT_EOL )
+			break;
+		if ( kind == TCPOPT_NOP )
+		{
+			i++;
+			continue;
+		}
+		if ( optlen - i < 2 )
+			break;
+		size_t len = opt[i + 1];
+		if ( len < 2 || optlen - i < len )
+			break;
+		if ( kind == TCPOPT_MAXSEG && len == TCPOLEN_MAXSEG )
+		{
+			opts->mss = opt[i + 2] << 8 | opt[i + 3];
+			opts->has_mss = true;
+		}
+		else if ( kind == TCPOPT_WINDOW && len == TCPOLEN_WINDOW )
+		{
+			opts->wscale = opt[i + 2];
+			opts->has_wscale = true;
+		}
+		else if ( kind == TCPOPT_TIMESTAMP && len == TCPOLEN_TIMESTAMP )
+		{
+			memcpy(&opts->tsval, opt + i + 2, sizeof(opts->tsval));
+			memcpy(&opts->tsecr, opt + i + 6, sizeof(opts->tsecr));
+			opts->tsval = be32toh(opts->tsval);
+			opts->tsecr = be32toh(opts->tsecr);
+			opts->has_ts = true;
+		}
+		else if ( kind == TCPOPT_SACK_PERMITTED &&
+		          len == TCPOLEN_SACK_PERMITTED )
+			opts->has_sack_permitted = true;
+		else if ( kind == TCPOPT_SACK && len % TCPOLEN_SACK == 2 )
+		{
+			opts->sack_count = 0;
+			for ( size_t n = 2; n < len && opts->sack_count < TCP_MAX_SACK;
+			      n += TCPOLEN_SACK )
+			{
+				struct tcp_range* range = &opts->sack[opts->sack_count++];
+				memcpy(&range->start, opt + i + n, sizeof(range->start));
+				memcpy(&range->end, opt + i + n + 4, sizeof(range->end));
+				range->start = be32toh(range->start);
+				range->end = be32toh(range->end);
+			}
+		}
+		i += len;
+	}
+}
+
+// Add a range to a sorted array of ranges, merging it with any ranges that it
+// overlaps or is adjacent to, or return false if the array is full.
+static bool AddRange(struct tcp_range* ranges,
+                     size_t* count_ptr,
+                     size_t max,
+                     tcp_seq start,
+                     tcp_seq end)
+{
+	size_t count = *count_ptr;
+	size_t i = 0;
+	while ( i < count && mod32_lt(ranges[i].end, start) )
+		i++;
+	size_t j = i;
+	while ( j < count && mod32_le(ranges[j].start, end) )
+	{
+		if ( mod32_lt(ranges[j].start, start) )
+			start = ranges[j].start;
+		if ( mod32_gt(ranges[j].end, end) )
+			end = ranges[j].end;
+		j++;
+	}
+	if ( i == j )
+	{
+		if ( count == max )
+			return false;
+		memmove(ranges + i + 1, ranges + i, (count - i) * sizeof(*ranges));
+		count++;
+	}
+	else
+	{
+		memmove(ranges + i + 1, ranges + j, (count - j) * sizeof(*ranges));
+		count -= j - i - 1;
+	}
+	ranges[i].start = start;
+	ranges[i].end = end;
+	*count_ptr = count;
+	return true;
+}
+
+// Remove the parts of the sorted ranges that are before the base.
+static void TrimRanges(struct tcp_range* ranges,
+                       size_t* count_ptr,
+                       tcp_seq base)
+{
+	size_t count = *count_ptr;
+	size_t i = 0;
+	while ( i < count && mod32_le(ranges[i].end, base) )
+		i++;
+	memmove(ranges, ranges + i, (count - i) * sizeof(*ranges));
+	count -= i;
+	if ( count && mod32_lt(ranges[0].start, base) )
+		ranges[0].start = base;
+	*count_ptr = count;
+}
+
+// Reallocate a ring buffer to a new size and move its contents to the start.
+static bool ResizeRing(unsigned char** ring,
+                       size_t* ring_size,
+                       size_t* ring_offset,
+                       size_t ring_used,
+                       size_t new_size)
+{
+	assert(ring_used <= new_size);
+	unsigned char* new_ring = new unsigned char[new_size];
+	if ( !new_ring )
+		return false;
+	if ( *ring )
+	{
+		size_t until_end = *ring_size - *ring_offset;
+		size_t first = until_end < ring_used ? until_end : ring_used;
+		memcpy(new_ring, *ring + *ring_offset, first);
+		memcpy(new_ring + first, *ring, ring_used - first);
+		delete[] *ring;
+	}
+	*ring = new_ring;
+	*ring_size = new_size;
+	*ring_offset = 0;
+	return true;
+}
+
+static size_t ClampBufferSize(uintmax_t size)
+{
+	if ( size < BUFFER_SIZE_MIN )
+		return BUFFER_SIZE_MIN;
+	if ( BUFFER_SIZE_MAX < size )
+		return BUFFER_SIZE_MAX;
+	return size;
+}
+
 static bool IsSupportedAddressFamily(int af)
 {
 	return af == AF_INET /* TODO: || af == AF_INET6 */;
@@ -197,6 +402,8 @@ class TCPSocket
 public:
 	TCPSocket(int af);
 	~TCPSocket();
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 	Ref<Inode> accept4(ioctx_t* ctx, uint8_t* addr, size_t* addrsize,
 	                   int flags);
 	int bind(ioctx_t* ctx, const uint8_t* addr, size_t addrsize);
@@ -208,6 +415,8 @@ public:
 	ssize_t read(ioctx_t* ctx, uint8_t* buf, size_t count);
 	ssize_t recvmsg(ioctx_t* ctx, struct msghdr* msg, int flags);
 	ssize_t write(ioctx_t* ctx, const uint8_t* buf, size_t count);
+	ssize_t sendfile(ioctx_t* ctx, Ref<Inode> file, off_t offset,
+	                 size_t count);
 	int poll(ioctx_t* ctx, PollNode* node);
 	int getsockopt(ioctx_t* ctx, int level, int option_name, void* option_value,
 	                size_t* option_size_ptr);
@@ -241,7 +450,34 @@ private:
 	                   size_t addrsize);
 	bool CanBind(union tcp_sockaddr new_local);
 	bool BindDefault(const union tcp_sockaddr* new_local_ptr);
-	void UpdateWindow(uint16_t new_window);
+	void UpdateWindow(tcp_seq new_window);
+	void UpdateReceiveWindow();
+	void InitializeOptions();
+	void NegotiateOptions(const struct tcp_options* opts);
+	size_t EncodeOptions(unsigned char* opt, bool syn, size_t mtu);
+	uint32_t Timestamp();
+	size_t SegmentSize();
+	void SampleRoundTrip(uint32_t sample);
+	void SampleTimestamp(uint32_t tsecr);
+	void UpdateCongestion(tcp_seq acked, bool duplicate);
+	void UpdateScoreboard(const struct tcp_options* opts);
+	bool NextHole(tcp_seq* start_ptr, tcp_seq* end_ptr);
+	bool NextHoleLost();
+	void ReceiveOutOfOrder(tcp_seq seq, const unsigned char* data,
+	                       size_t length, bool fin);
+	bool Reassemble();
+	size_t IncomingExtent();
+	void AutotuneReceive(size_t amount);
+	void AutotuneTransmit();
+	struct tcp_page* OutgoingPage(size_t index);
+	struct tcp_page* LocateOutgoing(uint64_t position, uint64_t* ring_ptr,
+	                                size_t* length_ptr);
+	size_t OutgoingQueued();
+	bool AddOutgoingPage(addr_t phys, size_t offset, size_t length);
+	void ReleaseOutgoingPages(size_t count);
+	void RemoveOutgoing(size_t amount);
+	size_t PacketizeOutgoing(Ref<Packet> pkt, size_t position, size_t amount,
+	                         bool gather, uint16_t* sum);
 	void TransmitLoop();
 	bool Transmit();
 	void ScheduleTransmit();
@@ -254,6 +490,8 @@ private:
 	ssize_t recv_unlocked(ioctx_t* ctx, uint8_t* buf, size_t count, int flags);
 	ssize_t send_unlocked(ioctx_t* ctx, const uint8_t* buf, size_t count,
 	                      int flags);
+	ssize_t send_page_unlocked(ioctx_t* ctx, addr_t phys, size_t offset,
+	                           size_t length);
 	int shutdown_unlocked(int how);
 
 public:
@@ -312,13 +550,42 @@ private:
 	// The poll channel to publish poll bit changes on.
 	PollChannel poll_channel;
 
-	// The queue of incoming packets whose sequence numbers are too high to
-	// process right now, sorted by increasing sequence number.
-	Ref<Packet> receive_queue; // TODO: Not a good way to keep track of this.
+	// The sorted ranges of data received out of order and stored in the
+	// incoming ring buffer after the data received in order.
+	struct tcp_range reassembly[REASSEMBLY_MAX];
+
+	// The sorted ranges above send_una selectively acknowledged by the remote
+	// socket (RFC 2018).
+	struct tcp_range sacked[SACKED_MAX];
 
 	// The deadline for the remote to acknowledge before retransmitting.
 	struct timespec deadline;
 
+	// When the application began reading the bytes counted in recv_copied.
+	struct timespec recv_copied_since;
+
+	// When ts_recent was last updated.
+	struct timespec ts_recent_age;
+
+	// When the segment ending at rtt_seq was sent if rtt_timing.
+	struct timespec rtt_start;
+
+	// The incoming ring buffer, or NULL if not allocated yet.
+	unsigned char* incoming;
+
+	// The outgoing ring buffer, or NULL if not allocated yet.
+	unsigned char* outgoing;
+
+	// The ring buffer of the file pages in the outgoing data, or NULL if not
+	// allocated yet.
+	struct tcp_page* outgoing_pages;
+
+	// The size of the incoming ring buffer.
+	size_t incoming_size;
+
+	// The size of the outgoing ring buffer.
+	size_t outgoing_size;
+
 	// The offset at which data begins in the incoming ring buffer.
 	size_t incoming_offset;
 
@@ -331,6 +598,41 @@ private:
 	// The amount of bytes in the outgoing ring buffer.
 	size_t outgoing_used;
 
+	// The size of the outgoing pages ring buffer.
+	size_t outgoing_pages_size;
+
+	// The index at which the pages begin in the outgoing pages ring buffer.
+	size_t outgoing_pages_offset;
+
+	// The number of pages in the outgoing pages ring buffer.
+	size_t outgoing_pages_used;
+
+	// The amount of bytes in the outgoing pages.
+	size_t outgoing_paged;
+
+	// The position in the outgoing data at send_una, counted since the data
+	// was first sent.
+	uint64_t outgoing_position;
+
+	// The amount of bytes written to the outgoing ring buffer before
+	// outgoing_position.
+	uint64_t outgoing_ring_position;
+
+	// The amount of bytes read by the application since recv_copied_since.
+	size_t recv_copied;
+
+	// The number of ranges in reassembly.
+	size_t reassembly_count;
+
+	// The number of ranges in sacked.
+	size_t sacked_count;
+
+	// The maximum segment size accepted by the remote socket.
+	size_t send_mss;
+
+	// The maximum segment size set with TCP_MAXSEG, or 0 if not set.
+	size_t mss_clamp;
+
 	// Send unacknowledged (STD 7, RFC 793).
 	tcp_seq send_una;
 
@@ -356,6 +658,34 @@ private:
 	// Initial send sequence number (STD 7, RFC 793).
 	tcp_seq iss;
 
+	// The highest sequence number sent so far.
+	tcp_seq send_max;
+
+	// The end of the segment whose round trip is timed if rtt_timing.
+	tcp_seq rtt_seq;
+
+	// Congestion window (RFC 5681).
+	tcp_seq cwnd;
+
+	// Slow start threshold (RFC 5681).
+	tcp_seq ssthresh;
+
+	// Bytes acknowledged in congestion avoidance since cwnd grew (RFC 5681).
+	tcp_seq bytes_acked;
+
+	// The highest sequence number sent when loss was detected (RFC 6582).
+	tcp_seq recover;
+
+	// The sequence number up to which holes have been retransmitted during
+	// the fast recovery.
+	tcp_seq recovery_pos;
+
+	// The start of the most recently received segment out of order.
+	tcp_seq reassembly_latest;
+
+	// The sequence number of the FIN received out of order if reassembly_fin.
+	tcp_seq reassembly_fin_seq;
+
 	// Receive next (STD 7, RFC 793).
 	tcp_seq recv_nxt;
 
@@ -374,6 +704,31 @@ private:
 	// Initial receive sequence number (STD 7, RFC 793).
 	tcp_seq irs;
 
+	// The most recent timestamp to echo to the remote (RFC 7323).
+	uint32_t ts_recent;
+
+	// The random offset of the timestamps sent to the remote (RFC 7323).
+	uint32_t ts_offset;
+
+	// The smoothed round trip time in microseconds if rtt_measured.
+	uint32_t srtt;
+
+	// The round trip time variation in microseconds if rtt_measured.
+	uint32_t rttvar;
+
+	// The retransmission timeout in microseconds (RFC 6298).
+	uint32_t rto;
+
+	// Statistics reported by TCP_INFO.
+	uint64_t stat_bytes_acked;
+	uint64_t stat_bytes_received;
+	uint64_t stat_segs_out;
+	uint64_t stat_segs_in;
+	uint64_t stat_total_retrans;
+	uint64_t stat_timeouts;
+	uint64_t stat_fast_retrans;
+	uint64_t stat_dupacks;
+
 	// The address family to which this socket belongs.
 	int af;
 
@@ -390,6 +745,9 @@ private:
 	// acknowledgement from the remote socket.
 	unsigned int retransmissions;
 
+	// The number of consecutive duplicate acknowledgements (RFC 5681).
+	unsigned int dupacks;
+
 	// The current TCP state.
 	enum tcp_state state;
 
@@ -414,11 +772,42 @@ private:
 	// Whether the socket has been shut down for receive.
 	bool shutdown_receive;
 
-	// The incoming ring buffer.
-	unsigned char incoming[BUFFER_SIZE];
+	// Whether window scaling is offered or has been negotiated (RFC 7323).
+	bool wscale_ok;
+
+	// Whether timestamps are offered or have been negotiated (RFC 7323).
+	bool ts_ok;
+
+	// Whether srtt has been measured.
+	bool rtt_measured;
+
+	// Whether the round trip time of a segment is being timed (RFC 6298).
+	bool rtt_timing;
+
+	// Whether fast recovery is in progress (RFC 6582).
+	bool in_recovery;
+
+	// Whether the next hole after recovery_pos should be retransmitted.
+	bool retransmit_hole;
+
+	// Whether a FIN has been received out of order.
+	bool reassembly_fin;
+
+	// Whether selective acknowledgements are offered or have been negotiated
+	// (RFC 2018).
+	bool sack_ok;
+
+	// Whether the incoming ring buffer grows as needed (no SO_RCVBUF).
+	bool incoming_autotune;
 
-	// The outgoing ring buffer.
-	unsigned char outgoing[BUFFER_SIZE];
+	// Whether the outgoing ring buffer grows as needed (no SO_SNDBUF).
+	bool outgoing_autotune;
+
+	// The window scale shift count of the remote socket (RFC 7323).
+	uint8_t send_wscale;
+
+	// The window scale shift count of this socket (RFC 7323).
+	uint8_t recv_wscale;
 };
 
 // The TCP socket Inode with a reference counted lifetime. The backend class
@@ -429,6 +818,8 @@ class TCPSocketNode : public AbstractInode
 public:
 	TCPSocketNode(TCPSocket* socket);
 	virtual ~TCPSocketNode();
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 	virtual Ref<Inode> accept4(ioctx_t* ctx, uint8_t* addr, size_t* addrsize,
 	                           int flags);
 	virtual int bind(ioctx_t* ctx, const uint8_t* addr, size_t addrsize);
@@ -442,6 +833,8 @@ public:
 	                        int flags);
 	virtual ssize_t read(ioctx_t* ctx, uint8_t* buf, size_t count);
 	virtual ssize_t write(ioctx_t* ctx, const uint8_t* buf, size_t count);
+	virtual ssize_t sendfile(ioctx_t* ctx, Ref<Inode> file, off_t offset,
+	                         size_t count);
 	virtual int poll(ioctx_t* ctx, PollNode* node);
 	virtual int getsockopt(ioctx_t* ctx, int level, int option_name,
 	                       void* option_value, size_t* option_size_ptr);
@@ -461,6 +854,19 @@ void TCPSocket__OnTimer(Clock* /*clock*/, Timer* /*timer*/, void* user)
 	((TCPSocket*) user)->OnTimer();
 }
 
+static struct slab_cache tcp_socket_cache =
+	SLAB_CACHE_INITIALIZER("tcp socket", TCPSocket);
+
+void* TCPSocket::operator new(size_t size)
+{
+	return SlabAllocate(&tcp_socket_cache, size);
+}
+
+void TCPSocket::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&tcp_socket_cache, ptr, size);
+}
+
 TCPSocket::TCPSocket(int af)
 {
 	prev_socket = NULL;
@@ -481,12 +887,30 @@ TCPSocket::TCPSocket(int af)
 	// timer is initialized by its constructor.
 	timer.Attach(Time::GetClock(CLOCK_MONOTONIC));
 	// poll_channel is initialized by its constructor.
-	// receive_queue is initialized by its constructor.
 	deadline = timespec_make(-1, 0);
+	recv_copied_since = timespec_make(0, 0);
+	ts_recent_age = timespec_make(0, 0);
+	rtt_start = timespec_make(0, 0);
+	incoming = NULL;
+	outgoing = NULL;
+	outgoing_pages = NULL;
+	incoming_size = BUFFER_SIZE;
+	outgoing_size = BUFFER_SIZE;
 	incoming_offset = 0;
 	incoming_used = 0;
 	outgoing_offset = 0;
 	outgoing_used = 0;
+	outgoing_pages_size = 0;
+	outgoing_pages_offset = 0;
+	outgoing_pages_used = 0;
+	outgoing_paged = 0;
+	outgoing_position = 0;
+	outgoing_ring_position = 0;
+	recv_copied = 0;
+	reassembly_count = 0;
+	sacked_count = 0;
+	send_mss = TCP_MSS;
+	mss_clamp = 0;
 	send_una = 0;
 	send_nxt = 0;
 	send_wnd = 0;
@@ -495,17 +919,40 @@ TCPSocket::TCPSocket(int af)
 	send_wl2 = 0;
 	send_pos = 0;
 	iss = 0;
+	send_max = 0;
+	rtt_seq = 0;
+	cwnd = TCP_MSS;
+	ssthresh = CWND_MAX;
+	bytes_acked = 0;
+	recover = 0;
+	recovery_pos = 0;
+	reassembly_latest = 0;
+	reassembly_fin_seq = 0;
 	recv_nxt = 0;
 	recv_wnd = 0;
 	recv_up = 0;
 	recv_acked = 0;
 	recv_wndlast = 0;
 	irs = 0;
+	ts_recent = 0;
+	ts_offset = 0;
+	srtt = 0;
+	rttvar = 0;
+	rto = RTO_INITIAL;
+	stat_bytes_acked = 0;
+	stat_bytes_received = 0;
+	stat_segs_out = 0;
+	stat_segs_in = 0;
+	stat_total_retrans = 0;
+	stat_timeouts = 0;
+	stat_fast_retrans = 0;
+	stat_dupacks = 0;
 	this->af = af;
 	sockerr = 0;
 	backlog_used = 0;
 	backlog_max = 0;
 	retransmissions = 0;
+	dupacks = 0;
 	state = TCP_STATE_CLOSED;
 	outgoing_syn = TCP_SPECIAL_NOT;
 	outgoing_fin = TCP_SPECIAL_NOT;
@@ -515,8 +962,18 @@ TCPSocket::TCPSocket(int af)
 	is_referenced = false;
 	timer_armed = false;
 	shutdown_receive = false;
-	memset(incoming, 0, sizeof(incoming));
-	memset(outgoing, 0, sizeof(outgoing));
+	wscale_ok = false;
+	ts_ok = false;
+	rtt_measured = false;
+	rtt_timing = false;
+	in_recovery = false;
+	retransmit_hole = false;
+	reassembly_fin = false;
+	sack_ok = false;
+	incoming_autotune = true;
+	outgoing_autotune = true;
+	send_wscale = 0;
+	recv_wscale = 0;
 }
 
 TCPSocket::~TCPSocket()
@@ -532,13 +989,10 @@ TCPSocket::~TCPSocket()
 	assert(!connecting_next);
 	assert(!connecting_parent);
 	assert(!is_referenced);
-	// Avoid stack overflow in receive_queue recursive destructor.
-	while ( receive_queue )
-	{
-		Ref<Packet> packet = receive_queue;
-		receive_queue = packet->next;
-		packet->next.Reset();
-	}
+	delete[] incoming;
+	delete[] outgoing;
+	ReleaseOutgoingPages(outgoing_pages_used);
+	delete[] outgoing_pages;
 }
 
 void TCPSocket::Unreference()
@@ -945,8 +1399,12 @@ bool TCPSocket::Transmit() // tcp_lock taken
 	if ( state == TCP_STATE_CLOSED )
 		return (errno = sockerr ? sockerr : ENOTCONN), false;
 
-	// Move new outgoing data into the transmission window if there is room.
-	tcp_seq window_available = (tcp_seq) (send_una + send_wnd - send_nxt);
+	// Move new outgoing data into the transmission window if there is room in
+	// both the remote window and the congestion window (RFC 5681).
+	tcp_seq window_size = send_wnd < cwnd ? send_wnd : cwnd;
+	tcp_seq window_used = (tcp_seq) (send_nxt - send_una);
+	tcp_seq window_available =
+		window_used < window_size ? window_size - window_used : 0;
 	if ( window_available && outgoing_syn == TCP_SPECIAL_PENDING )
 	{
 		send_nxt++;
@@ -960,8 +1418,8 @@ bool TCPSocket::Transmit() // tcp_lock taken
 			window_data--;
 		if ( outgoing_fin == TCP_SPECIAL_WINDOW )
 			window_data--;
-		assert(window_data <= outgoing_used);
-		size_t outgoing_new = outgoing_used - window_data;
+		assert(window_data <= OutgoingQueued());
+		size_t outgoing_new = OutgoingQueued() - window_data;
 		tcp_seq amount = window_available;
 		if ( outgoing_new < amount )
 			amount = outgoing_new;
@@ -975,32 +1433,50 @@ bool TCPSocket::Transmit() // tcp_lock taken
 		window_available--;
 	}
 
+	// The congestion window may have shrunk below the data in the window.
+	tcp_seq send_end = send_nxt;
+	if ( cwnd < (tcp_seq) (send_nxt - send_una) )
+		send_end = send_una + cwnd;
+
+	// Retransmit the next missing segment during the fast recovery and then
+	// resume where the transmission was (RFC 5681 3.2).
+	tcp_seq hole_start, hole_end;
+	bool retransmit = retransmit_hole && NextHole(&hole_start, &hole_end);
+	retransmit_hole = false;
+	tcp_seq resume_pos = send_pos;
+	if ( retransmit )
+		send_pos = hole_start;
+
 	// Transmit packets.
 	bool any = false;
-	while ( mod32_lt(send_pos, send_nxt) ||
+	while ( retransmit ||
+	        mod32_lt(send_pos, send_end) ||
 	        (has_syn && mod32_lt(recv_acked, recv_nxt)) ||
 	        recv_wnd != recv_wndlast )
 	{
 		any = true;
+		tcp_seq segment_end = retransmit ? hole_end : send_end;
 		size_t mtu;
+		int features;
 		union tcp_sockaddr sendfrom;
 		if ( af == AF_INET )
 		{
 			if ( !IP::GetSourceIP(&local.in.sin_addr, &remote.in.sin_addr,
-				                  &sendfrom.in.sin_addr, ifindex, &mtu) )
+				                  &sendfrom.in.sin_addr, ifindex, &mtu,
+				                  &features) )
 				return false;
 		}
 		// TODO: IPv6 support.
 		else
 			return errno = EAFNOSUPPORT, false;
-		if ( mtu < sizeof(struct tcphdr) )
+		if ( mtu < sizeof(struct tcphdr) + TCP_MAXOLEN )
 			return errno = EINVAL, false;
-		mtu -= sizeof(struct tcphdr);
 		Ref<Packet> pkt = GetPacket();
 		if ( !pkt )
 			return false;
-		pkt->length = sizeof(struct tcphdr);
-		unsigned char* out = pkt->from;
+		// Leave room for the lower layers to prepend their headers.
+		pkt->offset = PACKET_HEADROOM;
+		unsigned char* out = pkt->from + pkt->offset;
 		struct tcphdr hdr;
 		if ( af == AF_INET )
 		{
@@ -1015,11 +1491,11 @@ bool TCPSocket::Transmit() // tcp_lock taken
 		else
 			return errno = EAFNOSUPPORT, false;
 		hdr.th_seq = htobe32(send_pos);
-		hdr.th_offset = TCP_OFFSET_ENCODE(sizeof(struct tcphdr) / 4);
 		hdr.th_flags = 0;
 		tcp_seq send_nxtpos = send_pos;
 		assert(mod32_le(send_nxtpos, send_nxt));
-		if ( outgoing_syn == TCP_SPECIAL_WINDOW && send_nxtpos == send_una )
+		if ( outgoing_syn == TCP_SPECIAL_WINDOW && send_nxtpos == send_una &&
+		     mod32_lt(send_nxtpos, segment_end) )
 		{
 			hdr.th_flags |= TH_SYN;
 			send_nxtpos++;
@@ -1027,53 +1503,53 @@ bool TCPSocket::Transmit() // tcp_lock taken
 		assert(mod32_le(send_nxtpos, send_nxt));
 		if ( has_syn )
 		{
-			// TODO: RFC 1122 4.2.2.6:
-			//       "TCP SHOULD send an MSS (Maximum Segment Size) option in
-			//        every SYN segment when its receive MSS differs from the
-			//        default 536, and MAY send it always."
-			//       "If an MSS option is not received at connection setup, TCP
-			//        MUST assume a default send MSS of 536 (576-40)."
 			hdr.th_flags |= TH_ACK;
 			hdr.th_ack = htobe32(recv_nxt);
 		}
 		else
 			hdr.th_ack = htobe32(0);
-		hdr.th_win = htobe16(recv_wnd);
+		size_t optlen = EncodeOptions(out + sizeof(hdr),
+		                              hdr.th_flags & TH_SYN, mtu);
+		size_t hdrlen = sizeof(hdr) + optlen;
+		hdr.th_offset = TCP_OFFSET_ENCODE(hdrlen / 4);
+		pkt->length = pkt->offset + hdrlen;
+		// The segment size excludes the options (RFC 6691).
+		size_t mss = mtu - sizeof(hdr);
+		if ( send_mss < mss )
+			mss = send_mss;
+		mss = optlen < mss ? mss - optlen : 1;
+		// The window is never scaled in SYN segments (RFC 7323 2.2).
+		tcp_seq window = recv_wnd;
+		if ( !(hdr.th_flags & TH_SYN) )
+			window >>= recv_wscale;
+		if ( TCP_MAXWIN < window )
+			window = TCP_MAXWIN;
+		hdr.th_win = htobe16(window);
 		hdr.th_urp = htobe16(0);
 		hdr.th_sum = htobe16(0);
-		tcp_seq window_data = (tcp_seq)(send_nxt - send_pos);
-		if ( send_pos == send_una && outgoing_syn == TCP_SPECIAL_WINDOW )
+		tcp_seq window_data = 0;
+		if ( mod32_lt(send_pos, segment_end) )
+			window_data = (tcp_seq) (segment_end - send_pos);
+		if ( window_data && send_pos == send_una &&
+		     outgoing_syn == TCP_SPECIAL_WINDOW )
 			window_data--;
-		if ( mod32_lt(send_pos, send_nxt) &&
+		if ( window_data && segment_end == send_nxt &&
 		     outgoing_fin == TCP_SPECIAL_WINDOW )
 			window_data--;
+		uint16_t fragments_sum = 0;
 		if ( window_data )
 		{
-			size_t amount = mtu < window_data ? mtu : window_data;
-			assert(outgoing_offset <= sizeof(outgoing));
+			size_t amount = mss < window_data ? mss : window_data;
 			tcp_seq window_length = (tcp_seq) (send_nxtpos - send_una);
 			if ( outgoing_syn == TCP_SPECIAL_WINDOW )
 				window_length--;
-			assert(window_length <= sizeof(outgoing));
-			size_t outgoing_end = outgoing_offset + window_length;
-			if ( sizeof(outgoing) <= outgoing_end )
-				outgoing_end -= sizeof(outgoing);
-			assert(outgoing_end < sizeof(outgoing));
-			size_t until_end = sizeof(outgoing) - outgoing_end;
-			size_t first = until_end < amount ? until_end : amount;
-			assert(first <= sizeof(outgoing));
-			assert(first <= sizeof(outgoing) - outgoing_end);
-			size_t second = amount - first;
-			assert(second <= sizeof(outgoing));
-			memcpy(out + sizeof(hdr), outgoing + outgoing_end, first);
-			if ( second )
-				memcpy(out + sizeof(hdr) + first, outgoing, second);
-			pkt->length += amount;
-			send_nxtpos += amount;
+			bool gather = features & IF_FEATURE_SCATTER_GATHER;
+			send_nxtpos += PacketizeOutgoing(pkt, window_length, amount, gather,
+			                                 &fragments_sum);
 		}
 		assert(mod32_le(send_nxtpos, send_nxt));
 		if ( outgoing_fin == TCP_SPECIAL_WINDOW &&
-		     send_nxtpos + 1 == send_nxt )
+		     send_nxtpos + 1 == send_nxt && segment_end == send_nxt )
 		{
 			hdr.th_flags |= TH_FIN;
 			send_nxtpos++;
@@ -1098,8 +1574,9 @@ bool TCPSocket::Transmit() // tcp_lock taken
 		else
 			return errno = EAFNOSUPPORT, false;
 		checksum = IP::ipsum_word(checksum, IPPROTO_TCP);
-		checksum = IP::ipsum_word(checksum, pkt->length);
-		checksum = IP::ipsum_buf(checksum, out, pkt->length);
+		checksum = IP::ipsum_word(checksum, pkt->DataLength());
+		checksum = IP::ipsum_buf(checksum, out, pkt->length - pkt->offset);
+		checksum = IP::ipsum_word(checksum, fragments_sum);
 		hdr.th_sum = htobe16(IP::ipsum_finish(checksum));
 		memcpy(out, &hdr, sizeof(hdr));
 		if ( af == AF_INET )
@@ -1115,7 +1592,32 @@ bool TCPSocket::Transmit() // tcp_lock taken
 			recv_acked = recv_nxt;
 		recv_wndlast = recv_wnd;
 		assert(mod32_le(send_nxtpos, send_nxt));
+		stat_segs_out++;
+		if ( send_pos != send_nxtpos && mod32_lt(send_pos, send_max) )
+		{
+			stat_total_retrans++;
+			// Karn's algorithm: Don't time retransmitted segments.
+			rtt_timing = false;
+		}
+		if ( mod32_lt(send_max, send_nxtpos) )
+		{
+			// Time a segment if timestamps can't measure the round trip.
+			if ( !ts_ok && !rtt_timing && mod32_le(send_max, send_pos) )
+			{
+				rtt_timing = true;
+				rtt_seq = send_nxtpos;
+				rtt_start = Time::Get(CLOCK_MONOTONIC);
+			}
+			send_max = send_nxtpos;
+		}
 		send_pos = send_nxtpos;
+		if ( retransmit )
+		{
+			retransmit = false;
+			recovery_pos = send_pos;
+			if ( mod32_lt(send_pos, resume_pos) )
+				send_pos = resume_pos;
+		}
 	}
 	if ( any )
 	{
@@ -1136,9 +1638,23 @@ void TCPSocket::OnTimer()
 		if ( state == TCP_STATE_TIME_WAIT ||
 			 (state == TCP_STATE_FIN_WAIT_2 && !is_referenced) )
 			Close();
-		else if ( mod32_lt(send_una, send_pos) )
+		else if ( mod32_lt(send_una, send_max) )
 		{
+			// Retransmit from the first unacknowledged segment with a single
+			// segment congestion window (RFC 5681 3.1, RFC 6582 3.2 step 4).
+			tcp_seq flight = (tcp_seq) (send_max - send_una);
+			tcp_seq smss = SegmentSize();
+			ssthresh = 2 * smss < flight / 2 ? flight / 2 : 2 * smss;
+			cwnd = smss;
+			bytes_acked = 0;
+			dupacks = 0;
+			in_recovery = false;
+			recover = send_max;
+			rtt_timing = false;
+			// RFC 2018 8: Forget the selective acknowledgements on timeout.
+			sacked_count = 0;
 			retransmissions++;
+			stat_timeouts++;
 			send_pos = send_una;
 		}
 	}
@@ -1172,10 +1688,18 @@ void TCPSocket::SetDeadline() // tcp_lock locked
 		struct timespec msl2 = timespec_make(60, 0); // Documented in tcp(4).
 		deadline = timespec_add(now, msl2);
 	}
-	else if ( mod32_le(send_una, send_pos) )
+	else if ( mod32_lt(send_una, send_max) )
 	{
+		// Back off exponentially on each retransmission (RFC 6298 5.5).
+		uint64_t timeout = rto;
+		for ( unsigned int i = 0; i < retransmissions; i++ )
+			if ( timeout < RTO_MAX )
+				timeout *= 2;
+		if ( RTO_MAX < timeout )
+			timeout = RTO_MAX;
 		struct timespec now = Time::Get(CLOCK_MONOTONIC);
-		struct timespec delay = timespec_make(1 + 1 * retransmissions, 0);
+		struct timespec delay = timespec_make(timeout / 1000000,
+		                                      timeout % 1000000 * 1000);
 		deadline = timespec_add(now, delay);
 	}
 }
@@ -1224,6 +1748,8 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	hdr.th_win = be16toh(hdr.th_win);
 	hdr.th_urp = be16toh(hdr.th_urp);
 	size_t offset = TCP_OFFSET_DECODE(hdr.th_offset) * 4;
+	struct tcp_options opts;
+	ParseOptions(&opts, in + sizeof(hdr), offset - sizeof(hdr));
 	in += offset;
 	inlen -= offset;
 	if ( state == TCP_STATE_CLOSED ) // STD 7, RFC 793, page 65.
@@ -1276,13 +1802,21 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 				socket->next_socket->prev_socket = socket;
 			bindings_v6[port] = socket;
 		}
+		socket->incoming_size = incoming_size;
+		socket->outgoing_size = outgoing_size;
+		socket->incoming_autotune = incoming_autotune;
+		socket->outgoing_autotune = outgoing_autotune;
+		socket->mss_clamp = mss_clamp;
 		socket->iss = arc4random();
 		socket->send_una = socket->iss;
 		socket->send_nxt = socket->iss;
 		socket->send_wnd = 1;
 		socket->send_pos = socket->iss;
+		socket->send_max = socket->iss;
+		socket->recover = socket->iss;
 		socket->outgoing_syn = TCP_SPECIAL_PENDING;
-		socket->recv_wnd = TCP_MAXWIN;
+		socket->InitializeOptions();
+		socket->NegotiateOptions(&opts);
 		socket->recv_acked = hdr.th_seq;
 		socket->recv_nxt = hdr.th_seq + 1;
 		socket->irs = hdr.th_seq;
@@ -1321,6 +1855,7 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		}
 		if ( !(hdr.th_flags & TH_SYN) )
 			return;
+		NegotiateOptions(&opts);
 		recv_acked = hdr.th_seq;
 		recv_nxt = hdr.th_seq + 1;
 		irs = hdr.th_seq;
@@ -1332,6 +1867,8 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		// TODO: Drop packet if the packet contains data/FIN beyond the SYN?
 		if ( hdr.th_flags & TH_ACK )
 		{
+			if ( ts_ok && opts.tsecr )
+				SampleTimestamp(opts.tsecr);
 			send_una = hdr.th_ack;
 			retransmissions = 0;
 			deadline = timespec_make(-1, 0);
@@ -1348,6 +1885,18 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		state = TCP_STATE_SYN_RECV;
 		return;
 	}
+	// RFC 7323 5.3: Drop segments with old timestamps upon arrival to protect
+	// against wrapped sequence numbers, unless the connection has been idle
+	// long enough for the remote timestamp clock to have wrapped.
+	if ( ts_ok && opts.has_ts && !(hdr.th_flags & TH_RST) &&
+	     mod32_lt(opts.tsval, ts_recent) &&
+	     timespec_sub(Time::Get(CLOCK_MONOTONIC), ts_recent_age).tv_sec <
+	     24 * 24 * 60 * 60 )
+	{
+		// Send <SEQ=SND.NXT><ACK=RCV.NXT><CTL=ACK>.
+		recv_acked = recv_nxt - 1;
+		return;
+	}
 	// STD 7, RFC 793, page 69.
 	bool acceptable;
 	if ( inlen == 0 && recv_wnd == 0 )
@@ -1378,9 +1927,15 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		recv_acked = recv_nxt - 1;
 		return;
 	}
+	// RFC 7323 4.3: Remember the timestamp to echo to the remote.
+	if ( ts_ok && opts.has_ts && mod32_ge(opts.tsval, ts_recent) &&
+	     mod32_le(hdr.th_seq, recv_acked) )
+	{
+		ts_recent = opts.tsval;
+		ts_recent_age = Time::Get(CLOCK_MONOTONIC);
+	}
 	// STD 7, RFC 793, page 70. Process segments in the right order and trim the
 	// segment to the receive window.
-	uint16_t real_seq = hdr.th_seq;
 	if ( mod32_lt(hdr.th_seq, recv_nxt) && (hdr.th_flags & TH_SYN) )
 	{
 		hdr.th_flags &= ~TH_SYN;
@@ -1404,34 +1959,18 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		return;
 	if ( mod32_gt(hdr.th_seq, recv_nxt) ) // Can't process yet.
 	{
-		// Insert the segment in the receive queue.
-		Ref<Packet> prev;
-		Ref<Packet> iter = receive_queue;
-		// TODO: For n packets in the worst order, this scales O(n^2).
-		// TODO: This wastes a packet per byte in the worst case.
-		while ( iter )
-		{
-			const unsigned char* iter_in = iter->from + iter->offset;
-			const unsigned char* iter_in_seq =
-				iter_in + offsetof(struct tcphdr, th_seq);
-			tcp_seq iter_seq;
-			memcpy(&iter_seq, iter_in_seq, sizeof(iter_seq));
-			iter_seq = be32toh(iter_seq);
-			if ( mod32_le(real_seq, iter_seq) )
-				break;
-			// TODO: Handle duplicate and overlapping segments.
-			prev = iter;
-			iter = iter->next;
-		}
-		if ( prev )
-		{
-			pkt->next = prev->next;
-			prev->next = pkt;
-		}
-		else
+		if ( (hdr.th_flags & (TH_RST | TH_SYN)) || !(hdr.th_flags & TH_ACK) )
+			return;
+		if ( state == TCP_STATE_ESTAB ||
+		     state == TCP_STATE_FIN_WAIT_1 ||
+		     state == TCP_STATE_FIN_WAIT_2 )
+			ReceiveOutOfOrder(hdr.th_seq, in, inlen, hdr.th_flags & TH_FIN);
+		// RFC 5681 4.2: Immediately send a duplicate acknowledgement so the
+		// remote can detect the missing segment.
+		if ( inlen )
 		{
-			pkt->next = receive_queue;
-			receive_queue = pkt;
+			recv_acked = recv_nxt - 1;
+			TransmitLoop();
 		}
 		return;
 	}
@@ -1462,7 +2001,7 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	if ( state == TCP_STATE_SYN_RECV )
 	{
 		// RFC 1122 4.2.2.20 (f), page 94.
-		UpdateWindow(hdr.th_win);
+		UpdateWindow((tcp_seq) hdr.th_win << send_wscale);
 		send_wl1 = hdr.th_seq;
 		send_wl2 = hdr.th_ack;
 		if ( mod32_le(send_una, hdr.th_ack) && mod32_le(hdr.th_ack, send_nxt) )
@@ -1522,17 +2061,12 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	if ( window_data && acked )
 	{
 		size_t amount = window_data < acked ? window_data : acked;
-		assert(outgoing_offset < sizeof(outgoing));
-		outgoing_offset += amount;
-		if ( sizeof(outgoing) <= outgoing_offset )
-			outgoing_offset -= sizeof(outgoing);
-		assert(outgoing_offset < sizeof(outgoing));
-		assert(amount <= outgoing_used);
-		outgoing_used -= amount;
+		RemoveOutgoing(amount);
 		kthread_cond_broadcast(&transmit_cond);
 		poll_channel.Signal(PollEventStatus());
 		acked -= amount;
 		send_una += amount;
+		stat_bytes_acked += amount;
 	}
 	bool fin_was_acked = false;
 	if ( outgoing_fin == TCP_SPECIAL_WINDOW && 0 < acked )
@@ -1542,17 +2076,41 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 		send_una++;
 		fin_was_acked = true;
 	}
-	if ( send_una != old_send_una )
+	tcp_seq newly_acked = (tcp_seq) (send_una - old_send_una);
+	// RFC 5681 2: Duplicate acknowledgements signal a segment went missing.
+	bool duplicate = !newly_acked && mod32_lt(send_una, send_max) && !inlen &&
+	                 !(hdr.th_flags & (TH_SYN | TH_FIN)) &&
+	                 ((tcp_seq) hdr.th_win << send_wscale) == send_wnd;
+	// RFC 7323 4.1: Measure the round trip time using the echoed timestamp.
+	if ( ts_ok && opts.tsecr && (newly_acked || inlen) )
+		SampleTimestamp(opts.tsecr);
+	if ( newly_acked )
 	{
-		// TODO: Possibly recalculate the average time to contact remote.
 		retransmissions = 0;
+		if ( mod32_lt(send_pos, send_una) )
+			send_pos = send_una;
+		// RFC 6298 3: Time segments if timestamps aren't used.
+		if ( rtt_timing && mod32_le(rtt_seq, send_una) )
+		{
+			struct timespec now = Time::Get(CLOCK_MONOTONIC);
+			struct timespec elapsed = timespec_sub(now, rtt_start);
+			if ( elapsed.tv_sec < 60 )
+				SampleRoundTrip(elapsed.tv_sec * 1000000 +
+				                elapsed.tv_nsec / 1000);
+			rtt_timing = false;
+		}
+		// RFC 6298 5.2, 5.3: Restart the retransmission timer.
+		deadline = timespec_make(-1, 0);
+		SetDeadline();
 		SetTimer();
 	}
+	UpdateScoreboard(&opts);
+	UpdateCongestion(newly_acked, duplicate);
 	// STD 7, RFC 793, page 72.
 	if ( mod32_lt(send_wl1, hdr.th_seq) ||
 	     (send_wl1 == hdr.th_seq && mod32_le(send_wl2, hdr.th_ack)) )
 	{
-		UpdateWindow(hdr.th_win);
+		UpdateWindow((tcp_seq) hdr.th_win << send_wscale);
 		send_wl1 = hdr.th_seq;
 		send_wl2 = hdr.th_ack;
 	}
@@ -1594,26 +2152,32 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	     state == TCP_STATE_FIN_WAIT_1 ||
 	     state == TCP_STATE_FIN_WAIT_2 )
 	{
-		assert(incoming_offset < sizeof(incoming));
-		assert(incoming_used <= sizeof(incoming));
-		size_t available = sizeof(incoming) - incoming_used;
+		// Allocate the incoming ring buffer when data first arrives, or drop
+		// the segment and let the remote retransmit it.
+		if ( inlen && !incoming && !shutdown_receive &&
+		     !ResizeRing(&incoming, &incoming_size, &incoming_offset,
+		                 incoming_used, incoming_size) )
+			return;
+		assert(incoming_offset < incoming_size);
+		assert(incoming_used <= incoming_size);
+		size_t available = incoming_size - incoming_used;
 		size_t amount = available < inlen ? available : inlen;
-		assert(amount <= sizeof(incoming));
+		assert(amount <= incoming_size);
 		assert(amount <= available);
 		size_t newat = incoming_offset + incoming_used;
-		if ( sizeof(incoming) <= newat )
-			newat -= sizeof(incoming);
-		assert(newat < sizeof(incoming));
-		size_t until_end = sizeof(incoming) - newat;
-		assert(until_end <= sizeof(incoming));
+		if ( incoming_size <= newat )
+			newat -= incoming_size;
+		assert(newat < incoming_size);
+		size_t until_end = incoming_size - newat;
+		assert(until_end <= incoming_size);
 		size_t first = until_end < amount ? until_end : amount;
 		assert(first <= amount);
-		assert(first <= sizeof(incoming));
+		assert(first <= incoming_size);
 		size_t second = amount - first;
 		assert(second <= amount);
-		assert(second <= sizeof(incoming));
+		assert(second <= incoming_size);
 		assert(first + second == amount);
-		assert(first + second <= sizeof(incoming));
+		assert(first + second <= incoming_size);
 		assert(first + second <= available);
 		if ( !shutdown_receive )
 		{
@@ -1621,12 +2185,19 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 			if ( second )
 				memcpy(incoming, in + first, second);
 			incoming_used += amount;
+			stat_bytes_received += amount;
+		}
+		recv_nxt = hdr.th_seq + amount;
+		bool fin = amount == inlen && (hdr.th_flags & TH_FIN);
+		if ( Reassemble() )
+		{
+			fin = true;
+			hdr.th_flags |= TH_FIN;
 		}
-		available = sizeof(incoming) - incoming_used;
+		available = incoming_size - incoming_used;
 		if ( available < recv_wnd )
 			recv_wnd = available;
-		recv_nxt = hdr.th_seq + amount;
-		if ( amount == inlen && (hdr.th_flags & TH_FIN) )
+		if ( fin )
 		{
 			recv_nxt++;
 			has_fin = true;
@@ -1666,32 +2237,104 @@ void TCPSocket::ProcessPacket(Ref<Packet> pkt,
 	}
 }
 
-void TCPSocket::ReceivePacket(Ref<Packet> pktnew,
+void TCPSocket::ReceivePacket(Ref<Packet> pkt,
                               union tcp_sockaddr* pkt_src,
                               union tcp_sockaddr* pkt_dst) // tcp_lock locked
 {
-	if ( pktnew )
-		ProcessPacket(pktnew, pkt_src, pkt_dst);
-	while ( receive_queue )
-	{
-		Ref<Packet> pkt = receive_queue;
-		const unsigned char* in = pkt->from + pkt->offset;
-		const unsigned char* in_seq = in + offsetof(struct tcphdr, th_seq);
-		tcp_seq seq;
-		memcpy(&seq, in_seq, sizeof(seq));
-		seq = be32toh(seq);
-		if ( mod32_gt(seq, recv_nxt) )
-			break;
-		receive_queue = pkt->next;
-		pkt->next.Reset();
-		if ( seq == recv_nxt )
-			ProcessPacket(pkt, pkt_src, pkt_dst);
-	}
+	stat_segs_in++;
+	ProcessPacket(pkt, pkt_src, pkt_dst);
 	// Delay transmit to answer more efficiently based on upcoming packets.
 	ScheduleTransmit();
 }
 
-void TCPSocket::UpdateWindow(uint16_t new_window)
+// tcp_lock locked
+void TCPSocket::ReceiveOutOfOrder(tcp_seq seq,
+                                  const unsigned char* data,
+                                  size_t length,
+                                  bool fin)
+{
+	// Trim the segment to the receive window.
+	tcp_seq offset = (tcp_seq) (seq - recv_nxt);
+	if ( recv_wnd <= offset )
+		return;
+	if ( recv_wnd - offset < length )
+	{
+		length = recv_wnd - offset;
+		fin = false;
+	}
+	if ( length )
+	{
+		if ( !incoming && !shutdown_receive &&
+		     !ResizeRing(&incoming, &incoming_size, &incoming_offset,
+		                 incoming_used, incoming_size) )
+			return;
+		// Drop the segment if too many ranges are out of order and let the
+		// remote retransmit it.
+		if ( !AddRange(reassembly, &reassembly_count, REASSEMBLY_MAX, seq,
+		               seq + length) )
+			return;
+		// Store the data where it belongs in the incoming ring buffer after
+		// the missing data.
+		if ( !shutdown_receive )
+		{
+			assert(incoming_used + offset + length <= incoming_size);
+			size_t at = incoming_offset + incoming_used + offset;
+			if ( incoming_size <= at )
+				at -= incoming_size;
+			assert(at < incoming_size);
+			size_t until_end = incoming_size - at;
+			size_t first = until_end < length ? until_end : length;
+			memcpy(incoming + at, data, first);
+			if ( first < length )
+				memcpy(incoming, data + first, length - first);
+		}
+	}
+	reassembly_latest = seq;
+	if ( fin )
+	{
+		reassembly_fin = true;
+		reassembly_fin_seq = seq + length;
+	}
+}
+
+bool TCPSocket::Reassemble() // tcp_lock locked
+{
+	// The data received out of order is already in the incoming ring buffer
+	// and is received once the data before it has been received.
+	while ( reassembly_count && mod32_le(reassembly[0].start, recv_nxt) )
+	{
+		if ( mod32_lt(recv_nxt, reassembly[0].end) )
+		{
+			tcp_seq amount = (tcp_seq) (reassembly[0].end - recv_nxt);
+			if ( !shutdown_receive )
+			{
+				incoming_used += amount;
+				stat_bytes_received += amount;
+			}
+			recv_nxt = reassembly[0].end;
+		}
+		TrimRanges(reassembly, &reassembly_count, recv_nxt);
+	}
+	// Return whether the FIN received out of order is next.
+	if ( reassembly_fin && reassembly_fin_seq == recv_nxt )
+	{
+		reassembly_fin = false;
+		return true;
+	}
+	return false;
+}
+
+size_t TCPSocket::IncomingExtent() // tcp_lock locked
+{
+	// The amount of the incoming ring buffer used including the data received
+	// out of order.
+	if ( !reassembly_count )
+		return incoming_used;
+	tcp_seq end = reassembly[reassembly_count - 1].end;
+	return incoming_used + (tcp_seq) (end - recv_nxt);
+}
+
+void TCPSocket::UpdateWindow(tcp_seq new_window)
 {
 	tcp_seq pending = (tcp_seq) (send_nxt - send_una);
 	if ( new_window < pending )
@@ -1699,6 +2342,603 @@ void TCPSocket::UpdateWindow(uint16_t new_window)
 	send_wnd = new_window;
 }
 
+void TCPSocket::UpdateReceiveWindow() // tcp_lock locked
+{
+	size_t available = incoming_size - incoming_used;
+	size_t maximum = (size_t) TCP_MAXWIN << recv_wscale;
+	recv_wnd = available < maximum ? available : maximum;
+}
+
+void TCPSocket::InitializeOptions() // tcp_lock locked
+{
+	// Offer a window scale large enough for the largest receive buffer.
+	size_t wanted = incoming_autotune ? BUFFER_SIZE_MAX : incoming_size;
+	recv_wscale = 0;
+	while ( recv_wscale < TCP_MAX_WINSHIFT &&
+	        ((size_t) TCP_MAXWIN << recv_wscale) < wanted )
+		recv_wscale++;
+	send_wscale = 0;
+	wscale_ok = true;
+	ts_ok = true;
+	sack_ok = true;
+	ts_offset = arc4random();
+	ts_recent = 0;
+	send_mss = TCP_MSS;
+	UpdateReceiveWindow();
+}
+
+// tcp_lock locked
+void TCPSocket::NegotiateOptions(const struct tcp_options* opts)
+{
+	// RFC 1122 4.2.2.6: Assume 536 if the remote doesn't send the MSS option.
+	send_mss = opts->has_mss ? opts->mss : TCP_MSS;
+	if ( mss_clamp && mss_clamp < send_mss )
+		send_mss = mss_clamp;
+	if ( send_mss < MSS_MIN )
+		send_mss = MSS_MIN;
+	// RFC 7323 2.2: Windows are only scaled if both sockets offered it.
+	wscale_ok = wscale_ok && opts->has_wscale;
+	if ( wscale_ok )
+	{
+		send_wscale = opts->wscale;
+		if ( TCP_MAX_WINSHIFT < send_wscale )
+			send_wscale = TCP_MAX_WINSHIFT;
+	}
+	else
+	{
+		send_wscale = 0;
+		recv_wscale = 0;
+	}
+	// RFC 2018 2: Selective acknowledgements are only sent if both sockets
+	// offered them.
+	sack_ok = sack_ok && opts->has_sack_permitted;
+	// RFC 7323 3.2: Timestamps are only sent if both sockets offered them.
+	ts_ok = ts_ok && opts->has_ts;
+	if ( ts_ok )
+	{
+		ts_recent = opts->tsval;
+		ts_recent_age = Time::Get(CLOCK_MONOTONIC);
+	}
+	UpdateReceiveWindow();
+	// RFC 5681 3.1: The initial congestion window.
+	size_t smss = SegmentSize();
+	if ( 2190 < smss )
+		cwnd = 2 * smss;
+	else if ( 1095 < smss )
+		cwnd = 3 * smss;
+	else
+		cwnd = 4 * smss;
+}
+
+size_t TCPSocket::EncodeOptions(unsigned char* opt,
+                                bool syn,
+                                size_t mtu) // tcp_lock locked
+{
+	size_t optlen = 0;
+	if ( syn )
+	{
+		// RFC 1122 4.2.2.6: Send the MSS option in every SYN segment.
+		size_t mss = mtu - sizeof(struct tcphdr);
+		if ( mss_clamp && mss_clamp < mss )
+			mss = mss_clamp;
+		if ( UINT16_MAX < mss )
+			mss = UINT16_MAX;
+		opt[optlen++] = TCPOPT_MAXSEG;
+		opt[optlen++] = TCPOLEN_MAXSEG;
+		opt[optlen++] = mss >> 8;
+		opt[optlen++] = mss & 0xFF;
+		if ( wscale_ok )
+		{
+			opt[optlen++] = TCPOPT_NOP;
+			opt[optlen++] = TCPOPT_WINDOW;
+			opt[optlen++] = TCPOLEN_WINDOW;
+			opt[optlen++] = recv_wscale;
+		}
+		if ( sack_ok )
+		{
+			opt[optlen++] = TCPOPT_NOP;
+			opt[optlen++] = TCPOPT_NOP;
+			opt[optlen++] = TCPOPT_SACK_PERMITTED;
+			opt[optlen++] = TCPOLEN_SACK_PERMITTED;
+		}
+	}
+	if ( ts_ok )
+	{
+		uint32_t tsval = htobe32(Timestamp());
+		uint32_t tsecr = htobe32(ts_recent);
+		opt[optlen++] = TCPOPT_NOP;
+		opt[optlen++] = TCPOPT_NOP;
+		opt[optlen++] = TCPOPT_TIMESTAMP;
+		opt[optlen++] = TCPOLEN_TIMESTAMP;
+		memcpy(opt + optlen, &tsval, sizeof(tsval));
+		optlen += sizeof(tsval);
+		memcpy(opt + optlen, &tsecr, sizeof(tsecr));
+		optlen += sizeof(tsecr);
+	}
+	if ( !syn && sack_ok && reassembly_count )
+	{
+		size_t max_blocks = (TCP_MAXOLEN - optlen - 4) / TCPOLEN_SACK;
+		size_t blocks = reassembly_count;
+		if ( max_blocks < blocks )
+			blocks = max_blocks;
+		opt[optlen++] = TCPOPT_NOP;
+		opt[optlen++] = TCPOPT_NOP;
+		opt[optlen++] = TCPOPT_SACK;
+		opt[optlen++] = 2 + blocks * TCPOLEN_SACK;
+		// RFC 2018 4: The first block contains the most recent segment.
+		size_t latest = 0;
+		for ( size_t i = 0; i < reassembly_count; i++ )
+			if ( mod32_le(reassembly[i].start, reassembly_latest) &&
+			     mod32_lt(reassembly_latest, reassembly[i].end) )
+				latest = i;
+		for ( size_t i = 0; i < blocks; i++ )
+		{
+			size_t index = i == 0 ? latest : i <= latest ? i - 1 : i;
+			uint32_t start = htobe32(reassembly[index].start);
+			uint32_t end = htobe32(reassembly[index].end);
+			memcpy(opt + optlen, &start, sizeof(start));
+			optlen += sizeof(start);
+			memcpy(opt + optlen, &end, sizeof(end));
+			optlen += sizeof(end);
+		}
+	}
+	assert(optlen % 4 == 0 && optlen <= TCP_MAXOLEN);
+	return optlen;
+}
+
+uint32_t TCPSocket::Timestamp() // tcp_lock locked
+{
+	// RFC 7323 5.4: The timestamp clock ticks every millisecond.
+	struct timespec now = Time::Get(CLOCK_MONOTONIC);
+	uint32_t msecs = (uint32_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	return ts_offset + msecs;
+}
+
+size_t TCPSocket::SegmentSize() // tcp_lock locked
+{
+	// The sender maximum segment size excludes the options (RFC 5681 2).
+	size_t optlen = ts_ok ? TCPOLEN_TSTAMP_APPA : 0;
+	return send_mss - optlen;
+}
+
+void TCPSocket::SampleRoundTrip(uint32_t sample) // tcp_lock locked
+{
+	// RFC 6298 2.2, 2.3: Estimate the round trip time and its variation.
+	if ( !rtt_measured )
+	{
+		srtt = sample;
+		rttvar = sample / 2;
+		rtt_measured = true;
+	}
+	else
+	{
+		uint32_t delta = srtt < sample ? sample - srtt : srtt - sample;
+		rttvar = (3 * (uint64_t) rttvar + delta) / 4;
+		srtt = (7 * (uint64_t) srtt + sample) / 8;
+	}
+	// The clock granularity is a millisecond.
+	uint64_t variation = 4 * (uint64_t) rttvar;
+	if ( variation < 1000 )
+		variation = 1000;
+	uint64_t timeout = srtt + variation;
+	if ( timeout < RTO_MIN )
+		timeout = RTO_MIN;
+	if ( RTO_MAX < timeout )
+		timeout = RTO_MAX;
+	rto = timeout;
+}
+
+void TCPSocket::SampleTimestamp(uint32_t tsecr) // tcp_lock locked
+{
+	uint32_t sample = Timestamp() - tsecr;
+	// Ignore echoes of timestamps that were never sent.
+	if ( 60 * 1000 < sample )
+		return;
+	SampleRoundTrip(sample * 1000);
+}
+
+// tcp_lock locked
+void TCPSocket::UpdateScoreboard(const struct tcp_options* opts)
+{
+	// RFC 2018 5: Remember the data selectively acknowledged by the remote.
+	if ( sack_ok )
+	{
+		for ( size_t i = 0; i < opts->sack_count; i++ )
+		{
+			tcp_seq start = opts->sack[i].start;
+			tcp_seq end = opts->sack[i].end;
+			if ( mod32_lt(start, send_una) )
+				start = send_una;
+			if ( !mod32_lt(start, end) || mod32_lt(send_max, end) )
+				continue;
+			// Ignore the block if the scoreboard is full.
+			AddRange(sacked, &sacked_count, SACKED_MAX, start, end);
+		}
+	}
+	TrimRanges(sacked, &sacked_count, send_una);
+}
+
+// tcp_lock locked
+bool TCPSocket::NextHole(tcp_seq* start_ptr, tcp_seq* end_ptr)
+{
+	// Find the first data after recovery_pos that hasn't been selectively
+	// acknowledged.
+	tcp_seq start = mod32_lt(recovery_pos, send_una) ? send_una : recovery_pos;
+	tcp_seq end = send_max;
+	for ( size_t i = 0; i < sacked_count; i++ )
+	{
+		if ( mod32_le(sacked[i].end, start) )
+			continue;
+		if ( mod32_le(sacked[i].start, start) )
+		{
+			start = sacked[i].end;
+			continue;
+		}
+		end = sacked[i].start;
+		break;
+	}
+	if ( !mod32_lt(start, end) )
+		return false;
+	*start_ptr = start;
+	*end_ptr = end;
+	return true;
+}
+
+bool TCPSocket::NextHoleLost() // tcp_lock locked
+{
+	// The hole is considered lost if the remote received data after it.
+	tcp_seq start, end;
+	return NextHole(&start, &end) && sacked_count &&
+	       mod32_lt(start, sacked[sacked_count - 1].end);
+}
+
+// tcp_lock locked
+void TCPSocket::UpdateCongestion(tcp_seq acked, bool duplicate)
+{
+	tcp_seq smss = SegmentSize();
+	if ( duplicate )
+	{
+		stat_dupacks++;
+		dupacks++;
+		// Retransmit the holes selectively acknowledged data came after.
+		if ( in_recovery && sacked_count && NextHoleLost() )
+			retransmit_hole = true;
+		// RFC 6582 3.2 step 3: Inflate the congestion window for every segment
+		// that has left the network.
+		else if ( in_recovery )
+			cwnd = cwnd < CWND_MAX - smss ? cwnd + smss : CWND_MAX;
+		// RFC 6582 3.2 step 2: Fast retransmit on the third duplicate
+		// acknowledgement unless recovering from loss in the same window.
+		else if ( dupacks == 3 && mod32_lt(recover, send_una) )
+		{
+			tcp_seq flight = (tcp_seq) (send_max - send_una);
+			ssthresh = 2 * smss < flight / 2 ? flight / 2 : 2 * smss;
+			cwnd = ssthresh + 3 * smss;
+			recover = send_max;
+			recovery_pos = send_una;
+			in_recovery = true;
+			retransmit_hole = true;
+			stat_fast_retrans++;
+		}
+		return;
+	}
+	if ( !acked )
+		return;
+	dupacks = 0;
+	if ( in_recovery )
+	{
+		// RFC 6582 3.2 step 5: Retransmit the next missing segment on partial
+		// acknowledgements and deflate the window by the acknowledged data.
+		if ( mod32_lt(send_una, recover) )
+		{
+			cwnd = (acked < cwnd ? cwnd - acked : 0) + smss;
+			if ( !sacked_count || NextHoleLost() )
+			{
+				retransmit_hole = true;
+				stat_fast_retrans++;
+			}
+			return;
+		}
+		// RFC 6582 3.2 step 4: Full acknowledgement ends the fast recovery.
+		tcp_seq flight = (tcp_seq) (send_max - send_una);
+		cwnd = (flight < smss ? smss : flight) + smss;
+		if ( ssthresh < cwnd )
+			cwnd = ssthresh;
+		in_recovery = false;
+		bytes_acked = 0;
+		return;
+	}
+	// RFC 5681 3.1: Slow start until ssthresh and then congestion avoidance
+	// with appropriate byte counting (RFC 3465).
+	if ( cwnd < ssthresh )
+		cwnd += acked < smss ? acked : smss;
+	else
+	{
+		bytes_acked += acked;
+		if ( cwnd <= bytes_acked )
+		{
+			bytes_acked -= cwnd;
+			cwnd += smss;
+		}
+	}
+	if ( CWND_MAX < cwnd )
+		cwnd = CWND_MAX;
+}
+
+void TCPSocket::AutotuneReceive(size_t amount) // tcp_lock locked
+{
+	if ( !incoming_autotune || BUFFER_SIZE_MAX <= incoming_size )
+		return;
+	recv_copied += amount;
+	// Measure how much the application reads per round trip.
+	struct timespec now = Time::Get(CLOCK_MONOTONIC);
+	struct timespec elapsed = timespec_sub(now, recv_copied_since);
+	uint64_t elapsed_us = elapsed.tv_sec * 1000000ULL + elapsed.tv_nsec / 1000;
+	uint64_t interval_us = rtt_measured ? srtt : 100000;
+	if ( elapsed_us < interval_us || !elapsed_us )
+		return;
+	uint64_t rate = recv_copied * interval_us / elapsed_us;
+	recv_copied = 0;
+	recv_copied_since = now;
+	// The remote must be able to send twice what the application reads per
+	// round trip so the receive window never limits the throughput.
+	if ( 2 * rate <= incoming_size )
+		return;
+	size_t size = incoming_size;
+	while ( size < 2 * rate && size < BUFFER_SIZE_MAX )
+		size *= 2;
+	size = ClampBufferSize(size);
+	// Keep the current buffer if no memory is available.
+	ResizeRing(&incoming, &incoming_size, &incoming_offset, IncomingExtent(),
+	           size);
+}
+
+void TCPSocket::AutotuneTransmit() // tcp_lock locked
+{
+	// The full outgoing ring buffer limits the throughput if the remote window
+	// and the congestion window could take all of it.
+	tcp_seq window = send_wnd < cwnd ? send_wnd : cwnd;
+	if ( !outgoing_autotune || BUFFER_SIZE_MAX <= outgoing_size ||
+	     window < outgoing_size )
+		return;
+	size_t size = ClampBufferSize(2 * outgoing_size);
+	// The ring buffer is allocated when data is first sent.
+	if ( !outgoing )
+	{
+		outgoing_size = size;
+		return;
+	}
+	// Keep the current buffer if no memory is available.
+	ResizeRing(&outgoing, &outgoing_size, &outgoing_offset, outgoing_used,
+	           size);
+}
+
+struct tcp_page* TCPSocket::OutgoingPage(size_t index) // tcp_lock locked
+{
+	assert(index < outgoing_pages_used);
+	size_t at = outgoing_pages_offset + index;
+	if ( outgoing_pages_size <= at )
+		at -= outgoing_pages_size;
+	return &outgoing_pages[at];
+}
+
+// Locate the outgoing data at the position, which is either in the returned
+// page, or in the ring buffer if NULL is returned. The amount of bytes written
+// to the ring buffer before the position is stored in *ring_ptr and the amount
+// of data until the next page boundary is stored in *length_ptr.
+struct tcp_page* TCPSocket::LocateOutgoing(uint64_t position,
+                                           uint64_t* ring_ptr,
+                                           size_t* length_ptr)
+{
+	uint64_t end = outgoing_position + OutgoingQueued();
+	assert(outgoing_position <= position && position <= end);
+	// Binary search for the pages that begin before or at the position.
+	size_t low = 0;
+	size_t high = outgoing_pages_used;
+	while ( low < high )
+	{
+		size_t middle = low + (high - low) / 2;
+		if ( OutgoingPage(middle)->position <= position )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	uint64_t until = end;
+	if ( low < outgoing_pages_used )
+		until = OutgoingPage(low)->position;
+	if ( !low )
+	{
+		*ring_ptr = outgoing_ring_position + (position - outgoing_position);
+		*length_ptr = until - position;
+		return NULL;
+	}
+	struct tcp_page* page = OutgoingPage(low - 1);
+	uint64_t page_end = page->position + page->length;
+	if ( position < page_end )
+	{
+		*ring_ptr = page->ring;
+		*length_ptr = page_end - position;
+		return page;
+	}
+	*ring_ptr = page->ring + (position - page_end);
+	*length_ptr = until - position;
+	return NULL;
+}
+
+size_t TCPSocket::OutgoingQueued() // tcp_lock locked
+{
+	return outgoing_used + outgoing_paged;
+}
+
+// Append part of a file page to the outgoing data, referencing the page rather
+// than copying it.
+bool TCPSocket::AddOutgoingPage(addr_t phys,
+                                size_t offset,
+                                size_t length) // tcp_lock locked
+{
+	uint64_t position = outgoing_position + OutgoingQueued();
+	uint64_t ring = outgoing_ring_position + outgoing_used;
+	// Extend the last page if the data continues in it.
+	if ( outgoing_pages_used )
+	{
+		struct tcp_page* last = OutgoingPage(outgoing_pages_used - 1);
+		if ( last->phys == phys && last->offset + last->length == offset &&
+		     last->position + last->length == position )
+		{
+			last->length += length;
+			outgoing_paged += length;
+			return true;
+		}
+	}
+	if ( outgoing_pages_used == OUTGOING_PAGES_MAX )
+		return errno = ENOBUFS, false;
+	if ( outgoing_pages_used == outgoing_pages_size )
+	{
+		size_t new_size = outgoing_pages_size ? 2 * outgoing_pages_size : 16;
+		struct tcp_page* new_pages = new struct tcp_page[new_size];
+		if ( !new_pages )
+			return false;
+		for ( size_t i = 0; i < outgoing_pages_used; i++ )
+			new_pages[i] = *OutgoingPage(i);
+		delete[] outgoing_pages;
+		outgoing_pages = new_pages;
+		outgoing_pages_size = new_size;
+		outgoing_pages_offset = 0;
+	}
+	// Map the page so it can be checksummed and copied into the packets for
+	// the network interfaces that can't gather it.
+	struct tcp_page page;
+	page.position = position;
+	page.ring = ring;
+	page.phys = phys;
+	page.offset = offset;
+	page.length = length;
+	if ( !AllocateKernelAddress(&page.mapping, Page::Size()) )
+		return false;
+	if ( !Page::Share(phys) )
+		return FreeKernelAddress(&page.mapping), false;
+	if ( !Memory::Map(phys, page.mapping.from, PROT_KREAD) )
+	{
+		Page::Release(phys, PAGE_USAGE_USER_SPACE);
+		FreeKernelAddress(&page.mapping);
+		return false;
+	}
+	outgoing_pages_used++;
+	*OutgoingPage(outgoing_pages_used - 1) = page;
+	outgoing_paged += length;
+	return true;
+}
+
+// Release the first pages in the outgoing data, unmapping them all before
+// flushing the address translation caches once.
+void TCPSocket::ReleaseOutgoingPages(size_t count) // tcp_lock locked
+{
+	if ( !count )
+		return;
+	for ( size_t i = 0; i < count; i++ )
+		Memory::Unmap(OutgoingPage(i)->mapping.from);
+	Memory::Flush();
+	for ( size_t i = 0; i < count; i++ )
+	{
+		struct tcp_page* page = OutgoingPage(i);
+		FreeKernelAddress(&page->mapping);
+		Page::Release(page->phys, PAGE_USAGE_USER_SPACE);
+	}
+	outgoing_pages_offset += count;
+	if ( outgoing_pages_size <= outgoing_pages_offset )
+		outgoing_pages_offset -= outgoing_pages_size;
+	outgoing_pages_used -= count;
+}
+
+// Remove acknowledged data from the start of the outgoing data.
+void TCPSocket::RemoveOutgoing(size_t amount) // tcp_lock locked
+{
+	assert(amount <= OutgoingQueued());
+	uint64_t end = outgoing_position + amount;
+	uint64_t ring;
+	size_t length;
+	LocateOutgoing(end, &ring, &length);
+	size_t ring_amount = ring - outgoing_ring_position;
+	assert(ring_amount <= outgoing_used);
+	assert(outgoing_offset < outgoing_size || !ring_amount);
+	outgoing_offset += ring_amount;
+	if ( outgoing_size <= outgoing_offset )
+		outgoing_offset -= outgoing_size;
+	outgoing_used -= ring_amount;
+	outgoing_ring_position = ring;
+	size_t count = 0;
+	while ( count < outgoing_pages_used &&
+	        OutgoingPage(count)->position + OutgoingPage(count)->length <= end )
+		count++;
+	ReleaseOutgoingPages(count);
+	if ( outgoing_pages_used && OutgoingPage(0)->position < end )
+	{
+		struct tcp_page* page = OutgoingPage(0);
+		size_t partial = end - page->position;
+		page->position += partial;
+		page->offset += partial;
+		page->length -= partial;
+	}
+	outgoing_paged -= amount - ring_amount;
+	outgoing_position = end;
+}
+
+// Add the outgoing data at the position after send_una to the packet, either
+// by copying it into the packet buffer, or by referencing the pages if the
+// network interface can gather them. The sum of the referenced data is added
+// to *sum. The data in the packet buffer must come before the referenced data,
+// so less than the requested amount is added if the data can't be combined.
+size_t TCPSocket::PacketizeOutgoing(Ref<Packet> pkt,
+                                    size_t position,
+                                    size_t amount,
+                                    bool gather,
+                                    uint16_t* sum) // tcp_lock locked
+{
+	size_t sofar = 0;
+	while ( sofar < amount )
+	{
+		uint64_t at = outgoing_position + position + sofar;
+		uint64_t ring;
+		size_t length;
+		struct tcp_page* page = LocateOutgoing(at, &ring, &length);
+		if ( amount - sofar < length )
+			length = amount - sofar;
+		const unsigned char* data;
+		if ( page )
+		{
+			size_t page_offset = page->offset + (size_t) (at - page->position);
+			data = (const unsigned char*) page->mapping.from + page_offset;
+			size_t segment_offset = pkt->DataLength();
+			if ( gather && (pkt->fragments_used || FRAGMENT_MIN <= length) &&
+			     pkt->AddFragment(page->phys, page_offset, length) )
+			{
+				*sum = IP::ipsum_buf_at(*sum, data, length, segment_offset);
+				sofar += length;
+				continue;
+			}
+		}
+		else
+		{
+			size_t ring_offset = outgoing_offset +
+			                     (size_t) (ring - outgoing_ring_position);
+			if ( outgoing_size <= ring_offset )
+				ring_offset -= outgoing_size;
+			assert(ring_offset < outgoing_size);
+			size_t until_end = outgoing_size - ring_offset;
+			if ( until_end < length )
+				length = until_end;
+			data = outgoing + ring_offset;
+		}
+		if ( pkt->fragments_used )
+			break;
+		assert(length <= pkt->pmap.size - pkt->length);
+		memcpy(pkt->from + pkt->length, data, length);
+		pkt->length += length;
+		sofar += length;
+	}
+	return sofar;
+}
+
 int TCPSocket::connect(ioctx_t* ctx, const uint8_t* addr, size_t addrsize)
 {
 	ScopedLock lock(&tcp_lock);
@@ -1754,11 +2994,13 @@ int TCPSocket::connect(ioctx_t* ctx, const uint8_t* addr, size_t addrsize)
 	memcpy(&remote, &new_remote, sizeof(new_remote));
 	remoted = true;
 	iss = arc4random();
-	recv_wnd = TCP_MAXWIN;
+	InitializeOptions();
 	send_una = iss;
 	send_nxt = iss;
 	send_wnd = 1;
 	send_pos = iss;
+	send_max = iss;
+	recover = iss;
 	outgoing_syn = TCP_SPECIAL_PENDING;
 	state = TCP_STATE_SYN_SENT;
 	TransmitLoop();
@@ -1911,10 +3153,10 @@ ssize_t TCPSocket::recv_unlocked(ioctx_t* ctx,
 			return sofar;
 		uint8_t* data = buf + sofar;
 		size_t left = count - sofar;
-		assert(incoming_used <= sizeof(incoming));
+		assert(incoming_used <= incoming_size);
 		size_t amount = incoming_used < left ? incoming_used : left;
-		assert(incoming_offset < sizeof(incoming));
-		size_t until_end = sizeof(incoming) - incoming_offset;
+		assert(incoming_offset < incoming_size);
+		size_t until_end = incoming_size - incoming_offset;
 		size_t first = until_end < amount ? until_end : amount;
 		size_t second = amount - first;
 		if ( !ctx->copy_to_dest(data, incoming + incoming_offset, first) )
@@ -1925,15 +3167,12 @@ ssize_t TCPSocket::recv_unlocked(ioctx_t* ctx,
 		if ( flags & MSG_PEEK )
 			return sofar;
 		incoming_offset += amount;
-		if ( sizeof(incoming) <= incoming_offset )
-			incoming_offset -= sizeof(incoming);
-		assert(incoming_offset < sizeof(incoming));
+		if ( incoming_size <= incoming_offset )
+			incoming_offset -= incoming_size;
+		assert(incoming_offset < incoming_size);
 		incoming_used -= amount;
-		recv_wnd = sizeof(incoming) - incoming_used;
-		if ( UINT16_MAX < recv_wnd )
-			recv_wnd = UINT16_MAX;
-		if ( TCP_MAXWIN < recv_wnd )
-			recv_wnd = TCP_MAXWIN;
+		AutotuneReceive(amount);
+		UpdateReceiveWindow();
 	}
 	return sofar;
 }
@@ -2005,10 +3244,17 @@ ssize_t TCPSocket::send_unlocked(ioctx_t* ctx,
 	     state == TCP_STATE_SYN_SENT ||
 	     state == TCP_STATE_SYN_RECV )
 		return errno = ENOTCONN, -1;
+	// Allocate the outgoing ring buffer when data is first sent.
+	if ( !outgoing &&
+	     !ResizeRing(&outgoing, &outgoing_size, &outgoing_offset,
+	                 outgoing_used, outgoing_size) )
+		return -1;
 	size_t sofar = 0;
 	while ( sofar < count )
 	{
-		while ( outgoing_used == sizeof(outgoing) ||
+		if ( outgoing_size <= OutgoingQueued() )
+			AutotuneTransmit();
+		while ( outgoing_size <= OutgoingQueued() ||
 		        (state != TCP_STATE_ESTAB && state != TCP_STATE_CLOSE_WAIT) )
 		{
 			if ( sofar )
@@ -2028,15 +3274,15 @@ ssize_t TCPSocket::send_unlocked(ioctx_t* ctx,
 		}
 		const uint8_t* data = buf + sofar;
 		size_t left = count - sofar;
-		assert(outgoing_offset < sizeof(outgoing));
-		assert(outgoing_used <= sizeof(outgoing));
-		size_t available = sizeof(outgoing) - outgoing_used;
+		assert(outgoing_offset < outgoing_size);
+		assert(OutgoingQueued() <= outgoing_size);
+		size_t available = outgoing_size - OutgoingQueued();
 		size_t amount = available < left ? available : left;
 		size_t newat = outgoing_offset + outgoing_used;
-		if ( sizeof(outgoing) <= newat )
-			newat -= sizeof(outgoing);
-		assert(newat < sizeof(outgoing));
-		size_t until_end = sizeof(outgoing) - newat;
+		if ( outgoing_size <= newat )
+			newat -= outgoing_size;
+		assert(newat < outgoing_size);
+		size_t until_end = outgoing_size - newat;
 		size_t first = until_end < amount ? until_end : amount;
 		size_t second = amount - first;
 		if ( !ctx->copy_from_src(outgoing + newat, data, first) )
@@ -2044,7 +3290,7 @@ ssize_t TCPSocket::send_unlocked(ioctx_t* ctx,
 		if ( second && !ctx->copy_from_src(outgoing, data + first, second) )
 			return sofar ? sofar : -1;
 		outgoing_used += amount;
-		assert(outgoing_used <= sizeof(outgoing));
+		assert(outgoing_used <= outgoing_size);
 		sofar += amount;
 		// TODO: If there's a sent packet that hasn't been acknowledged, and
 		//       there isn't a full packet yet, then just buffer and don't
@@ -2055,6 +3301,49 @@ ssize_t TCPSocket::send_unlocked(ioctx_t* ctx,
 	return sofar;
 }
 
+ssize_t TCPSocket::send_page_unlocked(ioctx_t* ctx,
+                                      addr_t phys,
+                                      size_t offset,
+                                      size_t length) // tcp_lock taken
+{
+	if ( sockerr )
+		return errno = sockerr, -1;
+	if ( state == TCP_STATE_CLOSED ||
+	     state == TCP_STATE_LISTEN ||
+	     state == TCP_STATE_SYN_SENT ||
+	     state == TCP_STATE_SYN_RECV )
+		return errno = ENOTCONN, -1;
+	// Allocate the outgoing ring buffer when data is first sent, as its size is
+	// the limit on the outgoing data.
+	if ( !outgoing &&
+	     !ResizeRing(&outgoing, &outgoing_size, &outgoing_offset,
+	                 outgoing_used, outgoing_size) )
+		return -1;
+	if ( outgoing_size <= OutgoingQueued() )
+		AutotuneTransmit();
+	while ( outgoing_size <= OutgoingQueued() ||
+	        outgoing_pages_used == OUTGOING_PAGES_MAX ||
+	        (state != TCP_STATE_ESTAB && state != TCP_STATE_CLOSE_WAIT) )
+	{
+		if ( sockerr )
+			return errno = sockerr, -1;
+		if ( ctx->dflags & O_NONBLOCK )
+			return errno = EWOULDBLOCK, -1;
+		if ( !kthread_cond_wait_signal(&transmit_cond, &tcp_lock) )
+			return errno = EINTR, -1;
+	}
+	if ( state != TCP_STATE_ESTAB && state != TCP_STATE_CLOSE_WAIT )
+	{
+		CurrentThread()->DeliverSignal(SIGPIPE);
+		return errno = EPIPE, -1;
+	}
+	size_t available = outgoing_size - OutgoingQueued();
+	size_t amount = available < length ? available : length;
+	if ( !AddOutgoingPage(phys, offset, amount) )
+		return -1;
+	return amount;
+}
+
 ssize_t TCPSocket::read(ioctx_t* ctx, uint8_t* buf, size_t count)
 {
 	return recv(ctx, buf, count, 0);
@@ -2065,6 +3354,56 @@ ssize_t TCPSocket::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
 	return send(ctx, buf, count, 0);
 }
 
+// Send the file by referencing its pages in the outgoing data, rather than
+// copying them, which lets network interfaces gather them into the packets.
+ssize_t TCPSocket::sendfile(ioctx_t* ctx,
+                            Ref<Inode> file,
+                            off_t offset,
+                            size_t count)
+{
+	ioctx_t kctx; SetupKernelIOCtx(&kctx);
+	struct stat st;
+	if ( file->stat(&kctx, &st) < 0 )
+		return -1;
+	if ( offset < 0 )
+		return errno = EINVAL, -1;
+	if ( st.st_size <= offset )
+		return 0;
+	if ( (uintmax_t) (st.st_size - offset) < count )
+		count = st.st_size - offset;
+	if ( SSIZE_MAX < count )
+		count = SSIZE_MAX;
+	size_t sofar = 0;
+	while ( sofar < count )
+	{
+		off_t position = offset + (off_t) sofar;
+		size_t page_offset = (size_t) (position % Page::Size());
+		off_t page_position = position - (off_t) page_offset;
+		size_t length = Page::Size() - page_offset;
+		if ( count - sofar < length )
+			length = count - sofar;
+		addr_t phys = file->mmap_page(&kctx, page_position);
+		if ( !phys )
+		{
+			// Let the caller copy the file if its pages can't be shared.
+			if ( errno == ENODEV && !sofar )
+				return errno = ENOTSUP, -1;
+			if ( errno == ENXIO )
+				break;
+			return sofar ? (ssize_t) sofar : -1;
+		}
+		kthread_mutex_lock(&tcp_lock);
+		ssize_t amount = send_page_unlocked(ctx, phys, page_offset, length);
+		TransmitLoop();
+		kthread_mutex_unlock(&tcp_lock);
+		Page::Release(phys, PAGE_USAGE_USER_SPACE);
+		if ( amount < 0 )
+			return sofar ? (ssize_t) sofar : -1;
+		sofar += amount;
+	}
+	return sofar;
+}
+
 short TCPSocket::PollEventStatus()
 {
 	// TODO: os-test the poll bits.
@@ -2075,7 +3414,7 @@ short TCPSocket::PollEventStatus()
 	if ( incoming_used || has_fin || shutdown_receive )
 		status |= POLLIN | POLLRDNORM;
 	if ( (state == TCP_STATE_ESTAB || state == TCP_STATE_CLOSE_WAIT) &&
-	     outgoing_used < sizeof(outgoing) )
+	     OutgoingQueued() < outgoing_size )
 		status |= POLLOUT | POLLWRNORM;
 	if ( state == TCP_STATE_CLOSE_WAIT ||
 	     state == TCP_STATE_LAST_ACK ||
@@ -2124,6 +3463,45 @@ int TCPSocket::getsockopt(ioctx_t* ctx, int level, int option_name,
 		return 0;
 	}
 
+	if ( level == IPPROTO_TCP && option_name == TCP_INFO )
+	{
+		struct tcp_info info;
+		memset(&info, 0, sizeof(info));
+		if ( has_syn && ts_ok )
+			info.tcpi_options |= TCPI_OPT_TIMESTAMPS;
+		if ( has_syn && sack_ok )
+			info.tcpi_options |= TCPI_OPT_SACK;
+		if ( has_syn && wscale_ok )
+			info.tcpi_options |= TCPI_OPT_WSCALE;
+		info.tcpi_snd_wscale = send_wscale;
+		info.tcpi_rcv_wscale = recv_wscale;
+		info.tcpi_rto = rto;
+		info.tcpi_rtt = srtt;
+		info.tcpi_rttvar = rttvar;
+		info.tcpi_snd_mss = send_mss;
+		info.tcpi_snd_cwnd = cwnd;
+		info.tcpi_snd_ssthresh = ssthresh;
+		info.tcpi_snd_wnd = send_wnd;
+		info.tcpi_rcv_wnd = recv_wnd;
+		info.tcpi_bytes_acked = stat_bytes_acked;
+		info.tcpi_bytes_received = stat_bytes_received;
+		info.tcpi_segs_out = stat_segs_out;
+		info.tcpi_segs_in = stat_segs_in;
+		info.tcpi_total_retrans = stat_total_retrans;
+		info.tcpi_timeouts = stat_timeouts;
+		info.tcpi_fast_retrans = stat_fast_retrans;
+		info.tcpi_dupacks = stat_dupacks;
+		size_t option_size;
+		if ( !CopyFromUser(&option_size, option_size_ptr, sizeof(option_size)) )
+			return -1;
+		if ( sizeof(info) < option_size )
+			option_size = sizeof(info);
+		if ( !CopyToUser(option_value, &info, option_size) ||
+			 !CopyToUser(option_size_ptr, &option_size, sizeof(option_size)) )
+			return -1;
+		return 0;
+	}
+
 	uintmax_t result = 0;
 
 	if ( level == IPPROTO_TCP )
@@ -2131,7 +3509,12 @@ int TCPSocket::getsockopt(ioctx_t* ctx, int level, int option_name,
 		switch ( option_name )
 		{
 		// TODO: TCP_NODELAY
-		// TODO: TCP_MAXSEG
+		case TCP_MAXSEG:
+			if ( has_syn )
+				result = send_mss;
+			else
+				result = mss_clamp ? mss_clamp : TCP_MSS;
+			break;
 		// TODO: TCP_NOPUSH
 		// TODO: TCP_CORK
 		default: return errno = ENOPROTOOPT, -1;
@@ -2146,9 +3529,9 @@ int TCPSocket::getsockopt(ioctx_t* ctx, int level, int option_name,
 		case SO_DOMAIN: result = af; break;
 		case SO_ERROR: result = sockerr; break;
 		case SO_PROTOCOL: result = IPPROTO_TCP; break;
-		case SO_RCVBUF: result = sizeof(incoming); break;
+		case SO_RCVBUF: result = incoming_size; break;
 		case SO_REUSEADDR: result = reuseaddr; break;
-		case SO_SNDBUF: result = sizeof(outgoing); break;
+		case SO_SNDBUF: result = outgoing_size; break;
 		case SO_TYPE: result = SOCK_STREAM; break;
 		// TODO: SO_ACCEPTCONN
 		// TODO: SO_LINGER
@@ -2211,7 +3594,13 @@ int TCPSocket::setsockopt(ioctx_t* ctx, int level, int option_name,
 		switch ( option_name )
 		{
 		case TCP_NODELAY: break; // TODO: Transmit if turned on?
-		case TCP_MAXSEG: break; // TODO: Implement this.
+		case TCP_MAXSEG:
+			if ( value && (value < MSS_MIN || UINT16_MAX < value) )
+				return errno = EINVAL, -1;
+			mss_clamp = value;
+			if ( has_syn && mss_clamp && mss_clamp < send_mss )
+				send_mss = mss_clamp;
+			break;
 		case TCP_NOPUSH: break; // TODO: Implement this.
 		// TODO: TCP_CORK
 		default:
@@ -2234,8 +3623,46 @@ int TCPSocket::setsockopt(ioctx_t* ctx, int level, int option_name,
 		case SO_KEEPALIVE: break; // TODO: Implement this.
 		case SO_REUSEADDR: reuseaddr = value; break;
 		case SO_LINGER: break; // TODO: Implement this.
-		case SO_RCVBUF: break; // TODO: Implement this.
-		case SO_SNDBUF: break; // TODO: Implement this.
+		case SO_RCVBUF:
+		{
+			size_t size = ClampBufferSize(value);
+			size_t extent = IncomingExtent();
+			if ( size < extent )
+				size = extent;
+			if ( incoming )
+			{
+				if ( !ResizeRing(&incoming, &incoming_size, &incoming_offset,
+				                 extent, size) )
+					return -1;
+			}
+			else
+				incoming_size = size;
+			incoming_autotune = false;
+			if ( has_syn )
+			{
+				UpdateReceiveWindow();
+				ScheduleTransmit();
+			}
+			break;
+		}
+		case SO_SNDBUF:
+		{
+			size_t size = ClampBufferSize(value);
+			if ( size < OutgoingQueued() )
+				size = OutgoingQueued();
+			if ( outgoing )
+			{
+				if ( !ResizeRing(&outgoing, &outgoing_size, &outgoing_offset,
+				                 outgoing_used, size) )
+					return -1;
+			}
+			else
+				outgoing_size = size;
+			outgoing_autotune = false;
+			kthread_cond_broadcast(&transmit_cond);
+			poll_channel.Signal(PollEventStatus());
+			break;
+		}
 		// TODO: SO_BROADCAST
 		// TODO: SO_DONTROUTE
 		// TODO: SO_LINGER
@@ -2344,6 +3771,19 @@ int TCPSocket::getsockname(ioctx_t* ctx, uint8_t* addr, size_t* addrsize_ptr)
 	return 0;
 }
 
+static struct slab_cache tcp_socket_node_cache =
+	SLAB_CACHE_INITIALIZER("tcp socket node", TCPSocketNode);
+
+void* TCPSocketNode::operator new(size_t size)
+{
+	return SlabAllocate(&tcp_socket_node_cache, size);
+}
+
+void TCPSocketNode::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&tcp_socket_node_cache, ptr, size);
+}
+
 // TODO: os-test fstat on a socket.
 TCPSocketNode::TCPSocketNode(TCPSocket* socket)
 {
@@ -2419,6 +3859,14 @@ ssize_t TCPSocketNode::write(ioctx_t* ctx, const uint8_t* buf, size_t count)
 	return socket->write(ctx, buf, count);
 }
 
+ssize_t TCPSocketNode::sendfile(ioctx_t* ctx,
+                                Ref<Inode> file,
+                                off_t offset,
+                                size_t count)
+{
+	return socket->sendfile(ctx, file, offset, count);
+}
+
 int TCPSocketNode::poll(ioctx_t* ctx, PollNode* node)
 {
 	return socket->poll(ctx, node);
@@ -2487,7 +3935,6 @@ void HandleIP(Ref<Packet> pkt,
 	// Port 0 is not valid.
 	if ( hdr.th_sport == 0 || hdr.th_dport == 0 )
 		return;
-	// TODO: TCP options. Respect TCPOPT_MAXSEG.
 	TCPSocket* socket = NULL;
 	TCPSocket* socket_listener = NULL;
 	TCPSocket* any_socket_listener = NULL;
@@ -45,6 +45,7 @@
 #include <sortix/kernel/packet.h>
 #include <sortix/kernel/poll.h>
 #include <sortix/kernel/process.h>
+#include <sortix/kernel/slab.h>
 #include <sortix/kernel/sockopt.h>
 #include <sortix/kernel/thread.h>
 
@@ -108,6 +109,8 @@ class UDPSocket : public AbstractInode
 public:
 	UDPSocket(int af);
 	virtual ~UDPSocket();
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 	virtual Ref<Inode> accept4(ioctx_t* ctx, uint8_t* addr, size_t* addrsize,
 	                           int flags);
 	virtual int bind(ioctx_t* ctx, const uint8_t* addr, size_t addrsize);
@@ -167,6 +170,19 @@ private:
 
 };
 
+static struct slab_cache udp_socket_cache =
+	SLAB_CACHE_INITIALIZER("udp socket", UDPSocket);
+
+void* UDPSocket::operator new(size_t size)
+{
+	return SlabAllocate(&udp_socket_cache, size);
+}
+
+void UDPSocket::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&udp_socket_cache, ptr, size);
+}
+
 // TODO: os-test fstat on a socket.
 UDPSocket::UDPSocket(int af)
 {
@@ -0,0 +1,633 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * pagecache.cpp
+ * Cache of file pages for memory mapping files.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sortix/kernel/fcache.h>
+#include <sortix/kernel/ioctx.h>
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/kthread.h>
+#include <sortix/kernel/memorymanagement.h>
+#include <sortix/kernel/pagecache.h>
+
+namespace Sortix {
+namespace PageCache {
+
+// Files without their own backing pages are memory mapped through this cache,
+// which reads each page from the file the first time it is accessed. The pages
+// are shared with every mapping of the file (see Page::Share) and stay in the
+// cache after the mappings go away until they are evicted in least recently
+// used order. The pages of a file are dropped when it is written or truncated,
+// or when the file is found to have changed when it is mapped again, and the
+// mappings then keep their old pages (see BlockCache::ReleaseBlock). Shared
+// mappings write to the cached pages directly and the changes reach the file
+// when they are written back with msync or unmapped.
+//
+// Filesystems whose files only change through the kernel also read through the
+// cache. Each page remembers how much of it was inside the file when it was
+// read, so a short page marks the end of the file, and the short pages are
+// dropped along with the written range when the file is written or truncated
+// as the end of the file may have moved.
+
+struct page_cache_file
+{
+	struct page_cache_file* hash_next;
+	struct page_cache_page* first_page;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtim;
+	struct timespec ctim;
+	off_t size;
+};
+
+struct page_cache_page
+{
+	struct page_cache_page* hash_next;
+	struct page_cache_page* file_prev;
+	struct page_cache_page* file_next;
+	struct page_cache_page* lru_prev;
+	struct page_cache_page* lru_next;
+	struct page_cache_file* file;
+	BlockCacheBlock* block;
+	off_t offset;
+	size_t length;
+	size_t pins;
+	bool filling;
+	bool stale;
+};
+
+static const size_t FILE_BUCKETS = 256;
+static const size_t PAGE_BUCKETS = 4096;
+static const size_t FILL_PAGES_MAX = 16;
+
+static kthread_mutex_t pcache_lock = KTHREAD_MUTEX_INITIALIZER;
+static kthread_cond_t pcache_cond = KTHREAD_COND_INITIALIZER;
+static BlockCache* pcache_blocks = NULL;
+static struct page_cache_file* files[FILE_BUCKETS];
+static struct page_cache_page* pages[PAGE_BUCKETS];
+static struct page_cache_page* mru_page = NULL;
+static struct page_cache_page* lru_page = NULL;
+static size_t pages_used = 0;
+static size_t pages_limit = 0;
+
+void Init()
+{
+	if ( !(pcache_blocks = new BlockCache()) )
+		Panic("Unable to allocate page cache");
+	// Leave most of the memory for everything else.
+	size_t total;
+	Memory::Statistics(NULL, &total, NULL);
+	pages_limit = total / Page::Size() / 4;
+}
+
+static size_t HashFile(dev_t dev, ino_t ino)
+{
+	uintmax_t hash = (uintmax_t) dev * 31 + (uintmax_t) ino;
+	return (size_t) (hash ^ (hash >> 8)) % FILE_BUCKETS;
+}
+
+static size_t HashPage(struct page_cache_file* file, off_t offset)
+{
+	uintmax_t hash = (uintptr_t) file / sizeof(*file) +
+	                 (uintmax_t) offset / Page::Size();
+	return (size_t) ((hash * 2654435761U) >> 8) % PAGE_BUCKETS;
+}
+
+static struct page_cache_file* FindFile(dev_t dev, ino_t ino)
+{
+	// pcache_lock is held.
+	struct page_cache_file* file = files[HashFile(dev, ino)];
+	while ( file && !(file->dev == dev && file->ino == ino) )
+		file = file->hash_next;
+	return file;
+}
+
+static struct page_cache_file* CreateFile(dev_t dev, ino_t ino)
+{
+	// pcache_lock is held.
+	struct page_cache_file* file = new struct page_cache_file;
+	if ( !file )
+		return NULL;
+	memset(file, 0, sizeof(*file));
+	file->dev = dev;
+	file->ino = ino;
+	size_t bucket = HashFile(dev, ino);
+	file->hash_next = files[bucket];
+	files[bucket] = file;
+	return file;
+}
+
+static void DeleteFileIfUnused(struct page_cache_file* file)
+{
+	// pcache_lock is held.
+	if ( file->first_page )
+		return;
+	struct page_cache_file** link = &files[HashFile(file->dev, file->ino)];
+	while ( *link != file )
+		link = &(*link)->hash_next;
+	*link = file->hash_next;
+	delete file;
+}
+
+static struct page_cache_page* FindPage(struct page_cache_file* file,
+                                        off_t offset)
+{
+	// pcache_lock is held.
+	struct page_cache_page* page = pages[HashPage(file, offset)];
+	while ( page && !(page->file == file && page->offset == offset) )
+		page = page->hash_next;
+	return page;
+}
+
+static void LinkPage(struct page_cache_page* page)
+{
+	// pcache_lock is held.
+	page->lru_prev = NULL;
+	page->lru_next = mru_page;
+	if ( mru_page )
+		mru_page->lru_prev = page;
+	mru_page = page;
+	if ( !lru_page )
+		lru_page = page;
+}
+
+static void UnlinkPage(struct page_cache_page* page)
+{
+	// pcache_lock is held.
+	(page->lru_prev ? page->lru_prev->lru_next : mru_page) = page->lru_next;
+	(page->lru_next ? page->lru_next->lru_prev : lru_page) = page->lru_prev;
+	page->lru_prev = page->lru_next = NULL;
+}
+
+static void RemovePage(struct page_cache_page* page)
+{
+	// pcache_lock is held.
+	struct page_cache_page** link = &pages[HashPage(page->file, page->offset)];
+	while ( *link != page )
+		link = &(*link)->hash_next;
+	*link = page->hash_next;
+	if ( page->file_prev )
+		page->file_prev->file_next = page->file_next;
+	else
+		page->file->first_page = page->file_next;
+	if ( page->file_next )
+		page->file_next->file_prev = page->file_prev;
+	if ( !page->pins )
+		UnlinkPage(page);
+	pcache_blocks->ReleaseBlock(page->block);
+	pages_used--;
+	delete page;
+}
+
+static void DropPages(struct page_cache_file* file, off_t from, off_t to)
+{
+	// pcache_lock is held.
+	struct page_cache_page* page = file->first_page;
+	while ( page )
+	{
+		struct page_cache_page* next = page->file_next;
+		if ( (from < page->offset + (off_t) Page::Size() && page->offset < to) ||
+		     page->filling || page->length < Page::Size() )
+		{
+			// Pages in use are dropped once they are no longer used.
+			if ( page->pins )
+				page->stale = true;
+			else
+				RemovePage(page);
+		}
+		page = next;
+	}
+}
+
+static bool EvictPage()
+{
+	// pcache_lock is held.
+	if ( !lru_page )
+		return false;
+	struct page_cache_file* file = lru_page->file;
+	RemovePage(lru_page);
+	DeleteFileIfUnused(file);
+	return true;
+}
+
+static addr_t SharePage(struct page_cache_page* page)
+{
+	// pcache_lock is held.
+	addr_t phys;
+	uint8_t* data = pcache_blocks->BlockData(page->block);
+	if ( !Memory::LookUp((addr_t) data, &phys, NULL) )
+		return errno = EFAULT, 0;
+	if ( !Page::Share(phys) )
+		return 0;
+	return phys;
+}
+
+static bool IsSameTime(const struct timespec* a, const struct timespec* b)
+{
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void ValidateFile(dev_t dev, ino_t ino, const struct stat* st)
+{
+	// pcache_lock is held.
+	// Drop the cached pages if the file changed since they were read.
+	struct page_cache_file* file = FindFile(dev, ino);
+	if ( file && st && !(IsSameTime(&file->mtim, &st->st_mtim) &&
+	                     IsSameTime(&file->ctim, &st->st_ctim) &&
+	                     file->size == st->st_size) )
+	{
+		DropPages(file, 0, OFF_MAX);
+		file->mtim = st->st_mtim;
+		file->ctim = st->st_ctim;
+		file->size = st->st_size;
+	}
+}
+
+static void PinPage(struct page_cache_page* page)
+{
+	// pcache_lock is held.
+	if ( !page->pins++ )
+		UnlinkPage(page);
+}
+
+static void UnpinPage(struct page_cache_page* page)
+{
+	// pcache_lock is held.
+	if ( page->pins == 1 && page->stale )
+	{
+		struct page_cache_file* file = page->file;
+		RemovePage(page);
+		DeleteFileIfUnused(file);
+	}
+	else if ( !--page->pins )
+		LinkPage(page);
+}
+
+static struct page_cache_page* CreatePage(dev_t dev, ino_t ino, off_t offset,
+                                          const struct stat* st)
+{
+	// pcache_lock is held. The page is returned pinned and being filled.
+	// Make room for the page before finding its file, as the eviction may
+	// delete the file if its last page is evicted.
+	if ( pages_limit <= pages_used )
+		EvictPage();
+	BlockCacheBlock* block = pcache_blocks->AcquireBlock();
+	if ( !block && EvictPage() )
+		block = pcache_blocks->AcquireBlock();
+	struct page_cache_file* file = FindFile(dev, ino);
+	if ( !block )
+	{
+		if ( file )
+			DeleteFileIfUnused(file);
+		return errno = ENOMEM, (struct page_cache_page*) NULL;
+	}
+	if ( !file )
+	{
+		if ( !(file = CreateFile(dev, ino)) )
+		{
+			pcache_blocks->ReleaseBlock(block);
+			return NULL;
+		}
+		if ( st )
+		{
+			file->mtim = st->st_mtim;
+			file->ctim = st->st_ctim;
+			file->size = st->st_size;
+		}
+	}
+	struct page_cache_page* page = new struct page_cache_page;
+	if ( !page )
+	{
+		pcache_blocks->ReleaseBlock(block);
+		DeleteFileIfUnused(file);
+		return NULL;
+	}
+	memset(page, 0, sizeof(*page));
+	page->file = file;
+	page->block = block;
+	page->offset = offset;
+	page->pins = 1;
+	page->filling = true;
+	size_t bucket = HashPage(file, offset);
+	page->hash_next = pages[bucket];
+	pages[bucket] = page;
+	page->file_next = file->first_page;
+	if ( file->first_page )
+		file->first_page->file_prev = page;
+	file->first_page = page;
+	pages_used++;
+	return page;
+}
+
+static ssize_t ReadFully(ReadFunction read_function, void* user, uint8_t* buf,
+                         size_t count, off_t offset)
+{
+	ioctx_t ctx; SetupKernelIOCtx(&ctx);
+	size_t so_far = 0;
+	while ( so_far < count )
+	{
+		ssize_t amount = read_function(user, &ctx, buf + so_far,
+		                               count - so_far,
+		                               offset + (off_t) so_far);
+		if ( amount < 0 )
+			return -1;
+		if ( amount == 0 )
+			break;
+		so_far += amount;
+	}
+	return (ssize_t) so_far;
+}
+
+static bool FillPages(struct page_cache_page** run, size_t count,
+                      ReadFunction read_function, void* user)
+{
+	// pcache_lock is not held, the pages are pinned and being filled.
+	// Consecutive pages are read from the file at once through a buffer.
+	size_t size = count * Page::Size();
+	uint8_t* buffer = 1 < count ? new uint8_t[size] : NULL;
+	if ( buffer )
+	{
+		ssize_t amount = ReadFully(read_function, user, buffer, size,
+		                           run[0]->offset);
+		for ( size_t i = 0; 0 <= amount && i < count; i++ )
+		{
+			size_t begin = i * Page::Size();
+			size_t length = begin < (size_t) amount ? amount - begin : 0;
+			if ( Page::Size() < length )
+				length = Page::Size();
+			uint8_t* data = pcache_blocks->BlockData(run[i]->block);
+			memcpy(data, buffer + begin, length);
+			// The part of the page after the end of the file is zero.
+			memset(data + length, 0, Page::Size() - length);
+			run[i]->length = length;
+		}
+		delete[] buffer;
+		return 0 <= amount;
+	}
+	bool end_of_file = false;
+	for ( size_t i = 0; i < count; i++ )
+	{
+		uint8_t* data = pcache_blocks->BlockData(run[i]->block);
+		ssize_t amount = 0;
+		if ( !end_of_file )
+			amount = ReadFully(read_function, user, data, Page::Size(),
+			                   run[i]->offset);
+		if ( amount < 0 )
+			return false;
+		memset(data + amount, 0, Page::Size() - amount);
+		run[i]->length = amount;
+		end_of_file = (size_t) amount < Page::Size();
+	}
+	return true;
+}
+
+static void FinishFill(struct page_cache_page** run, size_t count, bool success)
+{
+	// pcache_lock is held.
+	for ( size_t i = 0; i < count; i++ )
+	{
+		run[i]->filling = false;
+		if ( !success )
+			run[i]->stale = true;
+	}
+	kthread_cond_broadcast(&pcache_cond);
+}
+
+addr_t GetPage(dev_t dev, ino_t ino, off_t offset, const struct stat* st,
+               ReadFunction read_function, void* user)
+{
+	assert(0 <= offset && !(offset & (Page::Size() - 1)));
+	ScopedLock lock(&pcache_lock);
+
+	ValidateFile(dev, ino, st);
+
+	// Share the cached page if it has already been read.
+	struct page_cache_file* file;
+	struct page_cache_page* page;
+	while ( (file = FindFile(dev, ino)) && (page = FindPage(file, offset)) )
+	{
+		if ( page->filling )
+		{
+			kthread_cond_wait(&pcache_cond, &pcache_lock);
+			continue;
+		}
+		if ( !page->pins )
+		{
+			UnlinkPage(page);
+			LinkPage(page);
+		}
+		return SharePage(page);
+	}
+
+	if ( !(page = CreatePage(dev, ino, offset, st)) )
+		return 0;
+
+	// Read the page without holding the lock, the concurrent users of the page
+	// wait for the read to finish.
+	kthread_mutex_unlock(&pcache_lock);
+	bool success = FillPages(&page, 1, read_function, user);
+	int errnum = errno;
+	kthread_mutex_lock(&pcache_lock);
+	FinishFill(&page, 1, success);
+
+	// The page is dropped from the cache if it was written in the meanwhile,
+	// but the mapping still gets the page that was read.
+	addr_t result = success ? SharePage(page) : 0;
+	if ( !result )
+		page->stale = true;
+	UnpinPage(page);
+	if ( !success )
+		errno = errnum;
+	return result;
+}
+
+ssize_t Read(dev_t dev, ino_t ino, ioctx_t* ctx, uint8_t* buf, size_t count,
+             off_t offset, const struct stat* st, ReadFunction read_function,
+             void* user)
+{
+	if ( offset < 0 )
+		return errno = EINVAL, -1;
+	if ( SSIZE_MAX < count )
+		count = SSIZE_MAX;
+	if ( OFF_MAX - offset < (off_t) count )
+		count = OFF_MAX - offset;
+	ScopedLock lock(&pcache_lock);
+
+	ValidateFile(dev, ino, st);
+
+	size_t so_far = 0;
+	bool done = false;
+	bool failed = false;
+	while ( !done && so_far < count )
+	{
+		off_t position = offset + (off_t) so_far;
+		off_t page_offset = position & ~((off_t) Page::Size() - 1);
+		struct page_cache_file* file = FindFile(dev, ino);
+		struct page_cache_page* page = file ? FindPage(file, page_offset) : NULL;
+		if ( page && page->filling )
+		{
+			kthread_cond_wait(&pcache_cond, &pcache_lock);
+			continue;
+		}
+
+		struct page_cache_page* run[FILL_PAGES_MAX];
+		size_t run_length = 0;
+		if ( page )
+		{
+			PinPage(page);
+			run[run_length++] = page;
+		}
+		else
+		{
+			// Read the missing pages of the request at once.
+			off_t end = offset + (off_t) count;
+			while ( run_length < FILL_PAGES_MAX &&
+			        page_offset + (off_t) (run_length * Page::Size()) < end )
+			{
+				off_t run_offset = page_offset +
+				                   (off_t) (run_length * Page::Size());
+				if ( run_length && FindPage(run[0]->file, run_offset) )
+					break;
+				if ( !(page = CreatePage(dev, ino, run_offset, st)) )
+					break;
+				run[run_length++] = page;
+			}
+			// Read directly from the file if the cache is out of memory.
+			if ( !run_length )
+			{
+				kthread_mutex_unlock(&pcache_lock);
+				ssize_t amount = read_function(user, ctx, buf + so_far,
+				                               count - so_far, position);
+				kthread_mutex_lock(&pcache_lock);
+				if ( amount < 0 )
+					return so_far ? (ssize_t) so_far : -1;
+				return (ssize_t) (so_far + amount);
+			}
+			kthread_mutex_unlock(&pcache_lock);
+			bool success = FillPages(run, run_length, read_function, user);
+			int errnum = errno;
+			kthread_mutex_lock(&pcache_lock);
+			FinishFill(run, run_length, success);
+			if ( !success )
+			{
+				for ( size_t i = 0; i < run_length; i++ )
+					UnpinPage(run[i]);
+				if ( so_far )
+					return (ssize_t) so_far;
+				return errno = errnum, -1;
+			}
+		}
+
+		// Copy from the pinned pages without holding the lock, as the copy may
+		// fault in pages of files mapped from this cache.
+		for ( size_t i = 0; i < run_length; i++ )
+		{
+			page = run[i];
+			position = offset + (off_t) so_far;
+			size_t page_position = (size_t) (position - page->offset);
+			if ( !done && so_far < count && page_position < page->length )
+			{
+				size_t amount = page->length - page_position;
+				if ( count - so_far < amount )
+					amount = count - so_far;
+				const uint8_t* data = pcache_blocks->BlockData(page->block);
+				kthread_mutex_unlock(&pcache_lock);
+				bool copied = ctx->copy_to_dest(buf + so_far,
+				                                data + page_position, amount);
+				kthread_mutex_lock(&pcache_lock);
+				if ( !copied )
+					failed = done = true;
+				else
+					so_far += amount;
+			}
+			// A short page is at the end of the file.
+			if ( page->length < Page::Size() )
+				done = true;
+			UnpinPage(page);
+		}
+	}
+	if ( failed && !so_far )
+		return -1;
+	return (ssize_t) so_far;
+}
+
+// The page was written back from a shared mapping, so the file has changed
+// but the cached page is still current if it is the page that was written.
+void UpdatePage(dev_t dev, ino_t ino, off_t offset, addr_t page,
+                const struct stat* st)
+{
+	ScopedLock lock(&pcache_lock);
+	struct page_cache_file* file = FindFile(dev, ino);
+	if ( !file )
+		return;
+	struct page_cache_page* cached = FindPage(file, offset);
+	addr_t phys;
+	uint8_t* data = cached ? pcache_blocks->BlockData(cached->block) : NULL;
+	if ( cached && cached->pins )
+		cached->stale = true;
+	else if ( cached && !(Memory::LookUp((addr_t) data, &phys, NULL) &&
+	                      phys == page) )
+		RemovePage(cached);
+	file->mtim = st->st_mtim;
+	file->ctim = st->st_ctim;
+	file->size = st->st_size;
+	DeleteFileIfUnused(file);
+}
+
+void Invalidate(dev_t dev, ino_t ino, off_t offset, off_t length)
+{
+	ScopedLock lock(&pcache_lock);
+	struct page_cache_file* file = FindFile(dev, ino);
+	if ( !file )
+		return;
+	off_t end;
+	if ( __builtin_add_overflow(offset, length, &end) )
+		end = OFF_MAX;
+	DropPages(file, offset, end);
+	DeleteFileIfUnused(file);
+}
+
+void InvalidateDevice(dev_t dev)
+{
+	ScopedLock lock(&pcache_lock);
+	for ( size_t i = 0; i < FILE_BUCKETS; i++ )
+	{
+		struct page_cache_file* file = files[i];
+		while ( file )
+		{
+			struct page_cache_file* next = file->hash_next;
+			if ( file->dev == dev )
+			{
+				DropPages(file, 0, OFF_MAX);
+				DeleteFileIfUnused(file);
+			}
+			file = next;
+		}
+	}
+}
+
+} // namespace PageCache
+} // namespace Sortix
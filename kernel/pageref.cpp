@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * pageref.cpp
+ * Reference counts for physical pages shared between address spaces.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/kthread.h>
+#include <sortix/kernel/memorymanagement.h>
+
+namespace Sortix {
+namespace Page {
+
+// Physical pages have an implicit reference count of one. Only the pages that
+// are currently shared are tracked, in an open addressing hash table keyed by
+// the physical address, as most pages are never shared. The lock is never held
+// while calling into the heap or the page allocator, so it's safe to use from
+// any code that may itself hold those locks.
+
+struct page_reference
+{
+	addr_t page;
+	size_t count;
+};
+
+static kthread_mutex_t reference_lock = KTHREAD_MUTEX_INITIALIZER;
+static struct page_reference* references = NULL;
+static size_t references_length = 0;
+static size_t references_used = 0;
+
+static size_t HashPage(addr_t page)
+{
+	uint32_t frame = (uint32_t) (page >> 12);
+	uint32_t hash = frame * 2654435761U;
+	return (size_t) (hash ^ (hash >> 16)) & (references_length - 1);
+}
+
+static size_t FindReference(addr_t page)
+{
+	// reference_lock is held.
+	assert(references_length);
+	size_t mask = references_length - 1;
+	size_t i = HashPage(page);
+	while ( references[i].page && references[i].page != page )
+		i = (i + 1) & mask;
+	return i;
+}
+
+static void RemoveReference(size_t i)
+{
+	// reference_lock is held.
+	size_t mask = references_length - 1;
+	size_t j = i;
+	while ( true )
+	{
+		references[i].page = 0;
+		references[i].count = 0;
+		size_t home;
+		do
+		{
+			j = (j + 1) & mask;
+			if ( !references[j].page )
+				return;
+			home = HashPage(references[j].page);
+		} while ( i <= j ? i < home && home <= j : i < home || home <= j );
+		references[i] = references[j];
+		i = j;
+	}
+}
+
+bool Share(addr_t page)
+{
+	assert(page && IsAligned(page));
+	kthread_mutex_lock(&reference_lock);
+	while ( references_length <= (references_used + 1) * 2 )
+	{
+		// Grow the table without holding the lock, as the heap may need to
+		// release pages while expanding.
+		size_t old_length = references_length;
+		size_t new_length = old_length ? 2 * old_length : 256;
+		kthread_mutex_unlock(&reference_lock);
+		size_t new_size = sizeof(struct page_reference) * new_length;
+		struct page_reference* new_references =
+			(struct page_reference*) malloc(new_size);
+		if ( !new_references )
+			return false;
+		memset(new_references, 0, new_size);
+		kthread_mutex_lock(&reference_lock);
+		if ( references_length != old_length )
+		{
+			free(new_references);
+			continue;
+		}
+		struct page_reference* old_references = references;
+		references = new_references;
+		references_length = new_length;
+		for ( size_t i = 0; i < old_length; i++ )
+		{
+			if ( !old_references[i].page )
+				continue;
+			references[FindReference(old_references[i].page)] =
+				old_references[i];
+		}
+		kthread_mutex_unlock(&reference_lock);
+		free(old_references);
+		kthread_mutex_lock(&reference_lock);
+	}
+	size_t i = FindReference(page);
+	if ( references[i].page )
+		references[i].count++;
+	else
+	{
+		references[i].page = page;
+		references[i].count = 2;
+		references_used++;
+	}
+	kthread_mutex_unlock(&reference_lock);
+	return true;
+}
+
+bool IsShared(addr_t page)
+{
+	ScopedLock lock(&reference_lock);
+	return references_length && references[FindReference(page)].page;
+}
+
+void Release(addr_t page, enum page_usage usage)
+{
+	kthread_mutex_lock(&reference_lock);
+	if ( references_length )
+	{
+		size_t i = FindReference(page);
+		if ( references[i].page )
+		{
+			if ( --references[i].count == 1 )
+			{
+				RemoveReference(i);
+				references_used--;
+			}
+			kthread_mutex_unlock(&reference_lock);
+			return;
+		}
+	}
+	kthread_mutex_unlock(&reference_lock);
+	Put(page, usage);
+}
+
+} // namespace Page
+} // namespace Sortix
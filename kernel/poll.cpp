@@ -40,6 +40,7 @@
 #include <sortix/kernel/poll.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/signal.h>
+#include <sortix/kernel/slab.h>
 #include <sortix/kernel/syscall.h>
 #include <sortix/kernel/thread.h>
 #include <sortix/kernel/time.h>
@@ -62,6 +63,15 @@ PollChannel::~PollChannel()
 	ScopedLock lock(&channel_lock);
 	// TODO: Is this the correct error to signal with?
 	SignalUnlocked(POLLHUP);
+	// Persistent registrations don't cancel themselves when woken, so detach
+	// them now. Their owners see they are no longer registered.
+	for ( PollNode* node = first; node; )
+	{
+		PollNode* next = node->next;
+		if ( node->master->wake_callback )
+			UnregisterUnlocked(node);
+		node = next;
+	}
 	// Note: We can't stop early in case of a signal, because that would mean
 	// other threads are still using our data, and since this is the destructor,
 	// leaving early _will_ cause data corruption. Luckily, this loop will
@@ -83,14 +93,20 @@ void PollChannel::SignalUnlocked(short events)
 	for ( PollNode* node = first; node; node = node->next )
 	{
 		PollNode* target = node->master;
-		if ( target->revents |= events & (target->events | POLL__ONLY_REVENTS) )
+		short revents = events & (target->events | POLL__ONLY_REVENTS);
+		if ( !revents )
+			continue;
+		if ( target->wake_callback )
+		{
+			target->wake_callback(target->wake_context);
+			continue;
+		}
+		target->revents |= revents;
+		ScopedLock target_lock(target->wake_mutex);
+		if ( !*target->woken )
 		{
-			ScopedLock target_lock(target->wake_mutex);
-			if ( !*target->woken )
-			{
-				*target->woken = true;
-				kthread_cond_signal(target->wake_cond);
-			}
+			*target->woken = true;
+			kthread_cond_signal(target->wake_cond);
 		}
 	}
 }
@@ -113,6 +129,11 @@ void PollChannel::Register(PollNode* node)
 void PollChannel::Unregister(PollNode* node)
 {
 	ScopedLock lock(&channel_lock);
+	UnregisterUnlocked(node);
+}
+
+void PollChannel::UnregisterUnlocked(PollNode* node)
+{
 	node->channel = NULL;
 	if ( node->prev )
 		node->prev->next = node->next;
@@ -126,6 +147,19 @@ void PollChannel::Unregister(PollNode* node)
 		kthread_cond_signal(&no_pending_cond);
 }
 
+static struct slab_cache poll_node_cache =
+	SLAB_CACHE_INITIALIZER("poll node", PollNode);
+
+void* PollNode::operator new(size_t size)
+{
+	return SlabAllocate(&poll_node_cache, size);
+}
+
+void PollNode::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&poll_node_cache, ptr, size);
+}
+
 void PollNode::Cancel()
 {
 	if ( channel )
@@ -144,6 +178,8 @@ PollNode* PollNode::CreateSlave()
 	new_slave->events = events;
 	new_slave->revents = revents;
 	new_slave->woken = woken;
+	new_slave->wake_callback = wake_callback;
+	new_slave->wake_context = wake_context;
 	new_slave->master = master;
 	new_slave->slave = slave;
 	return slave = new_slave;
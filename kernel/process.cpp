@@ -46,6 +46,7 @@
 #include <sortix/kernel/descriptor.h>
 #include <sortix/kernel/dtable.h>
 #include <sortix/kernel/elf.h>
+#include <sortix/kernel/inode.h>
 #include <sortix/kernel/ioctx.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/kthread.h>
@@ -55,11 +56,13 @@
 #include <sortix/kernel/ptable.h>
 #include <sortix/kernel/refcount.h>
 #include <sortix/kernel/scheduler.h>
+#include <sortix/kernel/segment.h>
 #include <sortix/kernel/sortedlist.h>
 #include <sortix/kernel/string.h>
 #include <sortix/kernel/syscall.h>
 #include <sortix/kernel/thread.h>
 #include <sortix/kernel/time.h>
+#include <sortix/kernel/vnode.h>
 #include <sortix/kernel/worker.h>
 
 #if defined(__i386__) || defined(__x86_64__)
@@ -417,7 +420,11 @@ void Process::ResetAddressSpace()
 	assert(Memory::GetAddressSpace() == addrspace);
 
 	for ( size_t i = 0; i < segments_used; i++ )
+	{
+		Memory::SyncMemory(this, segments[i].addr, segments[i].size);
 		Memory::UnmapRange(segments[i].addr, segments[i].size, PAGE_USAGE_USER_SPACE);
+		ReleaseSegmentBacking(&segments[i]);
+	}
 
 	Memory::Flush();
 
@@ -674,22 +681,30 @@ Process* Process::Fork()
 
 	struct segment* clone_segments = NULL;
 
+	// The address space must not change while it is being forked.
+	kthread_mutex_lock(&segment_write_lock);
+	kthread_mutex_lock(&segment_lock);
+
 	// Fork the segment list.
 	if ( segments )
 	{
 		size_t segments_size = sizeof(struct segment) * segments_used;
 		if ( !(clone_segments = (struct segment*) malloc(segments_size)) )
 		{
+			kthread_mutex_unlock(&segment_lock);
+			kthread_mutex_unlock(&segment_write_lock);
 			delete clone;
 			return NULL;
 		}
 		memcpy(clone_segments, segments, segments_size);
 	}
 
-	// Fork address-space here and copy memory.
+	// Fork address-space here and share the memory copy-on-write.
 	clone->addrspace = Memory::Fork();
 	if ( !clone->addrspace )
 	{
+		kthread_mutex_unlock(&segment_lock);
+		kthread_mutex_unlock(&segment_write_lock);
 		free(clone_segments);
 		delete clone;
 		return NULL;
@@ -700,6 +715,12 @@ Process* Process::Fork()
 	clone->segments = clone_segments;
 	clone->segments_used = segments_used;
 	clone->segments_length = segments_used;
+	for ( size_t i = 0; i < segments_used; i++ )
+		if ( clone_segments[i].inode )
+			clone_segments[i].inode->Refer_Renamed();
+
+	kthread_mutex_unlock(&segment_lock);
+	kthread_mutex_unlock(&segment_write_lock);
 
 	kthread_mutex_lock(&process_family_lock);
 
@@ -831,7 +852,8 @@ bool Process::MapSegment(struct segment* result, void* hint, size_t size,
 
 	if ( !PlaceSegment(result, this, hint, size, flags) )
 		return false;
-	if ( !Memory::MapMemory(this, result->addr, result->size, result->prot = prot) )
+	if ( !Memory::MapMemory(this, result->addr, result->size, result->prot = prot,
+	                        MAP_PRIVATE) )
 	{
 		// The caller is expected to self-destruct in this case, so the
 		// segment just created is not removed.
@@ -842,9 +864,9 @@ bool Process::MapSegment(struct segment* result, void* hint, size_t size,
 }
 
 int Process::Execute(const char* programname, const uint8_t* program,
-                     size_t programsize, int argc, const char* const* argv,
-                     int envc, const char* const* envp,
-                     struct thread_registers* regs)
+                     size_t programsize, size_t filesize, Inode* inode,
+                     int argc, const char* const* argv, int envc,
+                     const char* const* envp, struct thread_registers* regs)
 {
 	assert(argc != INT_MAX);
 	assert(envc != INT_MAX);
@@ -859,7 +881,7 @@ int Process::Execute(const char* programname, const uint8_t* program,
 
 	ELF::Auxiliary aux;
 
-	addr_t entry = ELF::Load(program, programsize, &aux);
+	addr_t entry = ELF::Load(program, programsize, filesize, inode, &aux);
 	if ( !entry ) { delete[] programname_clone; return -1; }
 
 	delete[] program_image_path;
@@ -976,7 +998,17 @@ int Process::Execute(const char* programname, const uint8_t* program,
 	}
 	target_envp[envc] = (char*) NULL;
 
-	const uint8_t* file_raw_tls = program + aux.tls_file_offset;
+	// The initialization image is copied from the loaded program, which may
+	// need to be paged in first.
+	const uint8_t* file_raw_tls = (const uint8_t*) aux.tls_vaddr;
+	if ( aux.tls_file_size &&
+	     !Memory::PrepareUserRead(this, aux.tls_vaddr, aux.tls_file_size) )
+	{
+		kthread_mutex_unlock(&segment_lock);
+		kthread_mutex_unlock(&segment_write_lock);
+		ResetForExecute();
+		return errno = EINVAL, -1;
+	}
 
 	uint8_t* target_raw_tls = (uint8_t*) raw_tls_segment.addr;
 	memcpy(target_raw_tls, file_raw_tls, aux.tls_file_size);
@@ -1208,33 +1240,55 @@ int sys_execve_kernel(const char* filename,
 
 	size_t filesize = (size_t) st.st_size;
 
-	addralloc_t buffer_alloc;
-	if ( !sys_execve_alloc(&buffer_alloc, filesize) )
-		return -1;
+	// Only read the headers if the program can be paged in on demand from the
+	// file, and otherwise read the whole program.
+	Ref<Inode> inode;
+	if ( S_ISREG(st.st_mode) && desc->vnode->inode->mmap_page_supported() )
+		inode = desc->vnode->inode;
 
-	uint8_t* buffer = (uint8_t*) buffer_alloc.from;
-	for ( size_t sofar = 0; sofar < filesize; )
+	addralloc_t buffer_alloc;
+	uint8_t* buffer;
+	size_t buffersize = inode && Page::Size() < filesize ? Page::Size() :
+	                    filesize;
+	while ( true )
 	{
-		ssize_t amount = desc->read(&ctx, buffer + sofar, filesize - sofar);
-		if ( amount < 0 )
-			return sys_execve_free(&buffer_alloc), -1;
-		if ( amount == 0 )
-			return sys_execve_free(&buffer_alloc), errno = EEOF, -1;
-		sofar += amount;
+		if ( !sys_execve_alloc(&buffer_alloc, buffersize) )
+			return -1;
+		buffer = (uint8_t*) buffer_alloc.from;
+		for ( size_t sofar = 0; sofar < buffersize; )
+		{
+			ssize_t amount = desc->pread(&ctx, buffer + sofar,
+			                             buffersize - sofar, sofar);
+			if ( amount < 0 )
+				return sys_execve_free(&buffer_alloc), -1;
+			if ( amount == 0 )
+				return sys_execve_free(&buffer_alloc), errno = EEOF, -1;
+			sofar += amount;
+		}
+		if ( !inode )
+			break;
+		size_t needed = ELF::HeaderSize(buffer, buffersize, filesize);
+		if ( needed <= buffersize )
+			break;
+		sys_execve_free(&buffer_alloc);
+		buffersize = needed;
 	}
 
 	desc.Reset();
 
-	int result = process->Execute(filename, buffer, filesize, argc, argv, envc, envp, regs);
+	int result = process->Execute(filename, buffer, buffersize, filesize,
+	                              inode.Get(), argc, argv, envc, envp, regs);
+
+	inode.Reset();
 
 	if ( result == 0 || errno != ENOEXEC ||
-	     filesize < 2 || buffer[0] != '#' || buffer[1] != '!' )
+	     buffersize < 2 || buffer[0] != '#' || buffer[1] != '!' )
 		return sys_execve_free(&buffer_alloc), result;
 
 	size_t line_length = 0;
-	while ( 2 + line_length < filesize && buffer[2 + line_length] != '\n' )
+	while ( 2 + line_length < buffersize && buffer[2 + line_length] != '\n' )
 		line_length++;
-	if ( line_length == filesize )
+	if ( line_length == buffersize )
 		return sys_execve_free(&buffer_alloc), errno = ENOEXEC, -1;
 
 	char* line = new char[line_length+1];
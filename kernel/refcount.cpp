@@ -45,6 +45,17 @@ void Refcountable::Refer_Renamed()
 	refcount++;
 }
 
+// Take a reference unless the object is already being destroyed, for pointers
+// that the destructor clears under a lock held by the caller.
+bool Refcountable::TryRefer_Renamed()
+{
+	ScopedLock lock(&reflock);
+	if ( !refcount )
+		return false;
+	refcount++;
+	return true;
+}
+
 void Refcountable::Unref_Renamed()
 {
 	assert(!being_deleted);
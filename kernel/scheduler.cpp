@@ -30,6 +30,7 @@
 #include <sortix/clock.h>
 #include <sortix/timespec.h>
 
+#include <sortix/kernel/cpu.h>
 #include <sortix/kernel/decl.h>
 #include <sortix/kernel/interrupt.h>
 #include <sortix/kernel/kernel.h>
@@ -38,6 +39,7 @@
 #include <sortix/kernel/registers.h>
 #include <sortix/kernel/scheduler.h>
 #include <sortix/kernel/signal.h>
+#include <sortix/kernel/smp.h>
 #include <sortix/kernel/syscall.h>
 #include <sortix/kernel/thread.h>
 #include <sortix/kernel/time.h>
@@ -50,7 +52,151 @@
 namespace Sortix {
 namespace Scheduler {
 
-static Thread* current_thread;
+// Every processor has its own ring of runnable threads, which includes the
+// thread it's currently running, unless it's the idle thread. The runnable
+// threads other than the current thread are also kept in a heap ordered by
+// their virtual runtime, so the next thread is found in constant time. The
+// rings and heaps are protected by the kernel lock along with interrupts being
+// disabled.
+struct cpu_scheduler
+{
+	Thread* current_thread;
+	Thread* idle_thread;
+	Thread* first_runnable_thread;
+	Thread* runnable_heap;
+	Thread* true_current_thread;
+	Thread* next_thread;
+	size_t runnable_count;
+	int64_t min_vruntime;
+	bool preempt;
+};
+
+static struct cpu_scheduler cpus[CPU::MAX_CPUS];
+static Process* init_process;
+
+// Threads are charged for the processor time they use in virtual runtime, which
+// is scaled by the weight of their nice value, and the runnable thread with the
+// least virtual runtime runs next. Each step of niceness is about a 10%
+// difference in the processor share. The virtual runtimes of threads in a ring
+// are absolute, while threads that are not runnable keep their virtual runtime
+// relative to the minimum of the ring, so they can be woken on any processor.
+static const int64_t nice_weights[40] =
+{
+	/* -20 */ 88761, 71755, 56483, 46273, 36291,
+	/* -15 */ 29154, 23254, 18705, 14949, 11916,
+	/* -10 */ 9548, 7620, 6100, 4904, 3906,
+	/*  -5 */ 3121, 2501, 1991, 1586, 1277,
+	/*   0 */ 1024, 820, 655, 526, 423,
+	/*   5 */ 335, 272, 215, 172, 137,
+	/*  10 */ 110, 87, 70, 56, 45,
+	/*  15 */ 36, 29, 23, 18, 15,
+};
+
+static const int64_t NICE_0_WEIGHT = 1024;
+
+// Threads that wake up after sleeping, such as on I/O, are credited up to this
+// much virtual runtime, so they run soon without banking unbounded credit.
+static const int64_t SLEEPER_CREDIT_NS = 10000000;
+
+// Woken threads preempt the running thread if they are this much behind in
+// virtual runtime.
+static const int64_t WAKEUP_GRANULARITY_NS = 2000000;
+
+static inline struct cpu_scheduler* LocalScheduler()
+{
+	return &cpus[CPU::GetId()];
+}
+
+// The heap is a pairing heap threaded through the threads themselves, like the
+// clock timers. A thread's scheduler_heap_child is its first child,
+// scheduler_heap_next is its next sibling, and scheduler_heap_prev is its
+// previous sibling, or its parent if it's the first child. The running thread
+// is charged for its runtime outside of the heap, and enters the heap again
+// when it's switched away from.
+static Thread* MeldThreads(Thread* a, Thread* b)
+{
+	if ( !a )
+		return b;
+	if ( !b )
+		return a;
+	if ( b->scheduler_vruntime < a->scheduler_vruntime )
+	{
+		Thread* tmp = a;
+		a = b;
+		b = tmp;
+	}
+	b->scheduler_heap_prev = a;
+	b->scheduler_heap_next = a->scheduler_heap_child;
+	if ( a->scheduler_heap_child )
+		a->scheduler_heap_child->scheduler_heap_prev = b;
+	a->scheduler_heap_child = b;
+	return a;
+}
+
+// Combine the children of a removed thread into a single heap, by melding them
+// in pairs from the left and then melding the pairs from the right.
+static Thread* MeldChildThreads(Thread* thread)
+{
+	Thread* list = thread->scheduler_heap_child;
+	thread->scheduler_heap_child = NULL;
+	Thread* pairs = NULL;
+	while ( list )
+	{
+		Thread* a = list;
+		Thread* b = a->scheduler_heap_next;
+		list = b ? b->scheduler_heap_next : NULL;
+		a->scheduler_heap_prev = a->scheduler_heap_next = NULL;
+		if ( b )
+			b->scheduler_heap_prev = b->scheduler_heap_next = NULL;
+		Thread* pair = MeldThreads(a, b);
+		pair->scheduler_heap_next = pairs;
+		pairs = pair;
+	}
+	Thread* result = NULL;
+	while ( pairs )
+	{
+		Thread* pair = pairs;
+		pairs = pair->scheduler_heap_next;
+		pair->scheduler_heap_next = NULL;
+		result = MeldThreads(result, pair);
+	}
+	return result;
+}
+
+static bool IsThreadInHeap(struct cpu_scheduler* sched, Thread* thread)
+{
+	return thread->scheduler_heap_prev || sched->runnable_heap == thread;
+}
+
+static void InsertHeapThread(struct cpu_scheduler* sched, Thread* thread)
+{
+	assert(!IsThreadInHeap(sched, thread));
+	thread->scheduler_heap_prev = NULL;
+	thread->scheduler_heap_next = NULL;
+	thread->scheduler_heap_child = NULL;
+	sched->runnable_heap = MeldThreads(sched->runnable_heap, thread);
+}
+
+static void RemoveHeapThread(struct cpu_scheduler* sched, Thread* thread)
+{
+	assert(IsThreadInHeap(sched, thread));
+	if ( thread == sched->runnable_heap )
+	{
+		sched->runnable_heap = MeldChildThreads(thread);
+		return;
+	}
+	Thread* prev = thread->scheduler_heap_prev;
+	if ( prev->scheduler_heap_child == thread )
+		prev->scheduler_heap_child = thread->scheduler_heap_next;
+	else
+		prev->scheduler_heap_next = thread->scheduler_heap_next;
+	if ( thread->scheduler_heap_next )
+		thread->scheduler_heap_next->scheduler_heap_prev = prev;
+	thread->scheduler_heap_prev = NULL;
+	thread->scheduler_heap_next = NULL;
+	sched->runnable_heap = MeldThreads(sched->runnable_heap,
+	                                   MeldChildThreads(thread));
+}
 
 void SaveInterruptedContext(const struct interrupt_context* intctx,
                             struct thread_registers* registers)
@@ -181,6 +327,7 @@ extern "C" void fake_interrupt(void);
 static void FakeInterruptedContext(struct interrupt_context* intctx, int int_no)
 {
 #if defined(__i386__)
+	Thread* current_thread = LocalScheduler()->current_thread;
 	uintptr_t stack = current_thread->kernelstackpos +
 	                  current_thread->kernelstacksize;
 	stack -= sizeof(struct interrupt_context);
@@ -209,6 +356,7 @@ static void FakeInterruptedContext(struct interrupt_context* intctx, int int_no)
 	intctx->esp = stack;
 	intctx->ss = KDS | KRPL;
 #elif defined(__x86_64__)
+	Thread* current_thread = LocalScheduler()->current_thread;
 	uintptr_t stack = current_thread->kernelstackpos +
 	                  current_thread->kernelstacksize;
 	stack -= sizeof(struct interrupt_context);
@@ -255,6 +403,9 @@ static void SwitchRegisters(struct interrupt_context* intctx,
 	if ( prev == next )
 		return;
 
+	Time::OnCPUSwitch(!InUserspace(intctx),
+	                  next == LocalScheduler()->idle_thread);
+
 	SaveInterruptedContext(intctx, &prev->registers);
 	if ( !prev->registers.cr3 )
 		Log::PrintF("Thread %p had cr3=0x%zx\n", prev, prev->registers.cr3);
@@ -262,20 +413,24 @@ static void SwitchRegisters(struct interrupt_context* intctx,
 		Log::PrintF("Thread %p has cr3=0x%zx\n", next, next->registers.cr3);
 	LoadInterruptedContext(intctx, &next->registers);
 
-	current_thread = next;
+	// The running thread is charged outside of the heap.
+	struct cpu_scheduler* sched = LocalScheduler();
+	size_t self = CPU::GetId();
+	if ( prev != sched->idle_thread &&
+	     prev->state == ThreadState::RUNNABLE &&
+	     prev->scheduler_cpu == self )
+		InsertHeapThread(sched, prev);
+	if ( next != sched->idle_thread )
+		RemoveHeapThread(sched, next);
+	sched->current_thread = next;
 }
 
-static Thread* idle_thread;
-static Thread* first_runnable_thread;
-static Thread* true_current_thread;
-static Process* init_process;
-
 static void SwitchThread(struct interrupt_context* intctx,
                          Thread* old_thread,
                          Thread* new_thread)
 {
 	assert(new_thread->state == ThreadState::RUNNABLE ||
-	       new_thread == idle_thread);
+	       new_thread == LocalScheduler()->idle_thread);
 	SwitchRegisters(intctx, old_thread, new_thread);
 	if ( intctx->signal_pending && InUserspace(intctx) )
 	{
@@ -297,73 +452,249 @@ static void SwitchThread(struct interrupt_context* intctx,
 	}
 }
 
-static Thread* FindRunnableThreadWithSystemTid(uintptr_t system_tid)
+static bool InterruptsWereEnabled(const struct interrupt_context* intctx)
+{
+#if defined(__i386__)
+	return intctx->eflags & FLAGS_INTERRUPT;
+#elif defined(__x86_64__)
+	return intctx->rflags & FLAGS_INTERRUPT;
+#endif
+}
+
+static int64_t ThreadWeight(Thread* thread)
+{
+	// The nice value is read without its lock as it's merely advisory here.
+	int nice = thread->process->nice;
+	if ( nice < -20 )
+		nice = -20;
+	if ( 19 < nice )
+		nice = 19;
+	return nice_weights[nice + 20];
+}
+
+static void AddRunnableThread(size_t cpu, Thread* thread)
+{
+	struct cpu_scheduler* sched = &cpus[cpu];
+	thread->scheduler_cpu = cpu;
+	thread->scheduler_vruntime += sched->min_vruntime;
+	if ( thread != sched->current_thread )
+		InsertHeapThread(sched, thread);
+	if ( !sched->first_runnable_thread )
+	{
+		sched->first_runnable_thread = thread;
+		thread->scheduler_list_prev = thread;
+		thread->scheduler_list_next = thread;
+	}
+	else
+	{
+		Thread* first = sched->first_runnable_thread;
+		thread->scheduler_list_prev = first->scheduler_list_prev;
+		thread->scheduler_list_next = first;
+		first->scheduler_list_prev = thread;
+		thread->scheduler_list_prev->scheduler_list_next = thread;
+	}
+	sched->runnable_count++;
+}
+
+static void RemoveRunnableThread(Thread* thread)
 {
-	Thread* begun_thread = first_runnable_thread;
-	if ( !begun_thread )
+	struct cpu_scheduler* sched = &cpus[thread->scheduler_cpu];
+	if ( IsThreadInHeap(sched, thread) )
+		RemoveHeapThread(sched, thread);
+	thread->scheduler_vruntime -= sched->min_vruntime;
+	if ( thread == sched->next_thread )
+		sched->next_thread = NULL;
+	if ( thread == sched->first_runnable_thread )
+		sched->first_runnable_thread = thread->scheduler_list_next;
+	if ( thread == sched->first_runnable_thread )
+		sched->first_runnable_thread = NULL;
+	assert(thread->scheduler_list_prev);
+	assert(thread->scheduler_list_next);
+	thread->scheduler_list_prev->scheduler_list_next = thread->scheduler_list_next;
+	thread->scheduler_list_next->scheduler_list_prev = thread->scheduler_list_prev;
+	thread->scheduler_list_prev = NULL;
+	thread->scheduler_list_next = NULL;
+	sched->runnable_count--;
+}
+
+static void MigrateThread(Thread* thread, size_t cpu)
+{
+	assert(cpus[thread->scheduler_cpu].current_thread != thread);
+	RemoveRunnableThread(thread);
+	AddRunnableThread(cpu, thread);
+}
+
+// Threads are woken on the processor they last ran on, unless another
+// processor has nothing to do.
+static size_t PickProcessor(Thread* thread)
+{
+	size_t count = CPU::GetCount();
+	size_t last = thread->scheduler_cpu < count ? thread->scheduler_cpu : 0;
+	if ( !cpus[last].runnable_count )
+		return last;
+	for ( size_t cpu = 0; cpu < count; cpu++ )
+		if ( !cpus[cpu].runnable_count )
+			return cpu;
+	return last;
+}
+
+// Take a thread from the busiest processor if this processor has nothing to
+// run, or if it's balancing and the busiest processor has two more threads.
+static Thread* StealThread(size_t self, bool balance)
+{
+	size_t count = CPU::GetCount();
+	size_t own_count = cpus[self].runnable_count;
+	if ( own_count && !balance )
 		return NULL;
-	Thread* iter = begun_thread;
+	size_t busiest = self;
+	for ( size_t cpu = 0; cpu < count; cpu++ )
+		if ( cpus[busiest].runnable_count < cpus[cpu].runnable_count )
+			busiest = cpu;
+	if ( busiest == self ||
+	     cpus[busiest].runnable_count < own_count + (own_count ? 2 : 1) )
+		return NULL;
+	Thread* victim_current = cpus[busiest].current_thread;
+	Thread* first = cpus[busiest].first_runnable_thread;
+	Thread* iter = first;
 	do
 	{
-		if ( iter->system_tid == system_tid )
+		if ( iter != victim_current )
+		{
+			MigrateThread(iter, self);
 			return iter;
+		}
 		iter = iter->scheduler_list_next;
-	} while ( iter != begun_thread );
+	} while ( iter != first );
 	return NULL;
 }
 
-static Thread* PopNextThread(bool yielded)
+static Thread* FindRunnableThreadWithSystemTid(size_t self,
+                                               uintptr_t system_tid)
 {
+	size_t count = CPU::GetCount();
+	for ( size_t i = 0; i < count; i++ )
+	{
+		// Search the local ring first.
+		size_t cpu = (self + i) % count;
+		Thread* begun_thread = cpus[cpu].first_runnable_thread;
+		if ( !begun_thread )
+			continue;
+		Thread* iter = begun_thread;
+		do
+		{
+			if ( iter->system_tid == system_tid )
+			{
+				if ( cpu == self )
+					return iter;
+				if ( cpus[cpu].current_thread == iter )
+					return NULL;
+				MigrateThread(iter, self);
+				return iter;
+			}
+			iter = iter->scheduler_list_next;
+		} while ( iter != begun_thread );
+	}
+	return NULL;
+}
+
+static Thread* PopNextThread(bool yielded, bool balance)
+{
+	size_t self = CPU::GetId();
+	struct cpu_scheduler* sched = &cpus[self];
 	Thread* result;
 
-	uintptr_t yield_to_tid = current_thread->yield_to_tid;
+	uintptr_t yield_to_tid = sched->current_thread->yield_to_tid;
 	if ( yielded && yield_to_tid != 0 )
 	{
-		if ( (result = FindRunnableThreadWithSystemTid(yield_to_tid)) )
+		if ( (result = FindRunnableThreadWithSystemTid(self, yield_to_tid)) )
 			return result;
 	}
 
-	if ( first_runnable_thread )
+	// The thread switched away from is resumed, unless a woken thread should
+	// preempt it.
+	if ( (result = sched->next_thread) )
 	{
-		result = first_runnable_thread;
-		first_runnable_thread = first_runnable_thread->scheduler_list_next;
-	}
-	else
-	{
-		result = idle_thread;
+		sched->next_thread = NULL;
+		if ( !sched->preempt )
+			return result;
 	}
 
+	if ( (result = StealThread(self, balance)) )
+		return result;
+
+	if ( !sched->first_runnable_thread )
+		return sched->idle_thread;
+
+	// Pick the thread with the least virtual runtime, which is either the top
+	// of the heap or the current thread, breaking ties in favor of the other
+	// threads, and avoiding the current thread if it yielded unless nothing
+	// else is runnable.
+	Thread* current = sched->current_thread;
+	Thread* least = sched->runnable_heap;
+	if ( current != sched->idle_thread &&
+	     current->state == ThreadState::RUNNABLE &&
+	     current->scheduler_cpu == self &&
+	     (!least || current->scheduler_vruntime < least->scheduler_vruntime) )
+		least = current;
+	result = sched->runnable_heap;
+	if ( !result || (least == current && !yielded) )
+		result = least;
+	if ( !result )
+		return sched->idle_thread;
+	if ( sched->min_vruntime < least->scheduler_vruntime )
+		sched->min_vruntime = least->scheduler_vruntime;
+
 	return result;
 }
 
 void SwitchTo(struct interrupt_context* intctx, Thread* new_thread)
 {
-	Thread* old_thread = CurrentThread();
+	size_t self = CPU::GetId();
+	struct cpu_scheduler* sched = &cpus[self];
+	Thread* old_thread = sched->current_thread;
 	if ( new_thread == old_thread )
 		return;
 	if ( new_thread->state != ThreadState::RUNNABLE )
 		return;
-	if ( old_thread != idle_thread )
-		first_runnable_thread = old_thread;
-	true_current_thread = new_thread;
+	if ( new_thread->scheduler_cpu != self )
+	{
+		if ( cpus[new_thread->scheduler_cpu].current_thread == new_thread )
+			return;
+		MigrateThread(new_thread, self);
+	}
+	if ( old_thread != sched->idle_thread &&
+	     old_thread->state == ThreadState::RUNNABLE )
+		sched->next_thread = old_thread;
+	sched->true_current_thread = new_thread;
 	SwitchThread(intctx, old_thread, new_thread);
 }
 
-static void RealSwitch(struct interrupt_context* intctx, bool yielded)
+static void RealSwitch(struct interrupt_context* intctx, bool yielded,
+                       bool balance = false)
 {
-	Thread* old_thread = CurrentThread();
-	Thread* new_thread = PopNextThread(yielded);
-	true_current_thread = new_thread;
+	struct cpu_scheduler* sched = LocalScheduler();
+	Thread* old_thread = sched->current_thread;
+	Thread* new_thread = PopNextThread(yielded, balance);
+	sched->true_current_thread = new_thread;
+	sched->preempt = false;
 	SwitchThread(intctx, old_thread, new_thread);
 }
 
 void Switch(struct interrupt_context* intctx)
 {
-	RealSwitch(intctx, false);
+	// Let any waiting processors into the kernel, as this processor might
+	// otherwise keep it while running kernel threads.
+	if ( InterruptsWereEnabled(intctx) )
+		SMP::YieldKernel();
+	RealSwitch(intctx, false, true);
 }
 
 void InterruptYieldCPU(struct interrupt_context* intctx, void* /*user*/)
 {
+	// Threads yielding in a loop may be waiting for another processor.
+	if ( InterruptsWereEnabled(intctx) )
+		SMP::YieldKernel();
+	Thread* current_thread = LocalScheduler()->current_thread;
 	bool wait = false;
 	switch ( current_thread->yield_operation )
 	{
@@ -390,21 +721,56 @@ void InterruptYieldCPU(struct interrupt_context* intctx, void* /*user*/)
 	}
 }
 
+void InterruptReschedule(struct interrupt_context* intctx, void* /*user*/)
+{
+	struct cpu_scheduler* sched = LocalScheduler();
+	if ( sched->current_thread == sched->idle_thread || sched->preempt )
+		RealSwitch(intctx, false);
+	else
+		SwitchThread(intctx, sched->current_thread, sched->current_thread);
+}
+
+// Switch to a thread woken by an interrupt handler on this processor if it
+// should preempt the current thread, or if this processor was idle.
+void InterruptPreempt(struct interrupt_context* intctx)
+{
+	struct cpu_scheduler* sched = LocalScheduler();
+	if ( !sched->preempt )
+		return;
+	if ( InterruptsWereEnabled(intctx) )
+		SMP::YieldKernel();
+	RealSwitch(intctx, false);
+}
+
 void ThreadExitCPU(struct interrupt_context* intctx, void* /*user*/)
 {
-	SetThreadState(current_thread, ThreadState::DEAD);
+	SetThreadState(LocalScheduler()->current_thread, ThreadState::DEAD);
 	RealSwitch(intctx, false);
 }
 
 // The idle thread serves no purpose except being an infinite loop that does
-// nothing, which is only run when the system has nothing to do.
-void SetIdleThread(Thread* thread)
+// nothing, which is only run when the processor has nothing to do.
+void SetIdleThread(Thread* thread, size_t cpu)
+{
+	struct cpu_scheduler* sched = &cpus[cpu];
+	assert(!sched->idle_thread || !thread);
+	sched->idle_thread = thread;
+	sched->current_thread = thread;
+	sched->true_current_thread = thread;
+	if ( thread )
+	{
+		thread->scheduler_cpu = cpu;
+		SetThreadState(thread, ThreadState::NONE);
+	}
+}
+
+void ChargeThread(Thread* thread, struct timespec runtime)
 {
-	assert(!idle_thread);
-	idle_thread = thread;
-	SetThreadState(thread, ThreadState::NONE);
-	current_thread = thread;
-	true_current_thread = thread;
+	if ( thread == LocalScheduler()->idle_thread )
+		return;
+	int64_t runtime_ns = runtime.tv_sec * 1000000000LL + runtime.tv_nsec;
+	thread->scheduler_vruntime += runtime_ns * NICE_0_WEIGHT /
+	                              ThreadWeight(thread);
 }
 
 void SetInitProcess(Process* init)
@@ -419,9 +785,9 @@ Process* GetInitProcess()
 
 Process* GetKernelProcess()
 {
-	if ( !idle_thread )
+	if ( !cpus[0].idle_thread )
 		return NULL;
-	return idle_thread->process;
+	return cpus[0].idle_thread->process;
 }
 
 void SetThreadState(Thread* thread, ThreadState state, bool wake_only)
@@ -432,32 +798,31 @@ void SetThreadState(Thread* thread, ThreadState state, bool wake_only)
 	if ( wake_only && thread->state != ThreadState::FUTEX_WAITING )
 		state = thread->state;
 
-	// Remove the thread from the list of runnable threads.
+	// Remove the thread from its processor's list of runnable threads.
 	if ( thread->state == ThreadState::RUNNABLE &&
 	     state != ThreadState::RUNNABLE )
-	{
-		if ( thread == first_runnable_thread )
-			first_runnable_thread = thread->scheduler_list_next;
-		if ( thread == first_runnable_thread )
-			first_runnable_thread = NULL;
-		assert(thread->scheduler_list_prev);
-		assert(thread->scheduler_list_next);
-		thread->scheduler_list_prev->scheduler_list_next = thread->scheduler_list_next;
-		thread->scheduler_list_next->scheduler_list_prev = thread->scheduler_list_prev;
-		thread->scheduler_list_prev = NULL;
-		thread->scheduler_list_next = NULL;
-	}
+		RemoveRunnableThread(thread);
 
-	// Insert the thread into the scheduler's carousel linked list.
+	// Insert the thread into a processor's carousel linked list and wake the
+	// processor if it's idle or if the thread should preempt it.
 	if ( thread->state != ThreadState::RUNNABLE &&
 	     state == ThreadState::RUNNABLE )
 	{
-		if ( first_runnable_thread == NULL )
-			first_runnable_thread = thread;
-		thread->scheduler_list_prev = first_runnable_thread->scheduler_list_prev;
-		thread->scheduler_list_next = first_runnable_thread;
-		first_runnable_thread->scheduler_list_prev = thread;
-		thread->scheduler_list_prev->scheduler_list_next = thread;
+		if ( thread->scheduler_vruntime < -SLEEPER_CREDIT_NS )
+			thread->scheduler_vruntime = -SLEEPER_CREDIT_NS;
+		size_t cpu = PickProcessor(thread);
+		AddRunnableThread(cpu, thread);
+		// This processor switches when it returns from the interrupt, while
+		// other processors are interrupted to switch.
+		Thread* running = cpus[cpu].current_thread;
+		if ( !cpus[cpu].preempt &&
+		     (running == cpus[cpu].idle_thread ||
+		      thread->scheduler_vruntime + WAKEUP_GRANULARITY_NS <
+		      running->scheduler_vruntime) )
+		{
+			cpus[cpu].preempt = true;
+			SMP::Reschedule(cpu);
+		}
 	}
 
 	thread->state = state;
@@ -470,6 +835,16 @@ void SetThreadState(Thread* thread, ThreadState state, bool wake_only)
 
 void SetSignalPending(Thread* thread, unsigned long is_pending)
 {
+	// A thread running on another processor picks up the new value when that
+	// processor enters the kernel, which it's asked to do right away.
+	size_t cpu = thread->scheduler_cpu;
+	if ( cpu != CPU::GetId() && cpus[cpu].current_thread == thread )
+	{
+		SMP::SetSignalPending(cpu, is_pending);
+		if ( is_pending )
+			SMP::Reschedule(cpu);
+		return;
+	}
 	thread->registers.signal_pending = is_pending;
 	if ( is_pending )
 		Scheduler::SetThreadState(thread, ThreadState::RUNNABLE, true);
@@ -498,10 +873,15 @@ namespace Scheduler {
 void ScheduleTrueThread()
 {
 	bool was_enabled = Interrupt::SetEnabled(false);
-	if ( true_current_thread != current_thread )
+	struct cpu_scheduler* sched = LocalScheduler();
+	Thread* true_thread = sched->true_current_thread;
+	// The true thread may have been migrated to another processor meanwhile.
+	if ( true_thread != sched->current_thread &&
+	     true_thread->state == ThreadState::RUNNABLE &&
+	     true_thread->scheduler_cpu == CPU::GetId() )
 	{
-		current_thread->yield_to_tid = 0;
-		first_runnable_thread = true_current_thread;
+		sched->current_thread->yield_to_tid = 0;
+		sched->next_thread = true_thread;
 		kthread_yield();
 	}
 	Interrupt::SetEnabled(was_enabled);
@@ -514,7 +894,11 @@ namespace Sortix {
 
 Thread* CurrentThread()
 {
-	return Scheduler::current_thread;
+	// Threads may migrate between processors if preempted.
+	bool was_enabled = Interrupt::SetEnabled(false);
+	Thread* thread = Scheduler::LocalScheduler()->current_thread;
+	Interrupt::SetEnabled(was_enabled);
+	return thread;
 }
 
 Process* CurrentProcess()
@@ -27,6 +27,7 @@
 #include <sortix/mman.h>
 
 #include <sortix/kernel/decl.h>
+#include <sortix/kernel/inode.h>
 #include <sortix/kernel/kernel.h>
 #include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/process.h>
@@ -97,6 +98,8 @@ bool AddSegment(Process* process, const struct segment* new_segment)
 
 	// Add the new segment to the segment list.
 	process->segments[process->segments_used++] = *new_segment;
+	if ( new_segment->inode )
+		new_segment->inode->Refer_Renamed();
 
 	// Sort the segment list after address.
 	qsort(process->segments, process->segments_used, sizeof(struct segment),
@@ -105,6 +108,16 @@ bool AddSegment(Process* process, const struct segment* new_segment)
 	return true;
 }
 
+void ReleaseSegmentBacking(struct segment* segment)
+{
+	// process->segment_lock is held at this point.
+
+	if ( segment->inode )
+		segment->inode->Unref_Renamed();
+	segment->inode = NULL;
+	segment->offset = 0;
+}
+
 class segment_gaps
 {
 	typedef yielder_iterator<segment_gaps, struct segment> my_iterator;
@@ -223,6 +236,9 @@ bool PlaceSegment(struct segment* solution, Process* process, void* addr_ptr,
 			solution->addr = addr;
 			solution->size = size;
 			solution->prot = 0;
+			solution->flags = 0;
+			solution->inode = NULL;
+			solution->offset = 0;
 			return true;
 		}
 		struct segment attempt;
@@ -230,12 +246,18 @@ bool PlaceSegment(struct segment* solution, Process* process, void* addr_ptr,
 		attempt.addr = gap.addr;
 		attempt.size = size;
 		attempt.prot = 0;
+		attempt.flags = 0;
+		attempt.inode = NULL;
+		attempt.offset = 0;
 		distance = addr < attempt.addr ? attempt.addr - addr : addr - attempt.addr;
 		if ( !found_any|| distance < best_distance )
 			found_any = true, best_distance = distance, best = attempt;
 		attempt.addr = gap.addr + gap.size - size;
 		attempt.size = size;
 		attempt.prot = 0;
+		attempt.flags = 0;
+		attempt.inode = NULL;
+		attempt.offset = 0;
 		distance = addr < attempt.addr ? attempt.addr - addr : addr - attempt.addr;
 		if ( !found_any|| distance < best_distance )
 			found_any = true, best_distance = distance, best = attempt;
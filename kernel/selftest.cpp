@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * selftest.cpp
+ * Tests of kernel facilities run during boot on request.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <timespec.h>
+
+#include <sortix/clock.h>
+
+#include <sortix/kernel/blockqueue.h>
+#include <sortix/kernel/clock.h>
+#include <sortix/kernel/harddisk.h>
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/kthread.h>
+#include <sortix/kernel/log.h>
+#include <sortix/kernel/slab.h>
+#include <sortix/kernel/time.h>
+#include <sortix/kernel/timer.h>
+
+#include "selftest.h"
+
+namespace Sortix {
+namespace SelfTest {
+
+static uintmax_t ElapsedMicroseconds(struct timespec since)
+{
+	struct timespec elapsed = timespec_sub(Time::Get(CLOCK_MONOTONIC), since);
+	return (uintmax_t) elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000;
+}
+
+static const size_t TIMER_TEST_COUNT = 100000;
+static const long TIMER_TEST_STEP_NS = 1000000;
+static const time_t TIMER_TEST_RANGE_SECONDS = 10;
+
+struct timer_test
+{
+	Timer timer;
+	struct timespec expiry;
+	size_t fired;
+	bool cancelled;
+};
+
+struct timer_test_state
+{
+	struct timespec last_delay;
+	struct timespec last_absolute;
+	struct timespec step;
+	size_t fired;
+	size_t errors;
+};
+
+static struct timer_test_state* timer_test_state;
+
+static void TimerTestFired(Clock* clock, Timer* timer, void* user)
+{
+	struct timer_test_state* state = timer_test_state;
+	struct timer_test* test = (struct timer_test*) user;
+	state->fired++;
+	test->fired++;
+	struct timespec* last = timer->flags & TIMER_ABSOLUTE ?
+	                        &state->last_absolute : &state->last_delay;
+	// Timers must expire in order, neither before their expiry nor after the
+	// first step past it.
+	struct timespec now = clock->current_time;
+	if ( test->cancelled || 1 < test->fired ||
+	     timespec_lt(test->expiry, *last) ||
+	     timespec_lt(now, test->expiry) ||
+	     timespec_le(test->expiry, timespec_sub(now, state->step)) )
+		state->errors++;
+	*last = test->expiry;
+}
+
+// Arm a large number of timers with pseudorandom expiries on a private clock,
+// cancel a third of them, and advance the clock in small steps to check that
+// the rest expire exactly once, in order, and on time.
+bool Timers()
+{
+	Clock* clock = new Clock();
+	struct timer_test* tests = new struct timer_test[TIMER_TEST_COUNT];
+	if ( !clock || !tests )
+	{
+		delete clock;
+		delete[] tests;
+		Log::PrintF("kernel: self-test: timers: out of memory\n");
+		return false;
+	}
+
+	struct timer_test_state state;
+	state.last_delay = timespec_nul();
+	state.last_absolute = timespec_nul();
+	state.step = timespec_make(0, TIMER_TEST_STEP_NS);
+	state.fired = 0;
+	state.errors = 0;
+	timer_test_state = &state;
+
+	struct timespec begun = Time::Get(CLOCK_MONOTONIC);
+	uint32_t seed = 1;
+	const uint64_t range_ns = TIMER_TEST_RANGE_SECONDS * 1000000000ULL;
+	for ( size_t i = 0; i < TIMER_TEST_COUNT; i++ )
+	{
+		seed = seed * 1103515245 + 12345;
+		uint64_t random = (uint64_t) seed << 16 ^ (uint64_t) i * 2654435761U;
+		uint64_t expiry_ns = random % range_ns;
+		struct timer_test* test = &tests[i];
+		test->expiry = timespec_make(expiry_ns / 1000000000ULL,
+		                             expiry_ns % 1000000000ULL);
+		test->fired = 0;
+		test->cancelled = false;
+		test->timer.Attach(clock);
+		struct itimerspec timerspec;
+		timerspec.it_value = test->expiry;
+		timerspec.it_interval = timespec_nul();
+		int flags = TIMER_FUNC_ADVANCE_THREAD | (i & 1 ? TIMER_ABSOLUTE : 0);
+		test->timer.Set(&timerspec, NULL, flags, TimerTestFired, test);
+	}
+	uintmax_t arm_usecs = ElapsedMicroseconds(begun);
+
+	begun = Time::Get(CLOCK_MONOTONIC);
+	size_t expected = 0;
+	for ( size_t i = 0; i < TIMER_TEST_COUNT; i++ )
+	{
+		if ( i % 3 == 0 )
+		{
+			tests[i].cancelled = true;
+			if ( !tests[i].timer.TryCancel() )
+				state.errors++;
+		}
+		else
+			expected++;
+	}
+	uintmax_t cancel_usecs = ElapsedMicroseconds(begun);
+
+	begun = Time::Get(CLOCK_MONOTONIC);
+	size_t steps = TIMER_TEST_RANGE_SECONDS * (1000000000L / TIMER_TEST_STEP_NS);
+	for ( size_t i = 0; i <= steps; i++ )
+		clock->Advance(state.step);
+	uintmax_t expire_usecs = ElapsedMicroseconds(begun);
+
+	for ( size_t i = 0; i < TIMER_TEST_COUNT; i++ )
+	{
+		if ( tests[i].timer.flags & TIMER_ACTIVE )
+		{
+			state.errors++;
+			tests[i].timer.Cancel();
+		}
+		if ( !tests[i].cancelled && tests[i].fired != 1 )
+			state.errors++;
+		tests[i].timer.Detach();
+	}
+	if ( state.fired != expected )
+		state.errors++;
+
+	delete[] tests;
+	delete clock;
+
+	Log::PrintF("kernel: self-test: timers: %zu timers armed in %ju us, "
+	            "a third cancelled in %ju us, and the rest expired in %ju us: "
+	            "%s\n", TIMER_TEST_COUNT, arm_usecs, cancel_usecs, expire_usecs,
+	            state.errors ? "failed" : "passed");
+	return !state.errors;
+}
+
+struct cond_test
+{
+	kthread_mutex_t lock;
+	kthread_cond_t cond;
+	bool signaled;
+};
+
+static void CondTestSignal(Clock* /*clock*/, Timer* /*timer*/, void* user)
+{
+	struct cond_test* test = (struct cond_test*) user;
+	ScopedLock lock(&test->lock);
+	test->signaled = true;
+	kthread_cond_signal(&test->cond);
+}
+
+bool CondTimeouts()
+{
+	struct cond_test test;
+	test.lock = KTHREAD_MUTEX_INITIALIZER;
+	test.cond = KTHREAD_COND_INITIALIZER;
+	test.signaled = false;
+	Clock* clock = Time::GetClock(CLOCK_MONOTONIC);
+	size_t errors = 0;
+
+	// Nobody signals the condition, so the wait times out at the deadline.
+	struct timespec begun = Time::Get(CLOCK_MONOTONIC);
+	struct timespec timeout = timespec_make(0, 20 * 1000000L);
+	kthread_mutex_lock(&test.lock);
+	if ( kthread_cond_wait_until(&test.cond, &test.lock, clock,
+	                             timespec_add(begun, timeout)) ||
+	     errno != ETIMEDOUT )
+		errors++;
+	if ( test.cond.first || test.cond.last )
+		errors++;
+	kthread_mutex_unlock(&test.lock);
+	uintmax_t timeout_usecs = ElapsedMicroseconds(begun);
+	if ( timeout_usecs < 20000 )
+		errors++;
+
+	// A timer signals the condition long before the deadline.
+	Timer timer;
+	timer.Attach(clock);
+	struct itimerspec timerspec;
+	timerspec.it_value = timespec_make(0, 10 * 1000000L);
+	timerspec.it_interval = timespec_nul();
+	begun = Time::Get(CLOCK_MONOTONIC);
+	timer.Set(&timerspec, NULL, 0, CondTestSignal, &test);
+	kthread_mutex_lock(&test.lock);
+	struct timespec deadline = timespec_add(begun, timespec_make(10, 0));
+	while ( !test.signaled )
+	{
+		if ( !kthread_cond_wait_until(&test.cond, &test.lock, clock,
+		                              deadline) )
+		{
+			errors++;
+			break;
+		}
+	}
+	kthread_mutex_unlock(&test.lock);
+	timer.Cancel();
+	timer.Detach();
+	uintmax_t signal_usecs = ElapsedMicroseconds(begun);
+
+	Log::PrintF("kernel: self-test: condition timeouts: timed out in %ju us, "
+	            "signaled in %ju us: %s\n", timeout_usecs, signal_usecs,
+	            errors ? "failed" : "passed");
+	return !errors;
+}
+
+// A disk that runs one request at a time and records the order of the requests.
+class TestDisk : public Harddisk
+{
+public:
+	TestDisk() : issued_count(0) { }
+	virtual off_t GetSize() { return 1024 * 512; }
+	virtual blkcnt_t GetBlockCount() { return 1024; }
+	virtual blksize_t GetBlockSize() { return 512; }
+	virtual uint16_t GetCylinderCount() { return 0; }
+	virtual uint16_t GetHeadCount() { return 0; }
+	virtual uint16_t GetSectorCount() { return 0; }
+	virtual const char* GetDriver() { return "test"; }
+	virtual const char* GetModel() { return "test"; }
+	virtual const char* GetSerial() { return "test"; }
+	virtual const char* GetRevision() { return "test"; }
+	virtual const unsigned char* GetATAIdentify(size_t* /*size_ptr*/)
+	{
+		return errno = ENOTSUP, (const unsigned char*) NULL;
+	}
+	virtual int sync(ioctx_t* /*ctx*/) { return 0; }
+	virtual ssize_t pread(ioctx_t* /*ctx*/, unsigned char* /*buf*/,
+	                      size_t /*count*/, off_t /*off*/)
+	{
+		return errno = ENOTSUP, -1;
+	}
+	virtual ssize_t pwrite(ioctx_t* /*ctx*/, const unsigned char* /*buf*/,
+	                       size_t /*count*/, off_t /*off*/)
+	{
+		return errno = ENOTSUP, -1;
+	}
+	virtual size_t IssueRequests(struct block_request** requests, size_t count)
+	{
+		for ( size_t i = 0; i < count && issued_count < 8; i++ )
+			issued[issued_count++] = requests[i];
+		return count;
+	}
+
+public:
+	struct block_request* issued[8];
+	size_t issued_count;
+
+};
+
+static void BlockQueueTestDone(struct block_request* request)
+{
+	(*(size_t*) request->context)++;
+}
+
+bool BlockQueues()
+{
+	TestDisk disk;
+	BlockQueue queue(&disk, 1, 128, 16);
+	size_t done = 0;
+	struct block_request requests[4];
+	memset(requests, 0, sizeof(requests));
+	blkcnt_t block_indexes[4] = { 100, 10, 11, 50 };
+	for ( size_t i = 0; i < 4; i++ )
+	{
+		requests[i].block_index = block_indexes[i];
+		requests[i].block_count = 1;
+		requests[i].done = BlockQueueTestDone;
+		requests[i].context = &done;
+	}
+	size_t errors = 0;
+
+	// The first request is issued at once, the requests for the adjacent
+	// blocks 10 and 11 are merged while it runs, and the sweep continues from
+	// the lowest block after the end of the disk is reached.
+	for ( size_t i = 0; i < 4; i++ )
+		queue.Submit(&requests[i]);
+	for ( size_t i = 0; i < 3 && i < disk.issued_count; i++ )
+		queue.Complete(disk.issued[i], 0);
+	if ( disk.issued_count != 3 ||
+	     disk.issued[0] != &requests[0] ||
+	     disk.issued[1] != &requests[1] ||
+	     requests[1].merge_next != &requests[2] ||
+	     disk.issued[2] != &requests[3] )
+		errors++;
+	if ( done != 4 )
+		errors++;
+
+	Log::PrintF("kernel: self-test: block queue: %s\n",
+	            errors ? "failed" : "passed");
+	return !errors;
+}
+
+struct slab_test_object
+{
+	unsigned char data[200];
+};
+
+static struct slab_cache slab_test_cache =
+	SLAB_CACHE_INITIALIZER("self-test", struct slab_test_object);
+
+bool Slabs()
+{
+	const size_t count = 64;
+	const size_t size = sizeof(struct slab_test_object);
+	void* objects[count];
+	size_t errors = 0;
+
+	// The objects are distinct and are counted as used.
+	size_t allocated = 0;
+	for ( ; allocated < count; allocated++ )
+	{
+		objects[allocated] = SlabAllocate(&slab_test_cache, size);
+		if ( !objects[allocated] )
+		{
+			errors++;
+			break;
+		}
+		memset(objects[allocated], 0xCC, size);
+	}
+	// The objects are aligned at least like heap allocations.
+	for ( size_t i = 0; i < allocated; i++ )
+		if ( (uintptr_t) objects[i] & (16 - 1) )
+			errors++;
+	for ( size_t i = 0; i < allocated; i++ )
+		for ( size_t n = i + 1; n < allocated; n++ )
+			if ( objects[i] == objects[n] )
+				errors++;
+	size_t total;
+	size_t used;
+	SlabStatistics(&total, &used);
+	if ( used < allocated * size || total < used )
+		errors++;
+
+	// Freed objects are reused.
+	for ( size_t i = 0; i < allocated; i++ )
+		SlabFree(&slab_test_cache, objects[i], size);
+	void* again = SlabAllocate(&slab_test_cache, size);
+	bool reused = false;
+	for ( size_t i = 0; i < allocated; i++ )
+		if ( objects[i] == again )
+			reused = true;
+	if ( !reused )
+		errors++;
+	SlabFree(&slab_test_cache, again, size);
+
+	// Allocations of other sizes go to the heap.
+	void* other = SlabAllocate(&slab_test_cache, size + 1);
+	if ( !other )
+		errors++;
+	SlabFree(&slab_test_cache, other, size + 1);
+
+	Log::PrintF("kernel: self-test: slab: %s\n", errors ? "failed" : "passed");
+	return !errors;
+}
+
+bool Run()
+{
+	bool success = true;
+	if ( !Timers() )
+		success = false;
+	if ( !CondTimeouts() )
+		success = false;
+	if ( !BlockQueues() )
+		success = false;
+	if ( !Slabs() )
+		success = false;
+	return success;
+}
+
+} // namespace SelfTest
+} // namespace Sortix
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * slab.cpp
+ * Object caches for frequently allocated kernel objects.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sortix/mman.h>
+
+#include <sortix/kernel/addralloc.h>
+#include <sortix/kernel/cpu.h>
+#include <sortix/kernel/interrupt.h>
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/kthread.h>
+#include <sortix/kernel/memorymanagement.h>
+#include <sortix/kernel/slab.h>
+
+namespace Sortix {
+
+// Objects are aligned at least like heap allocations, and more if their type
+// requires it.
+static const size_t SLAB_ALIGN = 16;
+
+// Slab pages are mapped this many at a time.
+static const size_t SLAB_CHUNK_PAGES = 8;
+
+// The number of freed objects kept for reuse by each processor.
+static const size_t MAGAZINE_SIZE = 16;
+
+// The slab header is at the start of the page, followed by the objects, and
+// the free objects are linked through their first word.
+struct slab
+{
+	struct slab* prev;
+	struct slab* next;
+	struct slab_cache* cache;
+	void* free_objects;
+	size_t used;
+};
+
+struct slab_magazine
+{
+	size_t count;
+	void* objects[MAGAZINE_SIZE];
+};
+
+// The pages of the slabs are shared between the caches and are kept mapped for
+// reuse once a cache no longer needs them.
+static kthread_mutex_t slab_pages_lock = KTHREAD_MUTEX_INITIALIZER;
+static struct slab* free_slab_pages = NULL;
+static uintptr_t slab_chunk_next = 0;
+static uintptr_t slab_chunk_end = 0;
+static size_t slab_pages_mapped = 0;
+static struct slab_cache* slab_caches = NULL;
+
+static size_t CacheAlign(struct slab_cache* cache)
+{
+	return SLAB_ALIGN < cache->object_align ? cache->object_align : SLAB_ALIGN;
+}
+
+// The objects follow the header at the first aligned offset.
+static size_t HeaderSize(struct slab_cache* cache)
+{
+	size_t align = CacheAlign(cache);
+	return (sizeof(struct slab) + align - 1) & ~(align - 1);
+}
+
+static size_t ObjectStride(struct slab_cache* cache)
+{
+	size_t align = CacheAlign(cache);
+	return (cache->object_size + align - 1) & ~(align - 1);
+}
+
+static bool IsSlabObject(struct slab_cache* cache, size_t size)
+{
+	return size == cache->object_size &&
+	       HeaderSize(cache) + ObjectStride(cache) <= Page::Size();
+}
+
+static struct slab* GetSlabPage()
+{
+	ScopedLock lock(&slab_pages_lock);
+	if ( free_slab_pages )
+	{
+		struct slab* slab = free_slab_pages;
+		free_slab_pages = slab->next;
+		return slab;
+	}
+	if ( slab_chunk_next == slab_chunk_end )
+	{
+		size_t size = SLAB_CHUNK_PAGES * Page::Size();
+		addralloc_t addralloc;
+		if ( !AllocateKernelAddress(&addralloc, size) )
+			return NULL;
+		int prot = PROT_KREAD | PROT_KWRITE;
+		if ( !Memory::MapRange(addralloc.from, size, prot,
+		                       PAGE_USAGE_KERNEL_HEAP) )
+		{
+			Memory::Flush();
+			FreeKernelAddress(&addralloc);
+			return NULL;
+		}
+		Memory::Flush();
+		slab_chunk_next = addralloc.from;
+		slab_chunk_end = addralloc.from + size;
+		slab_pages_mapped += SLAB_CHUNK_PAGES;
+	}
+	struct slab* slab = (struct slab*) slab_chunk_next;
+	slab_chunk_next += Page::Size();
+	return slab;
+}
+
+static void PutSlabPage(struct slab* slab)
+{
+	ScopedLock lock(&slab_pages_lock);
+	slab->next = free_slab_pages;
+	free_slab_pages = slab;
+}
+
+static void LinkSlab(struct slab** list, struct slab* slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if ( slab->next )
+		slab->next->prev = slab;
+	*list = slab;
+}
+
+static void UnlinkSlab(struct slab** list, struct slab* slab)
+{
+	if ( slab->prev )
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	if ( slab->next )
+		slab->next->prev = slab->prev;
+}
+
+// The cache lock must be held.
+static struct slab* NewSlab(struct slab_cache* cache)
+{
+	if ( !cache->objects_per_slab )
+	{
+		size_t stride = ObjectStride(cache);
+		cache->objects_per_slab = (Page::Size() - HeaderSize(cache)) / stride;
+		ScopedLock lock(&slab_pages_lock);
+		cache->next = slab_caches;
+		slab_caches = cache;
+	}
+	struct slab* slab = GetSlabPage();
+	if ( !slab )
+		return NULL;
+	slab->cache = cache;
+	slab->free_objects = NULL;
+	slab->used = 0;
+	size_t stride = ObjectStride(cache);
+	uintptr_t objects = (uintptr_t) slab + HeaderSize(cache);
+	for ( size_t i = cache->objects_per_slab; i; i-- )
+	{
+		void* object = (void*) (objects + (i - 1) * stride);
+		*(void**) object = slab->free_objects;
+		slab->free_objects = object;
+	}
+	cache->slab_count++;
+	return slab;
+}
+
+// The cache lock must be held.
+static void* TakeObject(struct slab_cache* cache)
+{
+	struct slab* slab = cache->partial;
+	if ( !slab )
+	{
+		if ( (slab = cache->empty) )
+			cache->empty = NULL;
+		else if ( !(slab = NewSlab(cache)) )
+			return NULL;
+		LinkSlab(&cache->partial, slab);
+	}
+	void* object = slab->free_objects;
+	slab->free_objects = *(void**) object;
+	if ( ++slab->used == cache->objects_per_slab )
+		UnlinkSlab(&cache->partial, slab);
+	return object;
+}
+
+// Return an object to its slab, keeping a single empty slab in the cache and
+// giving the pages of any other empty slabs to the other caches. The cache lock
+// must be held.
+static void ReturnObject(struct slab_cache* cache, void* object)
+{
+	struct slab* slab = (struct slab*) Page::AlignDown((uintptr_t) object);
+	assert(slab->cache == cache);
+	if ( slab->used == cache->objects_per_slab )
+		LinkSlab(&cache->partial, slab);
+	*(void**) object = slab->free_objects;
+	slab->free_objects = object;
+	if ( --slab->used )
+		return;
+	UnlinkSlab(&cache->partial, slab);
+	if ( !cache->empty )
+	{
+		cache->empty = slab;
+		return;
+	}
+	cache->slab_count--;
+	PutSlabPage(slab);
+}
+
+void* SlabAllocate(struct slab_cache* cache, size_t size)
+{
+	if ( !IsSlabObject(cache, size) )
+		return malloc(size);
+	// The magazine of this processor can be used without locking as long as
+	// the thread isn't preempted.
+	bool interrupts = Interrupt::SetEnabled(false);
+	struct slab_magazine* magazine = cache->magazines[CPU::GetId()];
+	if ( magazine && magazine->count )
+	{
+		void* object = magazine->objects[--magazine->count];
+		Interrupt::SetEnabled(interrupts);
+		__atomic_add_fetch(&cache->objects_used, 1, __ATOMIC_RELAXED);
+		return object;
+	}
+	Interrupt::SetEnabled(interrupts);
+	ScopedLock lock(&cache->lock);
+	void* object = TakeObject(cache);
+	if ( object )
+		__atomic_add_fetch(&cache->objects_used, 1, __ATOMIC_RELAXED);
+	return object;
+}
+
+void SlabFree(struct slab_cache* cache, void* ptr, size_t size)
+{
+	if ( !ptr )
+		return;
+	if ( !IsSlabObject(cache, size) )
+	{
+		free(ptr);
+		return;
+	}
+	__atomic_sub_fetch(&cache->objects_used, 1, __ATOMIC_RELAXED);
+	bool interrupts = Interrupt::SetEnabled(false);
+	struct slab_magazine* magazine = cache->magazines[CPU::GetId()];
+	if ( magazine && magazine->count < MAGAZINE_SIZE )
+	{
+		magazine->objects[magazine->count++] = ptr;
+		Interrupt::SetEnabled(interrupts);
+		return;
+	}
+	Interrupt::SetEnabled(interrupts);
+	ScopedLock lock(&cache->lock);
+	// Give this processor a magazine the first time it frees an object.
+	if ( !magazine && (magazine = new struct slab_magazine) )
+	{
+		magazine->count = 0;
+		interrupts = Interrupt::SetEnabled(false);
+		size_t cpu = CPU::GetId();
+		if ( !cache->magazines[cpu] )
+		{
+			cache->magazines[cpu] = magazine;
+			magazine->objects[magazine->count++] = ptr;
+			magazine = NULL;
+			ptr = NULL;
+		}
+		Interrupt::SetEnabled(interrupts);
+		delete magazine;
+		if ( !ptr )
+			return;
+	}
+	ReturnObject(cache, ptr);
+}
+
+void SlabStatistics(size_t* total, size_t* used)
+{
+	ScopedLock lock(&slab_pages_lock);
+	*total = slab_pages_mapped * Page::Size();
+	*used = 0;
+	for ( struct slab_cache* cache = slab_caches; cache; cache = cache->next )
+		*used += __atomic_load_n(&cache->objects_used, __ATOMIC_RELAXED) *
+		         cache->object_size;
+}
+
+} // namespace Sortix
@@ -204,6 +204,11 @@ void* syscall_list[SYSCALL_MAX_NUM + 1] =
 	[SYSCALL_SETDNSCONFIG] = (void*) sys_setdnsconfig,
 	[SYSCALL_FUTEX] = (void*) sys_futex,
 	[SYSCALL_MEMUSAGE] = (void*) sys_memusage,
+	[SYSCALL_MSYNC] = (void*) sys_msync,
+	[SYSCALL_EPOLL_CREATE1] = (void*) sys_epoll_create1,
+	[SYSCALL_EPOLL_CTL] = (void*) sys_epoll_ctl,
+	[SYSCALL_EPOLL_PWAIT] = (void*) sys_epoll_pwait,
+	[SYSCALL_SENDFILE] = (void*) sys_sendfile,
 	[SYSCALL_MAX_NUM] = (void*) sys_bad_syscall,
 };
 } /* extern "C" */
@@ -41,6 +41,7 @@
 #include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/scheduler.h>
+#include <sortix/kernel/slab.h>
 #include <sortix/kernel/syscall.h>
 #include <sortix/kernel/thread.h>
 #include <sortix/kernel/time.h>
@@ -51,6 +52,19 @@
 
 namespace Sortix {
 
+static struct slab_cache thread_cache =
+	SLAB_CACHE_INITIALIZER("thread", Thread);
+
+void* Thread::operator new(size_t size)
+{
+	return SlabAllocate(&thread_cache, size);
+}
+
+void Thread::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&thread_cache, ptr, size);
+}
+
 Thread::Thread()
 {
 	assert(!((uintptr_t) registers.fpuenv & 0xFUL));
@@ -63,6 +77,11 @@ Thread::Thread()
 	nextsibling = NULL;
 	scheduler_list_prev = NULL;
 	scheduler_list_next = NULL;
+	scheduler_heap_prev = NULL;
+	scheduler_heap_next = NULL;
+	scheduler_heap_child = NULL;
+	scheduler_cpu = 0;
+	scheduler_vruntime = 0;
 	state = NONE;
 	memset(&registers, 0, sizeof(registers));
 	kernelstackpos = 0;
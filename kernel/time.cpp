@@ -77,6 +77,12 @@ void OnTick(struct timespec tick_period, bool system_mode)
 {
 	realtime_clock->Advance(tick_period);
 	uptime_clock->Advance(tick_period);
+	OnCPUTick(tick_period, system_mode);
+}
+
+// Charge the tick to the thread running on the current processor.
+void OnCPUTick(struct timespec tick_period, bool system_mode)
+{
 	Thread* thread = CurrentThread();
 	Process* process = thread->process;
 	thread->execute_clock.Advance(tick_period);
@@ -88,6 +94,7 @@ void OnTick(struct timespec tick_period, bool system_mode)
 		process->system_clock.Advance(tick_period);
 		process->child_system_clock.Advance(tick_period);
 	}
+	Scheduler::ChargeThread(thread, tick_period);
 }
 
 void Init()
@@ -37,6 +37,7 @@ Timer::Timer()
 	clock = NULL;
 	prev_timer = NULL;
 	next_timer = NULL;
+	child_timer = NULL;
 	next_interrupt_timer = NULL;
 	callback = NULL;
 	user = NULL;
@@ -94,13 +95,20 @@ void Timer::GetInternal(struct itimerspec* current)
 		current->it_value = timespec_sub(value.it_value, clock->current_time),
 		current->it_interval = value.it_interval;
 	else
-		*current = value;
+	{
+		current->it_value = timespec_sub(value.it_value,
+		                                 clock->current_advancement);
+		if ( timespec_lt(current->it_value, timespec_nul()) )
+			current->it_value = timespec_nul();
+		current->it_interval = value.it_interval;
+	}
 }
 
 void Timer::Get(struct itimerspec* current)
 {
 	assert(clock);
 
+	clock->Refresh();
 	clock->LockClock();
 	GetInternal(current);
 	clock->UnlockClock();
@@ -114,6 +122,7 @@ void Timer::Set(struct itimerspec* new_value, struct itimerspec* old_value,
 	assert(!(flags & TIMER_FUNC_MAY_DEALLOCATE_TIMER) ||
 	       timespec_le(new_value->it_interval, timespec_nul()));
 
+	clock->Refresh();
 	clock->LockClock();
 
 	// Dequeue this timer if it is already armed.
@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fsmarshall-msg.h>
 
 #include <sortix/fcntl.h>
 #include <sortix/mount.h>
@@ -32,6 +33,7 @@
 #include <sortix/kernel/vnode.h>
 #include <sortix/kernel/mtable.h>
 #include <sortix/kernel/process.h>
+#include <sortix/kernel/slab.h>
 
 #include "fs/user.h"
 
@@ -60,6 +62,19 @@ static Ref<Inode> LookupMount(Ref<Inode> inode)
 	return LookupMountUnlocked(inode);
 }
 
+static struct slab_cache vnode_cache =
+	SLAB_CACHE_INITIALIZER("vnode", Vnode);
+
+void* Vnode::operator new(size_t size)
+{
+	return SlabAllocate(&vnode_cache, size);
+}
+
+void Vnode::operator delete(void* ptr, size_t size)
+{
+	SlabFree(&vnode_cache, ptr, size);
+}
+
 Vnode::Vnode(Ref<Inode> inode, Ref<Vnode> mountedat, ino_t rootino, dev_t rootdev)
 {
 	for ( Ref<Vnode> tmp = mountedat; tmp; tmp = tmp->mountedat )
@@ -138,8 +153,8 @@ Ref<Vnode> Vnode::fsm_mount(ioctx_t* ctx,
                             const struct stat* rootst_ptr,
                             int flags)
 {
-	if ( flags & ~(0) )
-		return Ref<Vnode>(NULL);
+	if ( flags & ~(FSM_MOUNT_MULTIPLEX | FSM_MOUNT_CACHE) )
+		return errno = EINVAL, Ref<Vnode>(NULL);
 
 	if ( !strcmp(filename, ".") || !strcmp(filename, "..") )
 		return errno = EINVAL, Ref<Vnode>(NULL);
@@ -154,7 +169,7 @@ Ref<Vnode> Vnode::fsm_mount(ioctx_t* ctx,
 
 	Ref<Inode> root_inode;
 	Ref<Inode> server_inode;
-	if ( !UserFS::Bootstrap(&root_inode, &server_inode, &rootst) )
+	if ( !UserFS::Bootstrap(&root_inode, &server_inode, &rootst, flags) )
 		return Ref<Vnode>(NULL);
 
 	Ref<Vnode> server_vnode(new Vnode(server_inode, Ref<Vnode>(NULL), 0, 0));
@@ -518,4 +533,22 @@ int Vnode::getsockname(ioctx_t* ctx, uint8_t* addr, size_t* addrsize)
 	return inode->getsockname(ctx, addr, addrsize);
 }
 
+int Vnode::epoll_ctl(ioctx_t* ctx, int op, int fd, Ref<Descriptor> desc,
+                     const struct epoll_event* event)
+{
+	return inode->epoll_ctl(ctx, op, fd, desc, event);
+}
+
+int Vnode::epoll_wait(ioctx_t* ctx, struct epoll_event* events, int maxevents,
+                      struct timespec timeout)
+{
+	return inode->epoll_wait(ctx, events, maxevents, timeout);
+}
+
+ssize_t Vnode::sendfile(ioctx_t* ctx, Ref<Inode> file, off_t offset,
+                        size_t count)
+{
+	return inode->sendfile(ctx, file, offset, count);
+}
+
 } // namespace Sortix
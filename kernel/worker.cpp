@@ -59,8 +59,9 @@ static bool _Schedule(void (*func)(void*), void* user, bool retry)
 		return false;
 	while ( jobsused == jobslen )
 		kthread_cond_wait(&jobsfree, &jobslock);
-	if ( !jobsused )
-		kthread_cond_signal(&jobsready);
+	// Wake a worker even if the queue wasn't empty, as there may be several
+	// workers and the others might all be busy.
+	kthread_cond_signal(&jobsready);
 	size_t index = (jobsoff + jobsused++) % jobslen;
 	jobs[index].func = func;
 	jobs[index].user = user;
@@ -91,8 +92,8 @@ void Thread(void* /*user*/)
 			kthread_cond_wait(&jobsready, &jobslock);
 		Job job = jobs[jobsoff];
 		jobsoff = (jobsoff+1) % jobslen;
-		if ( jobsused-- == jobslen )
-			kthread_cond_signal(&jobsfree);
+		jobsused--;
+		kthread_cond_signal(&jobsfree);
 		kthread_mutex_unlock(&jobslock);
 		PerformJob(&job);
 	}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * x86-family/acpi.cpp
+ * Discovers the processors through the ACPI tables.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sortix/mman.h>
+
+#include <sortix/kernel/addralloc.h>
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/memorymanagement.h>
+
+#include "acpi.h"
+
+namespace Sortix {
+namespace ACPI {
+
+struct rsdp
+{
+	char signature[8];
+	uint8_t checksum;
+	char oemid[6];
+	uint8_t revision;
+	uint32_t rsdt_address;
+	uint32_t length;
+	uint64_t xsdt_address;
+	uint8_t extended_checksum;
+	uint8_t reserved[3];
+} __attribute__((packed));
+
+struct sdt_header
+{
+	char signature[4];
+	uint32_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	char oemid[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__((packed));
+
+struct madt
+{
+	struct sdt_header header;
+	uint32_t lapic_address;
+	uint32_t flags;
+} __attribute__((packed));
+
+struct madt_entry
+{
+	uint8_t type;
+	uint8_t length;
+} __attribute__((packed));
+
+struct madt_lapic
+{
+	struct madt_entry entry;
+	uint8_t processor_id;
+	uint8_t apic_id;
+	uint32_t flags;
+} __attribute__((packed));
+
+struct madt_lapic_override
+{
+	struct madt_entry entry;
+	uint16_t reserved;
+	uint64_t lapic_address;
+} __attribute__((packed));
+
+static const uint8_t MADT_LAPIC = 0;
+static const uint8_t MADT_LAPIC_OVERRIDE = 5;
+static const uint32_t MADT_LAPIC_ENABLED = 1 << 0;
+
+static const size_t MAX_TABLE_SIZE = 1024 * 1024;
+
+// The tables live in physical memory that isn't mapped, so they are mapped
+// temporarily into the kernel address space while being read.
+static void* MapPhysical(addralloc_t* alloc, uint64_t physical, size_t size)
+{
+	if ( sizeof(void*) <= 4 && 0x100000000ULL <= physical + size )
+		return errno = EOVERFLOW, (void*) NULL;
+	addr_t unalignment = physical % Page::Size();
+	addr_t base = (addr_t) physical - unalignment;
+	size_t mapped_size = Page::AlignUp(unalignment + size);
+	if ( !AllocateKernelAddress(alloc, mapped_size) )
+		return NULL;
+	for ( size_t i = 0; i < mapped_size; i += Page::Size() )
+	{
+		if ( !Memory::Map(base + i, alloc->from + i, PROT_KREAD) )
+		{
+			for ( size_t n = 0; n < i; n += Page::Size() )
+				Memory::Unmap(alloc->from + n);
+			Memory::Flush();
+			FreeKernelAddress(alloc);
+			return NULL;
+		}
+	}
+	Memory::Flush();
+	return (void*) (alloc->from + unalignment);
+}
+
+static void UnmapPhysical(addralloc_t* alloc)
+{
+	for ( size_t i = 0; i < alloc->size; i += Page::Size() )
+		Memory::Unmap(alloc->from + i);
+	Memory::Flush();
+	FreeKernelAddress(alloc);
+}
+
+static bool IsChecksumValid(const void* data, size_t size)
+{
+	const uint8_t* bytes = (const uint8_t*) data;
+	uint8_t sum = 0;
+	for ( size_t i = 0; i < size; i++ )
+		sum += bytes[i];
+	return sum == 0;
+}
+
+static bool SearchRSDP(uint64_t physical, size_t size, struct rsdp* result)
+{
+	addralloc_t alloc;
+	const uint8_t* area = (const uint8_t*) MapPhysical(&alloc, physical, size);
+	if ( !area )
+		return false;
+	bool found = false;
+	for ( size_t i = 0; !found && i + 20 <= size; i += 16 )
+	{
+		if ( memcmp(area + i, "RSD PTR ", 8) != 0 ||
+		     !IsChecksumValid(area + i, 20) )
+			continue;
+		memset(result, 0, sizeof(*result));
+		const struct rsdp* rsdp = (const struct rsdp*) (area + i);
+		size_t length = 20;
+		if ( 2 <= rsdp->revision && i + sizeof(struct rsdp) <= size &&
+		     IsChecksumValid(area + i, sizeof(struct rsdp)) )
+			length = sizeof(struct rsdp);
+		memcpy(result, rsdp, length);
+		if ( length < sizeof(struct rsdp) )
+			result->revision = 0;
+		found = true;
+	}
+	UnmapPhysical(&alloc);
+	return found;
+}
+
+static bool FindRSDP(struct rsdp* result)
+{
+	// The segment of the Extended BIOS Data Area is stored in the BIOS Data
+	// Area, and the pointer may be in its first kilobyte.
+	addralloc_t alloc;
+	const uint16_t* ebda_segment =
+		(const uint16_t*) MapPhysical(&alloc, 0x40E, sizeof(uint16_t));
+	if ( !ebda_segment )
+		return false;
+	uint64_t ebda = (uint64_t) *ebda_segment << 4;
+	UnmapPhysical(&alloc);
+	if ( 0x80000 <= ebda && ebda < 0xA0000 && SearchRSDP(ebda, 1024, result) )
+		return true;
+	return SearchRSDP(0xE0000, 0x20000, result);
+}
+
+static struct sdt_header* MapTable(addralloc_t* alloc, uint64_t physical)
+{
+	struct sdt_header* header = (struct sdt_header*)
+		MapPhysical(alloc, physical, sizeof(struct sdt_header));
+	if ( !header )
+		return NULL;
+	size_t length = header->length;
+	UnmapPhysical(alloc);
+	if ( length < sizeof(struct sdt_header) || MAX_TABLE_SIZE < length )
+		return errno = EINVAL, (struct sdt_header*) NULL;
+	if ( !(header = (struct sdt_header*) MapPhysical(alloc, physical, length)) )
+		return NULL;
+	if ( !IsChecksumValid(header, length) )
+		return UnmapPhysical(alloc), errno = EINVAL, (struct sdt_header*) NULL;
+	return header;
+}
+
+static bool ParseMADT(const struct madt* madt, struct madt_info* info)
+{
+	info->lapic_address = madt->lapic_address;
+	info->apic_ids_count = 0;
+	const uint8_t* entries = (const uint8_t*) (madt + 1);
+	size_t length = madt->header.length - sizeof(struct madt);
+	size_t offset = 0;
+	while ( offset + sizeof(struct madt_entry) <= length )
+	{
+		const struct madt_entry* entry =
+			(const struct madt_entry*) (entries + offset);
+		if ( entry->length < sizeof(struct madt_entry) ||
+		     length - offset < entry->length )
+			break;
+		if ( entry->type == MADT_LAPIC &&
+		     sizeof(struct madt_lapic) <= entry->length )
+		{
+			const struct madt_lapic* lapic = (const struct madt_lapic*) entry;
+			if ( (lapic->flags & MADT_LAPIC_ENABLED) &&
+			     info->apic_ids_count < CPU::MAX_CPUS )
+				info->apic_ids[info->apic_ids_count++] = lapic->apic_id;
+		}
+		else if ( entry->type == MADT_LAPIC_OVERRIDE &&
+		          sizeof(struct madt_lapic_override) <= entry->length )
+		{
+			const struct madt_lapic_override* override =
+				(const struct madt_lapic_override*) entry;
+			if ( sizeof(void*) == 8 || override->lapic_address < 0x100000000ULL )
+				info->lapic_address = (addr_t) override->lapic_address;
+		}
+		offset += entry->length;
+	}
+	return info->lapic_address && info->apic_ids_count;
+}
+
+bool ReadMADT(struct madt_info* info)
+{
+	struct rsdp rsdp;
+	if ( !FindRSDP(&rsdp) )
+		return errno = ENODEV, false;
+
+	// Prefer the extended table with 64-bit pointers if available.
+	bool extended = 2 <= rsdp.revision && rsdp.xsdt_address;
+	uint64_t root_address = extended ? rsdp.xsdt_address : rsdp.rsdt_address;
+	size_t pointer_size = extended ? sizeof(uint64_t) : sizeof(uint32_t);
+	addralloc_t root_alloc;
+	struct sdt_header* root = MapTable(&root_alloc, root_address);
+	if ( !root )
+		return false;
+
+	bool found = false;
+	size_t count = (root->length - sizeof(struct sdt_header)) / pointer_size;
+	const uint8_t* pointers = (const uint8_t*) (root + 1);
+	for ( size_t i = 0; !found && i < count; i++ )
+	{
+		uint64_t address;
+		if ( extended )
+			memcpy(&address, pointers + i * pointer_size, sizeof(uint64_t));
+		else
+		{
+			uint32_t address32;
+			memcpy(&address32, pointers + i * pointer_size, sizeof(uint32_t));
+			address = address32;
+		}
+		addralloc_t alloc;
+		struct sdt_header* table = MapTable(&alloc, address);
+		if ( !table )
+			continue;
+		if ( !memcmp(table->signature, "APIC", 4) &&
+		     sizeof(struct madt) <= table->length )
+			found = ParseMADT((const struct madt*) table, info);
+		UnmapPhysical(&alloc);
+	}
+	UnmapPhysical(&root_alloc);
+
+	if ( !found )
+		return errno = ENODEV, false;
+	return true;
+}
+
+} // namespace ACPI
+} // namespace Sortix
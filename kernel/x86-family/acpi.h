@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * x86-family/acpi.h
+ * Discovers the processors through the ACPI tables.
+ */
+
+#ifndef SORTIX_X86_FAMILY_ACPI_H
+#define SORTIX_X86_FAMILY_ACPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sortix/kernel/cpu.h>
+#include <sortix/kernel/decl.h>
+
+namespace Sortix {
+namespace ACPI {
+
+struct madt_info
+{
+	addr_t lapic_address;
+	size_t apic_ids_count;
+	uint8_t apic_ids[CPU::MAX_CPUS];
+};
+
+bool ReadMADT(struct madt_info* info);
+
+} // namespace ACPI
+} // namespace Sortix
+
+#endif
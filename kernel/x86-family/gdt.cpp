@@ -104,8 +104,11 @@ extern "C" {
 const size_t STACK_SIZE = 64*1024;
 extern size_t stack[STACK_SIZE / sizeof(size_t)];
 
-struct tss_entry tss =
+// Every processor has its own task switch segment and global descriptor table,
+// where the first entries are used by the boot processor.
+struct tss_entry tss[CPU::MAX_CPUS] =
 {
+	{
 #if defined(__i386__)
 	.prev_tss = 0,                                                     /* c++ */
 	.esp0 = 0 /*(uintptr_t) stack + sizeof(stack)*/,
@@ -145,6 +148,7 @@ struct tss_entry tss =
 	.reserved3 = 0,
 	.iomap_base = 0,
 #endif
+	},
 };
 
 } /* extern "C" */
@@ -179,8 +183,17 @@ struct tss_entry tss =
 
 extern "C" {
 
-struct gdt_entry gdt[] =
+#if defined(__i386__)
+#define GDT_NUM_ENTRIES 8
+#elif defined(__x86_64__)
+#define GDT_NUM_ENTRIES 7
+#endif
+
+#define GDT_TSS_ENTRY 5
+
+struct gdt_entry gdt[CPU::MAX_CPUS][GDT_NUM_ENTRIES] =
 {
+	{
 	/* 0x00: Null segment */
 	GDT_ENTRY(0, 0, 0, 0),
 
@@ -198,7 +211,7 @@ struct gdt_entry gdt[] =
 	GDT_ENTRY(0, 0xFFFFFFFF, 0xF2, GRAN_32_BIT_MODE | GRAN_4KIB_BLOCKS),
 
 	/* 0x28: Task Switch Segment. */
-	GDT_ENTRY(0 /*((uintptr_t) &tss)*/, sizeof(tss) - 1, 0xE9, 0x00),
+	GDT_ENTRY(0 /*((uintptr_t) &tss)*/, sizeof(tss[0]) - 1, 0xE9, 0x00),
 
 	/* 0x30: F Segment. */
 	GDT_ENTRY(0, 0xFFFFFFFF, 0xF2, GRAN_32_BIT_MODE | GRAN_4KIB_BLOCKS),
@@ -219,20 +232,80 @@ struct gdt_entry gdt[] =
 	GDT_ENTRY(0, 0xFFFFFFFF, 0xF2, GRAN_64_BIT_MODE | GRAN_4KIB_BLOCKS),
 
 	/* 0x28: Task Switch Segment. */
-	GDT_ENTRY64((uint64_t) 0 /*((uintptr_t) &tss)*/, sizeof(tss) - 1, 0xE9, 0x00),
+	GDT_ENTRY64((uint64_t) 0 /*((uintptr_t) &tss)*/, sizeof(tss[0]) - 1, 0xE9, 0x00),
 #endif
+	},
 };
 
-uint16_t gdt_size_minus_one = sizeof(gdt) - 1;
+uint16_t gdt_size_minus_one = sizeof(gdt[0]) - 1;
 
 } /* extern "C" */
 
+void InitCPU(size_t cpu, uintptr_t stack_pointer)
+{
+	assert(0 < cpu && cpu < CPU::MAX_CPUS);
+	memcpy(gdt[cpu], gdt[0], sizeof(gdt[cpu]));
+	memcpy(&tss[cpu], &tss[0], sizeof(tss[cpu]));
+#if defined(__i386__)
+	tss[cpu].esp0 = (uint32_t) stack_pointer;
+#elif defined(__x86_64__)
+	tss[cpu].stack0 = (uint64_t) stack_pointer;
+#endif
+
+	// Point the copied descriptor at this processor's task switch segment and
+	// mark it available, as the boot processor's is marked busy once loaded.
+	uintptr_t base = (uintptr_t) &tss[cpu];
+	struct gdt_entry* entry = &gdt[cpu][GDT_TSS_ENTRY];
+	entry->base_low = base >> 0 & 0xFFFF;
+	entry->base_middle = base >> 16 & 0xFF;
+	entry->base_high = base >> 24 & 0xFF;
+	entry->access = 0xE9;
+#if defined(__x86_64__)
+	struct gdt_entry64* entry64 = (struct gdt_entry64*) entry;
+	entry64->base_highest = base >> 32 & 0xFFFFFFFF;
+#endif
+}
+
+void LoadCPU(size_t cpu)
+{
+	assert(cpu < CPU::MAX_CPUS);
+#if defined(__i386__)
+	struct { uint16_t limit; uint32_t base; } __attribute__((packed)) gdtr =
+		{ sizeof(gdt[cpu]) - 1, (uint32_t) gdt[cpu] };
+	asm volatile ("lgdt %0" : : "m"(gdtr));
+	asm volatile ("pushl $0x08\n\t"
+	              "pushl $1f\n\t"
+	              "lret\n"
+	              "1:" : : : "memory");
+#elif defined(__x86_64__)
+	struct { uint16_t limit; uint64_t base; } __attribute__((packed)) gdtr =
+		{ sizeof(gdt[cpu]) - 1, (uint64_t) gdt[cpu] };
+	asm volatile ("lgdt %0" : : "m"(gdtr));
+	asm volatile ("pushq $0x08\n\t"
+	              "leaq 1f(%%rip), %%rax\n\t"
+	              "pushq %%rax\n\t"
+	              "lretq\n"
+	              "1:" : : : "rax", "memory");
+#endif
+	asm volatile ("mov %0, %%ds\n\t"
+	              "mov %0, %%es\n\t"
+	              "mov %0, %%ss" : : "r"((uint16_t) KDS));
+	asm volatile ("ltr %0" : : "r"((uint16_t) (GDT_TSS_ENTRY << 3 | URPL)));
+#if defined(__i386__)
+	asm volatile ("mov %0, %%fs" : : "r"((uint16_t) (GDT_FS_ENTRY << 3 | URPL)));
+	asm volatile ("mov %0, %%gs" : : "r"((uint16_t) (GDT_GS_ENTRY << 3 | URPL)));
+#elif defined(__x86_64__)
+	asm volatile ("mov %0, %%fs\n\t"
+	              "mov %0, %%gs" : : "r"((uint16_t) (UDS | URPL)));
+#endif
+}
+
 uintptr_t GetKernelStack()
 {
 #if defined(__i386__)
-	return tss.esp0;
+	return tss[CPU::GetId()].esp0;
 #elif defined(__x86_64__)
-	return tss.stack0;
+	return tss[CPU::GetId()].stack0;
 #endif
 }
 
@@ -240,16 +313,16 @@ void SetKernelStack(uintptr_t stack_pointer)
 {
 	assert((stack_pointer & 0xF) == 0);
 #if defined(__i386__)
-	tss.esp0 = (uint32_t) stack_pointer;
+	tss[CPU::GetId()].esp0 = (uint32_t) stack_pointer;
 #elif defined(__x86_64__)
-	tss.stack0 = (uint64_t) stack_pointer;
+	tss[CPU::GetId()].stack0 = (uint64_t) stack_pointer;
 #endif
 }
 
 #if defined(__i386__)
 uint32_t GetFSBase()
 {
-	struct gdt_entry* entry = gdt + GDT_FS_ENTRY;
+	struct gdt_entry* entry = gdt[CPU::GetId()] + GDT_FS_ENTRY;
 	return (uint32_t) entry->base_low << 0 |
 	       (uint32_t) entry->base_middle << 16 |
 	       (uint32_t) entry->base_high << 24;
@@ -257,7 +330,7 @@ uint32_t GetFSBase()
 
 uint32_t GetGSBase()
 {
-	struct gdt_entry* entry = gdt + GDT_GS_ENTRY;
+	struct gdt_entry* entry = gdt[CPU::GetId()] + GDT_GS_ENTRY;
 	return (uint32_t) entry->base_low << 0 |
 	       (uint32_t) entry->base_middle << 16 |
 	       (uint32_t) entry->base_high << 24;
@@ -265,7 +338,7 @@ uint32_t GetGSBase()
 
 void SetFSBase(uint32_t fsbase)
 {
-	struct gdt_entry* entry = gdt + GDT_FS_ENTRY;
+	struct gdt_entry* entry = gdt[CPU::GetId()] + GDT_FS_ENTRY;
 	entry->base_low = fsbase >> 0 & 0xFFFF;
 	entry->base_middle = fsbase >> 16 & 0xFF;
 	entry->base_high = fsbase >> 24 & 0xFF;
@@ -274,7 +347,7 @@ void SetFSBase(uint32_t fsbase)
 
 void SetGSBase(uint32_t gsbase)
 {
-	struct gdt_entry* entry = gdt + GDT_GS_ENTRY;
+	struct gdt_entry* entry = gdt[CPU::GetId()] + GDT_GS_ENTRY;
 	entry->base_low = gsbase >> 0 & 0xFFFF;
 	entry->base_middle = gsbase >> 16 & 0xFF;
 	entry->base_high = gsbase >> 24 & 0xFF;
@@ -284,3 +357,21 @@ void SetGSBase(uint32_t gsbase)
 
 } // namespace GDT
 } // namespace Sortix
+
+namespace Sortix {
+namespace CPU {
+
+// The current processor is known by which global descriptor table it loaded.
+size_t GetId()
+{
+#if defined(__i386__)
+	struct { uint16_t limit; uint32_t base; } __attribute__((packed)) gdtr;
+#elif defined(__x86_64__)
+	struct { uint16_t limit; uint64_t base; } __attribute__((packed)) gdtr;
+#endif
+	asm ("sgdt %0" : "=m"(gdtr));
+	return (gdtr.base - (uintptr_t) GDT::gdt) / sizeof(GDT::gdt[0]);
+}
+
+} // namespace CPU
+} // namespace Sortix
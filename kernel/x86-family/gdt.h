@@ -20,12 +20,15 @@
 #ifndef SORTIX_X86_FAMILY_GDT_H
 #define SORTIX_X86_FAMILY_GDT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 namespace Sortix {
 namespace GDT {
 
 void Init();
+void InitCPU(size_t cpu, uintptr_t stack_pointer);
+void LoadCPU(size_t cpu);
 uintptr_t GetKernelStack();
 void SetKernelStack(uintptr_t stack_pointer);
 #if defined(__i386__)
@@ -26,6 +26,7 @@
 #include <sortix/kernel/cpu.h>
 #include <sortix/kernel/interrupt.h>
 #include <sortix/kernel/kernel.h>
+#include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/process.h>
 #include <sortix/kernel/scheduler.h>
 #include <sortix/kernel/signal.h>
@@ -34,6 +35,7 @@
 
 #include "gdt.h"
 #include "idt.h"
+#include "lapic.h"
 #include "pic.h"
 
 extern "C" void isr0();
@@ -87,10 +89,13 @@ extern "C" void irq12();
 extern "C" void irq13();
 extern "C" void irq14();
 extern "C" void irq15();
+extern "C" void isr48();
+extern "C" void isr49();
 extern "C" void interrupt_handler_null();
 extern "C" void syscall_handler();
 extern "C" void yield_cpu_handler();
 extern "C" void thread_exit_handler();
+extern "C" void tlb_shootdown_handler();
 
 namespace Sortix {
 namespace Interrupt {
@@ -131,6 +136,7 @@ static struct interrupt_handler Scheduler__InterruptYieldCPU_handler;
 static struct interrupt_handler Signal__DispatchHandler_handler;
 static struct interrupt_handler Signal__ReturnHandler_handler;
 static struct interrupt_handler Scheduler__ThreadExitCPU_handler;
+static struct interrupt_handler Scheduler__InterruptReschedule_handler;
 
 // Temporarily to see if this is the source of the assertion failure.
 void DispatchHandlerWrap(struct interrupt_context* intctx, void* user)
@@ -238,6 +244,9 @@ void Init()
 	RegisterRawHandler(45, irq13, false, false);
 	RegisterRawHandler(46, irq14, false, false);
 	RegisterRawHandler(47, irq15, false, false);
+	RegisterRawHandler(48, isr48, false, false);
+	RegisterRawHandler(49, isr49, false, false);
+	RegisterRawHandler(50, tlb_shootdown_handler, false, false);
 	RegisterRawHandler(128, syscall_handler, true, true);
 	RegisterRawHandler(129, yield_cpu_handler, true, false);
 	RegisterRawHandler(130, isr130, false, true);
@@ -252,12 +261,21 @@ void Init()
 	RegisterHandler(131, &Signal__ReturnHandler_handler);
 	Scheduler__ThreadExitCPU_handler.handler = Scheduler::ThreadExitCPU;
 	RegisterHandler(132, &Scheduler__ThreadExitCPU_handler);
+	Scheduler__InterruptReschedule_handler.handler =
+		Scheduler::InterruptReschedule;
+	RegisterHandler(IPI_RESCHEDULE, &Scheduler__InterruptReschedule_handler);
 
 	IDT::Set(interrupt_table, NUM_INTERRUPTS);
 
 	Interrupt::Enable();
 }
 
+// The application processors share the interrupt table of the boot processor.
+void InitCPU()
+{
+	IDT::Set(interrupt_table, NUM_INTERRUPTS);
+}
+
 const char* ExceptionName(const struct interrupt_context* intctx)
 {
 	if ( intctx->int_no < NUM_KNOWN_EXCEPTIONS )
@@ -292,6 +310,13 @@ void UserCrashHandler(struct interrupt_context* intctx)
 	// Execute this crash handler with preemption on.
 	Interrupt::Enable();
 
+	// Resolve the page fault if the page is shared copy-on-write or is paged
+	// in on demand.
+	if ( intctx->int_no == 14 /* Page fault */ &&
+	     Memory::HandlePageFault(intctx->cr2, intctx->err_code & 0x2,
+	                             intctx->err_code & 0x1) )
+		return;
+
 	// TODO: Also send signals for other types of user-space crashes.
 	if ( intctx->int_no == 14 /* Page fault */ )
 	{
@@ -354,15 +379,19 @@ extern "C" void interrupt_handler(struct interrupt_context* intctx)
 			iter->handler(intctx, iter->context);
 	}
 
-	// Send an end of interrupt signal to the PICs if we got an IRQ.
+	// Send an end of interrupt signal to the PICs or the local APIC.
 	if ( IRQ0 <= int_no && int_no <= IRQ15 )
 		PIC::SendEOI(int_no - IRQ0);
+	else if ( int_no == LAPIC_TIMER || int_no == IPI_RESCHEDULE )
+		LAPIC::EOI();
 
 	if ( interrupt_worker_thread_boost )
 	{
 		interrupt_worker_thread_boost = false;
 		Scheduler::SwitchTo(intctx, interrupt_worker_thread);
 	}
+	else if ( !is_crash )
+		Scheduler::InterruptPreempt(intctx);
 }
 
 } // namespace Interrupt
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * x86-family/lapic.cpp
+ * Driver for the Local Advanced Programmable Interrupt Controller.
+ */
+
+#include <errno.h>
+#include <msr.h>
+#include <stdint.h>
+
+#include <sortix/mman.h>
+
+#include <sortix/kernel/addralloc.h>
+#include <sortix/kernel/cpuid.h>
+#include <sortix/kernel/interrupt.h>
+#include <sortix/kernel/ioport.h>
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/memorymanagement.h>
+
+#include "lapic.h"
+
+namespace Sortix {
+namespace LAPIC {
+
+static const size_t REG_ID = 0x20;
+static const size_t REG_TPR = 0x80;
+static const size_t REG_EOI = 0xB0;
+static const size_t REG_SVR = 0xF0;
+static const size_t REG_ESR = 0x280;
+static const size_t REG_ICR_LOW = 0x300;
+static const size_t REG_ICR_HIGH = 0x310;
+static const size_t REG_LVT_TIMER = 0x320;
+static const size_t REG_LVT_LINT0 = 0x350;
+static const size_t REG_TIMER_INITIAL = 0x380;
+static const size_t REG_TIMER_CURRENT = 0x390;
+static const size_t REG_TIMER_DIVIDE = 0x3E0;
+
+static const uint32_t SVR_ENABLE = 1 << 8;
+static const uint32_t LVT_MASKED = 1 << 16;
+static const uint32_t LVT_TIMER_PERIODIC = 1 << 17;
+static const uint32_t LVT_TIMER_TSC_DEADLINE = 2 << 17;
+static const uint32_t ICR_FIXED = 0 << 8;
+static const uint32_t ICR_INIT = 5 << 8;
+static const uint32_t ICR_STARTUP = 6 << 8;
+static const uint32_t ICR_DELIVERY_PENDING = 1 << 12;
+static const uint32_t ICR_ASSERT = 1 << 14;
+static const uint32_t TIMER_DIVIDE_16 = 0x3;
+static const uint32_t MSRID_TSC_DEADLINE = 0x6E0;
+static const uint32_t bit_TSC = 1U << 4;
+static const uint32_t bit_TSC_DEADLINE = 1U << 24;
+static const uint32_t bit_INVARIANT_TSC = 1U << 8;
+
+static addralloc_t lapic_alloc;
+static volatile uint32_t* lapic;
+static uint64_t timer_ticks_per_second;
+static uint64_t tsc_ticks_per_second;
+static bool has_tsc;
+static bool has_tsc_deadline;
+static bool has_invariant_tsc;
+
+static uint32_t Read(size_t reg)
+{
+	return lapic[reg / sizeof(uint32_t)];
+}
+
+static void Write(size_t reg, uint32_t value)
+{
+	lapic[reg / sizeof(uint32_t)] = value;
+}
+
+// Count how far the timer and the time stamp counter get while the PIT's second
+// channel counts down 10 ms, which is gated through the keyboard controller's
+// port B rather than raising an interrupt.
+static uint64_t CalibrateTimer()
+{
+	const uint16_t pit_count = 1193180 / 100;
+	bool was_enabled = Interrupt::SetEnabled(false);
+	uint8_t port_b = inport8(0x61);
+	outport8(0x61, (port_b & ~0x02) | 0x01);
+	outport8(0x43, 0xB0);
+	outport8(0x42, pit_count >> 0 & 0xFF);
+	outport8(0x42, pit_count >> 8 & 0xFF);
+	Write(REG_LVT_TIMER, LVT_MASKED);
+	Write(REG_TIMER_DIVIDE, TIMER_DIVIDE_16);
+	Write(REG_TIMER_INITIAL, UINT32_MAX);
+	uint64_t tsc_begun = has_tsc ? ReadTSC() : 0;
+	while ( !(inport8(0x61) & 0x20) )
+		asm volatile ("pause");
+	uint32_t elapsed = UINT32_MAX - Read(REG_TIMER_CURRENT);
+	if ( has_tsc )
+		tsc_ticks_per_second = (ReadTSC() - tsc_begun) * 100;
+	Write(REG_TIMER_INITIAL, 0);
+	outport8(0x61, port_b);
+	Interrupt::SetEnabled(was_enabled);
+	return (uint64_t) elapsed * 100;
+}
+
+bool Init(addr_t physical)
+{
+	if ( !AllocateKernelAddress(&lapic_alloc, Page::Size()) )
+		return false;
+	if ( !Memory::MapPAT(physical, lapic_alloc.from, PROT_KREAD | PROT_KWRITE,
+	                     Memory::PAT_UC) )
+	{
+		FreeKernelAddress(&lapic_alloc);
+		return false;
+	}
+	Memory::Flush();
+	lapic = (volatile uint32_t*) lapic_alloc.from;
+
+	// The boot processor keeps receiving the legacy interrupts from the PICs
+	// through LINT0, as set up by the firmware.
+	Write(REG_TPR, 0);
+	Write(REG_SVR, SVR_ENABLE | Interrupt::LAPIC_SPURIOUS);
+	if ( IsCPUIdSupported() )
+	{
+		uint32_t eax, ebx, ecx, edx;
+		cpuid(1, eax, ebx, ecx, edx);
+		has_tsc = edx & bit_TSC;
+		has_tsc_deadline = has_tsc && (ecx & bit_TSC_DEADLINE);
+		// The time stamp counter only keeps a constant rate across frequency
+		// changes and sleep states if the processor says it's invariant.
+		uint32_t max_extended;
+		cpuid(0x80000000, max_extended, ebx, ecx, edx);
+		if ( has_tsc && 0x80000007 <= max_extended )
+		{
+			cpuid(0x80000007, eax, ebx, ecx, edx);
+			has_invariant_tsc = edx & bit_INVARIANT_TSC;
+		}
+	}
+	if ( !(timer_ticks_per_second = CalibrateTimer()) )
+		return errno = ENODEV, false;
+	return true;
+}
+
+void InitCPU()
+{
+	Write(REG_TPR, 0);
+	Write(REG_LVT_LINT0, LVT_MASKED);
+	Write(REG_ESR, 0);
+	Write(REG_SVR, SVR_ENABLE | Interrupt::LAPIC_SPURIOUS);
+}
+
+uint8_t GetId()
+{
+	return Read(REG_ID) >> 24;
+}
+
+void EOI()
+{
+	Write(REG_EOI, 0);
+}
+
+static void SendCommand(uint8_t apic_id, uint32_t command)
+{
+	while ( Read(REG_ICR_LOW) & ICR_DELIVERY_PENDING )
+		asm volatile ("pause");
+	Write(REG_ICR_HIGH, (uint32_t) apic_id << 24);
+	Write(REG_ICR_LOW, command);
+	while ( Read(REG_ICR_LOW) & ICR_DELIVERY_PENDING )
+		asm volatile ("pause");
+}
+
+void SendIPI(uint8_t apic_id, uint8_t vector)
+{
+	SendCommand(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+void SendInit(uint8_t apic_id)
+{
+	SendCommand(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+void SendStartup(uint8_t apic_id, addr_t trampoline)
+{
+	SendCommand(apic_id, ICR_STARTUP | ICR_ASSERT | (trampoline >> 12 & 0xFF));
+}
+
+void StartTimer(long frequency, uint8_t vector)
+{
+	Write(REG_TIMER_DIVIDE, TIMER_DIVIDE_16);
+	Write(REG_LVT_TIMER, LVT_TIMER_PERIODIC | vector);
+	Write(REG_TIMER_INITIAL, (uint32_t) (timer_ticks_per_second / frequency));
+}
+
+uint64_t GetTSCFrequency()
+{
+	return tsc_ticks_per_second;
+}
+
+bool HasInvariantTSC()
+{
+	return has_invariant_tsc;
+}
+
+void StartOneShotTimer(uint8_t vector)
+{
+	Write(REG_TIMER_DIVIDE, TIMER_DIVIDE_16);
+	if ( has_tsc_deadline )
+		Write(REG_LVT_TIMER, LVT_TIMER_TSC_DEADLINE | vector);
+	else
+		Write(REG_LVT_TIMER, vector);
+}
+
+// Fire the timer once when the time stamp counter reaches the deadline, or
+// disarm it if the deadline is UINT64_MAX. The counting timer can only reach a
+// second ahead, and the caller rearms it if it fires before the deadline.
+void ArmOneShotTimer(uint64_t deadline)
+{
+	if ( has_tsc_deadline )
+	{
+		wrmsr(MSRID_TSC_DEADLINE, deadline == UINT64_MAX ? 0 : deadline);
+		return;
+	}
+	if ( deadline == UINT64_MAX )
+	{
+		Write(REG_TIMER_INITIAL, 0);
+		return;
+	}
+	uint64_t now = ReadTSC();
+	uint64_t cycles = now < deadline ? deadline - now : 0;
+	if ( tsc_ticks_per_second < cycles )
+		cycles = tsc_ticks_per_second;
+	uint64_t ticks = cycles * timer_ticks_per_second / tsc_ticks_per_second;
+	if ( !ticks )
+		ticks = 1;
+	if ( UINT32_MAX < ticks )
+		ticks = UINT32_MAX;
+	Write(REG_TIMER_INITIAL, (uint32_t) ticks);
+}
+
+// The time stamp counter, or otherwise the timer of the boot processor before
+// it's used for anything else, serves as a precise delay while starting the
+// other processors.
+void Delay(unsigned long microseconds)
+{
+	if ( tsc_ticks_per_second )
+	{
+		uint64_t end = ReadTSC() + tsc_ticks_per_second * microseconds / 1000000;
+		while ( ReadTSC() < end )
+			asm volatile ("pause");
+		return;
+	}
+	uint64_t ticks = timer_ticks_per_second * microseconds / 1000000;
+	if ( UINT32_MAX < ticks )
+		ticks = UINT32_MAX;
+	Write(REG_LVT_TIMER, LVT_MASKED);
+	Write(REG_TIMER_DIVIDE, TIMER_DIVIDE_16);
+	Write(REG_TIMER_INITIAL, (uint32_t) ticks);
+	while ( Read(REG_TIMER_CURRENT) )
+		asm volatile ("pause");
+}
+
+} // namespace LAPIC
+} // namespace Sortix
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * x86-family/lapic.h
+ * Driver for the Local Advanced Programmable Interrupt Controller.
+ */
+
+#ifndef SORTIX_X86_FAMILY_LAPIC_H
+#define SORTIX_X86_FAMILY_LAPIC_H
+
+#include <stdint.h>
+
+#include <sortix/kernel/decl.h>
+
+namespace Sortix {
+namespace LAPIC {
+
+__attribute__((unused))
+static inline uint64_t ReadTSC()
+{
+	uint32_t low;
+	uint32_t high;
+	asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+	return (uint64_t) low << 0 | (uint64_t) high << 32;
+}
+
+bool Init(addr_t physical);
+void InitCPU();
+uint8_t GetId();
+void EOI();
+void SendIPI(uint8_t apic_id, uint8_t vector);
+void SendInit(uint8_t apic_id);
+void SendStartup(uint8_t apic_id, addr_t trampoline);
+void StartTimer(long frequency, uint8_t vector);
+uint64_t GetTSCFrequency();
+bool HasInvariantTSC();
+void StartOneShotTimer(uint8_t vector);
+void ArmOneShotTimer(uint64_t deadline);
+void Delay(unsigned long microseconds);
+
+} // namespace LAPIC
+} // namespace Sortix
+
+#endif
@@ -28,6 +28,7 @@
 #include <sortix/kernel/memorymanagement.h>
 #include <sortix/kernel/panic.h>
 #include <sortix/kernel/pat.h>
+#include <sortix/kernel/smp.h>
 #include <sortix/kernel/syscall.h>
 
 #include "multiboot.h"
@@ -427,6 +428,13 @@ void Put(addr_t page, enum page_usage usage)
 	PutUnlocked(page, usage);
 }
 
+void ChangeUsage(addr_t page, enum page_usage from, enum page_usage to)
+{
+	ScopedLock lock(&pagelock);
+	PageUsageRegisterFree(page, from);
+	PageUsageRegisterUse(page, to);
+}
+
 void Lock()
 {
 	kthread_mutex_lock(&pagelock);
@@ -562,6 +570,7 @@ void Flush()
 	addr_t previous;
 	asm ( "mov %%cr3, %0" : "=r"(previous) );
 	asm volatile ( "mov %0, %%cr3" : : "r"(previous) );
+	SMP::FlushTLB();
 }
 
 bool MapRange(addr_t where, size_t bytes, int protection, enum page_usage usage)
@@ -590,8 +599,11 @@ bool UnmapRange(addr_t where, size_t bytes, enum page_usage usage)
 {
 	for ( addr_t page = where; page < where + bytes; page += 4096UL )
 	{
+		// Demand paged memory may not have been faulted in yet.
+		if ( !LookUp(page, NULL, NULL) )
+			continue;
 		addr_t physicalpage = Unmap(page);
-		Page::Put(physicalpage, usage);
+		Page::Release(physicalpage, usage);
 	}
 	return true;
 }
@@ -600,6 +612,10 @@ static bool MapInternal(addr_t physical, addr_t mapto, int prot, addr_t extrafla
 {
 	addr_t flags = ProtectionToPMLFlags(prot) | PML_PRESENT;
 
+	// Shared pages must stay read-only until they have been copied.
+	if ( extraflags & PML_COW )
+		flags &= ~PML_WRITABLE;
+
 	// Translate the virtual address into PML indexes.
 	const size_t MASK = (1<<TRANSBITS)-1;
 	size_t pmlchildid[TOPPMLLEVEL + 1];
@@ -649,32 +665,111 @@ bool Map(addr_t physical, addr_t mapto, int prot)
 	return MapInternal(physical, mapto, prot);
 }
 
+bool MapCopyOnWrite(addr_t physical, addr_t mapto, int prot)
+{
+	return MapInternal(physical, mapto, prot, PML_COW);
+}
+
+bool MapShared(addr_t physical, addr_t mapto, int prot)
+{
+	return MapInternal(physical, mapto, prot, PML_SHARED);
+}
+
+// The flags kept when the protection of a page is changed.
+static const addr_t PML_KEEP = PML_COW | PML_SHARED | PML_DIRTY;
+
+static addr_t* LookUpEntry(addr_t mapto)
+{
+	// Translate the virtual address into PML indexes.
+	const size_t MASK = (1<<TRANSBITS)-1;
+	size_t pmlchildid[TOPPMLLEVEL + 1];
+	for ( size_t i = 1; i <= TOPPMLLEVEL; i++ )
+		pmlchildid[i] = mapto >> (12 + (i-1) * TRANSBITS) & MASK;
+
+	// For each PML level, make sure it exists.
+	size_t offset = 0;
+	for ( size_t i = TOPPMLLEVEL; i > 1; i-- )
+	{
+		size_t childid = pmlchildid[i];
+		PML* pml = PMLS[i] + offset;
+		if ( !(pml->entry[childid] & PML_PRESENT) )
+			return NULL;
+		offset = offset * ENTRIES + childid;
+	}
+
+	addr_t* entry = &(PMLS[1] + offset)->entry[pmlchildid[1]];
+	if ( !(*entry & PML_PRESENT) )
+		return NULL;
+	return entry;
+}
+
 void PageProtect(addr_t mapto, int protection)
 {
-	addr_t phys;
-	if ( !LookUp(mapto, &phys, NULL) )
+	addr_t* entry = LookUpEntry(mapto);
+	if ( !entry )
 		return;
-	Map(phys, mapto, protection);
+	addr_t phys = *entry & PML_ADDRESS;
+	MapInternal(phys, mapto, protection, *entry & PML_KEEP);
 }
 
 void PageProtectAdd(addr_t mapto, int protection)
 {
-	addr_t phys;
-	int prot;
-	if ( !LookUp(mapto, &phys, &prot) )
+	addr_t* entry = LookUpEntry(mapto);
+	if ( !entry )
 		return;
-	prot |= protection;
-	Map(phys, mapto, prot);
+	addr_t phys = *entry & PML_ADDRESS;
+	int prot = PMLFlagsToProtection(*entry & PML_FLAGS) | protection;
+	MapInternal(phys, mapto, prot, *entry & PML_KEEP);
 }
 
 void PageProtectSub(addr_t mapto, int protection)
 {
-	addr_t phys;
-	int prot;
-	if ( !LookUp(mapto, &phys, &prot) )
+	addr_t* entry = LookUpEntry(mapto);
+	if ( !entry )
 		return;
-	prot &= ~protection;
-	Map(phys, mapto, prot);
+	addr_t phys = *entry & PML_ADDRESS;
+	int prot = PMLFlagsToProtection(*entry & PML_FLAGS) & ~protection;
+	MapInternal(phys, mapto, prot, *entry & PML_KEEP);
+}
+
+// Gives the current address space its own writable copy of a copy-on-write
+// page, or takes over the page if it is no longer shared. The fork area is
+// used as a temporary mapping of the new copy.
+bool CopyOnWrite(addr_t mapto, int prot)
+{
+	// process->segment_lock is held.
+	addr_t* entry = LookUpEntry(mapto);
+	if ( !entry )
+		return errno = EFAULT, false;
+	if ( !(*entry & PML_COW) )
+		return *entry & PML_WRITABLE ? true : (errno = EFAULT, false);
+	addr_t phys = *entry & PML_ADDRESS;
+	if ( Page::IsShared(phys) )
+	{
+		addr_t copy = Page::Get(PAGE_USAGE_USER_SPACE);
+		if ( !copy )
+			return false;
+		addr_t copyaddr = (addr_t) (FORKPML + 0);
+		Map(copy, copyaddr, PROT_KREAD | PROT_KWRITE);
+		InvalidatePage(copyaddr);
+		memcpy((void*) copyaddr, (const void*) mapto, Page::Size());
+		Page::Release(phys, PAGE_USAGE_USER_SPACE);
+		phys = copy;
+	}
+	MapInternal(phys, mapto, prot);
+	InvalidatePage(mapto);
+	return true;
+}
+
+bool ClearDirty(addr_t mapto)
+{
+	// process->segment_lock is held.
+	addr_t* entry = LookUpEntry(mapto);
+	if ( !entry || !(*entry & PML_SHARED) || !(*entry & PML_DIRTY) )
+		return false;
+	*entry &= ~PML_DIRTY;
+	InvalidatePage(mapto);
+	return true;
 }
 
 addr_t Unmap(addr_t mapto)
@@ -721,15 +816,13 @@ bool MapPAT(addr_t physical, addr_t mapto, int prot, addr_t mtype)
 	return MapInternal(physical, mapto, prot, extraflags);
 }
 
-void ForkCleanup(size_t i, size_t level)
+static void ForkCleanup(size_t i, size_t level)
 {
 	PML* destpml = FORKPML + level;
-	if ( !i )
-		return;
-	for ( size_t n = 0; n < i-1; n++ )
+	for ( size_t n = 0; n < i; n++ )
 	{
-		addr_t entry = destpml->entry[i];
-		if ( !(entry & PML_FORK ) )
+		addr_t entry = destpml->entry[n];
+		if ( !(entry & PML_PRESENT) || !(entry & PML_FORK) )
 			continue;
 		addr_t phys = entry & PML_ADDRESS;
 		if ( 1 < level )
@@ -737,22 +830,24 @@ void ForkCleanup(size_t i, size_t level)
 			addr_t destaddr = (addr_t) (FORKPML + level-1);
 			Map(phys, destaddr, PROT_KREAD | PROT_KWRITE);
 			InvalidatePage(destaddr);
-			ForkCleanup(ENTRIES+1UL, level-1);
+			ForkCleanup(ENTRIES, level-1);
+			Page::Put(phys, PAGE_USAGE_PAGING_OVERHEAD);
 		}
-		enum page_usage usage = 1 < level ? PAGE_USAGE_PAGING_OVERHEAD
-		                                  : PAGE_USAGE_USER_SPACE;
-		Page::Put(phys, usage);
+		else
+			Page::Release(phys, PAGE_USAGE_USER_SPACE);
 	}
 }
 
-// TODO: Copying every frame is endlessly useless in many uses. It'd be
-// nice to upgrade this to a copy-on-write algorithm.
-bool Fork(size_t level, size_t pmloffset)
+// The user-space pages are shared copy-on-write between the address spaces.
+// Both sides lose write access to the pages and the first write to a page
+// gives the writer its own copy (see CopyOnWrite). Pages of shared mappings
+// stay writable and are simply mapped in both address spaces.
+static bool Fork(size_t level, size_t pmloffset)
 {
 	PML* destpml = FORKPML + level;
 	for ( size_t i = 0; i < ENTRIES; i++ )
 	{
-		addr_t entry = (PMLS[level] + pmloffset)->entry[i];
+		addr_t& entry = (PMLS[level] + pmloffset)->entry[i];
 
 		// Link the entry if it isn't supposed to be forked.
 		if ( !(entry & PML_PRESENT) || !(entry & PML_FORK ) )
@@ -761,9 +856,21 @@ bool Fork(size_t level, size_t pmloffset)
 			continue;
 		}
 
-		enum page_usage usage = 1 < level ? PAGE_USAGE_PAGING_OVERHEAD
-		                                  : PAGE_USAGE_USER_SPACE;
-		addr_t phys = Page::Get(usage);
+		// Share the page between both address spaces.
+		if ( level == 1 )
+		{
+			if ( !Page::Share(entry & PML_ADDRESS) )
+			{
+				ForkCleanup(i, level);
+				return false;
+			}
+			if ( !(entry & PML_SHARED) )
+				entry = (entry & ~PML_WRITABLE) | PML_COW;
+			destpml->entry[i] = entry;
+			continue;
+		}
+
+		addr_t phys = Page::Get(PAGE_USAGE_PAGING_OVERHEAD);
 		if ( unlikely(!phys) )
 		{
 			ForkCleanup(i, level);
@@ -780,24 +887,12 @@ bool Fork(size_t level, size_t pmloffset)
 
 		size_t offset = pmloffset * ENTRIES + i;
 
-		if ( 1 < level )
+		if ( !Fork(level-1, offset) )
 		{
-			if ( !Fork(level-1, offset) )
-			{
-				Page::Put(phys, usage);
-				ForkCleanup(i, level);
-				return false;
-			}
-			continue;
+			Page::Put(phys, PAGE_USAGE_PAGING_OVERHEAD);
+			ForkCleanup(i, level);
+			return false;
 		}
-
-		// Determine the source page's address.
-		const void* src = (const void*) (offset * 4096UL);
-
-		// Determine the destination page's address.
-		void* dest = (void*) (FORKPML + level - 1);
-
-		memcpy(dest, src, 4096UL);
 	}
 
 	return true;
@@ -842,6 +937,10 @@ addr_t Fork()
 		(FORKPML + i)->entry[ENTRIES-1] = dir | flags;
 		childaddr = (FORKPML + i)->entry[ENTRIES-2] & PML_ADDRESS;
 	}
+
+	// The pages shared with the child were made read-only.
+	Flush();
+
 	return dir;
 }
 
@@ -39,11 +39,14 @@ const addr_t PML_WRITABLE   = 1 << 1;
 const addr_t PML_USERSPACE  = 1 << 2;
 const addr_t PML_WRTHROUGH  = 1 << 3;
 const addr_t PML_NOCACHE    = 1 << 4;
+const addr_t PML_DIRTY      = 1 << 6;
 const addr_t PML_PAT        = 1 << 7;
 const addr_t PML_AVAILABLE1 = 1 << 9;
 const addr_t PML_AVAILABLE2 = 1 << 10;
 const addr_t PML_AVAILABLE3 = 1 << 11;
 const addr_t PML_FORK       = PML_AVAILABLE1;
+const addr_t PML_COW        = PML_AVAILABLE2; // Shared, copy on write.
+const addr_t PML_SHARED     = PML_AVAILABLE3; // Shared, writes are shared.
 #ifdef __x86_64__
 const addr_t PML_NX         = 1UL << 63;
 #else
@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * x86-family/smp.cpp
+ * Symmetric multiprocessing.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sortix/kernel/cpu.h>
+#include <sortix/kernel/interrupt.h>
+#include <sortix/kernel/kernel.h>
+#include <sortix/kernel/memorymanagement.h>
+#include <sortix/kernel/pat.h>
+#include <sortix/kernel/process.h>
+#include <sortix/kernel/scheduler.h>
+#include <sortix/kernel/signal.h>
+#include <sortix/kernel/smp.h>
+#include <sortix/kernel/thread.h>
+#include <sortix/kernel/time.h>
+
+#include "acpi.h"
+#include "gdt.h"
+#include "lapic.h"
+
+extern "C" uint8_t smp_trampoline_start[];
+extern "C" uint8_t smp_trampoline_cr3[];
+extern "C" uint8_t smp_trampoline_stack[];
+extern "C" uint8_t smp_trampoline_end[];
+
+namespace Sortix {
+namespace SMP {
+
+static const addr_t TRAMPOLINE = 0x8000;
+static const size_t IDLE_STACK_SIZE = 16 * 1024;
+
+struct cpu_state
+{
+	uint8_t exit_stack[1024];
+	unsigned long signal_pending;
+	unsigned long is_cpu_interrupted;
+	int kerrno;
+	uint8_t apic_id;
+	volatile bool online;
+	volatile addr_t user_addrspace;
+	volatile size_t tlb_generation;
+} __attribute__((aligned(64)));
+
+static struct cpu_state cpu_states[CPU::MAX_CPUS];
+static size_t cpu_count = 1;
+static volatile size_t booting_cpu;
+
+// The kernel is a ticket lock that is initially owned by the boot processor.
+static volatile size_t kernel_next_ticket = 1;
+static volatile size_t kernel_serving_ticket = 0;
+static volatile size_t kernel_owner = 0;
+
+// Each processor remembers the last translation lookaside buffer generation it
+// flushed and must flush again whenever the page tables have since changed.
+static volatile size_t tlb_generation = 0;
+
+static void ReloadTLB()
+{
+	addr_t addrspace;
+	asm volatile ("mov %%cr3, %0" : "=r"(addrspace));
+	asm volatile ("mov %0, %%cr3" : : "r"(addrspace) : "memory");
+}
+
+static void CatchUpTLB(struct cpu_state* state)
+{
+	size_t generation = __atomic_load_n(&tlb_generation, __ATOMIC_ACQUIRE);
+	if ( state->tlb_generation == generation )
+		return;
+	ReloadTLB();
+	__atomic_store_n(&state->tlb_generation, generation, __ATOMIC_RELEASE);
+}
+
+static void AcquireKernel(size_t cpu)
+{
+	struct cpu_state* state = &cpu_states[cpu];
+	size_t ticket = __atomic_fetch_add(&kernel_next_ticket, 1, __ATOMIC_RELAXED);
+	while ( __atomic_load_n(&kernel_serving_ticket, __ATOMIC_ACQUIRE) != ticket )
+	{
+		// The owner may be waiting for this processor to flush its
+		// translation lookaside buffer, which it can't do with interrupts
+		// disabled.
+		CatchUpTLB(state);
+		asm volatile ("pause");
+	}
+	kernel_owner = cpu;
+	state->user_addrspace = 0;
+	CatchUpTLB(state);
+	errno = state->kerrno;
+	asm_signal_is_pending = state->signal_pending;
+	Interrupt::asm_is_cpu_interrupted = state->is_cpu_interrupted;
+}
+
+static void ReleaseKernel(size_t cpu, addr_t user_addrspace)
+{
+	struct cpu_state* state = &cpu_states[cpu];
+	state->kerrno = errno;
+	state->signal_pending = asm_signal_is_pending;
+	state->is_cpu_interrupted = Interrupt::asm_is_cpu_interrupted;
+	state->user_addrspace = user_addrspace;
+	kernel_owner = SIZE_MAX;
+	size_t ticket = kernel_serving_ticket;
+	__atomic_store_n(&kernel_serving_ticket, ticket + 1, __ATOMIC_RELEASE);
+}
+
+extern "C" void smp_enter_kernel()
+{
+	bool was_enabled = Interrupt::SetEnabled(false);
+	size_t cpu = CPU::GetId();
+	if ( kernel_owner != cpu )
+		AcquireKernel(cpu);
+	Interrupt::SetEnabled(was_enabled);
+}
+
+extern "C" uintptr_t smp_leave_kernel_interrupt(const void* context,
+                                                size_t size)
+{
+	struct cpu_state* state = &cpu_states[CPU::GetId()];
+	uintptr_t stack = (uintptr_t) state->exit_stack + sizeof(state->exit_stack);
+	stack = (stack - size) & ~(uintptr_t) 0xF;
+	memcpy((void*) stack, context, size);
+	return stack;
+}
+
+extern "C" void smp_leave_kernel()
+{
+	addr_t addrspace;
+	asm ("mov %%cr3, %0" : "=r"(addrspace));
+	ReleaseKernel(CPU::GetId(), addrspace);
+}
+
+extern "C" void smp_tlb_shootdown_interrupt()
+{
+	CatchUpTLB(&cpu_states[CPU::GetId()]);
+	LAPIC::EOI();
+}
+
+void Idle()
+{
+	Interrupt::Disable();
+	size_t cpu = CPU::GetId();
+	if ( kernel_owner == cpu )
+		ReleaseKernel(cpu, 0);
+	asm volatile ("sti\n\thlt");
+}
+
+void YieldKernel()
+{
+	if ( cpu_count == 1 )
+		return;
+	bool was_enabled = Interrupt::SetEnabled(false);
+	size_t cpu = CPU::GetId();
+	assert(kernel_owner == cpu);
+	size_t next = __atomic_load_n(&kernel_next_ticket, __ATOMIC_RELAXED);
+	if ( next - kernel_serving_ticket != 1 )
+	{
+		ReleaseKernel(cpu, 0);
+		AcquireKernel(cpu);
+	}
+	Interrupt::SetEnabled(was_enabled);
+}
+
+bool IsOnline(size_t cpu)
+{
+	return cpu < CPU::MAX_CPUS && cpu_states[cpu].online;
+}
+
+void Reschedule(size_t cpu)
+{
+	if ( cpu != CPU::GetId() && IsOnline(cpu) )
+		LAPIC::SendIPI(cpu_states[cpu].apic_id, Interrupt::IPI_RESCHEDULE);
+}
+
+// The processor doesn't own the kernel, so its saved value is the one that
+// is loaded the next time it enters the kernel.
+void SetSignalPending(size_t cpu, unsigned long is_pending)
+{
+	assert(cpu != CPU::GetId());
+	cpu_states[cpu].signal_pending = is_pending;
+}
+
+void FlushTLB()
+{
+	size_t self = CPU::GetId();
+	size_t generation =
+		__atomic_add_fetch(&tlb_generation, 1, __ATOMIC_SEQ_CST);
+	cpu_states[self].tlb_generation = generation;
+	if ( cpu_count == 1 )
+		return;
+
+	// Only processors running user-space in this address space can be using
+	// the old translations, the others flush when entering the kernel.
+	addr_t addrspace;
+	asm ("mov %%cr3, %0" : "=r"(addrspace));
+	bool notified[CPU::MAX_CPUS];
+	for ( size_t cpu = 0; cpu < cpu_count; cpu++ )
+	{
+		notified[cpu] = cpu != self && cpu_states[cpu].online &&
+		                cpu_states[cpu].user_addrspace == addrspace;
+		if ( notified[cpu] )
+			LAPIC::SendIPI(cpu_states[cpu].apic_id,
+			               Interrupt::IPI_TLB_SHOOTDOWN);
+	}
+	for ( size_t cpu = 0; cpu < cpu_count; cpu++ )
+	{
+		if ( !notified[cpu] )
+			continue;
+		while ( __atomic_load_n(&cpu_states[cpu].tlb_generation,
+		                        __ATOMIC_ACQUIRE) < generation )
+			asm volatile ("pause");
+	}
+}
+
+extern "C" void smp_ap_main()
+{
+	size_t cpu = booting_cpu;
+	GDT::LoadCPU(cpu);
+	Interrupt::InitCPU();
+	if ( IsPATSupported() )
+		InitializePAT();
+	LAPIC::InitCPU();
+	Time::StartCPU();
+	cpu_states[cpu].tlb_generation =
+		__atomic_load_n(&tlb_generation, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&cpu_states[cpu].online, true, __ATOMIC_RELEASE);
+	// Become the idle thread of this processor, which first enters the kernel
+	// when the scheduler runs on the next timer interrupt.
+	while ( true )
+		Idle();
+}
+
+static bool StartCPU(size_t cpu, uint8_t apic_id)
+{
+	Thread* idle_thread = new Thread();
+	if ( !idle_thread )
+		return false;
+	uint8_t* stack = new uint8_t[IDLE_STACK_SIZE];
+	if ( !stack )
+		return delete idle_thread, false;
+	idle_thread->name = "idle";
+	idle_thread->process = Scheduler::GetKernelProcess();
+	idle_thread->kernelstackpos = (addr_t) stack;
+	idle_thread->kernelstacksize = IDLE_STACK_SIZE;
+	idle_thread->kernelstackmalloced = true;
+	uintptr_t stack_top = ((uintptr_t) stack + IDLE_STACK_SIZE) & ~0xFUL;
+
+	GDT::InitCPU(cpu, stack_top);
+	Scheduler::SetIdleThread(idle_thread, cpu);
+	cpu_states[cpu].apic_id = apic_id;
+	cpu_states[cpu].signal_pending = 0;
+	cpu_states[cpu].is_cpu_interrupted = 0;
+	cpu_states[cpu].kerrno = 0;
+
+	uintptr_t* trampoline_cr3 = (uintptr_t*)
+		(TRAMPOLINE + (smp_trampoline_cr3 - smp_trampoline_start));
+	uintptr_t* trampoline_stack = (uintptr_t*)
+		(TRAMPOLINE + (smp_trampoline_stack - smp_trampoline_start));
+	*trampoline_cr3 = idle_thread->process->addrspace;
+	*trampoline_stack = stack_top;
+	booting_cpu = cpu;
+
+	// The INIT and startup sequence from the MultiProcessor Specification.
+	LAPIC::SendInit(apic_id);
+	LAPIC::Delay(10000);
+	for ( int i = 0; i < 2 && !IsOnline(cpu); i++ )
+	{
+		LAPIC::SendStartup(apic_id, TRAMPOLINE);
+		LAPIC::Delay(200);
+	}
+	for ( int i = 0; i < 1000 && !IsOnline(cpu); i++ )
+		LAPIC::Delay(1000);
+	if ( IsOnline(cpu) )
+		return true;
+
+	// Put the processor back into the wait for startup state so it doesn't
+	// come online later with resources that are reused.
+	LAPIC::SendInit(apic_id);
+	Scheduler::SetIdleThread(NULL, cpu);
+	return false;
+}
+
+void Init()
+{
+	struct ACPI::madt_info madt;
+	if ( !ACPI::ReadMADT(&madt) )
+		return;
+	if ( !LAPIC::Init(madt.lapic_address) )
+	{
+		Log::PrintF("kernel: Failed to initialize the local APIC\n");
+		return;
+	}
+	uint8_t boot_apic_id = LAPIC::GetId();
+	cpu_states[0].apic_id = boot_apic_id;
+	cpu_states[0].online = true;
+	cpu_states[0].tlb_generation = tlb_generation;
+	Time::StartCPU();
+
+	// The trampoline is temporarily copied into the identity mapped low
+	// memory, where the real mode code can reach it.
+	size_t trampoline_size = smp_trampoline_end - smp_trampoline_start;
+	assert(trampoline_size <= Page::Size());
+	static uint8_t saved_page[4096];
+	memcpy(saved_page, (void*) TRAMPOLINE, trampoline_size);
+	memcpy((void*) TRAMPOLINE, smp_trampoline_start, trampoline_size);
+
+	for ( size_t i = 0; i < madt.apic_ids_count; i++ )
+	{
+		if ( madt.apic_ids[i] == boot_apic_id || cpu_count == CPU::MAX_CPUS )
+			continue;
+		// The processor is only counted once online, as only then can it be
+		// waited upon when flushing the translation lookaside buffers.
+		if ( StartCPU(cpu_count, madt.apic_ids[i]) )
+			cpu_count++;
+	}
+
+	memcpy((void*) TRAMPOLINE, saved_page, trampoline_size);
+}
+
+} // namespace SMP
+} // namespace Sortix
+
+namespace Sortix {
+namespace CPU {
+
+size_t GetCount()
+{
+	return SMP::cpu_count;
+}
+
+} // namespace CPU
+} // namespace Sortix
@@ -33,6 +33,8 @@
 #include <sortix/kernel/thread.h>
 #include <sortix/kernel/time.h>
 
+#include "lapic.h"
+
 namespace Sortix {
 namespace Time {
 
@@ -71,13 +73,132 @@ extern Clock* realtime_clock;
 extern Clock* uptime_clock;
 
 struct interrupt_handler timer_interrupt_registration;
+struct interrupt_handler cpu_timer_interrupt_registration;
 
 static struct timespec tick_period;
 static long tick_frequency;
 static uint16_t tick_divisor;
 
+// If the processors have an invariant time stamp counter and a local APIC, the
+// kernel is tickless: The clocks are advanced from the time stamp counter
+// whenever read, and each processor arms its local APIC timer in one-shot mode
+// for the earliest clock timer, and for the end of the time slice only while
+// it's running a thread. Idle processors are thus only woken when needed. A
+// time stamp counter that changes rate with the processor frequency or stops in
+// sleep states can't keep time, so the PIT and the periodic local APIC timers
+// keep ticking instead.
+static bool tickless;
+static uint64_t tsc_frequency;
+static uint64_t slice_cycles;
+static uint64_t clock_base_tsc;
+static struct timespec clock_accounted;
+static bool clock_refreshing;
+static uint64_t cpu_deadline[CPU::MAX_CPUS];
+static uint64_t cpu_account_tsc[CPU::MAX_CPUS];
+static bool cpu_busy[CPU::MAX_CPUS];
+
+static struct timespec TimespecOfCycles(uint64_t cycles)
+{
+	uint64_t seconds = cycles / tsc_frequency;
+	uint64_t remainder = cycles % tsc_frequency;
+	uint64_t nanoseconds = remainder * 1000000000ULL / tsc_frequency;
+	return timespec_make((time_t) seconds, (long) nanoseconds);
+}
+
+static uint64_t CyclesOfTimespec(struct timespec ts)
+{
+	if ( ts.tv_sec < 0 )
+		return 0;
+	// Far away deadlines are rounded down and rearmed when they're reached.
+	if ( 3600 < ts.tv_sec )
+		ts = timespec_make(3600, 0);
+	return (uint64_t) ts.tv_sec * tsc_frequency +
+	       (uint64_t) ts.tv_nsec * tsc_frequency / 1000000000ULL;
+}
+
+// Arm this processor's timer unless it will already fire before the deadline.
+static void ArmCPU(uint64_t deadline)
+{
+	size_t cpu = CPU::GetId();
+	if ( cpu_deadline[cpu] <= deadline )
+		return;
+	cpu_deadline[cpu] = deadline;
+	LAPIC::ArmOneShotTimer(deadline);
+}
+
+static void ArmClockTimers()
+{
+	struct timespec delay;
+	uint64_t now = LAPIC::ReadTSC();
+	if ( uptime_clock->GetNextExpiry(&delay) )
+		ArmCPU(now + CyclesOfTimespec(delay));
+	if ( realtime_clock->GetNextExpiry(&delay) )
+		ArmCPU(now + CyclesOfTimespec(delay));
+}
+
+static void OnClockTimer(struct timespec delay)
+{
+	bool was_enabled = Interrupt::SetEnabled(false);
+	ArmCPU(LAPIC::ReadTSC() + CyclesOfTimespec(delay));
+	Interrupt::SetEnabled(was_enabled);
+}
+
+// Advance the clocks to the time stamp counter, which may fire timers that
+// read the clocks again.
+static void RefreshClocks()
+{
+	bool was_enabled = Interrupt::SetEnabled(false);
+	if ( !clock_refreshing )
+	{
+		clock_refreshing = true;
+		uint64_t now_tsc = LAPIC::ReadTSC();
+		// The time stamp counters of the processors might be slightly apart.
+		if ( clock_base_tsc < now_tsc )
+		{
+			struct timespec now = TimespecOfCycles(now_tsc - clock_base_tsc);
+			if ( timespec_lt(clock_accounted, now) )
+			{
+				struct timespec elapsed = timespec_sub(now, clock_accounted);
+				clock_accounted = now;
+				realtime_clock->Advance(elapsed);
+				uptime_clock->Advance(elapsed);
+			}
+		}
+		clock_refreshing = false;
+	}
+	Interrupt::SetEnabled(was_enabled);
+}
+
+// Charge the time since the last charge to the thread running on this
+// processor.
+static void AccountCPU(bool system_mode)
+{
+	size_t cpu = CPU::GetId();
+	uint64_t now = LAPIC::ReadTSC();
+	uint64_t last = cpu_account_tsc[cpu];
+	if ( now <= last )
+		return;
+	cpu_account_tsc[cpu] = now;
+	OnCPUTick(TimespecOfCycles(now - last), system_mode);
+}
+
+void OnCPUSwitch(bool system_mode, bool idle)
+{
+	if ( !tickless )
+		return;
+	AccountCPU(system_mode);
+	size_t cpu = CPU::GetId();
+	cpu_busy[cpu] = !idle;
+	if ( !idle )
+		ArmCPU(LAPIC::ReadTSC() + slice_cycles);
+}
+
 static void OnIRQ0(struct interrupt_context* intctx, void* /*user*/)
 {
+	// The PIT may tick one last time after switching to the local APIC timer.
+	if ( tickless )
+		return;
+
 	OnTick(tick_period, !InUserspace(intctx));
 	Scheduler::Switch(intctx);
 
@@ -92,6 +213,27 @@ static void OnIRQ0(struct interrupt_context* intctx, void* /*user*/)
 		did_ugly_irq0_hack = true;
 }
 
+// If the kernel isn't tickless, the application processors tick using their
+// local APIC timer, while only the boot processor advances the system clocks.
+static void OnCPUTimer(struct interrupt_context* intctx, void* /*user*/)
+{
+	if ( !tickless )
+	{
+		OnCPUTick(tick_period, !InUserspace(intctx));
+		Scheduler::Switch(intctx);
+		return;
+	}
+
+	size_t cpu = CPU::GetId();
+	cpu_deadline[cpu] = UINT64_MAX;
+	RefreshClocks();
+	AccountCPU(!InUserspace(intctx));
+	Scheduler::Switch(intctx);
+	ArmClockTimers();
+	if ( cpu_busy[cpu] )
+		ArmCPU(LAPIC::ReadTSC() + slice_cycles);
+}
+
 void CPUInit()
 {
 	// Estimate the rate that interrupts will be coming at.
@@ -137,9 +279,58 @@ void Start()
 	timer_interrupt_registration.context = 0;
 	Interrupt::RegisterHandler(Interrupt::IRQ0, &timer_interrupt_registration);
 
+	cpu_timer_interrupt_registration.handler = OnCPUTimer;
+	cpu_timer_interrupt_registration.context = 0;
+	Interrupt::RegisterHandler(Interrupt::LAPIC_TIMER,
+	                           &cpu_timer_interrupt_registration);
+
 	// Request a timer interrupt now that we can handle them safely.
 	RequestIRQ0(tick_divisor);
 }
 
+// The boot processor calls this once its local APIC is available, before the
+// other processors are started, to decide whether the kernel is tickless.
+void StartCPU()
+{
+	size_t cpu = CPU::GetId();
+	bool was_enabled = Interrupt::SetEnabled(false);
+	if ( cpu == 0 && !LAPIC::GetTSCFrequency() )
+		Log::PrintF("kernel: No time stamp counter, ticking at %li Hz\n",
+		            tick_frequency);
+	else if ( cpu == 0 && !LAPIC::HasInvariantTSC() )
+		Log::PrintF("kernel: Time stamp counter isn't invariant, "
+		            "ticking at %li Hz\n", tick_frequency);
+	else if ( cpu == 0 )
+	{
+		tsc_frequency = LAPIC::GetTSCFrequency();
+		Log::PrintF("kernel: Tickless with invariant time stamp counter "
+		            "at %ju kHz\n", (uintmax_t) (tsc_frequency / 1000));
+		// Stop the PIT by giving it a new mode without an initial count.
+		outport8(0x43, 0x30);
+		clock_base_tsc = LAPIC::ReadTSC();
+		clock_accounted = timespec_nul();
+		slice_cycles = CyclesOfTimespec(tick_period);
+		tickless = true;
+		struct timespec resolution = timespec_make(0, 1);
+		realtime_clock->Set(NULL, &resolution);
+		uptime_clock->Set(NULL, &resolution);
+		realtime_clock->SetEventCallbacks(RefreshClocks, OnClockTimer);
+		uptime_clock->SetEventCallbacks(RefreshClocks, OnClockTimer);
+		cpu_busy[cpu] = true;
+	}
+	if ( tickless )
+	{
+		cpu_deadline[cpu] = UINT64_MAX;
+		cpu_account_tsc[cpu] = LAPIC::ReadTSC();
+		LAPIC::StartOneShotTimer(Interrupt::LAPIC_TIMER);
+		ArmClockTimers();
+		if ( cpu_busy[cpu] )
+			ArmCPU(LAPIC::ReadTSC() + slice_cycles);
+	}
+	else if ( cpu != 0 )
+		LAPIC::StartTimer(tick_frequency, Interrupt::LAPIC_TIMER);
+	Interrupt::SetEnabled(was_enabled);
+}
+
 } // namespace Time
 } // namespace Sortix
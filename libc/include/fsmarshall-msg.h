@@ -39,6 +39,8 @@ extern "C" {
 #define FSM_MOUNT_CLOFORK (1 << 1)
 #define FSM_MOUNT_NOFOLLOW (1 << 2)
 #define FSM_MOUNT_NONBLOCK (1 << 3)
+#define FSM_MOUNT_MULTIPLEX (1 << 4)
+#define FSM_MOUNT_CACHE (1 << 5)
 
 struct fsm_msg_header
 {
@@ -46,6 +48,7 @@ struct fsm_msg_header
 	size_t msgsize;
 	uid_t uid;
 	gid_t gid;
+	size_t request_id;
 };
 
 #define FSM_RESP_ERROR 0
@@ -497,7 +500,17 @@ struct fsm_req_shutdown
 	int how;
 };
 
-#define FSM_MSG_NUM 64
+/* Sent unrequested on a multiplexed session when the server changes the
+   directory entry, or the inode if namelen is zero, without being asked. */
+#define FSM_NOTIFY_INVALIDATE 64
+struct fsm_notify_invalidate
+{
+	ino_t ino;
+	size_t namelen;
+	/*char name[namelen];*/
+};
+
+#define FSM_MSG_NUM 65
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -36,6 +36,7 @@
 #define IF_TYPE_ETHERNET 2
 
 #define IF_FEATURE_ETHERNET_CRC_OFFLOAD (1 << 0)
+#define IF_FEATURE_SCATTER_GATHER (1 << 1)
 
 struct if_info
 {
@@ -67,10 +68,16 @@ struct if_config_inet
 	struct in_addr subnet;
 };
 
+struct if_config_loopback
+{
+	unsigned int loss;
+};
+
 struct if_config
 {
 	struct if_config_ether ether;
 	struct if_config_inet inet;
+	struct if_config_loopback loopback;
 };
 #endif
 
@@ -76,6 +76,22 @@ struct tcphdr
 #define TCPOPT_MAXSEG 2 /* Maximum Segment Size. */
 #define TCPOLEN_MAXSEG 4 /* Length of Maximum Segment Size. */
 
+#define TCPOPT_WINDOW 3 /* Window Scale. */
+#define TCPOLEN_WINDOW 3 /* Length of Window Scale. */
+
+#define TCPOPT_SACK_PERMITTED 4 /* Selective Acknowledgment permitted. */
+#define TCPOLEN_SACK_PERMITTED 2 /* Length of SACK permitted. */
+
+#define TCPOPT_SACK 5 /* Selective Acknowledgment. */
+#define TCPOLEN_SACK 8 /* Length of a Selective Acknowledgment block. */
+#define TCP_MAX_SACK 4 /* Maximum number of Selective Acknowledgment blocks. */
+
+#define TCPOPT_TIMESTAMP 8 /* Timestamps. */
+#define TCPOLEN_TIMESTAMP 10 /* Length of Timestamps. */
+#define TCPOLEN_TSTAMP_APPA 12 /* Length of Timestamps with two NOPs. */
+
+#define TCP_MAX_WINSHIFT 14 /* Maximum Window Scale shift count. */
+
 /* Maximum header size: 16 * 4 bytes */
 #define TCP_MAXHLEN 64
 
@@ -90,6 +106,38 @@ struct tcphdr
 #if __USE_SORTIX
 #define TCP_MAXSEG 2
 #define TCP_NOPUSH 3
+#define TCP_INFO 4
+#endif
+
+#if __USE_SORTIX
+/* Flags in struct tcp_info tcpi_options. */
+#define TCPI_OPT_TIMESTAMPS (1 << 0) /* Timestamps are used. */
+#define TCPI_OPT_SACK (1 << 1) /* Selective acknowledgments are used. */
+#define TCPI_OPT_WSCALE (1 << 2) /* Window scaling is used. */
+
+/* Connection statistics returned by the TCP_INFO socket option. */
+struct tcp_info
+{
+	uint8_t tcpi_options; /* TCPI_OPT_* flags. */
+	uint8_t tcpi_snd_wscale; /* Window scale shift of the remote. */
+	uint8_t tcpi_rcv_wscale; /* Window scale shift of this socket. */
+	uint32_t tcpi_rto; /* Retransmission timeout in microseconds. */
+	uint32_t tcpi_rtt; /* Smoothed round trip time in microseconds. */
+	uint32_t tcpi_rttvar; /* Round trip time variation in microseconds. */
+	uint32_t tcpi_snd_mss; /* Maximum segment size to the remote. */
+	uint32_t tcpi_snd_cwnd; /* Congestion window in bytes. */
+	uint32_t tcpi_snd_ssthresh; /* Slow start threshold in bytes. */
+	uint32_t tcpi_snd_wnd; /* Window of the remote in bytes. */
+	uint32_t tcpi_rcv_wnd; /* Window of this socket in bytes. */
+	uint64_t tcpi_bytes_acked; /* Bytes sent and acknowledged. */
+	uint64_t tcpi_bytes_received; /* Bytes received in order. */
+	uint64_t tcpi_segs_out; /* Segments sent. */
+	uint64_t tcpi_segs_in; /* Segments received. */
+	uint64_t tcpi_total_retrans; /* Segments retransmitted. */
+	uint64_t tcpi_timeouts; /* Retransmission timeouts. */
+	uint64_t tcpi_fast_retrans; /* Fast retransmissions. */
+	uint64_t tcpi_dupacks; /* Duplicate acknowledgements received. */
+};
 #endif
 
 #endif
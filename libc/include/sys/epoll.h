@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * sys/epoll.h
+ * Scalable input/output event notification.
+ */
+
+#ifndef _INCLUDE_SYS_EPOLL_H
+#define _INCLUDE_SYS_EPOLL_H
+
+#include <sys/cdefs.h>
+
+#include <sortix/epoll.h>
+#include <sortix/sigset.h>
+#include <sortix/timespec.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int epoll_create(int);
+int epoll_create1(int);
+int epoll_ctl(int, int, int, struct epoll_event*);
+int epoll_pwait(int, struct epoll_event*, int, int, const sigset_t*);
+int epoll_pwait2(int, struct epoll_event*, int, const struct timespec*,
+                 const sigset_t*);
+int epoll_wait(int, struct epoll_event*, int, int);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -48,6 +48,7 @@ typedef __off_t off_t;
 
 void* mmap(void*, size_t, int, int, int, off_t);
 int mprotect(const void*, size_t, int);
+int msync(void*, size_t, int);
 int munmap(void*, size_t);
 
 #ifdef __cplusplus
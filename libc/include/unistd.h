@@ -347,6 +347,8 @@ extern "C" {
 #define _SC_XOPEN_UNIX 132
 #define _SC_XOPEN_UUCP 133
 #define _SC_XOPEN_VERSION 134
+#define _SC_NPROCESSORS_CONF 135
+#define _SC_NPROCESSORS_ONLN 136
 
 #define STDIN_FILENO 0
 #define STDOUT_FILENO 1
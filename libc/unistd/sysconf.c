@@ -17,11 +17,22 @@
  * Get configuration information at runtime.
  */
 
+#include <sys/kernelinfo.h>
+
 #include <errno.h>
 #include <stdio.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <unistd.h>
 
+static long processor_count(void)
+{
+	char count[sizeof(long) * 3];
+	if ( kernelinfo("cpus", count, sizeof(count)) != 0 )
+		return 1;
+	return strtol(count, NULL, 10);
+}
+
 long sysconf(int name)
 {
 	switch ( name )
@@ -34,6 +45,8 @@ long sysconf(int name)
 	case _SC_GETGR_R_SIZE_MAX: return -1;
 	case _SC_GETPW_R_SIZE_MAX: return -1;
 	case _SC_MONOTONIC_CLOCK: return _POSIX_MONOTONIC_CLOCK;
+	case _SC_NPROCESSORS_CONF: case _SC_NPROCESSORS_ONLN:
+		return processor_count();
 	default:
 		fprintf(stderr, "%s:%u warning: %s(%i) is unsupported\n",
 		        __FILE__, __LINE__, __func__, name);
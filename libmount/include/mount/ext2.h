@@ -38,6 +38,7 @@
 #define EXT2_FEATURE_INCOMPAT_RECOVER (1U << 2U)
 #define EXT2_FEATURE_INCOMPAT_JOURNAL_DEV (1U << 3U)
 #define EXT2_FEATURE_INCOMPAT_META_BG (1U << 4U)
+#define EXT4_FEATURE_INCOMPAT_EXTENTS (1U << 6U)
 #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER (1U << 0U)
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE (1U << 1U)
 #define EXT2_FEATURE_RO_COMPAT_BTREE_DIR (1U << 2U)
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-dentry-cache.c
+ * Tests whether lookups and stat see changes to the directory entries.
+ */
+
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test.h"
+
+static char dir[] = "/tmp/test-dentry-cache.XXXXXX";
+static bool made_dir = false;
+
+static void cleanup(void)
+{
+	if ( !made_dir )
+		return;
+	const char* names[] = { "a", "b", "c", "e", "d/x" };
+	for ( size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++ )
+	{
+		char path[sizeof(dir) + 8];
+		snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+		unlink(path);
+	}
+	char path[sizeof(dir) + 8];
+	snprintf(path, sizeof(path), "%s/d", dir);
+	rmdir(path);
+	rmdir(dir);
+}
+
+static bool exists(int dirfd, const char* name, struct stat* st)
+{
+	int ret = fstatat(dirfd, name, st, 0);
+	test_assert(ret == 0 || errno == ENOENT);
+	return ret == 0;
+}
+
+int main(void)
+{
+	test_assert(atexit(cleanup) == 0);
+	test_assert(mkdtemp(dir));
+	made_dir = true;
+	int dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+	test_assert(0 <= dirfd);
+
+	// A missing file appears once created.
+	struct stat st;
+	test_assertx(!exists(dirfd, "a", &st));
+	test_assertx(!exists(dirfd, "a", &st));
+	int fd = openat(dirfd, "a", O_WRONLY | O_CREAT | O_EXCL, 0644);
+	test_assert(0 <= fd);
+	test_assertx(exists(dirfd, "a", &st));
+	test_assertx(st.st_size == 0);
+
+	// The attributes follow writes and changes to the inode.
+	test_assert(write(fd, "0123456789", 10) == 10);
+	test_assertx(exists(dirfd, "a", &st));
+	test_assertx(st.st_size == 10);
+	test_assert(fchmod(fd, 0600) == 0);
+	test_assertx(exists(dirfd, "a", &st));
+	test_assertx((st.st_mode & 07777) == 0600);
+	test_assert(ftruncate(fd, 4) == 0);
+	test_assertx(exists(dirfd, "a", &st));
+	test_assertx(st.st_size == 4);
+	close(fd);
+
+	// Renames move the entry and links change the link count.
+	ino_t ino = st.st_ino;
+	test_assert(renameat(dirfd, "a", dirfd, "b") == 0);
+	test_assertx(!exists(dirfd, "a", &st));
+	test_assertx(exists(dirfd, "b", &st));
+	test_assertx(st.st_ino == ino);
+	test_assert(linkat(dirfd, "b", dirfd, "c", 0) == 0);
+	test_assertx(exists(dirfd, "b", &st));
+	test_assertx(st.st_nlink == 2);
+	test_assert(unlinkat(dirfd, "b", 0) == 0);
+	test_assertx(!exists(dirfd, "b", &st));
+	test_assertx(exists(dirfd, "c", &st));
+	test_assertx(st.st_ino == ino);
+	test_assertx(st.st_nlink == 1);
+
+	// Symbolic links are looked up through the cache too.
+	test_assertx(!exists(dirfd, "e", &st));
+	test_assert(symlinkat("c", dirfd, "e") == 0);
+	test_assertx(exists(dirfd, "e", &st));
+	test_assertx(st.st_ino == ino);
+
+	// A directory made again with the same name is empty.
+	test_assert(mkdirat(dirfd, "d", 0755) == 0);
+	test_assertx(!exists(dirfd, "d/x", &st));
+	fd = openat(dirfd, "d/x", O_WRONLY | O_CREAT | O_EXCL, 0644);
+	test_assert(0 <= fd);
+	close(fd);
+	test_assertx(exists(dirfd, "d/x", &st));
+	test_assert(unlinkat(dirfd, "d/x", 0) == 0);
+	test_assertx(!exists(dirfd, "d/x", &st));
+	test_assert(unlinkat(dirfd, "d", AT_REMOVEDIR) == 0);
+	test_assertx(!exists(dirfd, "d", &st));
+	test_assert(mkdirat(dirfd, "d", 0755) == 0);
+	test_assertx(exists(dirfd, "d", &st));
+	test_assertx(S_ISDIR(st.st_mode));
+	test_assertx(!exists(dirfd, "d/x", &st));
+
+	close(dirfd);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-epoll.c
+ * Tests whether event queues report level and edge triggered events.
+ */
+
+#include <sys/epoll.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test.h"
+
+static int wait_events(int epfd, struct epoll_event* event)
+{
+	int count = epoll_wait(epfd, event, 1, 0);
+	test_assert(0 <= count);
+	return count;
+}
+
+static void add(int epfd, int fd, uint32_t events)
+{
+	struct epoll_event event = { .events = events, .data.fd = fd };
+	test_assert(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) == 0);
+}
+
+int main(void)
+{
+	int epfd;
+	test_assert(0 <= (epfd = epoll_create1(EPOLL_CLOEXEC)));
+	int fds[2];
+	test_assert(pipe(fds) == 0);
+	struct epoll_event event;
+	char c;
+
+	// Level triggered events are reported for as long as they persist.
+	add(epfd, fds[0], EPOLLIN);
+	test_assertx(wait_events(epfd, &event) == 0);
+	test_assert(write(fds[1], "x", 1) == 1);
+	test_assertx(wait_events(epfd, &event) == 1);
+	test_assertx(event.events == EPOLLIN && event.data.fd == fds[0]);
+	test_assertx(wait_events(epfd, &event) == 1);
+	test_assert(read(fds[0], &c, 1) == 1);
+	test_assertx(wait_events(epfd, &event) == 0);
+
+	// Registering twice fails, and deleted registrations are not reported.
+	errno = 0;
+	test_assertx(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event) < 0);
+	test_assertx(errno == EEXIST);
+	test_assert(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], NULL) == 0);
+	errno = 0;
+	test_assertx(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], NULL) < 0);
+	test_assertx(errno == ENOENT);
+	test_assert(write(fds[1], "x", 1) == 1);
+	test_assertx(wait_events(epfd, &event) == 0);
+
+	// Edge triggered events are reported once per change.
+	add(epfd, fds[0], EPOLLIN | EPOLLET);
+	test_assertx(wait_events(epfd, &event) == 1);
+	test_assertx(wait_events(epfd, &event) == 0);
+	test_assert(write(fds[1], "x", 1) == 1);
+	test_assertx(wait_events(epfd, &event) == 1);
+	test_assertx(wait_events(epfd, &event) == 0);
+	test_assert(read(fds[0], &c, 1) == 1);
+	test_assert(read(fds[0], &c, 1) == 1);
+
+	// One shot registrations are disabled until modified.
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.fd = fds[0];
+	test_assert(epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &event) == 0);
+	test_assert(write(fds[1], "x", 1) == 1);
+	test_assertx(wait_events(epfd, &event) == 1);
+	test_assert(write(fds[1], "x", 1) == 1);
+	test_assertx(wait_events(epfd, &event) == 0);
+	event.events = EPOLLIN;
+	event.data.fd = fds[0];
+	test_assert(epoll_ctl(epfd, EPOLL_CTL_MOD, fds[0], &event) == 0);
+	test_assertx(wait_events(epfd, &event) == 1);
+
+	// The write end reports the hang up when the read end is closed.
+	add(epfd, fds[1], EPOLLOUT | EPOLLET);
+	struct epoll_event events[2];
+	test_assert(epoll_wait(epfd, events, 2, -1) == 2);
+	test_assert(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[0], NULL) == 0);
+	test_assert(close(fds[0]) == 0);
+	test_assertx(wait_events(epfd, &event) == 1);
+	test_assertx(event.data.fd == fds[1] && (event.events & EPOLLERR));
+	test_assert(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[1], NULL) == 0);
+	test_assert(close(fds[1]) == 0);
+
+	// Registrations don't keep the pipe open, and are removed when it's closed.
+	test_assert(pipe(fds) == 0);
+	add(epfd, fds[1], EPOLLOUT);
+	test_assert(close(fds[1]) == 0);
+	test_assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+	test_assert(read(fds[0], &c, 1) == 0);
+	test_assertx(wait_events(epfd, &event) == 0);
+	errno = 0;
+	test_assertx(epoll_ctl(epfd, EPOLL_CTL_DEL, fds[1], NULL) < 0);
+	test_assertx(errno == ENOENT);
+
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-mmap-file.c
+ * Tests whether private file mappings are paged in correctly.
+ */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test.h"
+
+static char path[] = "/tmp/test-mmap-file.XXXXXX";
+static bool made_file = false;
+
+static void cleanup(void)
+{
+	if ( made_file )
+		unlink(path);
+}
+
+int main(void)
+{
+	test_assert(atexit(cleanup) == 0);
+
+	int fd = mkstemp(path);
+	test_assert(0 <= fd);
+	made_file = true;
+
+	size_t pagesize = getpagesize();
+	size_t file_size = 3 * pagesize + pagesize / 2;
+	unsigned char* data = malloc(file_size);
+	test_assert(data);
+	for ( size_t i = 0; i < file_size; i++ )
+		data[i] = (unsigned char) (i * 7 + i / pagesize);
+	test_assert(write(fd, data, file_size) == (ssize_t) file_size);
+
+	size_t map_size = 4 * pagesize;
+	unsigned char* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+	                          MAP_PRIVATE, fd, 0);
+	test_assert(map != MAP_FAILED);
+
+	// Touch the pages out of order to exercise the fault handler.
+	test_assertx(map[2 * pagesize] == data[2 * pagesize]);
+	test_assertx(map[0] == data[0]);
+	test_assertx(memcmp(map, data, file_size) == 0);
+	for ( size_t i = file_size; i < map_size; i++ )
+		test_assertx(map[i] == 0);
+
+	// The kernel must page in the mapping when reading from it.
+	unsigned char* other = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	test_assert(other != MAP_FAILED);
+	int fds[2];
+	test_assert(pipe(fds) == 0);
+	test_assert(write(fds[1], other + pagesize, 16) == 16);
+	unsigned char buffer[16];
+	test_assert(read(fds[0], buffer, 16) == 16);
+	test_assertx(memcmp(buffer, data + pagesize, 16) == 0);
+	close(fds[0]);
+	close(fds[1]);
+
+	// Private writes must neither reach the file nor other mappings.
+	map[pagesize] ^= 0xFF;
+	map[file_size] = 1;
+	test_assertx(other[pagesize] == data[pagesize]);
+	test_assertx(other[file_size] == 0);
+	unsigned char c;
+	test_assert(pread(fd, &c, 1, pagesize) == 1);
+	test_assertx(c == data[pagesize]);
+
+	// A forked child sees the private writes but its own writes are private.
+	pid_t pid = fork();
+	test_assert(0 <= pid);
+	if ( pid == 0 )
+	{
+		if ( map[pagesize] != (data[pagesize] ^ 0xFF) )
+			_exit(1);
+		map[3 * pagesize] ^= 0xFF;
+		_exit(map[3 * pagesize] == (data[3 * pagesize] ^ 0xFF) ? 0 : 1);
+	}
+	int status;
+	test_assert(waitpid(pid, &status, 0) == pid);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	test_assertx(map[3 * pagesize] == data[3 * pagesize]);
+
+	test_assert(munmap(other, map_size) == 0);
+	test_assert(munmap(map, map_size) == 0);
+	close(fd);
+	free(data);
+
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-mmap-shared.c
+ * Tests whether shared memory mappings are shared.
+ */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test.h"
+
+static char path[] = "/tmp/test-mmap-shared.XXXXXX";
+static bool made_file = false;
+
+static void cleanup(void)
+{
+	if ( made_file )
+		unlink(path);
+}
+
+int main(void)
+{
+	test_assert(atexit(cleanup) == 0);
+
+	size_t pagesize = getpagesize();
+
+	// Anonymous shared memory is shared with forked children.
+	volatile unsigned char* anon = mmap(NULL, pagesize, PROT_READ | PROT_WRITE,
+	                                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	test_assert(anon != MAP_FAILED);
+	test_assertx(anon[0] == 0);
+	anon[1] = 'P';
+	pid_t pid = fork();
+	test_assert(0 <= pid);
+	if ( pid == 0 )
+	{
+		if ( anon[1] != 'P' )
+			_exit(1);
+		anon[0] = 'C';
+		_exit(0);
+	}
+	int status;
+	test_assert(waitpid(pid, &status, 0) == pid);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	test_assertx(anon[0] == 'C');
+	test_assert(munmap((void*) anon, pagesize) == 0);
+
+	int fd = mkstemp(path);
+	test_assert(0 <= fd);
+	made_file = true;
+	size_t file_size = pagesize + pagesize / 2;
+	unsigned char* data = malloc(file_size);
+	test_assert(data);
+	for ( size_t i = 0; i < file_size; i++ )
+		data[i] = (unsigned char) (i * 13);
+	test_assert(write(fd, data, file_size) == (ssize_t) file_size);
+
+	// Writes to shared file mappings are visible in the other mappings.
+	size_t map_size = 2 * pagesize;
+	unsigned char* a = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                        fd, 0);
+	test_assert(a != MAP_FAILED);
+	unsigned char* b = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	test_assert(b != MAP_FAILED);
+	test_assertx(memcmp(a, data, file_size) == 0);
+	test_assertx(memcmp(b, data, file_size) == 0);
+	a[1] = 'A';
+	test_assertx(b[1] == 'A');
+
+	// Forked children share the mapping.
+	pid = fork();
+	test_assert(0 <= pid);
+	if ( pid == 0 )
+	{
+		a[pagesize] = 'C';
+		_exit(msync(a, map_size, MS_SYNC) == 0 ? 0 : 1);
+	}
+	test_assert(waitpid(pid, &status, 0) == pid);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	test_assertx(a[pagesize] == 'C');
+	test_assertx(b[pagesize] == 'C');
+
+	// The changes reach the file when written back, but not past its end.
+	test_assert(msync(a, map_size, MS_SYNC) == 0);
+	unsigned char c;
+	test_assert(pread(fd, &c, 1, 1) == 1);
+	test_assertx(c == 'A');
+	test_assert(pread(fd, &c, 1, pagesize) == 1);
+	test_assertx(c == 'C');
+	test_assert(lseek(fd, 0, SEEK_END) == (off_t) file_size);
+
+	// The file descriptor must be writable for writable shared mappings.
+	int rdfd = open(path, O_RDONLY);
+	test_assert(0 <= rdfd);
+	test_assert(mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                 rdfd, 0) == MAP_FAILED);
+	test_assertx(errno == EACCES);
+	// Nor can read-only shared mappings of it be made writable later, while
+	// they still see the changes to the file.
+	unsigned char* r = mmap(NULL, map_size, PROT_READ, MAP_SHARED, rdfd, 0);
+	test_assert(r != MAP_FAILED);
+	test_assert(mprotect(r, map_size, PROT_READ | PROT_WRITE) < 0);
+	test_assertx(errno == EACCES);
+	a[2] = 'R';
+	test_assertx(r[2] == 'R');
+	test_assert(munmap(r, map_size) == 0);
+	close(rdfd);
+
+	test_assert(munmap(b, map_size) == 0);
+	test_assert(munmap(a, map_size) == 0);
+	close(fd);
+	free(data);
+
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-read-cache.c
+ * Tests whether cached reads see writes and truncations of the file.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test.h"
+
+static char path[] = "/tmp/test-read-cache.XXXXXX";
+static bool made_file = false;
+
+static void cleanup(void)
+{
+	if ( made_file )
+		unlink(path);
+}
+
+static void check(int fd, const unsigned char* data, size_t size,
+                  unsigned char* buffer, size_t buffer_size)
+{
+	test_assert(pread(fd, buffer, buffer_size, 0) == (ssize_t) size);
+	test_assertx(memcmp(buffer, data, size) == 0);
+}
+
+int main(void)
+{
+	test_assert(atexit(cleanup) == 0);
+
+	int fd = mkstemp(path);
+	test_assert(0 <= fd);
+	made_file = true;
+
+	size_t pagesize = getpagesize();
+	size_t max_size = 6 * pagesize;
+	unsigned char* data = calloc(max_size, 1);
+	unsigned char* buffer = malloc(max_size + 1);
+	test_assert(data && buffer);
+	size_t size = 3 * pagesize + pagesize / 2;
+	for ( size_t i = 0; i < size; i++ )
+		data[i] = (unsigned char) (i * 7 + i / pagesize);
+	test_assert(write(fd, data, size) == (ssize_t) size);
+
+	// Read the file twice so the second read may be served from the cache.
+	check(fd, data, size, buffer, max_size + 1);
+	check(fd, data, size, buffer, max_size + 1);
+
+	// Reads in the middle of pages and across pages.
+	test_assert(pread(fd, buffer, pagesize, pagesize / 2) ==
+	            (ssize_t) pagesize);
+	test_assertx(memcmp(buffer, data + pagesize / 2, pagesize) == 0);
+	test_assert(pread(fd, buffer, 16, size - 8) == 8);
+	test_assertx(memcmp(buffer, data + size - 8, 8) == 0);
+	test_assert(pread(fd, buffer, 16, size) == 0);
+	test_assert(pread(fd, buffer, 16, 5 * pagesize) == 0);
+
+	// Overwrite the middle of the file.
+	memset(data + pagesize - 4, 0xAB, 8);
+	test_assert(pwrite(fd, data + pagesize - 4, 8, pagesize - 4) == 8);
+	check(fd, data, size, buffer, max_size + 1);
+
+	// Extend the file with a write after a hole, the old end of the file must
+	// now read as zeroes.
+	memset(data + 5 * pagesize, 0xCD, 16);
+	test_assert(pwrite(fd, data + 5 * pagesize, 16, 5 * pagesize) == 16);
+	size = 5 * pagesize + 16;
+	check(fd, data, size, buffer, max_size + 1);
+
+	// Shrink the file to the middle of a page and grow it again.
+	size = pagesize + pagesize / 2;
+	test_assert(ftruncate(fd, size) == 0);
+	check(fd, data, size, buffer, max_size + 1);
+	memset(data + size, 0, max_size - size);
+	size = 2 * pagesize + pagesize / 2;
+	test_assert(ftruncate(fd, size) == 0);
+	check(fd, data, size, buffer, max_size + 1);
+
+	// Another open file description sees the same contents.
+	int other = open(path, O_RDONLY);
+	test_assert(0 <= other);
+	check(other, data, size, buffer, max_size + 1);
+	data[0] ^= 0xFF;
+	test_assert(pwrite(fd, data, 1, 0) == 1);
+	check(other, data, size, buffer, max_size + 1);
+	close(other);
+
+	close(fd);
+	free(buffer);
+	free(data);
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-sendfile.c
+ * Tests whether sendfile transfers files to TCP sockets and pipes.
+ */
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define FILE_SIZE (256 * 1024 + 123)
+
+static char path[] = "/tmp/test-sendfile.XXXXXX";
+static bool made_file = false;
+
+static void cleanup(void)
+{
+	if ( made_file )
+		unlink(path);
+}
+
+static unsigned char pattern(size_t offset)
+{
+	return offset % 251;
+}
+
+static void sender(int fd, const struct sockaddr_in* addr)
+{
+	int sock;
+	test_assert(0 <= (sock = socket(AF_INET, SOCK_STREAM, 0)));
+	test_assert(connect(sock, (const struct sockaddr*) addr,
+	                    sizeof(*addr)) == 0);
+	// Send from an odd offset without changing the file offset.
+	off_t offset = 1;
+	while ( offset < FILE_SIZE )
+	{
+		ssize_t amount = sendfile(sock, fd, &offset, FILE_SIZE);
+		test_assert(0 < amount);
+	}
+	test_assertx(offset == FILE_SIZE);
+	test_assert(lseek(fd, 0, SEEK_CUR) == 0);
+	// Send the whole file again from the file offset.
+	size_t sofar = 0;
+	while ( sofar < FILE_SIZE )
+	{
+		ssize_t amount = sendfile(sock, fd, NULL, FILE_SIZE - sofar);
+		test_assert(0 < amount);
+		sofar += amount;
+	}
+	test_assert(lseek(fd, 0, SEEK_CUR) == FILE_SIZE);
+	test_assert(sendfile(sock, fd, NULL, FILE_SIZE) == 0);
+	close(sock);
+}
+
+int main(void)
+{
+	test_assert(atexit(cleanup) == 0);
+
+	int fd = mkstemp(path);
+	test_assert(0 <= fd);
+	made_file = true;
+	unsigned char buffer[4096];
+	for ( size_t offset = 0; offset < FILE_SIZE; )
+	{
+		size_t amount = sizeof(buffer);
+		if ( FILE_SIZE - offset < amount )
+			amount = FILE_SIZE - offset;
+		for ( size_t i = 0; i < amount; i++ )
+			buffer[i] = pattern(offset + i);
+		test_assert(write(fd, buffer, amount) == (ssize_t) amount);
+		offset += amount;
+	}
+	test_assert(lseek(fd, 0, SEEK_SET) == 0);
+
+	// Files are copied to pipes and reading stops at the end of the file.
+	int fds[2];
+	test_assert(pipe(fds) == 0);
+	off_t offset = FILE_SIZE - 50;
+	test_assert(sendfile(fds[1], fd, &offset, 100) == 50);
+	test_assertx(offset == FILE_SIZE);
+	test_assert(read(fds[0], buffer, sizeof(buffer)) == 50);
+	for ( size_t i = 0; i < 50; i++ )
+		test_assertx(buffer[i] == pattern(FILE_SIZE - 50 + i));
+	test_assert(sendfile(fds[1], fd, &offset, 100) == 0);
+	test_assert(lseek(fd, 0, SEEK_CUR) == 0);
+
+	// Only regular files can be sent.
+	errno = 0;
+	test_assert(sendfile(fds[1], fds[0], NULL, 1) < 0);
+	test_assertx(errno == EINVAL);
+	offset = -1;
+	test_assert(sendfile(fds[1], fd, &offset, 1) < 0);
+	test_assertx(errno == EINVAL);
+	close(fds[0]);
+	close(fds[1]);
+
+	int listen_fd;
+	test_assert(0 <= (listen_fd = socket(AF_INET, SOCK_STREAM, 0)));
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	test_assert(bind(listen_fd, (const struct sockaddr*) &addr,
+	                 sizeof(addr)) == 0);
+	socklen_t addr_size = sizeof(addr);
+	test_assert(getsockname(listen_fd, (struct sockaddr*) &addr,
+	                        &addr_size) == 0);
+	test_assert(listen(listen_fd, 1) == 0);
+
+	pid_t child;
+	test_assert(0 <= (child = fork()));
+	if ( child == 0 )
+	{
+		close(listen_fd);
+		sender(fd, &addr);
+		_exit(0);
+	}
+
+	int sock;
+	test_assert(0 <= (sock = accept(listen_fd, NULL, NULL)));
+	size_t received = 0;
+	ssize_t amount;
+	while ( 0 < (amount = recv(sock, buffer, sizeof(buffer), 0)) )
+	{
+		for ( ssize_t i = 0; i < amount; i++ )
+		{
+			size_t at = received + i;
+			size_t expected = at < FILE_SIZE - 1 ? at + 1 :
+			                  at - (FILE_SIZE - 1);
+			test_assertx(buffer[i] == pattern(expected));
+		}
+		received += amount;
+	}
+	test_assert(amount == 0);
+	test_assertx(received == 2 * FILE_SIZE - 1);
+	close(sock);
+	close(listen_fd);
+
+	int status;
+	test_assert(waitpid(child, &status, 0) == child);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2026 Jonas 'Sortie' Termansen.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * test-tcp-loss.c
+ * Tests whether TCP recovers from packet loss on a lossy loopback interface.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include "test.h"
+
+#define TRANSFER_SIZE (1024 * 1024)
+#define LOSS_PERCENT 5
+
+static int lo_fd;
+static struct if_config_loopback lo_original;
+
+static void restore_loss(void)
+{
+	ioctl(lo_fd, NIOC_SETCONFIG_LOOPBACK, &lo_original);
+}
+
+static unsigned char pattern(size_t offset)
+{
+	return offset % 251;
+}
+
+static void sender(const struct sockaddr_in* addr)
+{
+	int fd;
+	test_assert(0 <= (fd = socket(AF_INET, SOCK_STREAM, 0)));
+	test_assert(connect(fd, (const struct sockaddr*) addr,
+	                    sizeof(*addr)) == 0);
+	unsigned char buffer[4096];
+	size_t offset = 0;
+	while ( offset < TRANSFER_SIZE )
+	{
+		size_t amount = sizeof(buffer);
+		if ( TRANSFER_SIZE - offset < amount )
+			amount = TRANSFER_SIZE - offset;
+		for ( size_t i = 0; i < amount; i++ )
+			buffer[i] = pattern(offset + i);
+		ssize_t done = send(fd, buffer, amount, 0);
+		test_assert(0 < done);
+		offset += done;
+	}
+	// Wait for the receiver to close so all the data has been acknowledged.
+	test_assert(shutdown(fd, SHUT_WR) == 0);
+	char c;
+	test_assert(recv(fd, &c, 1, 0) == 0);
+	struct tcp_info info;
+	socklen_t size = sizeof(info);
+	test_assert(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &size) == 0);
+	test_assertx(size == sizeof(info));
+	test_assertx(info.tcpi_bytes_acked == TRANSFER_SIZE);
+	test_assertx(0 < info.tcpi_total_retrans);
+	test_assertx(info.tcpi_options & TCPI_OPT_SACK);
+	close(fd);
+}
+
+int main(void)
+{
+	// Skip the test if the loopback interface can't be configured.
+	if ( (lo_fd = open("/dev/lo0", O_RDONLY)) < 0 )
+		return 0;
+	test_assert(ioctl(lo_fd, NIOC_GETCONFIG_LOOPBACK, &lo_original) == 0);
+	struct if_config_loopback lossy = lo_original;
+	lossy.loss = LOSS_PERCENT;
+	if ( ioctl(lo_fd, NIOC_SETCONFIG_LOOPBACK, &lossy) < 0 )
+	{
+		if ( errno == EACCES || errno == EPERM )
+			return 0;
+		test_assert(false);
+	}
+	atexit(restore_loss);
+
+	int listen_fd;
+	test_assert(0 <= (listen_fd = socket(AF_INET, SOCK_STREAM, 0)));
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	test_assert(bind(listen_fd, (const struct sockaddr*) &addr,
+	                 sizeof(addr)) == 0);
+	socklen_t addr_size = sizeof(addr);
+	test_assert(getsockname(listen_fd, (struct sockaddr*) &addr,
+	                        &addr_size) == 0);
+	test_assert(listen(listen_fd, 1) == 0);
+
+	pid_t child;
+	test_assert(0 <= (child = fork()));
+	if ( child == 0 )
+	{
+		close(listen_fd);
+		sender(&addr);
+		_exit(0);
+	}
+
+	int fd;
+	test_assert(0 <= (fd = accept(listen_fd, NULL, NULL)));
+	unsigned char buffer[4096];
+	size_t offset = 0;
+	ssize_t amount;
+	while ( 0 < (amount = recv(fd, buffer, sizeof(buffer), 0)) )
+	{
+		for ( ssize_t i = 0; i < amount; i++ )
+			test_assertx(buffer[i] == pattern(offset + i));
+		offset += amount;
+	}
+	test_assert(amount == 0);
+	test_assertx(offset == TRANSFER_SIZE);
+	close(fd);
+	close(listen_fd);
+
+	int status;
+	test_assert(waitpid(child, &status, 0) == child);
+	test_assertx(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	return 0;
+}
@@ -75,6 +75,8 @@ static const struct memusage memusages[] =
 	{MEMUSAGE_PURPOSE_DRIVER, "driver"},
 	{MEMUSAGE_PURPOSE_PHYSICAL, "physical"},
 	{MEMUSAGE_PURPOSE_EXECVE, "execve"},
+	{MEMUSAGE_SLAB, "slab"},
+	{MEMUSAGE_SLAB_USED, "slab-used"},
 };
 
 int main(int argc, char* argv[])